@@ -1,7 +1,7 @@
 #version 410
 
 layout (location = 0) in vec3 vertex;
-layout (location = 2) in vec3 texcoord;
+#include "vertex_attributes.glsl"
 
 uniform mat4 vertex_model_to_world;
 uniform mat4 vertex_world_to_clip;
@@ -6,11 +6,11 @@
 // variable `vertex` is at location 0, which corresponds to attribute 0 of our
 // vertex array, vertex will be effectively filled with vertices from our
 // buffer.
-// Similarly, normal is set to location 1, which corresponds to attribute 1 of
+// Similarly, the normal is at location 1, which corresponds to attribute 1 of
 // the vertex array, and therefore will be filled with normals taken out of our
-// buffer.
+// buffer; those are packed, and vertex_attributes.glsl decodes them.
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
+#include "vertex_attributes.glsl"
 
 uniform mat4 vertex_model_to_world;
 uniform mat4 normal_model_to_world;
@@ -30,7 +30,7 @@ out VS_OUT {
 void main()
 {
 	vs_out.vertex = vec3(vertex_model_to_world * vec4(vertex, 1.0));
-	vs_out.normal = vec3(normal_model_to_world * vec4(normal, 0.0));
+	vs_out.normal = vec3(normal_model_to_world * vec4(vertex_normal(), 0.0));
 
 	gl_Position = vertex_world_to_clip * vertex_model_to_world * vec4(vertex, 1.0);
 }
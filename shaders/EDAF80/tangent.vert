@@ -1,7 +1,7 @@
 #version 410
 
 layout (location = 0) in vec3 vertex;
-layout (location = 3) in vec3 tangent;
+#include "vertex_attributes.glsl"
 
 uniform mat4 vertex_model_to_world;
 uniform mat4 normal_model_to_world;
@@ -14,7 +14,7 @@ out VS_OUT {
 
 void main()
 {
-	vs_out.tangent = normalize(vec3(normal_model_to_world * vec4(tangent, 0.0)));
+	vs_out.tangent = normalize(vec3(normal_model_to_world * vec4(vertex_tangent(), 0.0)));
 
 	gl_Position = vertex_world_to_clip * vertex_model_to_world * vec4(vertex, 1.0);
 }
@@ -1,17 +1,12 @@
 #version 410
 
+#include "object_constants.glsl"
+
 uniform bool has_environmentmap_texture;
 uniform sampler2D environmentmap_texture;
-uniform mat4 normal_model_to_world;
-
-uniform mat4 vertex_model_to_world;
-uniform mat4 vertex_world_to_clip;
 
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 texcoord;
-//layout (location = 3) in vec3 tangent;
-//layout (location = 4) in vec3 binormal;
+#include "vertex_attributes.glsl"
 
 out VS_OUT {
     vec3 oldPos;
@@ -33,7 +28,7 @@ const int max_iter = 50;
 
 void main()
 {
-    vs_out.normal = vec3(normalize(normal_model_to_world * vec4(normal, 0.)));
+    vs_out.normal = vec3(normalize(normal_model_to_world * vec4(vertex_normal(), 0.)));
 //    vs_out.tangent  = normalize(tangent);
 //    vs_out.binormal = normalize(binormal);
     
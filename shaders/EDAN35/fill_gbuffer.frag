@@ -1,5 +1,8 @@
 #version 410
 
+#include "object_constants.glsl"
+#include "normal_mapping.glsl"
+
 uniform bool has_diffuse_texture;
 uniform bool has_specular_texture;
 uniform bool has_normals_texture;
@@ -8,7 +11,6 @@ uniform sampler2D diffuse_texture;
 uniform sampler2D specular_texture;
 uniform sampler2D normals_texture;
 uniform sampler2D opacity_texture;
-uniform mat4 normal_model_to_world;
 uniform bool is_water;
 
 in VS_OUT {
@@ -48,7 +50,7 @@ void main()
 		vec3 b = normalize(fs_in.binormal);
 		vec3 n = normalize(fs_in.normal);
 		mat3 tbn = mat3(t, b, n);
-		vec3 textureNormal = (texture(normals_texture, fs_in.texcoord).xyz * 2.0) - 1.0;
+		vec3 textureNormal = sample_normal_map(normals_texture, fs_in.texcoord);
 		normal = normalize(tbn * textureNormal);
 	} else {
 		normal = fs_in.normal;
@@ -1,15 +1,11 @@
 #version 410
 
-uniform mat4 vertex_model_to_world;
-uniform mat4 vertex_world_to_clip;
+#include "object_constants.glsl"
 
 uniform bool is_water;
 
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 texcoord;
-layout (location = 3) in vec3 tangent;
-layout (location = 4) in vec3 binormal;
+#include "vertex_attributes.glsl"
 
 out VS_OUT {
 	vec3 normal;
@@ -82,9 +78,9 @@ void main() {
     } 
     else 
     {
-        vs_out.normal   = normalize(normal);
-	    vs_out.tangent  = normalize(tangent);
-	    vs_out.binormal = normalize(binormal);
+        vs_out.normal   = normalize(vertex_normal());
+	    vs_out.tangent  = normalize(vertex_tangent());
+	    vs_out.binormal = normalize(vertex_binormal());
 	    gl_Position = vertex_world_to_clip * vertex_model_to_world * vec4(vertex, 1.0);
     }
 	
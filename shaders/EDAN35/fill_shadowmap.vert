@@ -1,7 +1,6 @@
 #version 410
 
-uniform mat4 vertex_model_to_world;
-uniform mat4 vertex_world_to_clip;
+#include "object_constants.glsl"
 
 layout (location = 0) in vec3 vertex;
 
@@ -1,5 +1,9 @@
 #version 410
 
+#include "object_constants.glsl"
+#include "normal_mapping.glsl"
+#include "Project/constants.glsl"
+
 uniform bool has_diffuse_texture;
 uniform bool has_specular_texture;
 uniform bool has_normals_texture;
@@ -10,26 +14,11 @@ uniform sampler2D specular_texture;
 uniform sampler2D normals_texture;
 uniform sampler2D opacity_texture;
 uniform sampler2D causticmap_texture;
-uniform mat4 normal_model_to_world;
-
-// new
-uniform mat4 view_projection_inverse;
-uniform vec3 camera_position;
-uniform mat4 shadow_view_projection;
-
-uniform vec3 sun_dir;
 
-uniform vec2 inv_res;
 uniform sampler2DShadow shadow_texture;
-uniform vec2 shadowmap_texel_size;
 
 uniform sampler2DShadow water_depth_texture;
 
-uniform vec3 atmosphereColour;
-uniform vec3 underwaterColour;
-
-uniform float MAMSL;
-
 in VS_OUT {
     vec3 normal;
     vec2 texcoord;
@@ -39,16 +28,45 @@ in VS_OUT {
     float distCamSquared;
 } fs_in;
 
-layout (location = 0) out vec4 underwater_scene;
 
+vec4 sampleInside(sampler2D image, vec2 uv) {
+    return uv.x >= 0.0 && uv.x <= 1.0 && uv.y >= 0.0 && uv.y <= 1.0 ? texture2D(image, uv) : vec4(0);
+}
+
+float blur(sampler2D image, vec2 uv, vec2 texelsize, vec2 direction) {
+  float intensity = 0.;
+  vec2 off1 = vec2(1.3846153846) * direction;
+  vec2 off2 = vec2(3.2307692308) * direction;
+  intensity += sampleInside(image, uv).x * 0.2270270270;
+  intensity += sampleInside(image, uv + (off1 / texelsize)).x * 0.3162162162;
+  intensity += sampleInside(image, uv - (off1 / texelsize)).x * 0.3162162162;
+  intensity += sampleInside(image, uv + (off2 / texelsize)).x * 0.0702702703;
+  intensity += sampleInside(image, uv - (off2 / texelsize)).x * 0.0702702703;
+  return intensity;
+}
+
+layout (location = 0) out vec4 scene_colour;
+
+// Shades the solids of the final image in a single pass: each fragment is
+// lit as seen from above the water if the sun reaches it without going
+// through the water, and as seen from below otherwise.
 void main()
 {   
-    vec4 lightPos = shadow_view_projection * fs_in.worldPos;
-    lightPos = lightPos / lightPos.w;
+    // The overwater test is unbiased, while the underwater one is biased
+    // along the normal; fragments passing both are treated as overwater,
+    // and fragments passing neither are left out.
+    vec4 overwaterLightPos = shadow_view_projection * fs_in.worldPos;
+    overwaterLightPos = overwaterLightPos / overwaterLightPos.w;
+    vec4 underwaterLightPos = shadow_view_projection * (fs_in.worldPos + 0.01 * vec4(fs_in.normal,0.)); // normal biased
+    underwaterLightPos = underwaterLightPos / underwaterLightPos.w;
+
+    bool isOverwater = texture(water_depth_texture, (overwaterLightPos.xyz + 1.0) / 2.0) >= 1.0;
+    bool isUnderwater = !isOverwater && texture(water_depth_texture, (underwaterLightPos.xyz + 1.0) / 2.0) <= 0.0;
+    if (!isOverwater && !isUnderwater) discard;
+
+    vec4 lightPos = isOverwater ? overwaterLightPos : underwaterLightPos;
     vec2 light_coord = (lightPos).xy * 0.5 + 0.5;
 
-    if (texture(water_depth_texture, (lightPos.xyz + 1.0) / 2.0) < 1.0) discard;
-
     if (has_opacity_texture && texture(opacity_texture, fs_in.texcoord).r < 1.0)
         discard;
 
@@ -70,7 +88,7 @@ void main()
         vec3 b = normalize(fs_in.binormal);
         vec3 n = normalize(fs_in.normal);
         mat3 tbn = mat3(t, b, n);
-        vec3 textureNormal = (texture(normals_texture, fs_in.texcoord).xyz * 2.0) - 1.0;
+        vec3 textureNormal = sample_normal_map(normals_texture, fs_in.texcoord);
         normal = normalize(tbn * textureNormal);
     } else {
         normal = fs_in.normal;
@@ -87,12 +105,6 @@ void main()
     float diffuse = dot(n,l);
     result += diffuse * albedo.rgb;
 
-
-    vec2 uv = inv_res * gl_FragCoord.xy;
-    float depth = gl_FragCoord.z;
-    vec4 screenSpacePos = vec4(uv.x * 2.0 - 1.0, uv.y*2.0 - 1.0, 2.0*depth - 1.0, 1.0);
-
-
     float shadowMultiplier = 0.0;
     vec3 sampler_centre = (lightPos.xyz + 1.0) / 2.0;
 
@@ -119,10 +131,21 @@ void main()
     if (samples == 0)
         shadowMultiplier = 1.0;
 
-
     result *= shadowMultiplier;
 
+    if (isUnderwater) {
+        result = mix(result, underwaterColour, 0.2);
+
+        // Caustics
+        vec3 a = vec3(blur(causticmap_texture, light_coord, shadowmap_texel_size, vec2(0., 0.5)));
+        vec3 b = vec3(blur(causticmap_texture, light_coord, shadowmap_texel_size, vec2(0.5, 0.)));
+
+        vec3 caustic = a + b;
+
+        result += shadowMultiplier * caustic * smoothstep(0., 1., diffuse);
+    }
+
     result += albedo.rgb * ambient;
 
-    underwater_scene = vec4(result, 1.0);
+    scene_colour = vec4(result, 1.0);
 }
@@ -0,0 +1,22 @@
+// Constants shared by all draw calls of a frame; matches FrameConstants in
+// src/Project/project.cpp.
+layout (std140) uniform FrameConstants {
+    mat4 shadow_view_projection;
+    vec3 sun_dir;
+    float MAMSL;
+    vec3 atmosphereColour;
+    float t;
+    vec3 underwaterColour;
+    bool IN_WATER;
+    vec2 shadowmap_texel_size;
+    vec2 inv_res;
+    float near_plane;
+    float far_plane;
+};
+
+// Constants of the view a pass renders from; matches PassConstants in
+// src/Project/project.cpp.
+layout (std140) uniform PassConstants {
+    mat4 view_projection_inverse;
+    vec3 camera_position;
+};
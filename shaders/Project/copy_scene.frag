@@ -0,0 +1,20 @@
+#version 410
+
+// Copies the scene rendered from the camera into the framebuffer, along
+// with its depth, so that the water gets drawn and depth-tested on top of
+// it while tracing its reflections through the same textures.
+uniform sampler2D colour_texture;
+uniform sampler2D depth_texture;
+
+in VS_OUT {
+    vec2 texcoord;
+} fs_in;
+
+out vec4 frag_color;
+
+void main()
+{
+    ivec2 coords = ivec2(gl_FragCoord.xy);
+    frag_color = texelFetch(colour_texture, coords, 0);
+    gl_FragDepth = texelFetch(depth_texture, coords, 0).r;
+}
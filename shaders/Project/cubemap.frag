@@ -1,6 +1,7 @@
 #version 410
 
-uniform mat4 normal_model_to_world; // transform between model space and world space for vectors
+#include "object_constants.glsl"
+
 uniform samplerCube cubemap_texture;
 uniform int has_cubemap_texture;
 
@@ -1,18 +1,13 @@
 #version 410
 
+#include "object_constants.glsl"
+
 //uniform bool has_environmentmap_texture;
 uniform sampler2D environmentmap_texture;
 uniform sampler2D heightmap_texture;
-uniform mat4 normal_model_to_world;
-
-uniform mat4 vertex_model_to_world;
-uniform mat4 vertex_world_to_clip;
 
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 texcoord;
-layout (location = 3) in vec3 tangent;
-layout (location = 4) in vec3 binormal;
+#include "vertex_attributes.glsl"
 
 out VS_OUT {
     vec3 oldPos;
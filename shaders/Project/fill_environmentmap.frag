@@ -1,5 +1,7 @@
 #version 410
 
+#include "object_constants.glsl"
+
 uniform bool has_diffuse_texture;
 uniform bool has_specular_texture;
 uniform bool has_normals_texture;
@@ -8,7 +10,6 @@ uniform sampler2D diffuse_texture;
 uniform sampler2D specular_texture;
 uniform sampler2D normals_texture;
 uniform sampler2D opacity_texture;
-uniform mat4 normal_model_to_world;
 
 in VS_OUT {
     vec4 fragPos;
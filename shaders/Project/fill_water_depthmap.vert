@@ -1,15 +1,11 @@
 #version 410
 
-uniform mat4 vertex_model_to_world;
-uniform mat4 vertex_world_to_clip;
+#include "object_constants.glsl"
 
 uniform sampler2D heightmap_texture;
 
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 texcoord;
-layout (location = 3) in vec3 tangent;
-layout (location = 4) in vec3 binormal;
+#include "vertex_attributes.glsl"
 
 void main()
 {
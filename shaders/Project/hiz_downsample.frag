@@ -0,0 +1,62 @@
+#version 410
+
+// Fills one level of a hierarchical depth buffer: every texel keeps the
+// closest depth of the texels it covers in the level below, or the
+// farthest one when keep_farthest is set. The level below is the only one
+// accessible through depth_texture, as the level being written to belongs
+// to the same texture.
+uniform sampler2D depth_texture;
+
+// Whether depth_texture is the depth buffer itself, to be copied as is
+// into the first level.
+uniform bool copy_source;
+
+// Ray marching skips over texels using the closest depth, while occlusion
+// tests need the farthest one.
+uniform bool keep_farthest;
+
+in VS_OUT {
+    vec2 texcoord;
+} fs_in;
+
+out float reduced_depth;
+
+float reduce(float lhs, float rhs)
+{
+    return keep_farthest ? max(lhs, rhs) : min(lhs, rhs);
+}
+
+void main()
+{
+    ivec2 coords = ivec2(gl_FragCoord.xy);
+    if (copy_source) {
+        reduced_depth = texelFetch(depth_texture, coords, 0).r;
+        return;
+    }
+
+    ivec2 source_size = textureSize(depth_texture, 0);
+    ivec2 source_coords = 2 * coords;
+    ivec2 last = source_size - 1;
+
+    float depth = reduce(reduce(texelFetch(depth_texture, min(source_coords,               last), 0).r,
+                                texelFetch(depth_texture, min(source_coords + ivec2(1, 0), last), 0).r),
+                         reduce(texelFetch(depth_texture, min(source_coords + ivec2(0, 1), last), 0).r,
+                                texelFetch(depth_texture, min(source_coords + ivec2(1, 1), last), 0).r));
+
+    // With odd sizes, the last column and row of this level also have to
+    // cover the extra texels of the level below.
+    bool extra_column = ((source_size.x & 1) != 0) && (source_coords.x + 2 == last.x);
+    bool extra_row = ((source_size.y & 1) != 0) && (source_coords.y + 2 == last.y);
+    if (extra_column) {
+        depth = reduce(depth, texelFetch(depth_texture, min(source_coords + ivec2(2, 0), last), 0).r);
+        depth = reduce(depth, texelFetch(depth_texture, min(source_coords + ivec2(2, 1), last), 0).r);
+    }
+    if (extra_row) {
+        depth = reduce(depth, texelFetch(depth_texture, min(source_coords + ivec2(0, 2), last), 0).r);
+        depth = reduce(depth, texelFetch(depth_texture, min(source_coords + ivec2(1, 2), last), 0).r);
+    }
+    if (extra_column && extra_row)
+        depth = reduce(depth, texelFetch(depth_texture, last, 0).r);
+
+    reduced_depth = depth;
+}
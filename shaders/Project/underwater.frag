@@ -1,5 +1,9 @@
 #version 410
 
+#include "object_constants.glsl"
+#include "normal_mapping.glsl"
+#include "Project/constants.glsl"
+
 uniform bool has_diffuse_texture;
 uniform bool has_specular_texture;
 uniform bool has_normals_texture;
@@ -10,26 +14,11 @@ uniform sampler2D specular_texture;
 uniform sampler2D normals_texture;
 uniform sampler2D opacity_texture;
 uniform sampler2D causticmap_texture;
-uniform mat4 normal_model_to_world;
-
-// new
-uniform mat4 view_projection_inverse;
-uniform vec3 camera_position;
-uniform mat4 shadow_view_projection;
-
-uniform vec3 sun_dir;
 
-uniform vec2 inv_res;
 uniform sampler2DShadow shadow_texture;
-uniform vec2 shadowmap_texel_size;
 
 uniform sampler2DShadow water_depth_texture;
 
-uniform vec3 atmosphereColour;
-uniform vec3 underwaterColour;
-
-uniform float MAMSL;
-
 in VS_OUT {
     vec3 normal;
     vec2 texcoord;
@@ -87,7 +76,7 @@ void main()
         vec3 b = normalize(fs_in.binormal);
         vec3 n = normalize(fs_in.normal);
         mat3 tbn = mat3(t, b, n);
-        vec3 textureNormal = (texture(normals_texture, fs_in.texcoord).xyz * 2.0) - 1.0;
+        vec3 textureNormal = sample_normal_map(normals_texture, fs_in.texcoord);
         normal = normalize(tbn * textureNormal);
     } else {
         normal = fs_in.normal;
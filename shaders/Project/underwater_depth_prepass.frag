@@ -0,0 +1,31 @@
+#version 410
+
+#include "Project/constants.glsl"
+
+uniform bool has_opacity_texture;
+uniform sampler2D opacity_texture;
+
+uniform sampler2DShadow water_depth_texture;
+
+in VS_OUT {
+    vec3 normal;
+    vec2 texcoord;
+    vec3 tangent;
+    vec3 binormal;
+    vec4 worldPos;
+    float distCamSquared;
+} fs_in;
+
+// Lays down the depth of the solids shaded by underwater.frag, which is
+// depth-tested with GL_EQUAL against it: the fragments it discards have
+// to be discarded here as well, using the very same tests.
+void main()
+{
+    vec4 lightPos = shadow_view_projection * (fs_in.worldPos + 0.01 * vec4(fs_in.normal,0.)); // normal biased
+    lightPos = lightPos / lightPos.w;
+
+    if (texture(water_depth_texture, (lightPos.xyz + 1.0) / 2.0) > 0.0) discard;
+
+    if (has_opacity_texture && texture(opacity_texture, fs_in.texcoord).r < 1.0)
+        discard;
+}
@@ -1,14 +1,10 @@
 #version 410
 
-uniform vec3 camera_position;
+#include "Project/constants.glsl"
+
 uniform sampler2D underwater_texture;
 uniform samplerCube cubemap_texture;
 
-uniform vec3 atmosphereColour;
-uniform vec3 underwaterColour;
-
-uniform bool IN_WATER;
-
 const vec3 outide_water_tint = vec3(0.4, 0.45, 0.5);
 
 in VS_OUT {
@@ -1,19 +1,15 @@
 #version 410
 
+#include "object_constants.glsl"
+#include "instance_constants.glsl"
+#include "Project/constants.glsl"
+
 uniform sampler2D heightmap_texture;
-uniform mat4 vertex_model_to_world;
-uniform mat4 normal_model_to_world;
-uniform mat4 vertex_world_to_clip;
 
 uniform bool is_water;
 
-uniform vec3 camera_position;
-
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 texcoord;
-layout (location = 3) in vec3 tangent;
-layout (location = 4) in vec3 binormal;
+#include "vertex_attributes.glsl"
 
 out VS_OUT {
     vec3 worldPos;
@@ -22,7 +18,7 @@ out VS_OUT {
 
 void main() {
     vec4 modelPos;
-    vec3 worldNormal = normalize(vec3(normal_model_to_world * -vec4(normal,0)));
+    vec3 worldNormal = normalize(vec3(instance_normal_model_to_world() * -vec4(vertex_normal(),0)));
     float dx = abs(worldNormal.x); float dz = abs(worldNormal.z);
     
     vec2 uv = vec2(0,0); // uses normal to determine which edge to sample
@@ -44,7 +40,7 @@ void main() {
     float height = texcoord.y == 1 ? info.r : 0;
     modelPos = vec4(vertex, 1.0); // offset before SRT
 
-    vec4 worldPos = vertex_model_to_world * modelPos;
+    vec4 worldPos = instance_vertex_model_to_world() * modelPos;
     worldPos = worldPos / worldPos.w;
 
     worldPos += vec4(0,height,0,0); // offset after SRT
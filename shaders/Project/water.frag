@@ -1,5 +1,8 @@
 #version 410
 
+#include "object_constants.glsl"
+#include "Project/constants.glsl"
+
 uniform bool has_diffuse_texture;
 uniform bool has_specular_texture;
 uniform bool has_normals_texture;
@@ -14,16 +17,19 @@ uniform sampler2D underwater_texture;
 uniform samplerCube cubemap_texture;
 uniform sampler2D underwater_depth_texture;
 uniform sampler2D reflection_texture;
-uniform mat4 normal_model_to_world;
-uniform vec3 camera_position;
-uniform mat4 shadow_view_projection;
-
-uniform vec3 sun_dir;
-
-uniform vec2 inv_res;
-uniform float t;
-
-uniform bool IN_WATER;
+uniform sampler2D reflection_depth_texture;
+
+// Screen-space reflections trace scenes rendered from the main camera,
+// instead of reading the planar reflection: the bottom side traces the
+// underwater scene, while the top side traces the whole scene.
+uniform bool use_ssr;
+uniform sampler2D scene_texture;
+// Hierarchical depth buffers of those scenes; with a single level, the
+// tracing degrades into a march through every texel.
+uniform sampler2D underwater_hiz_texture;
+uniform int underwater_hiz_levels;
+uniform sampler2D scene_hiz_texture;
+uniform int scene_hiz_levels;
 
 in VS_OUT {
     vec3 refractedDir[3];
@@ -33,18 +39,131 @@ in VS_OUT {
     vec3 extra;
     float waveHeight;
     vec3 projectedReflected;
+    vec3 worldPos;
 } fs_in;
 
 
 float lineariseDepth(float value)
 {
-	return (2.0 * 0.01) / (30 + 0.01 - value * (30 - 0.01));
+	return (2.0 * near_plane * far_plane) / (far_plane + near_plane - (2.0 * value - 1.0) * (far_plane - near_plane));
 }
 
-out vec4 colour;
+// Sample a target which may have been rendered at a lower resolution than
+// the framebuffer. The four texels surrounding the lookup are weighted
+// bilinearly, as well as by how close their depth is to the one of the
+// texel nearest to the lookup, so that the foreground and the background
+// do not bleed into each other along silhouettes.
+vec3 upsample(sampler2D colour_texture, sampler2D depth_texture, vec2 uv)
+{
+    ivec2 size = textureSize(colour_texture, 0);
+    if (all(greaterThanEqual(vec2(size) * inv_res, vec2(1.0))))
+        return texture(colour_texture, uv).rgb;
+
+    vec2 position = uv * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = fract(position);
+    ivec2 nearest = clamp(ivec2(floor(uv * vec2(size))), ivec2(0), size - 1);
+    float reference = lineariseDepth(texelFetch(depth_texture, nearest, 0).r);
+
+    vec3 result = vec3(0.0);
+    float total_weight = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 coords = clamp(base + offset, ivec2(0), size - 1);
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float depth = lineariseDepth(texelFetch(depth_texture, coords, 0).r);
+        float weight = bilinear.x * bilinear.y / (0.01 + abs(depth - reference) / reference);
+        result += weight * texelFetch(colour_texture, coords, 0).rgb;
+        total_weight += weight;
+    }
+
+    return result / max(total_weight, 1e-5);
+}
 
-uniform vec3 atmosphereColour;
-uniform vec3 underwaterColour;
+// Intersect a ray, expressed in texture space (uv and depth), with the
+// depth buffer stored in hiz_texture, over hiz_levels levels. Cells whose closest depth lies
+// behind the ray are skipped as a whole, moving up the hierarchy, while
+// the others are refined by moving down.
+//
+// Returns the fraction of the ray at the intersection, or -1 on misses.
+float traceHiZ(sampler2D hiz_texture, int hiz_levels, vec3 origin, vec3 ray)
+{
+    const int max_iterations = 96;
+    const float thickness = 0.5;
+
+    vec2 size = vec2(textureSize(hiz_texture, 0));
+    vec2 direction = vec2(ray.x >= 0.0 ? 1.0 : 0.0, ray.y >= 0.0 ? 1.0 : 0.0);
+    vec2 inv_ray = vec2(abs(ray.x) > 1e-7 ? 1.0 / ray.x : 1e7,
+                        abs(ray.y) > 1e-7 ? 1.0 / ray.y : 1e7);
+    // Nudge used to step over a cell edge, a hundredth of a finest texel.
+    float nudge = 0.01 / max(max(abs(ray.x) * size.x, abs(ray.y) * size.y), 1e-5);
+
+    int level = 0;
+    float t = 0.0;
+    for (int i = 0; i < max_iterations; ++i) {
+        vec3 position = origin + t * ray;
+        if (t > 1.0 || any(lessThan(position.xy, vec2(0.0))) || any(greaterThan(position.xy, vec2(1.0))))
+            return -1.0;
+
+        vec2 cells = vec2(textureSize(hiz_texture, level));
+        vec2 cell = min(floor(position.xy * cells), cells - 1.0);
+        float min_depth = texelFetch(hiz_texture, ivec2(cell), level).r;
+
+        vec2 t_edges = ((cell + direction) / cells - origin.xy) * inv_ray;
+        float t_exit = min(t_edges.x, t_edges.y);
+        float t_surface = ray.z > 0.0 ? (min_depth - origin.z) / ray.z : 2.0;
+
+        bool is_in_front = position.z < min_depth;
+        if (is_in_front && t_surface >= t_exit) {
+            t = t_exit + nudge;
+            level = min(level + 1, hiz_levels - 1);
+            continue;
+        }
+
+        // The ray reaches the closest surface within this cell.
+        if (is_in_front)
+            t = t_surface;
+        if (level > 0) {
+            --level;
+        } else {
+            float ray_depth = origin.z + t * ray.z;
+            if (lineariseDepth(ray_depth) - lineariseDepth(min_depth) < thickness)
+                return t;
+            // The ray went behind a thin object: keep on looking past it.
+            t = t_exit + nudge;
+        }
+    }
+
+    return -1.0;
+}
+
+// Look up what a reflected ray hits in the given scene, using the fallback
+// colour when it leaves the screen or hits nothing.
+vec3 reflectScreenSpace(sampler2D colour_texture, sampler2D hiz_texture, int hiz_levels,
+                        vec3 origin, vec3 direction, vec3 fallback)
+{
+    const float max_distance = 30.0;
+
+    vec4 start_clip = vertex_world_to_clip * vec4(origin, 1.0);
+    vec4 end_clip = vertex_world_to_clip * vec4(origin + max_distance * direction, 1.0);
+    // Stop the ray at the near plane.
+    if (end_clip.w < near_plane)
+        end_clip = mix(start_clip, end_clip, (start_clip.w - near_plane) / (start_clip.w - end_clip.w));
+
+    vec3 start = start_clip.xyz / start_clip.w * 0.5 + 0.5;
+    vec3 end = end_clip.xyz / end_clip.w * 0.5 + 0.5;
+    float t = traceHiZ(hiz_texture, hiz_levels, start, end - start);
+    if (t < 0.0)
+        return fallback;
+
+    // Fade out towards the borders of the screen, to hide the transition
+    // to the fallback.
+    vec2 uv = mix(start.xy, end.xy, t);
+    vec2 fade = smoothstep(0.0, 0.1, uv) * (1.0 - smoothstep(0.9, 1.0, uv));
+    return mix(fallback, texture(colour_texture, uv).rgb, fade.x * fade.y);
+}
+
+out vec4 colour;
 
 void main()
 {
@@ -60,7 +179,11 @@ void main()
 
         // sample relfection based on wave heuristic
         vec2 refUV = gl_FragCoord.xy * inv_res;
-        reflectedColor = texture2D(reflection_texture, vec2(1 - refUV.x, refUV.y) + fs_in.waveHeight * fs_in.projectedReflected.xy).rgb;
+        if (use_ssr)
+            reflectedColor = reflectScreenSpace(underwater_texture, underwater_hiz_texture, underwater_hiz_levels,
+                                                fs_in.worldPos, fs_in.reflected, texture(cubemap_texture, fs_in.reflected).rgb);
+        else
+            reflectedColor = upsample(reflection_texture, reflection_depth_texture, vec2(1 - refUV.x, refUV.y) + fs_in.waveHeight * fs_in.projectedReflected.xy);
 
         // sample from cubemap
         refractedColor.r = texture(cubemap_texture, fs_in.refractedDir[0]).r;
@@ -81,11 +204,14 @@ void main()
     {
         //sample reflection in cubemap
         reflectedColor = texture(cubemap_texture, fs_in.reflected).xyz;
+        if (use_ssr)
+            reflectedColor = reflectScreenSpace(scene_texture, scene_hiz_texture, scene_hiz_levels,
+                                                fs_in.worldPos, fs_in.reflected, reflectedColor);
 
         // Color coming from the environment refraction, applying chromatic aberration
-        refractedColor.r = texture2D(underwater_texture, fs_in.refractedDir[0].xy * 0.5 + 0.5).r;
-        refractedColor.g = texture2D(underwater_texture, fs_in.refractedDir[1].xy * 0.5 + 0.5).g;
-        refractedColor.b = texture2D(underwater_texture, fs_in.refractedDir[2].xy * 0.5 + 0.5).b;
+        refractedColor.r = upsample(underwater_texture, underwater_depth_texture, fs_in.refractedDir[0].xy * 0.5 + 0.5).r;
+        refractedColor.g = upsample(underwater_texture, underwater_depth_texture, fs_in.refractedDir[1].xy * 0.5 + 0.5).g;
+        refractedColor.b = upsample(underwater_texture, underwater_depth_texture, fs_in.refractedDir[2].xy * 0.5 + 0.5).b;
     }
 
     result = mix(refractedColor, reflectedColor, clamp(fs_in.reflectionFactor, 0., 1.));
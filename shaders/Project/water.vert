@@ -1,17 +1,10 @@
 #version 410
 
-uniform mat4 vertex_model_to_world;
-uniform mat4 vertex_world_to_clip;
+#include "object_constants.glsl"
+#include "Project/constants.glsl"
 
 layout (location = 0) in vec3 vertex;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 texcoord;
-layout (location = 3) in vec3 tangent;
-layout (location = 4) in vec3 binormal;
-
-uniform vec2 inv_res;
-uniform float t;
-uniform vec3 camera_position;
+#include "vertex_attributes.glsl"
 
 uniform sampler2D heightmap_texture;
 
@@ -23,8 +16,6 @@ const float fresnelScale = 0.25;
 
 const float eta = 1 / 1.33;
 
-uniform bool IN_WATER;
-
 out VS_OUT {
     vec3 refractedDir[3];
     float reflectionFactor;
@@ -33,6 +24,7 @@ out VS_OUT {
     vec3 extra;
     float waveHeight;
     vec3 projectedReflected;
+    vec3 worldPos;
 } vs_out;
 
 
@@ -50,6 +42,8 @@ void main()
     vec4 worldPos = vertex_model_to_world * modelPos;
     worldPos = worldPos / worldPos.w;
 
+    vs_out.worldPos = worldPos.xyz;
+
     vec3 eye = normalize(worldPos.xyz - camera_position.xyz);
     vs_out.renderFromBelow = -eye.y;
 
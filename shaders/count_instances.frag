@@ -0,0 +1,9 @@
+#version 410
+
+// Each visible instance adds one, through additive blending.
+layout (location = 0) out float count;
+
+void main()
+{
+    count = 1.0;
+}
@@ -0,0 +1,7 @@
+#version 410
+
+// Draws a point covering the single texel of the render target.
+void main()
+{
+    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
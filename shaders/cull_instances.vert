@@ -0,0 +1,13 @@
+#version 410
+
+#include "instance_culling.glsl"
+
+// One point is drawn per instance.
+flat out int instance;
+flat out int is_visible;
+
+void main()
+{
+    instance = gl_VertexID;
+    is_visible = is_instance_visible(gl_VertexID) ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+// Transforms of the instance being drawn, relative to the object; matches
+// bonobo::InstanceBuffer, and is bound by Node when drawing instances.
+// Has to be included after "object_constants.glsl".
+uniform samplerBuffer instance_transforms;
+
+// Instances left visible by bonobo::InstanceCuller, if the node was
+// culled: draws then only cover those, and map them to their transforms.
+uniform usamplerBuffer instance_indices;
+uniform bool has_instance_indices;
+
+mat4 fetch_instance_matrix(int first_texel) {
+    return mat4(texelFetch(instance_transforms, first_texel),
+                texelFetch(instance_transforms, first_texel + 1),
+                texelFetch(instance_transforms, first_texel + 2),
+                texelFetch(instance_transforms, first_texel + 3));
+}
+
+int instance_index() {
+    return has_instance_indices ? int(texelFetch(instance_indices, gl_InstanceID).r) : gl_InstanceID;
+}
+
+mat4 instance_vertex_model_to_world() {
+    return vertex_model_to_world * fetch_instance_matrix(8 * instance_index());
+}
+
+mat4 instance_normal_model_to_world() {
+    return normal_model_to_world * fetch_instance_matrix(8 * instance_index() + 4);
+}
@@ -0,0 +1,35 @@
+// Frustum test of the instances of a node, shared by the culling shaders
+// of bonobo::InstanceCuller; instances are laid out as by
+// bonobo::InstanceBuffer.
+uniform samplerBuffer instance_transforms;
+uniform mat4 node_model_to_world;
+
+// Model-space box of the mesh, as its centre and half-extents
+uniform vec3 bounds_centre;
+uniform vec3 bounds_extents;
+
+// World-space planes of the frustum, pointing inwards
+uniform vec4 frustum_planes[6];
+
+bool is_instance_visible(int instance) {
+    int first_texel = 8 * instance;
+    mat4 model_to_world = node_model_to_world
+                        * mat4(texelFetch(instance_transforms, first_texel),
+                               texelFetch(instance_transforms, first_texel + 1),
+                               texelFetch(instance_transforms, first_texel + 2),
+                               texelFetch(instance_transforms, first_texel + 3));
+
+    // World-space box enclosing the transformed box of the mesh
+    vec3 centre = vec3(model_to_world * vec4(bounds_centre, 1.0));
+    mat3 linear = mat3(model_to_world);
+    vec3 extents = abs(linear[0]) * bounds_extents.x
+                 + abs(linear[1]) * bounds_extents.y
+                 + abs(linear[2]) * bounds_extents.z;
+
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = frustum_planes[i];
+        if (dot(plane.xyz, centre) + plane.w + dot(abs(plane.xyz), extents) < 0.0)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,7 @@
+// Normal maps only keep their X and Y, as loaded by bonobo::TextureLoader
+// for TextureUsage::normal_map: Z is rebuilt from them, knowing that
+// tangent-space normals are unit-length and point away from the surface.
+vec3 sample_normal_map(sampler2D normal_map, vec2 texcoord) {
+    vec2 xy = texture(normal_map, texcoord).xy * 2.0 - 1.0;
+    return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
@@ -0,0 +1,7 @@
+// Constants of the object being drawn; matches bonobo::ObjectConstants,
+// and is bound by Node::render().
+layout (std140) uniform ObjectConstants {
+    mat4 vertex_model_to_world;
+    mat4 normal_model_to_world;
+    mat4 vertex_world_to_clip;
+};
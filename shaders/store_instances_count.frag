@@ -0,0 +1,12 @@
+#version 410
+
+uniform sampler2D instances_count;
+
+// Integer copy of the count, which can then be read into the instance
+// count of an indirect draw command.
+layout (location = 0) out uint stored_count;
+
+void main()
+{
+    stored_count = uint(texelFetch(instances_count, ivec2(0), 0).r + 0.5);
+}
@@ -0,0 +1,64 @@
+#version 410
+
+// Occlusion test of the boxes of nodes against a Hi-Z pyramid, for
+// bonobo::OcclusionCuller. One point is drawn per draw command, i.e. per
+// level of detail of each node, and its result is captured by transform
+// feedback straight into the instance count of the command.
+uniform samplerBuffer object_bounds;
+uniform sampler2D hiz_texture;
+uniform int hiz_levels;
+uniform mat4 world_to_clip;
+
+flat out uint instance_count;
+
+bool is_visible(vec3 box_min, vec3 box_max)
+{
+    // Unknown bounds
+    if (any(greaterThan(box_min, box_max)))
+        return true;
+
+    vec3 ndc_min = vec3(1.0e30);
+    vec3 ndc_max = vec3(-1.0e30);
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = mix(box_min, box_max, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+        vec4 clip = world_to_clip * vec4(corner, 1.0);
+        // Boxes reaching behind the eye can not be projected.
+        if (clip.w <= 0.0)
+            return true;
+        vec3 ndc = clip.xyz / clip.w;
+        ndc_min = min(ndc_min, ndc);
+        ndc_max = max(ndc_max, ndc);
+    }
+
+    if (any(lessThan(ndc_max.xy, vec2(-1.0))) || any(greaterThan(ndc_min.xy, vec2(1.0))) || ndc_min.z > 1.0)
+        return false;
+
+    // Pick the level at which the rectangle covers at most two texels
+    // along each axis, so that four fetches cover all of it.
+    vec2 size = vec2(textureSize(hiz_texture, 0));
+    vec2 uv_min = clamp(ndc_min.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 uv_max = clamp(ndc_max.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 extent = (uv_max - uv_min) * size;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, hiz_levels - 1);
+
+    // The last texels of a level also cover the extra ones of odd sizes.
+    ivec2 last = textureSize(hiz_texture, level) - 1;
+    ivec2 texel_min = min(ivec2(uv_min * size) >> level, last);
+    ivec2 texel_max = min(ivec2(uv_max * size) >> level, last);
+
+    float farthest = max(max(texelFetch(hiz_texture, texel_min, level).r,
+                             texelFetch(hiz_texture, ivec2(texel_max.x, texel_min.y), level).r),
+                         max(texelFetch(hiz_texture, ivec2(texel_min.x, texel_max.y), level).r,
+                             texelFetch(hiz_texture, texel_max, level).r));
+
+    // Window-space depth of the nearest point of the box
+    float nearest = ndc_min.z * 0.5 + 0.5;
+    return nearest <= farthest;
+}
+
+void main()
+{
+    vec3 box_min = texelFetch(object_bounds, 2 * gl_VertexID).xyz;
+    vec3 box_max = texelFetch(object_bounds, 2 * gl_VertexID + 1).xyz;
+    instance_count = is_visible(box_min, box_max) ? 1u : 0u;
+}
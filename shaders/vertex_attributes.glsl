@@ -0,0 +1,25 @@
+// Attributes of pooled meshes, as quantised by bonobo::MeshPool: normals
+// and tangents are octahedral-encoded, and the binormal is rebuilt from
+// them and the handedness stored in the tangent.
+layout (location = 1) in vec2 packed_normal;
+layout (location = 2) in vec2 texcoord;
+layout (location = 3) in vec4 packed_tangent;
+
+vec3 decode_octahedral(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+
+vec3 vertex_normal() {
+    return decode_octahedral(packed_normal);
+}
+
+vec3 vertex_tangent() {
+    return decode_octahedral(packed_tangent.xy);
+}
+
+vec3 vertex_binormal() {
+    return cross(vertex_normal(), vertex_tangent()) * (packed_tangent.z < 0.0 ? -1.0 : 1.0);
+}
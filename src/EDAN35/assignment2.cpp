@@ -5,7 +5,9 @@
 #include "assignment2.hpp"
 
 #include "config.hpp"
+#include "core/AssetPack.hpp"
 #include "core/Bonobo.h"
+#include "core/DrawList.hpp"
 #include "core/FPSCamera.h"
 #include "core/GLStateInspection.h"
 #include "core/GLStateInspectionView.h"
@@ -55,6 +57,9 @@ edan35::Assignment2::Assignment2(WindowManager& windowManager) :
 	GLStateInspection::Init();
 	GLStateInspection::View::Init();
 
+	// Assets get read from the pack built by the asset_pack target, when
+	// there is one, rather than from separate files.
+	bonobo::mountAssetPack(config::asset_pack_path, config::root_dir);
 	bonobo::init();
 }
 
@@ -83,6 +88,13 @@ edan35::Assignment2::run()
 		sponza_elements.push_back(node);
 	}
 
+	// Sponza does not move, so the world-space bounds of its elements are
+	// gathered once and tested against the frustum of each view.
+	bonobo::FrustumCuller sponza_culler;
+	for (auto const& element : sponza_elements)
+		sponza_culler.add(element.get_bounds());
+	std::vector<std::uint8_t> sponza_visibility;
+
 	auto const cone_geometry = loadCone();
 	Node cone;
 	cone.set_geometry(cone_geometry);
@@ -160,6 +172,23 @@ edan35::Assignment2::run()
 
 	auto const set_uniforms = [](GLuint /*program*/){};
 
+	// All elements of Sponza share the identity as transform, and hence
+	// their object constants: draws sharing a material get merged. The
+	// constants of a view are pushed along with all others of the frame,
+	// before any pass runs.
+	bonobo::DrawList sponza_draw_list("Sponza");
+	auto const render_sponza = [&sponza_elements, &sponza_culler, &sponza_visibility, &sponza_draw_list](glm::mat4 const& world_to_clip, bonobo::UniformBuffer::Range const& object_constants,
+	                                                                                                     GLuint program, bool bind_textures) {
+		sponza_culler.cull(bonobo::extractFrustum(world_to_clip), sponza_visibility);
+
+		sponza_draw_list.clear();
+		for (std::size_t i = 0; i < sponza_elements.size(); ++i)
+			if (sponza_visibility[i])
+				sponza_draw_list.add(sponza_elements[i], object_constants, program, bind_textures, 0.0f);
+		sponza_draw_list.sort();
+		sponza_draw_list.submit();
+	};
+
 	int framebuffer_width, framebuffer_height;
 	glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
 
@@ -260,7 +289,11 @@ edan35::Assignment2::run()
 	bool show_gui = true;
 	bool shader_reload_failed = false;
 
+	std::array<glm::mat4, constant::lights_nb> light_matrices;
+	std::array<bonobo::UniformBuffer::Range, constant::lights_nb> shadowmap_constants, cone_constants;
+
 	while (!glfwWindowShouldClose(window)) {
+		bonobo::getTextureLoader().update();
 		auto const nowTime = std::chrono::high_resolution_clock::now();
 		auto const deltaTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(nowTime - lastTime);
 		lastTime = nowTime;
@@ -291,6 +324,24 @@ edan35::Assignment2::run()
 
 
 		if (!shader_reload_failed) {
+			//
+			// Gather the constants of all draw calls of the frame, and upload
+			// them at once.
+			//
+			auto& uniform_buffer = bonobo::getStreamingUniformBuffer();
+			uniform_buffer.reset();
+			auto const gbuffer_constants = uniform_buffer.push(bonobo::makeObjectConstants(glm::mat4(1.0f), mCamera.GetWorldToClipMatrix()));
+			for (size_t i = 0; i < static_cast<size_t>(lights_nb); ++i) {
+				auto& lightTransform = lightTransforms[i];
+				lightTransform.SetRotate(seconds_nb * 0.1f + i * 1.57f, glm::vec3(0.0f, 1.0f, 0.0f));
+
+				light_matrices[i] = lightProjection * lightOffsetTransform.GetMatrixInverse() * lightTransform.GetMatrixInverse();
+				shadowmap_constants[i] = uniform_buffer.push(bonobo::makeObjectConstants(glm::mat4(1.0f), light_matrices[i]));
+				cone_constants[i] = uniform_buffer.push(bonobo::makeObjectConstants(lightTransform.GetMatrix() * lightOffsetTransform.GetMatrix() * coneScaleTransform.GetMatrix(),
+				                                                                    mCamera.GetWorldToClipMatrix()));
+			}
+			uniform_buffer.upload();
+
 			glDepthFunc(GL_LESS);
 			//
 			// Pass 1: Render scene into the g-buffer
@@ -314,8 +365,7 @@ edan35::Assignment2::run()
 
 			GLStateInspection::CaptureSnapshot("Filling Pass");
 
-			for (auto const& element : sponza_elements)
-				element.render(mCamera.GetWorldToClipMatrix(), element.get_transform().GetMatrix(), fill_gbuffer_shader, set_uniforms);
+			render_sponza(mCamera.GetWorldToClipMatrix(), gbuffer_constants, fill_gbuffer_shader, true);
 			if (utils::opengl::debug::isSupported())
 			{
 				glPopDebugGroup();
@@ -334,10 +384,8 @@ edan35::Assignment2::run()
 			// XXX: Is any clearing needed?
 			glClear(GL_COLOR_BUFFER_BIT);
 			for (size_t i = 0; i < static_cast<size_t>(lights_nb); ++i) {
-				auto& lightTransform = lightTransforms[i];
-				lightTransform.SetRotate(seconds_nb * 0.1f + i * 1.57f, glm::vec3(0.0f, 1.0f, 0.0f));
-
-				auto light_matrix = lightProjection * lightOffsetTransform.GetMatrixInverse() * lightTransform.GetMatrixInverse();
+				auto const& lightTransform = lightTransforms[i];
+				auto const& light_matrix = light_matrices[i];
 
 				//
 				// Pass 2.1: Generate shadow map for light i
@@ -355,8 +403,7 @@ edan35::Assignment2::run()
 
 				GLStateInspection::CaptureSnapshot("Shadow Map Generation");
 
-				for (auto const& element : sponza_elements)
-					element.render(light_matrix, glm::mat4(1.0f), fill_shadowmap_shader, set_uniforms);
+				render_sponza(light_matrix, shadowmap_constants[i], fill_shadowmap_shader, false);
 				if (utils::opengl::debug::isSupported())
 				{
 					glPopDebugGroup();
@@ -407,9 +454,7 @@ edan35::Assignment2::run()
 
 				GLStateInspection::CaptureSnapshot("Accumulating");
 
-				cone.render(mCamera.GetWorldToClipMatrix(),
-				            lightTransform.GetMatrix() * lightOffsetTransform.GetMatrix() * coneScaleTransform.GetMatrix(),
-				            accumulate_lights_shader, spotlight_set_uniforms);
+				cone.render(cone_constants[i], accumulate_lights_shader, true, spotlight_set_uniforms);
 
 				glBindSampler(2u, 0u);
 				glBindSampler(1u, 0u);
@@ -464,12 +509,10 @@ edan35::Assignment2::run()
 		//
 		// Pass 4: Draw wireframe cones on top of the final image for debugging purposes
 		//
-		if (show_cone_wireframe) {
+		if (show_cone_wireframe && !shader_reload_failed) {
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 			for (size_t i = 0; i < lights_nb; ++i) {
-				cone.render(mCamera.GetWorldToClipMatrix(),
-				            lightTransforms[i].GetMatrix() * lightOffsetTransform.GetMatrix() * coneScaleTransform.GetMatrix(),
-				            render_light_cones_shader, set_uniforms);
+				cone.render(cone_constants[i], render_light_cones_shader, true, set_uniforms);
 			}
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 		}
@@ -5,14 +5,23 @@
 #include "project.hpp"
 
 #include "config.hpp"
+#include "core/AssetPack.hpp"
 #include "core/Bonobo.h"
+#include "core/DrawList.hpp"
 #include "core/FPSCamera.h"
 #include "core/GLStateInspection.h"
 #include "core/GLStateInspectionView.h"
 #include "core/helpers.hpp"
+#include "core/InstanceBuffer.hpp"
+#include "core/InstanceCuller.hpp"
+#include "core/LevelOfDetail.hpp"
 #include "core/node.hpp"
+#include "core/OcclusionCuller.hpp"
+#include "core/OcclusionQuery.hpp"
 #include "core/opengl.hpp"
+#include "core/RenderGraph.hpp"
 #include "core/ShaderProgramManager.hpp"
+#include "core/UniformBuffer.hpp"
 
 #include "Common/parametric_shapes.hpp"
 
@@ -23,11 +32,14 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <tinyfiledialogs.h>
 
+#include <algorithm>
 #include <array>
 #include <clocale>
 #include <cstdlib>
 #include <stdexcept>
 
+using namespace bonobo::literals;
+
 // mouse scroll delta
 // global since glfw window-data pointer
 // is already occupied.
@@ -68,6 +80,155 @@ namespace constant
     const glm::vec3 atmosphereColour = glm::vec3(0.529, 0.808, 0.922);
 
     const float MAMSL = 2.0; // Meter above mean sea level. (M..h)
+
+    const float pool_half_width = 10.0f;
+    const float pool_floor = -3.0f;
+    // How far the simulated waves can move the surface away from MAMSL; the
+    // camera sees both sides of the water while within that band.
+    const float wave_margin = 0.5f;
+}
+
+namespace
+{
+    //! \brief Description of a texture handled by the render graph.
+    bonobo::RenderGraph::TextureDesc textureDesc(GLsizei width, GLsizei height,
+                                                 GLint internal_format = GL_RGBA,
+                                                 GLenum format = GL_RGBA,
+                                                 GLenum type = GL_UNSIGNED_BYTE,
+                                                 GLint levels_nb = 1)
+    {
+        bonobo::RenderGraph::TextureDesc desc;
+        desc.width = width;
+        desc.height = height;
+        desc.internal_format = internal_format;
+        desc.format = format;
+        desc.type = type;
+        desc.levels_nb = levels_nb;
+        return desc;
+    }
+
+    std::array<char const*, 3> const target_scale_names = { "1", "1/2", "1/4" };
+
+    //! \brief Description of a texture which the scene is rendered into
+    //!        before being sampled by the water, at a fraction of the
+    //!        framebuffer resolution.
+    //!
+    //! @param [in] scale_index the framebuffer resolution is divided by
+    //!             2^scale_index
+    bonobo::RenderGraph::TextureDesc scaledTargetDesc(GLsizei framebuffer_width, GLsizei framebuffer_height, int scale_index,
+                                                      GLint internal_format, GLenum format, GLenum type)
+    {
+        return textureDesc(std::max(framebuffer_width >> scale_index, 1), std::max(framebuffer_height >> scale_index, 1),
+                           internal_format, format, type);
+    }
+
+    //! \brief Constants shared by all draw calls of a frame, laid out
+    //!        following the std140 rules; matches the `FrameConstants`
+    //!        block declared in shaders/Project/constants.glsl.
+    struct FrameConstants {
+        glm::mat4 shadow_view_projection;
+        glm::vec3 sun_dir;
+        float MAMSL;
+        glm::vec3 atmosphereColour;
+        float t;
+        glm::vec3 underwaterColour;
+        GLint IN_WATER;
+        glm::vec2 shadowmap_texel_size;
+        glm::vec2 inv_res;
+        float near_plane;
+        float far_plane;
+        glm::vec2 padding;
+    };
+
+    //! \brief Constants of the view a pass renders from; matches the
+    //!        `PassConstants` block declared in shaders/Project/constants.glsl.
+    struct PassConstants {
+        glm::mat4 view_projection_inverse;
+        glm::vec3 camera_position;
+        float padding;
+    };
+
+    GLuint const frame_constants_binding = static_cast<GLuint>(bonobo::uniform_block_bindings::first_application_binding);
+    GLuint const pass_constants_binding = frame_constants_binding + 1u;
+
+    //! \brief Ranges of the uniform buffer holding the constants of a
+    //!        view, and of the objects seen from it; objects outside of the
+    //!        frustum of the view get an empty range, and are not drawn.
+    struct ViewConstants {
+        glm::mat4 world_to_clip;
+        glm::vec3 position;
+        bonobo::LodSelector lod_selector;
+        bonobo::UniformBuffer::Range pass;
+        std::vector<bonobo::UniformBuffer::Range> solids;
+        std::vector<bonobo::UniformBuffer::Range> transparents;
+        std::vector<bonobo::UniformBuffer::Range> walls;
+        bonobo::UniformBuffer::Range sky;
+    };
+
+    //! \brief How the water gets its reflections from.
+    enum class reflection_mode_t : int {
+        planar = 0,  //!< re-render the scene from a camera mirrored about the water plane
+        screen_space //!< trace the scenes rendered from the main camera
+    };
+
+    std::array<char const*, 2> const reflection_mode_names = { "Planar", "Screen-space" };
+
+    //! \brief Description of the hierarchical depth buffer of a depth
+    //!        buffer: every texel of a level keeps the closest (or
+    //!        farthest) depth of the texels it covers in the level below.
+    bonobo::RenderGraph::TextureDesc hiZPyramidDesc(bonobo::RenderGraph::TextureDesc const& depth_desc)
+    {
+        GLint levels_nb = 1;
+        while ((std::max(depth_desc.width, depth_desc.height) >> levels_nb) > 0)
+            ++levels_nb;
+
+        return textureDesc(depth_desc.width, depth_desc.height, GL_R32F, GL_RED, GL_FLOAT, levels_nb);
+    }
+
+    //! \brief Copy a depth buffer into the first level of a pyramid, and
+    //!        reduce it level after level.
+    //!
+    //! While a level is being written to, the texture is restricted to
+    //! the level below so that sampling it does not form a feedback loop.
+    //!
+    //! @param [in] keep_farthest whether levels keep the farthest depth
+    //!             rather than the closest one, as needed by occlusion tests
+    void buildHiZPyramid(GLuint fbo, GLuint pyramid, bonobo::RenderGraph::TextureDesc const& pyramid_desc,
+                         GLuint depth_texture, GLuint program, bool keep_farthest = false)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glDisable(GL_DEPTH_TEST);
+        glUseProgram(program);
+        glActiveTexture(GL_TEXTURE0);
+        glBindSampler(0u, 0u);
+        glUniform1i(ShaderProgramManager::GetUniformLocation(program, "depth_texture"_hash), 0);
+        glUniform1i(ShaderProgramManager::GetUniformLocation(program, "keep_farthest"_hash), keep_farthest ? GL_TRUE : GL_FALSE);
+
+        for (GLint level = 0; level < pyramid_desc.levels_nb; ++level) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, level);
+            if (level == 0 && glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                LogError("Something went wrong with framebuffer %u", fbo);
+            glViewport(0, 0, std::max(pyramid_desc.width >> level, 1), std::max(pyramid_desc.height >> level, 1));
+
+            if (level == 0) {
+                glBindTexture(GL_TEXTURE_2D, depth_texture);
+            } else {
+                glBindTexture(GL_TEXTURE_2D, pyramid);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+            }
+            glUniform1i(ShaderProgramManager::GetUniformLocation(program, "copy_source"_hash), level == 0 ? GL_TRUE : GL_FALSE);
+
+            bonobo::drawFullscreen();
+        }
+
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramid_desc.levels_nb - 1);
+        glBindTexture(GL_TEXTURE_2D, 0u);
+        glUseProgram(0u);
+        glEnable(GL_DEPTH_TEST);
+    }
 }
 
 static bonobo::mesh_data loadCone();
@@ -88,6 +249,9 @@ project::Project::Project(WindowManager& windowManager) :
     GLStateInspection::Init();
     GLStateInspection::View::Init();
 
+    // Assets get read from the pack built by the asset_pack target, when
+    // there is one, rather than from separate files.
+    bonobo::mountAssetPack(config::asset_pack_path, config::root_dir);
     bonobo::init();
 }
 
@@ -163,19 +327,29 @@ project::Project::run()
         }
     }
 
-    std::vector<Node> transparents_walls;
+    // The four walls share their mesh and only differ by their
+    // transform, so they are drawn as instances of a single node.
+    std::vector<glm::mat4> wall_transforms;
     for (size_t i = 0; i < 4; ++i) {
-        for (size_t j = 0; j < water_wall.size(); ++j) {
-            Node node = {};
-            node.get_transform().SetTranslate(CSO_translations[i]);
-            node.get_transform().SetScale(glm::vec3(1, 1, 2.5));
-            node.get_transform().Scale(constant::scale_lengths);
-            node.get_transform().SetRotate(3.14159265359 / 2.0f, glm::vec3(1,0,0));
-            node.get_transform().Rotate(3.14159265359 / 2.0f, glm::vec3(0, 0, -1));
-            node.get_transform().Rotate(3.14159265359 / 2.0f * i, glm::vec3(0, 0, 1));
-            node.set_geometry(water_wall[j]);
-            transparents_walls.push_back(node);
-        }
+        TRSTransformf transform;
+        transform.SetTranslate(CSO_translations[i]);
+        transform.SetScale(glm::vec3(1, 1, 2.5));
+        transform.Scale(constant::scale_lengths);
+        transform.SetRotate(3.14159265359 / 2.0f, glm::vec3(1,0,0));
+        transform.Rotate(3.14159265359 / 2.0f, glm::vec3(0, 0, -1));
+        transform.Rotate(3.14159265359 / 2.0f * i, glm::vec3(0, 0, 1));
+        wall_transforms.push_back(transform.GetMatrix());
+    }
+    bonobo::InstanceBuffer wall_instances;
+    wall_instances.set(wall_transforms);
+    bonobo::InstanceCuller instance_culler;
+
+    std::vector<Node> transparents_walls;
+    for (size_t j = 0; j < water_wall.size(); ++j) {
+        Node node = {};
+        node.set_geometry(water_wall[j]);
+        node.set_instances(wall_instances);
+        transparents_walls.push_back(node);
     }
 
     auto const ortho_box = parametric_shapes::createCube(1.0);
@@ -193,6 +367,8 @@ project::Project::run()
     // Load all the shader programs used
     //
     ShaderProgramManager program_manager;
+    program_manager.SetUniformBlockBinding("FrameConstants", frame_constants_binding);
+    program_manager.SetUniformBlockBinding("PassConstants", pass_constants_binding);
     GLuint fallback_shader = 0u;
     program_manager.CreateAndRegisterProgram("Fallback",
         { { ShaderType::vertex, "EDAF80/fallback.vert" },
@@ -294,13 +470,13 @@ project::Project::run()
         return;
     }
 
-    GLuint render_overwater = 0u;
-    program_manager.CreateAndRegisterProgram("Overwater",
-        { { ShaderType::vertex, "Project/overwater.vert" },
-          { ShaderType::fragment, "Project/overwater.frag" } },
-        render_overwater);
-    if (render_overwater == 0u) {
-        LogError("Failed to load resolve shader");
+    GLuint render_composite = 0u;
+    program_manager.CreateAndRegisterProgram("Composite",
+        { { ShaderType::vertex, "Project/underwater.vert" },
+          { ShaderType::fragment, "Project/composite.frag" } },
+        render_composite);
+    if (render_composite == 0u) {
+        LogError("Failed to load composite shader");
         return;
     }
 
@@ -315,6 +491,49 @@ project::Project::run()
         return;
     }
 
+    // The shading programs discard some fragments, so their depth
+    // pre-passes, and the occluders hiding solids from them, have to run
+    // the same tests rather than just write the depth of every triangle.
+    GLuint underwater_depth_prepass_shader = 0u;
+    program_manager.CreateAndRegisterProgram("Underwater depth pre-pass",
+        { { ShaderType::vertex, "Project/underwater.vert" },
+          { ShaderType::fragment, "Project/underwater_depth_prepass.frag" } },
+        underwater_depth_prepass_shader);
+    if (underwater_depth_prepass_shader == 0u) {
+        LogError("Failed to load underwater depth pre-pass shader");
+        return;
+    }
+
+    GLuint composite_depth_prepass_shader = 0u;
+    program_manager.CreateAndRegisterProgram("Composite depth pre-pass",
+        { { ShaderType::vertex, "Project/underwater.vert" },
+          { ShaderType::fragment, "Project/composite_depth_prepass.frag" } },
+        composite_depth_prepass_shader);
+    if (composite_depth_prepass_shader == 0u) {
+        LogError("Failed to load composite depth pre-pass shader");
+        return;
+    }
+
+    GLuint build_hiz_shader = 0u;
+    program_manager.CreateAndRegisterProgram("Build Hi-Z",
+        { { ShaderType::vertex, "Project/sim_water.vert" },
+          { ShaderType::fragment, "Project/hiz_downsample.frag" } },
+        build_hiz_shader);
+    if (build_hiz_shader == 0u) {
+        LogError("Failed to load Hi-Z building shader");
+        return;
+    }
+
+    GLuint copy_scene_shader = 0u;
+    program_manager.CreateAndRegisterProgram("Copy scene",
+        { { ShaderType::vertex, "Project/sim_water.vert" },
+          { ShaderType::fragment, "Project/copy_scene.frag" } },
+        copy_scene_shader);
+    if (copy_scene_shader == 0u) {
+        LogError("Failed to load scene copying shader");
+        return;
+    }
+
     GLuint render_light_cones_shader = 0u;
     program_manager.CreateAndRegisterProgram("Render light box",
         { { ShaderType::vertex, "EDAN35/render_light_cones.vert" },
@@ -333,8 +552,6 @@ project::Project::run()
     if (render_cubemap == 0u)
         LogError("Failed to load cubemap shader");
 
-    auto const no_extra_uniforms = [](GLuint /*program*/) {};
-
     int framebuffer_width, framebuffer_height;
     glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
 
@@ -360,11 +577,7 @@ project::Project::run()
     //
     // Setup textures
     //
-
-    auto const underwater_scene_texture = bonobo::createTexture(framebuffer_width, framebuffer_height);
-
     for (auto& node : transparents) {
-        node.add_texture("underwater_texture", underwater_scene_texture, GL_TEXTURE_2D);
         node.add_texture("cubemap_texture", cubemap_texture, GL_TEXTURE_CUBE_MAP);
     }
 
@@ -372,32 +585,33 @@ project::Project::run()
         node.add_texture("cubemap_texture", cubemap_texture, GL_TEXTURE_CUBE_MAP);
     }
 
-    auto const shadowmap_texture = bonobo::createTexture(constant::light_texture_res_x, constant::light_texture_res_y,
-        GL_TEXTURE_2D, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
-    auto const environmentmap_texture = bonobo::createTexture(constant::light_texture_res_x, constant::light_texture_res_y,
-        GL_TEXTURE_2D, GL_RGBA32F);
-    auto const causticmap_texture = bonobo::createTexture(constant::light_texture_res_x, constant::light_texture_res_y);
-    auto const depth_texture = bonobo::createTexture(framebuffer_width, framebuffer_height,
-        GL_TEXTURE_2D, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
-    auto const water_depth_texture = bonobo::createTexture(constant::light_texture_res_x, constant::light_texture_res_y,
-        GL_TEXTURE_2D, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
-    auto const water_texture0 = bonobo::createTexture(constant::heightmap_res, constant::heightmap_res,
-        GL_TEXTURE_2D, GL_RGBA32F);
-    auto const water_texture1 = bonobo::createTexture(constant::heightmap_res, constant::heightmap_res,
-        GL_TEXTURE_2D, GL_RGBA32F);
-    auto const reflection_texture = bonobo::createTexture(framebuffer_width, framebuffer_height);
+    // Only the state of the water simulation persists from one frame to
+    // the next: all other textures are transient, and get allocated by the
+    // render graph.
+    auto const water_desc = textureDesc(constant::heightmap_res, constant::heightmap_res, GL_RGBA32F);
+    auto const water_texture0 = bonobo::createTexture(water_desc.width, water_desc.height,
+        GL_TEXTURE_2D, water_desc.internal_format);
+    auto const water_texture1 = bonobo::createTexture(water_desc.width, water_desc.height,
+        GL_TEXTURE_2D, water_desc.internal_format);
+
+    auto const light_depth_desc = textureDesc(constant::light_texture_res_x, constant::light_texture_res_y,
+        GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+    // The underwater scene (refracted by the top side of the water) and the
+    // mirrored scene (reflected by its bottom side) are rendered at a
+    // fraction of the framebuffer resolution.
+    int underwater_scene_scale_index = 1;
+    int reflection_scale_index = 1;
 
     //
     // Setup FBOs
     //
-    auto const shadowmap_fbo = bonobo::createFBO({}, shadowmap_texture);
-    auto const water_depth_fbo = bonobo::createFBO({}, water_depth_texture);
-    auto const environmentmap_fbo = bonobo::createFBO({ environmentmap_texture });
-    auto const causticmap_fbo = bonobo::createFBO({ causticmap_texture });
-    auto const underwater_scene_fbo = bonobo::createFBO({ underwater_scene_texture }, depth_texture);
-    auto const water_fbo0 = bonobo::createFBO({ water_texture0 });
-    auto const water_fbo1 = bonobo::createFBO({ water_texture1 });
-    auto const reflection_fbo = bonobo::createFBO({ reflection_texture }, depth_texture);
+
+    // The levels of the Hi-Z pyramid get attached one after the other,
+    // hence it uses its own FBO rather than one from the render graph.
+    GLuint hiz_fbo = 0u;
+    glGenFramebuffers(1, &hiz_fbo);
+
     //
     // Setup samplers
     //
@@ -422,6 +636,13 @@ project::Project::run()
         glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         });
 
+    auto const hiz_sampler = bonobo::createSampler([](GLuint sampler) {
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        });
+
     auto const shadow_sampler = bonobo::createSampler([](GLuint sampler) {
         glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -447,10 +668,10 @@ project::Project::run()
         glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
     });
 
-    auto const bind_texture_with_sampler = [](GLenum target, unsigned int slot, GLuint program, std::string const& name, GLuint texture, GLuint sampler) {
+    auto const bind_texture_with_sampler = [](GLenum target, unsigned int slot, GLuint program, std::uint32_t name_hash, GLuint texture, GLuint sampler) {
         glActiveTexture(GL_TEXTURE0 + slot);
         glBindTexture(target, texture);
-        glUniform1i(glGetUniformLocation(program, name.c_str()), static_cast<GLint>(slot));
+        glUniform1i(ShaderProgramManager::GetUniformLocation(program, name_hash), static_cast<GLint>(slot));
         glBindSampler(slot, sampler);
     };
 
@@ -481,13 +702,28 @@ project::Project::run()
 
     glm::mat4 boxScale = glm::scale(glm::mat4(1.0f), glm::vec3(right-left, bot - top, lightProjectionFarPlane - lightProjectionNearPlane));
 
+    //
+    // Setup the occlusion query on the water volume, used to skip the
+    // passes which only feed the water when it can not be seen.
+    //
+    bonobo::OcclusionQuery water_volume_query;
+    float const water_volume_top = (constant::MAMSL + constant::wave_margin) * constant::scale_lengths;
+    float const water_volume_bottom = constant::pool_floor * constant::scale_lengths;
+    glm::mat4 const water_volume_transform =
+        glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.5f * (water_volume_top + water_volume_bottom), 0.0f))
+        * glm::scale(glm::mat4(1.0f), glm::vec3(2.0f * constant::pool_half_width * constant::scale_lengths,
+                                                water_volume_top - water_volume_bottom,
+                                                2.0f * constant::pool_half_width * constant::scale_lengths));
+
     auto seconds_nb = 0.0f;
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glBindFramebuffer(GL_FRAMEBUFFER, water_fbo0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, water_fbo1);
-    glClear(GL_COLOR_BUFFER_BIT);
+    for (auto const water_texture : { water_texture0, water_texture1 }) {
+        auto water_fbo = bonobo::createFBO({ water_texture });
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDeleteFramebuffers(1, &water_fbo);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0u);
 
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -498,6 +734,18 @@ project::Project::run()
     auto lastTime = std::chrono::high_resolution_clock::now();
     bool show_textures = true;
     bool show_cone_wireframe = false;
+    bool use_occlusion_queries = true;
+    auto reflection_mode = reflection_mode_t::planar;
+    bool use_hiz = true;
+    bool use_depth_prepass = true;
+    bool use_occlusion_culling = true;
+    float lod_max_error = 1.0f;
+    float shadow_lod_bias = 2.0f;
+    bool use_gpu_instance_culling = false;
+    bool is_water_visible = true;
+    bool render_underwater_scene_pass = true;
+    bool render_reflection_pass = true;
+    bool build_scene_hiz_pass = false;
 
     bool show_logs = true;
     bool show_gui = true;
@@ -521,8 +769,709 @@ project::Project::run()
     float orbit_theta = 0.0f;
     bool hold_tab = false;
 
+    //
+    // State updated every frame before executing the render graph
+    //
+    auto const light_matrix = lightProjection * lightTransform.GetMatrixInverse();
+    bool hitWater = false;
+    bool isInWater = false;
+    bool query_water_volume = false;
+    bool is_water_volume_tested = false;
+    glm::mat4 water_query_world_to_clip(0.0f);
+    bool use_ssr = false;
+    bool cull_occluded = false;
+
+    auto const water_drop_uniform = [this, &hitWater, &water_mouseray_position](GLuint program) {
+        glUniform2fv(ShaderProgramManager::GetUniformLocation(program, "center"_hash), 1, glm::value_ptr(water_mouseray_position));
+        //glUniform2fv(glGetUniformLocation(program, "center"), 1, glm::value_ptr(glm::vec2(0,0)));
+        glUniform1f(ShaderProgramManager::GetUniformLocation(program, "radius"_hash), 0.03f);
+        glUniform1f(ShaderProgramManager::GetUniformLocation(program, "strength"_hash), hitWater ? 0.08f : 0.0f);
+    };
+
+    //
+    // Uniforms set directly by the passes; their locations are only looked
+    // up again once the programs get reloaded.
+    //
+    ShaderProgramManager::Uniform const caustic_inv_res(fill_causticmap_shader, "inv_res"_hash);
+    ShaderProgramManager::Uniform const caustic_light_color(fill_causticmap_shader, "light_color"_hash);
+    ShaderProgramManager::Uniform const caustic_light_direction(fill_causticmap_shader, "light_direction"_hash);
+    ShaderProgramManager::Uniform const caustic_environmentmap_texel_size(fill_causticmap_shader, "environmentmap_texel_size"_hash);
+    ShaderProgramManager::Uniform const water_use_ssr(render_water, "use_ssr"_hash);
+    ShaderProgramManager::Uniform const water_underwater_hiz_levels(render_water, "underwater_hiz_levels"_hash);
+    ShaderProgramManager::Uniform const water_scene_hiz_levels(render_water, "scene_hiz_levels"_hash);
+
+    //
+    // Setup the uniform buffer: all constants of a frame are pushed into
+    // it before executing the render graph, and uploaded at once, so that
+    // draw calls only have to bind the range holding their constants.
+    //
+    bonobo::UniformBuffer frame_uniform_buffer;
+    ViewConstants light_view, camera_view, mirrored_view;
+    bonobo::UniformBuffer::Range water_volume_constants, light_box_constants;
+    bonobo::FrustumCuller frustum_culler;
+    std::vector<std::uint8_t> node_visibility;
+    std::size_t culled_nodes_nb = 0u;
+
+    // Solids hidden behind other solids get skipped by the passes drawing
+    // them from the camera and its mirror, as found on the GPU by testing
+    // them against a Hi-Z pyramid of their view.
+    bonobo::OcclusionCuller camera_occlusion, mirrored_occlusion;
+
+    auto const push_view_constants = [&](glm::mat4 const& world_to_clip, glm::vec3 const& view_position,
+                                         bonobo::LodSelector const& lod_selector, ViewConstants& view) {
+        PassConstants const pass_constants = { glm::inverse(world_to_clip), view_position, 0.0f };
+        view.world_to_clip = world_to_clip;
+        view.position = view_position;
+        view.lod_selector = lod_selector;
+        view.pass = frame_uniform_buffer.push(pass_constants);
+
+        // Consecutive nodes sharing their transform, such as the meshes
+        // of a same model, share their constants, which lets draw lists
+        // issue them together.
+        auto const frustum = bonobo::extractFrustum(world_to_clip);
+        auto const push_objects = [&](std::vector<Node> const& nodes, std::vector<bonobo::UniformBuffer::Range>& ranges) {
+            frustum_culler.clear();
+            for (auto const& node : nodes)
+                frustum_culler.add(node.get_bounds().transform(node.get_transform().GetMatrix()));
+            culled_nodes_nb += frustum_culler.cull(frustum, node_visibility);
+
+            ranges.clear();
+            for (std::size_t i = 0; i < nodes.size(); ++i) {
+                if (!node_visibility[i]) {
+                    ranges.push_back({});
+                    continue;
+                }
+                auto const world = nodes[i].get_transform().GetMatrix();
+                if (i > 0 && ranges.back().size != 0 && world == nodes[i - 1].get_transform().GetMatrix())
+                    ranges.push_back(ranges.back());
+                else
+                    ranges.push_back(frame_uniform_buffer.push(bonobo::makeObjectConstants(world, world_to_clip)));
+            }
+        };
+        push_objects(solids, view.solids);
+        push_objects(transparents, view.transparents);
+        push_objects(transparents_walls, view.walls);
+        view.sky = frame_uniform_buffer.push(bonobo::makeObjectConstants(glm::mat4(1.0f), world_to_clip));
+    };
+
+    //
+    // Nodes are drawn through a draw list, sorting them so that only the
+    // state changing between consecutive draws gets emitted.
+    //
+    bonobo::DrawList draw_list("Nodes");
+    //
+    // Each node is drawn at the coarsest level of detail whose error stays
+    // below a few pixels once projected by the view; the light views get
+    // a larger tolerance, as the shadows and caustics they produce are
+    // filtered anyway.
+    //
+    auto const render_nodes = [&draw_list](std::vector<Node> const& nodes, std::vector<bonobo::UniformBuffer::Range> const& object_constants,
+                                           ViewConstants const& view, GLuint program, bool bind_textures,
+                                           bonobo::OcclusionCuller const* occlusion = nullptr) {
+        draw_list.clear();
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            if (object_constants[i].size == 0) // culled
+                continue;
+            auto const& node = nodes[i];
+            auto const lod = node.get_lods().empty() ? std::size_t(0u)
+                           : view.lod_selector.select(node.get_lods(), node.get_bounds(), node.get_transform().GetMatrix(), view.position);
+            draw_list.add(node, object_constants[i], program, bind_textures,
+                          glm::distance(view.position, node.get_transform().GetTranslation()), lod,
+                          occlusion != nullptr ? occlusion->get_draw(i, lod) : bonobo::DrawList::IndirectDraw{ 0u, 0 });
+        }
+        draw_list.sort();
+        draw_list.submit();
+    };
+
+    // Lay down the depth of the solids without any shading, so that
+    // the expensive shading that follows only runs for the fragments
+    // which end up visible. The pre-pass program has to discard the same
+    // fragments as the shading one, which reads the same water depth map
+    // and opacity textures.
+    auto const begin_depth_prepass = [&](ViewConstants const& view, GLuint program, GLuint water_depth_texture,
+                                         bonobo::OcclusionCuller const* occlusion) {
+        if (!use_depth_prepass)
+            return;
+        glUseProgram(program);
+        bind_texture_with_sampler(GL_TEXTURE_2D, 7, program, "water_depth_texture"_hash, water_depth_texture, shadow_sampler);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        render_nodes(solids, view.solids, view, program, true, occlusion);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    };
+    auto const end_depth_prepass = [&]() {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    };
+
+    // The sky lies on the far plane, and is drawn after everything
+    // else so that only the pixels left uncovered get shaded.
+    auto const render_sky = [&](ViewConstants const& view) {
+        glCullFace(GL_FRONT);
+        glDepthFunc(GL_LEQUAL);
+        cube.render(view.sky, render_cubemap);
+        glDepthFunc(GL_LESS);
+        glCullFace(GL_BACK);
+    };
+
+    //
+    // Setup the render graph
+    //
+    bonobo::RenderGraph frame_graph;
+    bool is_frame_graph_outdated = true;
+
+    // Latest versions of the resources of the graph, which the passes use
+    // to look up the textures backing them.
+    struct {
+        bonobo::RenderGraph::ResourceHandle water_state0, water_state1, backbuffer;
+        bonobo::RenderGraph::ResourceHandle shadowmap, water_depthmap, environmentmap, causticmap;
+        bonobo::RenderGraph::ResourceHandle underwater_colour, underwater_depth, underwater_hiz;
+        bonobo::RenderGraph::ResourceHandle reflection_colour, reflection_depth;
+        bonobo::RenderGraph::ResourceHandle scene_colour, scene_depth, scene_hiz;
+        bonobo::RenderGraph::ResourceHandle camera_occluders, camera_occlusion_hiz;
+        bonobo::RenderGraph::ResourceHandle mirrored_occluders, mirrored_occlusion_hiz;
+    } frame;
+
+    // Occluders discard the same fragments as the pass they cull for, so
+    // that solids seen through cut-outs, or through what that pass leaves
+    // out, stay visible.
+    auto const render_occluders = [&](ViewConstants const& view, GLuint program, bonobo::OcclusionCuller const& occlusion) {
+        glUseProgram(program);
+        bind_texture_with_sampler(GL_TEXTURE_2D, 7, program, "water_depth_texture"_hash, frame_graph.get_texture(frame.water_depthmap), shadow_sampler);
+        render_nodes(solids, view.solids, view, program, true, &occlusion);
+    };
+
+    // Shade the solids seen from the camera, both above and below the
+    // water, into whichever target the final image gets rendered to.
+    auto const render_camera_solids = [&]() {
+        auto const* const occlusion = cull_occluded ? &camera_occlusion : nullptr;
+        begin_depth_prepass(camera_view, composite_depth_prepass_shader, frame_graph.get_texture(frame.water_depthmap), occlusion);
+
+        glUseProgram(render_composite);
+        bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_composite, "shadow_texture"_hash, frame_graph.get_texture(frame.shadowmap), shadow_sampler);
+        bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_composite, "causticmap_texture"_hash, frame_graph.get_texture(frame.causticmap), caustics_sampler);
+        bind_texture_with_sampler(GL_TEXTURE_2D, 7, render_composite, "water_depth_texture"_hash, frame_graph.get_texture(frame.water_depthmap), shadow_sampler);
+
+        GLStateInspection::CaptureSnapshot("Composite Pass");
+
+        render_nodes(solids, camera_view.solids, camera_view, render_composite, true, occlusion);
+
+        end_depth_prepass();
+    };
+
+    // Declare all passes, whether or not they will end up used: the graph
+    // culls those whose outputs are not read, e.g. the reflected scene
+    // when using screen-space reflections. It has to be declared anew
+    // whenever one of the settings it depends on changes.
+    auto const declare_frame_graph = [&]() {
+        using PassBuilder = bonobo::RenderGraph::PassBuilder;
+
+        frame_graph.clear();
+        use_ssr = reflection_mode == reflection_mode_t::screen_space;
+        cull_occluded = use_occlusion_culling && camera_occlusion.is_valid() && mirrored_occlusion.is_valid();
+
+        frame.water_state0 = frame_graph.import_texture("Water state 0", water_texture0, water_desc);
+        frame.water_state1 = frame_graph.import_texture("Water state 1", water_texture1, water_desc);
+        frame.backbuffer = frame_graph.import_backbuffer(framebuffer_width, framebuffer_height);
+
+        frame.shadowmap = frame_graph.create_texture("Shadow map", light_depth_desc);
+        frame.water_depthmap = frame_graph.create_texture("Water depth map", light_depth_desc);
+        frame.environmentmap = frame_graph.create_texture("Environment map",
+            textureDesc(constant::light_texture_res_x, constant::light_texture_res_y, GL_RGBA32F));
+        frame.causticmap = frame_graph.create_texture("Caustic map",
+            textureDesc(constant::light_texture_res_x, constant::light_texture_res_y));
+
+        auto const underwater_depth_desc = scaledTargetDesc(framebuffer_width, framebuffer_height, underwater_scene_scale_index,
+            GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+        frame.underwater_colour = frame_graph.create_texture("Underwater scene",
+            scaledTargetDesc(framebuffer_width, framebuffer_height, underwater_scene_scale_index, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE));
+        frame.underwater_depth = frame_graph.create_texture("Underwater scene depth", underwater_depth_desc);
+        frame.underwater_hiz = frame_graph.create_texture("Underwater scene Hi-Z", hiZPyramidDesc(underwater_depth_desc));
+
+        frame.reflection_colour = frame_graph.create_texture("Reflected scene",
+            scaledTargetDesc(framebuffer_width, framebuffer_height, reflection_scale_index, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE));
+        frame.reflection_depth = frame_graph.create_texture("Reflected scene depth",
+            scaledTargetDesc(framebuffer_width, framebuffer_height, reflection_scale_index, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT));
+
+        // With screen-space reflections, the final image renders its solids
+        // and sky into these rather than into the backbuffer, so that the
+        // top side of the water can trace them.
+        auto const scene_depth_desc = textureDesc(framebuffer_width, framebuffer_height,
+            GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+        frame.scene_colour = frame_graph.create_texture("Camera scene",
+            textureDesc(framebuffer_width, framebuffer_height, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE));
+        frame.scene_depth = frame_graph.create_texture("Camera scene depth", scene_depth_desc);
+        frame.scene_hiz = frame_graph.create_texture("Camera scene Hi-Z", hiZPyramidDesc(scene_depth_desc));
+
+        // Occluders are drawn at a quarter of the framebuffer resolution,
+        // which is plenty for testing whole objects.
+        auto const occluders_depth_desc = scaledTargetDesc(framebuffer_width, framebuffer_height, 2,
+            GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+        frame.camera_occluders = frame_graph.create_texture("Camera occluders depth", occluders_depth_desc);
+        frame.camera_occlusion_hiz = frame_graph.create_texture("Camera occlusion Hi-Z", hiZPyramidDesc(occluders_depth_desc));
+        frame.mirrored_occluders = frame_graph.create_texture("Mirrored occluders depth", occluders_depth_desc);
+        frame.mirrored_occlusion_hiz = frame_graph.create_texture("Mirrored occlusion Hi-Z", hiZPyramidDesc(occluders_depth_desc));
+
+        //
+        // Pass 1: Simulate water heightmap
+        //
+        frame_graph.add_pass("Add water drop",
+            [&](PassBuilder& builder) {
+                builder.read(frame.water_state1);
+                frame.water_state0 = builder.write_colour(frame.water_state0);
+            },
+            [&]() {
+                glCullFace(GL_BACK);
+
+                GLStateInspection::CaptureSnapshot("Heightmap Generation Pass");
+                glUseProgram(water_drop_shader);
+                water_drop_uniform(water_drop_shader);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 0, water_drop_shader, "sim_texture"_hash, water_texture1, heightmap_sampler);
+
+                bonobo::drawFullscreen();
+            });
+
+        frame_graph.add_pass("Simulate water",
+            [&](PassBuilder& builder) {
+                builder.read(frame.water_state0);
+                frame.water_state1 = builder.write_colour(frame.water_state1);
+            },
+            [&]() {
+                GLStateInspection::CaptureSnapshot("Heightmap Generation Pass");
+                glUseProgram(simulate_water_shader);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 0, simulate_water_shader, "sim_texture"_hash, water_texture0, heightmap_sampler);
+
+                bonobo::drawFullscreen();
+            });
+
+        //
+        // Pass 2: Generate shadow map for sun
+        //
+        frame_graph.add_pass("Create shadow map Sun",
+            [&](PassBuilder& builder) {
+                frame.shadowmap = builder.write_depth(frame.shadowmap);
+            },
+            [&]() {
+                glCullFace(GL_FRONT);
+                glClear(GL_DEPTH_BUFFER_BIT);
+
+                GLStateInspection::CaptureSnapshot("Shadow Map Generation");
+
+                render_nodes(solids, light_view.solids, light_view, fill_shadowmap_shader, false);
+            });
+
+        //
+        // Pass 3: Generate water depth map for sun
+        //
+        frame_graph.add_pass("Create water depth map Sun",
+            [&](PassBuilder& builder) {
+                builder.read(frame.water_state1);
+                frame.water_depthmap = builder.write_depth(frame.water_depthmap);
+            },
+            [&]() {
+                glUseProgram(fill_water_depthmap_shader);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 1, fill_water_depthmap_shader, "heightmap_texture"_hash, water_texture1, heightmap_sampler);
+
+                glCullFace(GL_BACK);
+                glClear(GL_DEPTH_BUFFER_BIT);
+
+                GLStateInspection::CaptureSnapshot("Water depth map Generation");
+
+                render_nodes(transparents, light_view.transparents, light_view, fill_water_depthmap_shader, true);
+            });
+
+        //
+        // Pass 4: Generate environment map for sun
+        //
+        frame_graph.add_pass("Create environment map Sun",
+            [&](PassBuilder& builder) {
+                frame.environmentmap = builder.write_colour(frame.environmentmap);
+            },
+            [&]() {
+                glCullFace(GL_BACK);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+                GLStateInspection::CaptureSnapshot("Filling Pass");
+
+                render_nodes(solids, light_view.solids, light_view, fill_environmentmap_shader, false);
+            });
+
+        //
+        // Pass 5: Generate caustic map for sun
+        //
+        frame_graph.add_pass("Create caustic map Sun",
+            [&](PassBuilder& builder) {
+                builder.read(frame.environmentmap);
+                builder.read(frame.water_state1);
+                frame.causticmap = builder.write_colour(frame.causticmap);
+            },
+            [&]() {
+                glCullFace(GL_BACK);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+                GLStateInspection::CaptureSnapshot("Filling Pass");
+
+                glUseProgram(fill_causticmap_shader);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 0, fill_causticmap_shader, "environmentmap_texture"_hash, frame_graph.get_texture(frame.environmentmap), default_sampler);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 1, fill_causticmap_shader, "heightmap_texture"_hash, water_texture1, heightmap_sampler);
+                glUniform2f(caustic_inv_res.location(),
+                    1.0f / static_cast<float>(constant::light_texture_res_x),
+                    1.0f / static_cast<float>(constant::light_texture_res_y));
+                glUniform3fv(caustic_light_color.location(), 1, glm::value_ptr(sunColor));
+                glUniform3fv(caustic_light_direction.location(), 1, glm::value_ptr(sunDir));
+                glUniform2f(caustic_environmentmap_texel_size.location(),
+                    1.0f / static_cast<float>(constant::light_texture_res_x),
+                    1.0f / static_cast<float>(constant::light_texture_res_y));
+
+                render_nodes(transparents, light_view.transparents, light_view, fill_causticmap_shader, false);
+            });
+
+        //
+        // Pass 6.0: find out which solids are hidden from the camera and
+        // from its mirror. The solids found visible by the previous test
+        // are drawn as occluders, and all solids then get tested against
+        // the farthest depth of those: solids which just came into view
+        // get drawn this very frame, rather than one frame late.
+        //
+        if (cull_occluded) {
+            frame_graph.add_pass("Draw camera occluders",
+                [&](PassBuilder& builder) {
+                    builder.read(frame.water_depthmap);
+                    frame.camera_occluders = builder.write_depth(frame.camera_occluders);
+                },
+                [&]() {
+                    glCullFace(GL_BACK);
+                    glDepthFunc(GL_LESS);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+
+                    bonobo::UniformBuffer::bind(pass_constants_binding, camera_view.pass);
+                    render_occluders(camera_view, composite_depth_prepass_shader, camera_occlusion);
+                });
+
+            frame_graph.add_pass("Test camera occlusion",
+                [&](PassBuilder& builder) {
+                    builder.read(frame.camera_occluders);
+                    frame.camera_occlusion_hiz = builder.write(frame.camera_occlusion_hiz);
+                },
+                [&]() {
+                    GLStateInspection::CaptureSnapshot("Occlusion Pass");
+                    auto const& hiz_desc = frame_graph.get_desc(frame.camera_occlusion_hiz);
+                    buildHiZPyramid(hiz_fbo, frame_graph.get_texture(frame.camera_occlusion_hiz), hiz_desc,
+                                    frame_graph.get_texture(frame.camera_occluders), build_hiz_shader, true);
+                    camera_occlusion.test(frame_graph.get_texture(frame.camera_occlusion_hiz), hiz_desc.levels_nb, camera_view.world_to_clip);
+                });
+
+            frame_graph.add_pass("Draw mirrored occluders",
+                [&](PassBuilder& builder) {
+                    builder.read(frame.water_depthmap);
+                    frame.mirrored_occluders = builder.write_depth(frame.mirrored_occluders);
+                    builder.enable_if([&render_reflection_pass]() { return render_reflection_pass; });
+                },
+                [&]() {
+                    glCullFace(GL_BACK);
+                    glDepthFunc(GL_LESS);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+
+                    bonobo::UniformBuffer::bind(pass_constants_binding, mirrored_view.pass);
+                    render_occluders(mirrored_view, underwater_depth_prepass_shader, mirrored_occlusion);
+                });
+
+            frame_graph.add_pass("Test mirrored occlusion",
+                [&](PassBuilder& builder) {
+                    builder.read(frame.mirrored_occluders);
+                    frame.mirrored_occlusion_hiz = builder.write(frame.mirrored_occlusion_hiz);
+                    builder.enable_if([&render_reflection_pass]() { return render_reflection_pass; });
+                },
+                [&]() {
+                    GLStateInspection::CaptureSnapshot("Occlusion Pass");
+                    auto const& hiz_desc = frame_graph.get_desc(frame.mirrored_occlusion_hiz);
+                    buildHiZPyramid(hiz_fbo, frame_graph.get_texture(frame.mirrored_occlusion_hiz), hiz_desc,
+                                    frame_graph.get_texture(frame.mirrored_occluders), build_hiz_shader, true);
+                    mirrored_occlusion.test(frame_graph.get_texture(frame.mirrored_occlusion_hiz), hiz_desc.levels_nb, mirrored_view.world_to_clip);
+                });
+        }
+
+        //
+        // Pass 6.1: render underwater texture
+        //
+        frame_graph.add_pass("Render underwater scene",
+            [&](PassBuilder& builder) {
+                builder.read(frame.shadowmap);
+                builder.read(frame.causticmap);
+                builder.read(frame.water_depthmap);
+                frame.underwater_colour = builder.write_colour(frame.underwater_colour);
+                frame.underwater_depth = builder.write_depth(frame.underwater_depth);
+                builder.enable_if([&render_underwater_scene_pass]() { return render_underwater_scene_pass; });
+            },
+            [&]() {
+                glCullFace(GL_BACK);
+                glDepthFunc(GL_LESS);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+                GLStateInspection::CaptureSnapshot("underwater Pass");
+
+                // The camera occluders include solids above the water, which
+                // this pass discards: it does not get culled against them.
+                bonobo::UniformBuffer::bind(pass_constants_binding, camera_view.pass);
+                begin_depth_prepass(camera_view, underwater_depth_prepass_shader, frame_graph.get_texture(frame.water_depthmap), nullptr);
+
+                glUseProgram(render_underwater);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_underwater, "shadow_texture"_hash, frame_graph.get_texture(frame.shadowmap), shadow_sampler);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_underwater, "causticmap_texture"_hash, frame_graph.get_texture(frame.causticmap), caustics_sampler);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 7, render_underwater, "water_depth_texture"_hash, frame_graph.get_texture(frame.water_depthmap), shadow_sampler);
+
+                render_nodes(solids, camera_view.solids, camera_view, render_underwater, true);
+
+                end_depth_prepass();
+
+                //
+                // Pass 6.2: render cubemap into underwater texture
+                //
+                GLStateInspection::CaptureSnapshot("Cubemap Pass");
+                render_sky(camera_view);
+            });
+
+        //
+        // Pass 6.3: build the Hi-Z pyramid of the underwater scene
+        //
+        frame_graph.add_pass("Build Hi-Z of underwater scene",
+            [&](PassBuilder& builder) {
+                builder.read(frame.underwater_depth);
+                frame.underwater_hiz = builder.write(frame.underwater_hiz);
+                builder.enable_if([&render_underwater_scene_pass]() { return render_underwater_scene_pass; });
+            },
+            [&]() {
+                GLStateInspection::CaptureSnapshot("Hi-Z Pass");
+                buildHiZPyramid(hiz_fbo, frame_graph.get_texture(frame.underwater_hiz), frame_graph.get_desc(frame.underwater_hiz),
+                                frame_graph.get_texture(frame.underwater_depth), build_hiz_shader);
+            });
+
+        //
+        // Pass 7.0: Render reflected scene
+        //
+        frame_graph.add_pass("Render reflected scene",
+            [&](PassBuilder& builder) {
+                builder.read(frame.shadowmap);
+                builder.read(frame.causticmap);
+                builder.read(frame.water_depthmap);
+                frame.reflection_colour = builder.write_colour(frame.reflection_colour);
+                frame.reflection_depth = builder.write_depth(frame.reflection_depth);
+                if (cull_occluded)
+                    builder.read(frame.mirrored_occlusion_hiz);
+                builder.enable_if([&render_reflection_pass]() { return render_reflection_pass; });
+            },
+            [&]() {
+                glCullFace(GL_BACK);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+                auto const* const occlusion = cull_occluded ? &mirrored_occlusion : nullptr;
+                bonobo::UniformBuffer::bind(pass_constants_binding, mirrored_view.pass);
+                begin_depth_prepass(mirrored_view, underwater_depth_prepass_shader, frame_graph.get_texture(frame.water_depthmap), occlusion);
+
+                glUseProgram(render_underwater);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_underwater, "shadow_texture"_hash, frame_graph.get_texture(frame.shadowmap), shadow_sampler);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_underwater, "causticmap_texture"_hash, frame_graph.get_texture(frame.causticmap), caustics_sampler);
+                bind_texture_with_sampler(GL_TEXTURE_2D, 7, render_underwater, "water_depth_texture"_hash, frame_graph.get_texture(frame.water_depthmap), shadow_sampler);
+
+                render_nodes(solids, mirrored_view.solids, mirrored_view, render_underwater, true, occlusion);
+
+                end_depth_prepass();
+
+                //
+                // Pass 7.1: Render reflected cubemap
+                //
+                render_sky(mirrored_view);
+            });
+
+        //
+        // Pass 8: Render the final image
+        //
+        // With screen-space reflections, the solids and the sky are first
+        // rendered into the scene textures, which the water then traces
+        // once they have been copied into the backbuffer.
+        //
+        if (use_ssr) {
+            frame_graph.add_pass("Render camera scene",
+                [&](PassBuilder& builder) {
+                    builder.read(frame.shadowmap);
+                    builder.read(frame.causticmap);
+                    builder.read(frame.water_depthmap);
+                    frame.scene_colour = builder.write_colour(frame.scene_colour);
+                    frame.scene_depth = builder.write_depth(frame.scene_depth);
+                    if (cull_occluded)
+                        builder.read(frame.camera_occlusion_hiz);
+                },
+                [&]() {
+                    glCullFace(GL_BACK);
+                    glDepthFunc(GL_LESS);
+                    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+                    bonobo::UniformBuffer::bind(pass_constants_binding, camera_view.pass);
+                    render_camera_solids();
+
+                    GLStateInspection::CaptureSnapshot("Cubemap Pass");
+                    render_sky(camera_view);
+                });
+
+            frame_graph.add_pass("Build Hi-Z of camera scene",
+                [&](PassBuilder& builder) {
+                    builder.read(frame.scene_depth);
+                    frame.scene_hiz = builder.write(frame.scene_hiz);
+                    builder.enable_if([&build_scene_hiz_pass]() { return build_scene_hiz_pass; });
+                },
+                [&]() {
+                    GLStateInspection::CaptureSnapshot("Hi-Z Pass");
+                    buildHiZPyramid(hiz_fbo, frame_graph.get_texture(frame.scene_hiz), frame_graph.get_desc(frame.scene_hiz),
+                                    frame_graph.get_texture(frame.scene_depth), build_hiz_shader);
+                });
+        }
+
+        frame_graph.add_pass("Render final image",
+            [&](PassBuilder& builder) {
+                builder.read(frame.shadowmap);
+                builder.read(frame.causticmap);
+                builder.read(frame.water_depthmap);
+                builder.read(frame.water_state1);
+                builder.read(frame.underwater_colour);
+                builder.read(frame.underwater_depth);
+                if (use_ssr) {
+                    builder.read(frame.scene_colour);
+                    builder.read(frame.scene_depth);
+                    if (use_hiz) {
+                        builder.read(frame.underwater_hiz);
+                        builder.read(frame.scene_hiz);
+                    }
+                }
+                if (cull_occluded)
+                    builder.read(frame.camera_occlusion_hiz);
+                if (!use_ssr) {
+                    builder.read(frame.reflection_colour);
+                    builder.read(frame.reflection_depth);
+                }
+                frame.backbuffer = builder.write_colour(frame.backbuffer);
+            },
+            [&]() {
+                glCullFace(GL_BACK);
+                glDepthFunc(GL_LESS);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+                bonobo::UniformBuffer::bind(pass_constants_binding, camera_view.pass);
+                if (use_ssr) {
+                    //
+                    // Pass 8.0: copy the scene rendered from the camera
+                    //
+                    glDepthFunc(GL_ALWAYS);
+                    glUseProgram(copy_scene_shader);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 0, copy_scene_shader, "colour_texture"_hash, frame_graph.get_texture(frame.scene_colour), default_sampler);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 1, copy_scene_shader, "depth_texture"_hash, frame_graph.get_texture(frame.scene_depth), depth_sampler);
+                    bonobo::drawFullscreen();
+                    glDepthFunc(GL_LESS);
+                } else {
+                    //
+                    // Pass 8.1: render the solids, both above and below the water
+                    //
+                    render_camera_solids();
+                }
+
+                //
+                // Pass 8.2: test the visibility of the water volume against the
+                // solids; the result decides whether the water and its walls get
+                // drawn this frame, and whether the passes feeding the water get
+                // run in the upcoming frames.
+                //
+                is_water_volume_tested = false;
+                if (query_water_volume) {
+                    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                    glDepthMask(GL_FALSE);
+                    glDisable(GL_CULL_FACE);
+                    is_water_volume_tested = water_volume_query.begin();
+                    if (is_water_volume_tested) {
+                        box.render(water_volume_constants, render_light_cones_shader);
+                        water_volume_query.end();
+                    }
+                    glEnable(GL_CULL_FACE);
+                    glDepthMask(GL_TRUE);
+                    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                }
+
+                // The passes feeding the water are only skipped while the
+                // camera stayed put since the water was found hidden, in
+                // which case it is still hidden; otherwise they ran this
+                // frame, and this frame's test lets the GPU skip the draws.
+                if (is_water_visible) {
+                    if (is_water_volume_tested)
+                        glBeginConditionalRender(water_volume_query.get_last_issued(), GL_QUERY_WAIT);
+
+                    auto const underwater_texture = frame_graph.get_texture(frame.underwater_colour);
+                    auto const underwater_depth_texture = frame_graph.get_texture(frame.underwater_depth);
+
+                    glUseProgram(render_water);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_water, "heightmap_texture"_hash, water_texture1, heightmap_sampler);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_water, "underwater_texture"_hash, underwater_texture, default_sampler);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 8, render_water, "underwater_depth_texture"_hash, underwater_depth_texture, depth_sampler);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 9, render_water, "reflection_texture"_hash, frame_graph.get_texture(frame.reflection_colour), default_sampler);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 10, render_water, "reflection_depth_texture"_hash, frame_graph.get_texture(frame.reflection_depth), depth_sampler);
+                    glUniform1i(water_use_ssr.location(), use_ssr ? GL_TRUE : GL_FALSE);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 12, render_water, "scene_texture"_hash, frame_graph.get_texture(frame.scene_colour), default_sampler);
+                    if (use_ssr && use_hiz) {
+                        bind_texture_with_sampler(GL_TEXTURE_2D, 11, render_water, "underwater_hiz_texture"_hash, frame_graph.get_texture(frame.underwater_hiz), hiz_sampler);
+                        glUniform1i(water_underwater_hiz_levels.location(), frame_graph.get_desc(frame.underwater_hiz).levels_nb);
+                        bind_texture_with_sampler(GL_TEXTURE_2D, 13, render_water, "scene_hiz_texture"_hash, frame_graph.get_texture(frame.scene_hiz), hiz_sampler);
+                        glUniform1i(water_scene_hiz_levels.location(), frame_graph.get_desc(frame.scene_hiz).levels_nb);
+                    } else {
+                        bind_texture_with_sampler(GL_TEXTURE_2D, 11, render_water, "underwater_hiz_texture"_hash, underwater_depth_texture, depth_sampler);
+                        glUniform1i(water_underwater_hiz_levels.location(), 1);
+                        bind_texture_with_sampler(GL_TEXTURE_2D, 13, render_water, "scene_hiz_texture"_hash, frame_graph.get_texture(frame.scene_depth), depth_sampler);
+                        glUniform1i(water_scene_hiz_levels.location(), 1);
+                    }
+
+                    //
+                    // Pass 8.3: render water
+                    //
+                    glCullFace(GL_FRONT);
+                    render_nodes(transparents, camera_view.transparents, camera_view, render_water, true);
+                    glCullFace(GL_BACK);
+
+                    render_nodes(transparents, camera_view.transparents, camera_view, render_water, true);
+
+                    glUseProgram(water_wall_shader);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 5, water_wall_shader, "heightmap_texture"_hash, water_texture1, heightmap_sampler);
+                    bind_texture_with_sampler(GL_TEXTURE_2D, 6, water_wall_shader, "underwater_texture"_hash, underwater_texture, default_sampler);
+                    glCullFace(GL_FRONT);
+                    render_nodes(transparents_walls, camera_view.walls, camera_view, water_wall_shader, true);
+                    glCullFace(GL_BACK);
+
+                    if (is_water_volume_tested)
+                        glEndConditionalRender();
+                }
+
+                //
+                // Pass 8.4: render cubemap
+                //
+                if (!use_ssr) {
+                    GLStateInspection::CaptureSnapshot("Cubemap Pass");
+                    render_sky(camera_view);
+                }
+            });
+
+        frame_graph.mark_output(frame.backbuffer);
+
+        // The debug view displays some transient textures once the graph
+        // has run, so they must neither be culled nor share their storage.
+        if (show_textures) {
+            frame_graph.mark_output(frame.shadowmap);
+            frame_graph.mark_output(frame.causticmap);
+            frame_graph.mark_output(use_ssr ? frame.scene_colour : frame.reflection_colour);
+        }
+
+        if (!frame_graph.compile())
+            LogError("Failed to compile the render graph of the frame");
+    };
+
     while (!glfwWindowShouldClose(window)) {
         global_scroll = 0.0f; // sorry about this global :(
+        bonobo::getTextureLoader().update();
         auto const nowTime = std::chrono::high_resolution_clock::now();
         auto const deltaTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(nowTime - lastTime);
         lastTime = nowTime;
@@ -643,392 +1592,121 @@ project::Project::run()
 
 
         if (!shader_reload_failed) {
-
-            /* RENDER DIRECTIONAL LIGHT */
-            auto light_matrix = lightProjection * lightTransform.GetMatrixInverse();
-            //
-            // Pass 1: Simulate water heightmap
-            //
-            glCullFace(GL_BACK);
-
-            const bool hitWater = mouse_right_down && water_intersection_hit;
-
-            auto const water_drop_uniform = [this, &hitWater, &water_mouseray_position](GLuint program) {
-                glUniform2fv(glGetUniformLocation(program, "center"), 1, glm::value_ptr(water_mouseray_position));
-                //glUniform2fv(glGetUniformLocation(program, "center"), 1, glm::value_ptr(glm::vec2(0,0)));
-                glUniform1f(glGetUniformLocation(program, "radius"), 0.03f);
-                glUniform1f(glGetUniformLocation(program, "strength"), hitWater ? 0.08f : 0.0f);
-            };
-            // add drop
-            glBindFramebuffer(GL_FRAMEBUFFER, water_fbo0);
-            GLenum const drop_draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(1, drop_draw_buffers);
-            auto status_env = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            if (status_env != GL_FRAMEBUFFER_COMPLETE)
-                LogError("Something went wrong with framebuffer %u", water_fbo0);
-            glViewport(0, 0, constant::heightmap_res, constant::heightmap_res);
-
-            GLStateInspection::CaptureSnapshot("Heightmap Generation Pass");
-            glUseProgram(water_drop_shader);
-            water_drop_uniform(water_drop_shader);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 0, water_drop_shader, "sim_texture", water_texture1, heightmap_sampler);
-
-            bonobo::drawFullscreen();
-
-            // simulate
-            glBindFramebuffer(GL_FRAMEBUFFER, water_fbo1);
-            GLenum const sim_draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(1, sim_draw_buffers);
-            status_env = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            if (status_env != GL_FRAMEBUFFER_COMPLETE)
-                LogError("Something went wrong with framebuffer %u", water_fbo1);
-            glViewport(0, 0, constant::heightmap_res, constant::heightmap_res);
-
-            GLStateInspection::CaptureSnapshot("Heightmap Generation Pass");
-            glUseProgram(simulate_water_shader);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 0, simulate_water_shader, "sim_texture", water_texture0, heightmap_sampler);
-
-            bonobo::drawFullscreen();
-
-            //
-            // Pass 2: Generate shadow map for sun
-            //
-
-            glCullFace(GL_FRONT);
-
-            if (utils::opengl::debug::isSupported())
-            {
-                std::string const group_name = "Create shadow map Sun";
-                glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, group_name.size(), group_name.data());
+            if (is_frame_graph_outdated) {
+                declare_frame_graph();
+                is_frame_graph_outdated = false;
             }
-            glBindFramebuffer(GL_FRAMEBUFFER, shadowmap_fbo);
-            glViewport(0, 0, constant::light_texture_res_x, constant::light_texture_res_y);
-			glClear(GL_DEPTH_BUFFER_BIT);
-
-            GLStateInspection::CaptureSnapshot("Shadow Map Generation");
 
-            for (auto const& element : solids)
-                element.render(light_matrix, element.get_transform().GetMatrix(), fill_shadowmap_shader, no_extra_uniforms);
+            hitWater = mouse_right_down && water_intersection_hit;
 
-            if (utils::opengl::debug::isSupported())
-            {
-                glPopDebugGroup();
-            }
-
-            //
-            // Pass 3: Generate water depth map for sun
-            //
-            bool isInWater = abs(mCamera.mWorld.GetTranslation().x) < 10 
+            isInWater = abs(mCamera.mWorld.GetTranslation().x) < 10 
                 && abs(mCamera.mWorld.GetTranslation().z) < 10 
                 && abs(mCamera.mWorld.GetTranslation().y + 0.5) < 2.5;
-            auto const resolve_uniforms = [&sunColor, &sunDir, &seconds_nb, this, &light_matrix, &framebuffer_width, &framebuffer_height, &isInWater](GLuint program) {
-                // COMMON
-                glUniformMatrix4fv(glGetUniformLocation(program, "view_projection_inverse"), 1, GL_FALSE,
-                    glm::value_ptr(mCamera.GetClipToWorldMatrix()));
-                glUniform3fv(glGetUniformLocation(program, "camera_position"), 1,
-                    glm::value_ptr(mCamera.mWorld.GetTranslation()));
-                glUniformMatrix4fv(glGetUniformLocation(program, "shadow_view_projection"), 1, GL_FALSE,
-                    glm::value_ptr(light_matrix));
-                glUniform3fv(glGetUniformLocation(program, "sun_dir"), 1,
-                    glm::value_ptr(sunDir));
-                glUniform2f(glGetUniformLocation(program, "shadowmap_texel_size"),
-                    1.0f / static_cast<float>(constant::light_texture_res_x),
-                    1.0f / static_cast<float>(constant::light_texture_res_y));
-                glUniform2f(glGetUniformLocation(program, "inv_res"),
-                    1.0f / static_cast<float>(framebuffer_width),
-                    1.0f / static_cast<float>(framebuffer_height));
-                glUniform3fv(glGetUniformLocation(program, "atmosphereColour"), 1,
-                    glm::value_ptr(constant::atmosphereColour));
-                glUniform3fv(glGetUniformLocation(program, "underwaterColour"), 1,
-                    glm::value_ptr(constant::underwaterColour));
-                glUniform1f(glGetUniformLocation(program, "MAMSL"),
-                    constant::MAMSL);
-                glUniform1f(glGetUniformLocation(program, "t"),
-                    seconds_nb);
-                glUniform1i(glGetUniformLocation(program, "IN_WATER"),
-                    isInWater ? GL_TRUE : GL_FALSE);
-            };
-
-            glUseProgram(fill_water_depthmap_shader);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 1, fill_water_depthmap_shader, "heightmap_texture", water_texture1, heightmap_sampler);
-
-            glCullFace(GL_BACK);
-
-            if (utils::opengl::debug::isSupported())
-            {
-                std::string const group_name = "Create water depth map Sun";
-                glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, group_name.size(), group_name.data());
-            }
-            glBindFramebuffer(GL_FRAMEBUFFER, water_depth_fbo);
-            glViewport(0, 0, constant::light_texture_res_x, constant::light_texture_res_y);
-
-            glClear(GL_DEPTH_BUFFER_BIT);
-
-            GLStateInspection::CaptureSnapshot("Water depth map Generation");
-
-            for (auto const& element : transparents)
-                element.render(light_matrix, element.get_transform().GetMatrix(), fill_water_depthmap_shader, resolve_uniforms);
-
-            if (utils::opengl::debug::isSupported())
-            {
-                glPopDebugGroup();
-            }
 
             //
-            // Pass 4: Generate environment map for sun
+            // Find out which of the passes feeding the water can contribute
+            // to the final image. The water volume is tested against the
+            // depth buffer of the previous frames, unless the camera is so
+            // close to it that its proxy could get clipped by the near plane.
+            // Those results lag behind by a few frames, so they get dropped
+            // whenever the camera moves: the water counts as visible until a
+            // test issued from the current view comes back.
             //
-            glCullFace(GL_BACK);
-            if (utils::opengl::debug::isSupported())
-            {
-                std::string const group_name = "Create environment map Sun";
-                glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, group_name.size(), group_name.data());
-            }
-
-            glBindFramebuffer(GL_FRAMEBUFFER, environmentmap_fbo);
-            GLenum const environment_draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(1, environment_draw_buffers);
-            status_env = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            if (status_env != GL_FRAMEBUFFER_COMPLETE)
-                LogError("Something went wrong with framebuffer %u", environmentmap_fbo);
-            glViewport(0, 0, constant::light_texture_res_x, constant::light_texture_res_y);
-
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-            GLStateInspection::CaptureSnapshot("Filling Pass");
-
-            for (auto const& element : solids)
-                element.render(light_matrix, element.get_transform().GetMatrix(), fill_environmentmap_shader, no_extra_uniforms);
-            if (utils::opengl::debug::isSupported())
-            {
-                glPopDebugGroup();
-            }
+            glm::vec3 const camera_position = mCamera.mWorld.GetTranslation();
+            float const near_margin = 0.5f * constant::scale_lengths;
+            bool const is_camera_near_water_volume = std::abs(camera_position.x) < constant::pool_half_width * constant::scale_lengths + near_margin
+                && std::abs(camera_position.z) < constant::pool_half_width * constant::scale_lengths + near_margin
+                && camera_position.y > water_volume_bottom - near_margin
+                && camera_position.y < water_volume_top + near_margin;
+            query_water_volume = use_occlusion_queries && !is_camera_near_water_volume;
+
+            water_volume_query.poll();
+            auto const camera_world_to_clip = mCamera.GetWorldToClipMatrix();
+            if (!query_water_volume || camera_world_to_clip != water_query_world_to_clip)
+                water_volume_query.reset();
+            water_query_world_to_clip = camera_world_to_clip;
+            is_water_visible = water_volume_query.was_visible();
+
+            // The top side of the water refracts the underwater scene, while
+            // its bottom side reflects the mirrored scene. Screen-space
+            // reflections replace the mirrored scene by tracing the
+            // underwater one from below, and the top side traces the whole
+            // scene seen from the camera.
+            float const water_level = constant::MAMSL * constant::scale_lengths;
+            float const wave_margin = constant::wave_margin * constant::scale_lengths;
+            render_underwater_scene_pass = is_water_visible && (use_ssr || camera_position.y > water_level - wave_margin);
+            render_reflection_pass = is_water_visible && !use_ssr && camera_position.y < water_level + wave_margin;
+            build_scene_hiz_pass = is_water_visible && use_ssr && use_hiz && camera_position.y > water_level - wave_margin;
 
             //
-            // Pass 5: Generate caustic map for sun
+            // Gather the constants of the frame, of its views and of the
+            // objects drawn from them.
             //
-            glCullFace(GL_BACK);
-            if (utils::opengl::debug::isSupported())
-            {
-                std::string const group_name = "Create caustic map Sun";
-                glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, group_name.size(), group_name.data());
-            }
-
-            glBindFramebuffer(GL_FRAMEBUFFER, causticmap_fbo);
-            GLenum const caustic_draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(1, caustic_draw_buffers);
-            status_env = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            if (status_env != GL_FRAMEBUFFER_COMPLETE)
-                LogError("Something went wrong with framebuffer %u", causticmap_fbo);
-            glViewport(0, 0, constant::light_texture_res_x, constant::light_texture_res_y);
-
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-            GLStateInspection::CaptureSnapshot("Filling Pass");
-            
-            auto const caustic_set_uniforms = [&sunColor, &sunDir, &seconds_nb](GLuint program) {
-                glUniform2f(glGetUniformLocation(program, "inv_res"),
-                    1.0f / static_cast<float>(constant::light_texture_res_x),
-                    1.0f / static_cast<float>(constant::light_texture_res_y));
-                glUniform3fv(glGetUniformLocation(program, "light_color"), 1, glm::value_ptr(sunColor));
-                glUniform3fv(glGetUniformLocation(program, "light_direction"), 1, glm::value_ptr(sunDir));
-                glUniform2f(glGetUniformLocation(program, "environmentmap_texel_size"),
-                    1.0f / static_cast<float>(constant::light_texture_res_x),
-                    1.0f / static_cast<float>(constant::light_texture_res_y));
-            };
-
-            glUseProgram(fill_causticmap_shader);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 0, fill_causticmap_shader, "environmentmap_texture", environmentmap_texture, default_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 1, fill_causticmap_shader, "heightmap_texture", water_texture1, heightmap_sampler);
-
-
-            for (auto & element : transparents) 
-                element.render(light_matrix, element.get_transform().GetMatrix(), fill_causticmap_shader, false, caustic_set_uniforms);
-            if (utils::opengl::debug::isSupported())
-            {
-                glPopDebugGroup();
+            frame_uniform_buffer.reset();
+            draw_list.reset_stats();
+            culled_nodes_nb = 0u;
+
+            FrameConstants frame_constants;
+            frame_constants.shadow_view_projection = light_matrix;
+            frame_constants.sun_dir = sunDir;
+            frame_constants.MAMSL = constant::MAMSL;
+            frame_constants.atmosphereColour = constant::atmosphereColour;
+            frame_constants.t = seconds_nb;
+            frame_constants.underwaterColour = constant::underwaterColour;
+            frame_constants.IN_WATER = isInWater ? GL_TRUE : GL_FALSE;
+            frame_constants.shadowmap_texel_size = glm::vec2(1.0f / static_cast<float>(constant::light_texture_res_x),
+                                                             1.0f / static_cast<float>(constant::light_texture_res_y));
+            frame_constants.inv_res = glm::vec2(1.0f / static_cast<float>(framebuffer_width),
+                                                1.0f / static_cast<float>(framebuffer_height));
+            frame_constants.near_plane = mCamera.mNear;
+            frame_constants.far_plane = mCamera.mFar;
+            frame_constants.padding = glm::vec2(0.0f);
+            bonobo::UniformBuffer::bind(frame_constants_binding, frame_uniform_buffer.push(frame_constants));
+
+            push_view_constants(light_matrix, lightTransform.GetTranslation(),
+                                bonobo::LodSelector::orthographic(bot - top, static_cast<float>(constant::light_texture_res_y),
+                                                                  lod_max_error * shadow_lod_bias),
+                                light_view);
+            push_view_constants(mCamera.GetWorldToClipMatrix(), camera_position,
+                                bonobo::LodSelector::perspective(mCamera.mFov, static_cast<float>(framebuffer_height), lod_max_error),
+                                camera_view);
+            if (render_reflection_pass) {
+                // reflect camera about water plane
+                glm::vec3 p0 = glm::vec3(0.0f, constant::MAMSL * constant::scale_lengths, 0.0f);
+                glm::vec3 pN = glm::vec3(0.0f, 1.0f, 0.0f);
+                glm::vec3 v = camera_position - p0;
+                float dist = glm::dot(pN, v);
+                glm::vec3 mirroredCpos = camera_position - (2.0f * dist * pN);
+                glm::vec3 mirroredCDir = glm::reflect(mCamera.mWorld.GetFront(), pN);
+                glm::vec3 mirroredCUp = glm::reflect(mCamera.mWorld.GetUp(), pN);
+
+                glm::mat4 reflectedLightMatrix = mCamera.GetViewToClipMatrix() * glm::lookAt(mirroredCpos, mirroredCpos + mirroredCDir, mirroredCUp);
+                auto const reflection_height = std::max(framebuffer_height >> reflection_scale_index, 1);
+                push_view_constants(reflectedLightMatrix, mirroredCpos,
+                                    bonobo::LodSelector::perspective(mCamera.mFov, static_cast<float>(reflection_height), lod_max_error),
+                                    mirrored_view);
             }
 
-            //
-            // Pass 6.0: render underwater texture
-            //
-            glCullFace(GL_BACK);
-            glDepthFunc(GL_LESS);
-
-            if (utils::opengl::debug::isSupported())
-            {
-                std::string const group_name = "Resolve scene";
-                glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, group_name.size(), group_name.data());
+            if (cull_occluded) {
+                camera_occlusion.set_nodes(solids);
+                if (render_reflection_pass)
+                    mirrored_occlusion.set_nodes(solids);
             }
 
-            glBindFramebuffer(GL_FRAMEBUFFER, underwater_scene_fbo);
-            GLenum const underwater_draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(1, underwater_draw_buffers);
-            status_env = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            if (status_env != GL_FRAMEBUFFER_COMPLETE)
-                LogError("Something went wrong with framebuffer %u", underwater_scene_fbo);
-
-            glViewport(0, 0, framebuffer_width, framebuffer_height);
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-            GLStateInspection::CaptureSnapshot("underwater Pass");
+            water_volume_constants = frame_uniform_buffer.push(bonobo::makeObjectConstants(water_volume_transform, mCamera.GetWorldToClipMatrix()));
+            light_box_constants = frame_uniform_buffer.push(bonobo::makeObjectConstants(lightTransform.GetMatrix() * boxScale, mCamera.GetWorldToClipMatrix()));
 
-            glUseProgram(render_underwater);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_underwater, "shadow_texture", shadowmap_texture, shadow_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_underwater, "causticmap_texture", causticmap_texture, caustics_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 7, render_underwater, "water_depth_texture", water_depth_texture, shadow_sampler);
+            frame_uniform_buffer.upload();
 
-            for (auto const& element : solids)
-                element.render(mCamera.GetWorldToClipMatrix(), element.get_transform().GetMatrix(), render_underwater, resolve_uniforms);
-
-            //
-            // Pass 6.1: render cubemap into underwater texture
-            //
-            auto const cubemap_uniforms = [this](GLuint program) {
-                glUniform3fv(glGetUniformLocation(program, "camera_position"), 1,
-                    glm::value_ptr(mCamera.mWorld.GetTranslation()));
-            };
-            glCullFace(GL_FRONT);
-            GLStateInspection::CaptureSnapshot("Cubemap Pass");
-            cube.render(mCamera.GetWorldToClipMatrix(), glm::mat4(1.0f), render_cubemap, cubemap_uniforms);
-            glCullFace(GL_BACK);
-
-            //
-            // Pass 7.0: Render reflected scene
-            //
-            // reflect camera about water plane
-            glm::vec3 p0 = glm::vec3(0.0f, constant::MAMSL * constant::scale_lengths, 0.0f);
-            glm::vec3 pN = glm::vec3(0.0f, 1.0f, 0.0f);
-            glm::vec3 cPos = mCamera.mWorld.GetTranslation();
-            glm::vec3 v = cPos - p0;
-            float dist = glm::dot(pN, v);
-            glm::vec3 mirroredCpos = cPos - (2.0f * dist * pN);
-            glm::vec3 mirroredCDir = glm::reflect(mCamera.mWorld.GetFront(), pN);
-            glm::vec3 mirroredCUp = glm::reflect(mCamera.mWorld.GetUp(), pN);
-
-
-            glm::mat4 reflectedLightMatrix = mCamera.GetViewToClipMatrix() * glm::lookAt(mirroredCpos, mirroredCpos + mirroredCDir, mirroredCUp);
-
-            auto const resolve_reflected_uniforms = [&sunColor, &sunDir, &seconds_nb, this, &light_matrix, &framebuffer_width, &framebuffer_height, &isInWater, &mirroredCpos, &reflectedLightMatrix](GLuint program) {
-                // COMMON
-                glUniformMatrix4fv(glGetUniformLocation(program, "view_projection_inverse"), 1, GL_FALSE,
-                    glm::value_ptr(glm::inverse(reflectedLightMatrix)));
-                glUniform3fv(glGetUniformLocation(program, "camera_position"), 1,
-                    glm::value_ptr(mirroredCpos));
-                glUniformMatrix4fv(glGetUniformLocation(program, "shadow_view_projection"), 1, GL_FALSE,
-                    glm::value_ptr(light_matrix));
-                glUniform3fv(glGetUniformLocation(program, "sun_dir"), 1,
-                    glm::value_ptr(sunDir));
-                glUniform2f(glGetUniformLocation(program, "shadowmap_texel_size"),
-                    1.0f / static_cast<float>(constant::light_texture_res_x),
-                    1.0f / static_cast<float>(constant::light_texture_res_y));
-                glUniform2f(glGetUniformLocation(program, "inv_res"),
-                    1.0f / static_cast<float>(framebuffer_width),
-                    1.0f / static_cast<float>(framebuffer_height));
-                glUniform3fv(glGetUniformLocation(program, "atmosphereColour"), 1,
-                    glm::value_ptr(constant::atmosphereColour));
-                glUniform3fv(glGetUniformLocation(program, "underwaterColour"), 1,
-                    glm::value_ptr(constant::underwaterColour));
-                glUniform1f(glGetUniformLocation(program, "MAMSL"),
-                    constant::MAMSL);
-                glUniform1f(glGetUniformLocation(program, "t"),
-                    seconds_nb);
-                glUniform1i(glGetUniformLocation(program, "IN_WATER"),
-                    isInWater ? GL_TRUE : GL_FALSE);
-            };
-
-            glBindFramebuffer(GL_FRAMEBUFFER, reflection_fbo);
-            GLenum const reflection_draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(1, reflection_draw_buffers);
-            status_env = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            if (status_env != GL_FRAMEBUFFER_COMPLETE)
-                LogError("Something went wrong with framebuffer %u", reflection_fbo);
-
-            glViewport(0, 0, framebuffer_width, framebuffer_height);
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-            for (auto const& element : solids)
-                element.render(reflectedLightMatrix, element.get_transform().GetMatrix(), render_underwater, resolve_reflected_uniforms);
-
-            //
-            // Pass 7.1: Render reflected cubemap
-            //
-            auto const cubemap_reflected_uniforms = [this, &mirroredCpos](GLuint program) {
-                glUniform3fv(glGetUniformLocation(program, "camera_position"), 1,
-                    glm::value_ptr(mirroredCpos));
-            };
-
-            glCullFace(GL_FRONT);
-            cube.render(reflectedLightMatrix, glm::mat4(1.0f), render_cubemap, cubemap_reflected_uniforms);
-            glCullFace(GL_BACK);
-
-            //
-            // Pass 8.0: render cubemap
-            //
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            glViewport(0, 0, framebuffer_width, framebuffer_height);
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-
-            glCullFace(GL_FRONT);
-            GLStateInspection::CaptureSnapshot("Cubemap Pass");
-            cube.render(mCamera.GetWorldToClipMatrix(), glm::mat4(1.0f), render_cubemap, cubemap_uniforms);
-            glCullFace(GL_BACK);
-
-            //
-            // Pass 8.1: render overwater scene
-            //
-            glUseProgram(render_overwater);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_overwater, "shadow_texture", shadowmap_texture, shadow_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_overwater, "causticmap_texture", causticmap_texture, caustics_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 7, render_overwater, "water_depth_texture", water_depth_texture, shadow_sampler);
-
-            for (auto const& element : solids)
-                element.render(mCamera.GetWorldToClipMatrix(), element.get_transform().GetMatrix(), render_overwater, resolve_uniforms);
-
-            GLStateInspection::CaptureSnapshot("Water Pass");
-
-            //
-            // Pass 8.1: render underwater scene
-            //
-            glUseProgram(render_underwater);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_underwater, "shadow_texture", shadowmap_texture, shadow_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_underwater, "causticmap_texture", causticmap_texture, caustics_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 7, render_underwater, "water_depth_texture", water_depth_texture, shadow_sampler);
-
-            for (auto const& element : solids)
-                element.render(mCamera.GetWorldToClipMatrix(), element.get_transform().GetMatrix(), render_underwater, resolve_uniforms);
-
-
-            glUseProgram(render_water);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 5, render_water, "heightmap_texture", water_texture1, heightmap_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 6, render_water, "underwater_texture", underwater_scene_texture, default_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 8, render_water, "underwater_depth_texture", depth_texture, depth_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 8, render_water, "reflection_texture", reflection_texture, default_sampler);
-
-            //
-            // Pass 8.2: render water
-            //
-            glCullFace(GL_FRONT);
-            for (auto const& element : transparents)
-                element.render(mCamera.GetWorldToClipMatrix(), element.get_transform().GetMatrix(), render_water, resolve_uniforms);
-            glCullFace(GL_BACK);
-
-            for (auto const& element : transparents)
-                element.render(mCamera.GetWorldToClipMatrix(), element.get_transform().GetMatrix(), render_water, resolve_uniforms);
-
-            glUseProgram(water_wall_shader);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 5, water_wall_shader, "heightmap_texture", water_texture1, heightmap_sampler);
-            bind_texture_with_sampler(GL_TEXTURE_2D, 6, water_wall_shader, "underwater_texture", underwater_scene_texture, default_sampler);
-            glCullFace(GL_FRONT);
-            for (auto const& element : transparents_walls)
-                element.render(mCamera.GetWorldToClipMatrix(), element.get_transform().GetMatrix(), water_wall_shader, resolve_uniforms);
-            glCullFace(GL_BACK);
-
-
-            if (utils::opengl::debug::isSupported())
-            {
-                glPopDebugGroup();
+            // The walls are only drawn from the camera.
+            if (use_gpu_instance_culling && instance_culler.is_valid()) {
+                for (auto const& node : transparents_walls)
+                    instance_culler.cull(wall_instances, node, mCamera.GetWorldToClipMatrix());
+            } else {
+                wall_instances.reset_culling();
             }
+
+            frame_graph.execute();
         }
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0u);
@@ -1036,10 +1714,9 @@ project::Project::run()
         // Pass 9: Draw wireframe cones on top of the final image for debugging purposes
         //
         glDisable(GL_CULL_FACE);
-        if (show_cone_wireframe) {
+        if (show_cone_wireframe && light_box_constants.size > 0) {
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            box.render(mCamera.GetWorldToClipMatrix(), lightTransform.GetMatrix() * boxScale,
-                render_light_cones_shader, no_extra_uniforms);
+            box.render(light_box_constants, render_light_cones_shader);
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
         glEnable(GL_CULL_FACE);
@@ -1047,12 +1724,14 @@ project::Project::run()
         //
         // Output content of the g-buffer as well as of the shadowmap, for debugging purposes
         //
-        if (show_textures) {
+        if (show_textures && !shader_reload_failed) {
             //bonobo::displayTexture({ 0.7f, 0.55f }, { 0.95f, 0.95f }, environmentmap_texture, default_sampler, { 0, 1, 2, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false);
             bonobo::displayTexture({ 0.7f, 0.55f }, { 0.95f, 0.95f }, water_texture0, heightmap_sampler, { 0, 1, 2, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false);
-            bonobo::displayTexture({ 0.7f, 0.05f }, { 0.95f, 0.45f }, causticmap_texture, default_sampler, { 0, 1, 2, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false);
-            bonobo::displayTexture({ 0.7f, -0.45f }, { 0.95f, -0.05f }, reflection_texture, default_sampler, { 0, 1, 2, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false);
-            bonobo::displayTexture({ 0.7f, -0.95f }, { 0.95f, -0.55f }, shadowmap_texture, depth_sampler, { 0, 0, 0, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false, lightProjectionNearPlane, lightProjectionFarPlane);
+            bonobo::displayTexture({ 0.7f, 0.05f }, { 0.95f, 0.45f }, frame_graph.get_texture(frame.causticmap), default_sampler, { 0, 1, 2, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false);
+            // The planar reflection is not rendered while the water is hidden.
+            if (use_ssr || render_reflection_pass)
+                bonobo::displayTexture({ 0.7f, -0.45f }, { 0.95f, -0.05f }, frame_graph.get_texture(use_ssr ? frame.scene_colour : frame.reflection_colour), default_sampler, { 0, 1, 2, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false);
+            bonobo::displayTexture({ 0.7f, -0.95f }, { 0.95f, -0.55f }, frame_graph.get_texture(frame.shadowmap), depth_sampler, { 0, 0, 0, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false, lightProjectionNearPlane, lightProjectionFarPlane);
             //bonobo::displayTexture({ 0.7f, -0.95f }, { 0.95f, -0.55f }, water_texture0, heightmap_sampler, { 0, 1, 2, -1 }, glm::uvec2(framebuffer_width, framebuffer_height), false);
         }
 
@@ -1072,8 +1751,47 @@ project::Project::run()
         if (opened) {
             ImGui::Checkbox("Pause lights", &are_lights_paused);
             //ImGui::SliderInt("Number of lights", &lights_nb, 1, static_cast<int>(constant::lights_nb));
-            ImGui::Checkbox("Show textures", &show_textures);
+            if (ImGui::Checkbox("Show textures", &show_textures))
+                is_frame_graph_outdated = true;
             ImGui::Checkbox("Show light cones wireframe", &show_cone_wireframe);
+            ImGui::Separator();
+            if (ImGui::Combo("Refraction resolution", &underwater_scene_scale_index, target_scale_names.data(), static_cast<int>(target_scale_names.size())))
+                is_frame_graph_outdated = true;
+            if (ImGui::Combo("Reflection resolution", &reflection_scale_index, target_scale_names.data(), static_cast<int>(target_scale_names.size())))
+                is_frame_graph_outdated = true;
+            auto reflection_mode_index = static_cast<int>(reflection_mode);
+            if (ImGui::Combo("Water reflections", &reflection_mode_index, reflection_mode_names.data(), static_cast<int>(reflection_mode_names.size()))) {
+                reflection_mode = static_cast<reflection_mode_t>(reflection_mode_index);
+                is_frame_graph_outdated = true;
+            }
+            if (reflection_mode == reflection_mode_t::screen_space && ImGui::Checkbox("Hi-Z acceleration", &use_hiz))
+                is_frame_graph_outdated = true;
+            ImGui::Separator();
+            ImGui::Checkbox("Depth pre-pass", &use_depth_prepass);
+            ImGui::SliderFloat("LOD error (pixels)", &lod_max_error, 0.0f, 8.0f);
+            ImGui::SliderFloat("Shadow LOD bias", &shadow_lod_bias, 1.0f, 8.0f);
+            if (camera_occlusion.is_valid() && ImGui::Checkbox("Cull occluded solids", &use_occlusion_culling))
+                is_frame_graph_outdated = true;
+            if (instance_culler.is_valid()) {
+                ImGui::Checkbox("Cull instances on the GPU", &use_gpu_instance_culling);
+                ImGui::SameLine();
+                ImGui::Text("(%s)", instance_culler.uses_compute_shaders() ? "compute shader" : "transform feedback");
+            }
+            ImGui::Checkbox("Skip passes hidden by occlusion", &use_occlusion_queries);
+            ImGui::Text("Water volume: %s", is_water_visible ? "visible" : "hidden");
+            ImGui::Text("Underwater scene pass: %s", render_underwater_scene_pass ? "run" : "skipped");
+            ImGui::Text("Reflection pass: %s", render_reflection_pass ? "run" : "skipped");
+            ImGui::Text("Scene Hi-Z pass: %s", build_scene_hiz_pass ? "run" : "skipped");
+            if (ImGui::CollapsingHeader("Render graph"))
+                frame_graph.show_stats();
+            if (ImGui::CollapsingHeader("Draw lists")) {
+                auto const& draw_stats = draw_list.get_stats();
+                ImGui::Text("Draws: %zu, in %zu calls", draw_stats.draws_nb, draw_stats.draw_calls_nb);
+                ImGui::Text("Program changes: %zu", draw_stats.program_changes_nb);
+                ImGui::Text("Material changes: %zu", draw_stats.material_changes_nb);
+                ImGui::Text("Vertex array changes: %zu", draw_stats.vao_changes_nb);
+                ImGui::Text("Nodes culled: %zu", culled_nodes_nb);
+            }
         }
         ImGui::End();
 
@@ -1087,6 +1805,8 @@ project::Project::run()
 
     glDeleteProgram(render_underwater);
     render_underwater = 0u;
+    glDeleteProgram(render_composite);
+    render_composite = 0u;
     glDeleteProgram(render_water);
     render_water = 0u;
 
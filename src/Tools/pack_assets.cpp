@@ -0,0 +1,39 @@
+#include "core/AssetPack.hpp"
+#include "core/Log.h"
+#include "core/various.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Packs the files listed in a text file, one path relative to the root
+// per line, into a single asset pack.
+int main(int argc, char* argv[])
+{
+	if (argc != 4) {
+		std::fprintf(stderr, "Usage: %s <pack> <root directory> <list of files>\n", argc > 0 ? argv[0] : "PackAssets");
+		return 1;
+	}
+
+	Log::Init();
+	int status = 1;
+	std::ifstream list(utils::widen(argv[3]));
+	if (list.is_open()) {
+		std::vector<std::string> files;
+		for (std::string line; std::getline(list, line);) {
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (!line.empty())
+				files.push_back(line);
+		}
+		if (bonobo::writeAssetPack(argv[1], argv[2], files)) {
+			LogInfo("Packed %zu files into \"%s\"", files.size(), argv[1]);
+			status = 0;
+		}
+	} else {
+		LogError("Failed to open \"%s\"", argv[3]);
+	}
+	Log::Destroy();
+	return status;
+}
@@ -0,0 +1,235 @@
+#include "AssetPack.hpp"
+
+#include "core/Log.h"
+#include "core/various.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <utility>
+
+namespace
+{
+	constexpr std::uint32_t pack_magic = 0x4B415042u; // "BPAK"
+	// Bumped whenever the layout of packs changes.
+	constexpr std::uint32_t pack_version = 1u;
+	// Assets start on a cache line, which keeps the alignment the caches
+	// they may hold expect.
+	constexpr std::size_t data_alignment = 64u;
+
+	struct PackHeader {
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint32_t entries_nb;
+		std::uint32_t paths_size;
+	};
+
+	struct PackEntry {
+		std::uint64_t path_hash;
+		std::uint32_t path_offset;
+		std::uint32_t path_length;
+		std::uint64_t offset;
+		std::uint64_t size;
+	};
+
+	// 64-bit FNV-1a, as for source files
+	std::uint64_t hash_path(std::string const& path)
+	{
+		std::uint64_t hash = 14695981039346656037ull;
+		for (auto const c : path)
+			hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+		return hash;
+	}
+
+	std::size_t align(std::size_t offset)
+	{
+		return (offset + data_alignment - 1u) / data_alignment * data_alignment;
+	}
+
+	std::unique_ptr<bonobo::AssetPack> mounted_pack;
+}
+
+bonobo::AssetPack::AssetPack(std::string const& path, std::string root) :
+	_file(path), _root(std::move(root))
+{
+	std::replace(_root.begin(), _root.end(), '\\', '/');
+	while (!_root.empty() && _root.back() == '/')
+		_root.pop_back();
+
+	if (!_file.is_valid() || _file.size() < sizeof(PackHeader))
+		return;
+
+	auto const bytes = static_cast<unsigned char const*>(_file.data());
+	PackHeader header;
+	std::memcpy(&header, bytes, sizeof(header));
+	auto const paths_offset = sizeof(PackHeader) + static_cast<std::size_t>(header.entries_nb) * sizeof(PackEntry);
+	if (header.magic != pack_magic || header.version != pack_version
+	    || paths_offset > _file.size() || header.paths_size > _file.size() - paths_offset)
+		return;
+
+	// Entries are checked once here, so that lookups can trust them.
+	auto const entries = reinterpret_cast<PackEntry const*>(bytes + sizeof(PackHeader));
+	for (std::uint32_t i = 0u; i < header.entries_nb; ++i) {
+		auto const& entry = entries[i];
+		if (entry.path_offset > header.paths_size || entry.path_length > header.paths_size - entry.path_offset
+		    || entry.offset > _file.size() || entry.size > _file.size() - entry.offset
+		    || (i > 0u && entries[i - 1u].path_hash > entry.path_hash))
+			return;
+	}
+
+	_entries = entries;
+	_entries_nb = header.entries_nb;
+	_paths = reinterpret_cast<char const*>(bytes + paths_offset);
+}
+
+bool
+bonobo::AssetPack::is_valid() const
+{
+	return _entries != nullptr;
+}
+
+bonobo::AssetPack::Asset
+bonobo::AssetPack::find(std::string const& path) const
+{
+	Asset asset;
+	if (!is_valid())
+		return asset;
+
+	auto const relative_path = normalise(path);
+	auto const hash = hash_path(relative_path);
+	auto const entries = static_cast<PackEntry const*>(_entries);
+	auto it = std::lower_bound(entries, entries + _entries_nb, hash,
+	                           [](PackEntry const& entry, std::uint64_t h) { return entry.path_hash < h; });
+	for (; it != entries + _entries_nb && it->path_hash == hash; ++it) {
+		if (relative_path.compare(0u, std::string::npos, _paths + it->path_offset, it->path_length) != 0)
+			continue;
+		asset.data = static_cast<unsigned char const*>(_file.data()) + it->offset;
+		asset.size = static_cast<std::size_t>(it->size);
+		break;
+	}
+	return asset;
+}
+
+std::size_t
+bonobo::AssetPack::get_assets_nb() const
+{
+	return _entries_nb;
+}
+
+std::string
+bonobo::AssetPack::normalise(std::string path) const
+{
+	std::replace(path.begin(), path.end(), '\\', '/');
+	if (!_root.empty() && path.size() > _root.size() && path.compare(0u, _root.size(), _root) == 0 && path[_root.size()] == '/')
+		path.erase(0u, _root.size() + 1u);
+	while (path.compare(0u, 2u, "./") == 0)
+		path.erase(0u, 2u);
+	for (auto position = path.find("/./"); position != std::string::npos; position = path.find("/./", position))
+		path.erase(position, 2u);
+	return path;
+}
+
+bool
+bonobo::writeAssetPack(std::string const& path, std::string const& root, std::vector<std::string> const& files)
+{
+	struct Source {
+		std::string path;
+		MappedFile file;
+	};
+	std::vector<Source> sources;
+	sources.reserve(files.size());
+	for (auto const& file : files) {
+		auto relative_path = file;
+		std::replace(relative_path.begin(), relative_path.end(), '\\', '/');
+		MappedFile mapping(root + "/" + relative_path, true);
+		if (!mapping.is_valid()) {
+			LogWarning("Failed to read \"%s\"; it will not be packed.", file.c_str());
+			continue;
+		}
+		sources.push_back({ std::move(relative_path), std::move(mapping) });
+	}
+
+	std::string paths;
+	for (auto const& source : sources)
+		paths += source.path;
+
+	// Assets are laid out in the order they were given, which should be
+	// the one they get loaded in, so that a cold start reads the pack
+	// sequentially; only the directory is sorted.
+	std::vector<PackEntry> entries;
+	entries.reserve(sources.size());
+	std::uint32_t path_offset = 0u;
+	auto offset = align(sizeof(PackHeader) + sources.size() * sizeof(PackEntry) + paths.size());
+	for (auto const& source : sources) {
+		entries.push_back({ hash_path(source.path), path_offset, static_cast<std::uint32_t>(source.path.size()),
+		                    offset, source.file.size() });
+		path_offset += static_cast<std::uint32_t>(source.path.size());
+		offset = align(offset + source.file.size());
+	}
+	auto sorted_entries = entries;
+	std::stable_sort(sorted_entries.begin(), sorted_entries.end(), [](PackEntry const& lhs, PackEntry const& rhs) {
+		return lhs.path_hash < rhs.path_hash;
+	});
+
+	auto const temporary_path = path + ".tmp";
+	{
+		std::ofstream file(utils::widen(temporary_path), std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			LogError("Failed to open \"%s\" for writing.", temporary_path.c_str());
+			return false;
+		}
+
+		PackHeader const header = { pack_magic, pack_version, static_cast<std::uint32_t>(sorted_entries.size()),
+		                            static_cast<std::uint32_t>(paths.size()) };
+		file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+		file.write(reinterpret_cast<char const*>(sorted_entries.data()), static_cast<std::streamsize>(sorted_entries.size() * sizeof(PackEntry)));
+		file.write(paths.data(), static_cast<std::streamsize>(paths.size()));
+
+		char const padding[data_alignment] = {};
+		std::size_t position = sizeof(PackHeader) + sorted_entries.size() * sizeof(PackEntry) + paths.size();
+		for (std::size_t i = 0u; i < sources.size(); ++i) {
+			auto const& entry = entries[i];
+			file.write(padding, static_cast<std::streamsize>(entry.offset - position));
+			file.write(static_cast<char const*>(sources[i].file.data()), static_cast<std::streamsize>(entry.size));
+			position = static_cast<std::size_t>(entry.offset + entry.size);
+		}
+
+		if (!file.good()) {
+			LogError("Failed to write \"%s\".", temporary_path.c_str());
+			file.close();
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+	}
+
+	std::remove(path.c_str());
+	if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+		LogError("Failed to replace \"%s\".", path.c_str());
+		std::remove(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool
+bonobo::mountAssetPack(std::string const& path, std::string const& root)
+{
+	auto pack = std::make_unique<AssetPack>(path, root);
+	if (!pack->is_valid()) {
+		if (std::ifstream(utils::widen(path)))
+			LogWarning("\"%s\" is not a valid asset pack, and gets ignored.", path.c_str());
+		return false;
+	}
+
+	LogInfo("Mounted \"%s\", holding %zu assets", path.c_str(), pack->get_assets_nb());
+	mounted_pack = std::move(pack);
+	return true;
+}
+
+bonobo::AssetPack const*
+bonobo::getMountedAssetPack()
+{
+	return mounted_pack.get();
+}
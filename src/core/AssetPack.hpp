@@ -0,0 +1,86 @@
+#pragma once
+
+#include "core/MappedFile.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Single file holding many assets, mapped at once.
+	//!
+	//! The pack starts with a directory of its entries sorted by the hash
+	//! of their path, followed by those paths and then by the content of
+	//! each asset, aligned to a cache line. Paths are relative to a root
+	//! directory, e.g. "shaders/EDAF80/default.vert"; looking up an asset
+	//! from its full path strips that root.
+	class AssetPack
+	{
+	public:
+		//! \brief Content of an asset, pointing into the mapping of the
+		//!        pack.
+		struct Asset {
+			void const* data{nullptr}; //!< nullptr if the pack does not hold it
+			std::size_t size{0u};
+		};
+
+		//! \brief Map the given pack; `is_valid()` tells whether it
+		//!        exists and was well-formed.
+		//!
+		//! @param [in] root directory the paths of the pack are relative
+		//!             to
+		AssetPack(std::string const& path, std::string root);
+
+		AssetPack(AssetPack const&) = delete;
+		AssetPack& operator=(AssetPack const&) = delete;
+
+		bool is_valid() const;
+
+		//! \brief Find an asset from its path, either relative to the
+		//!        root or including it.
+		Asset find(std::string const& path) const;
+
+		//! \brief Number of assets in the pack.
+		std::size_t get_assets_nb() const;
+
+	private:
+		std::string normalise(std::string path) const;
+
+		MappedFile _file;
+		std::string _root;
+		void const* _entries{nullptr}; //!< as laid out in the pack
+		std::size_t _entries_nb{0u};
+		char const* _paths{nullptr};
+	};
+
+	//! \brief Write the given files into a pack.
+	//!
+	//! Files which cannot be read are skipped with a warning, and will be
+	//! looked up on disk instead.
+	//!
+	//! @param [in] root directory the files are relative to
+	//! @param [in] files paths of the files, relative to `root`
+	//! @return whether the pack could be written
+	bool writeAssetPack(std::string const& path, std::string const& root, std::vector<std::string> const& files);
+
+	//! \brief Mount a pack, which then gets looked into by `MappedFile`
+	//!        before the disk, and thereby by everything loading files.
+	//!
+	//! Shaders reloaded at runtime, and caches found outdated in the pack,
+	//! get read from the disk instead.
+	//!
+	//! Meant to be called once at startup, before loading anything: files
+	//! are read from worker threads, which do not expect the pack to
+	//! change under their feet. A missing pack is not an error, as packs
+	//! are optional.
+	//!
+	//! @param [in] root directory the paths of the pack are relative to,
+	//!             usually `config::root_dir`
+	//! @return whether the pack was found and mounted
+	bool mountAssetPack(std::string const& path, std::string const& root);
+
+	//! \brief Currently mounted pack, or nullptr if there is none.
+	AssetPack const* getMountedAssetPack();
+}
@@ -0,0 +1,231 @@
+#include "Culling.hpp"
+#include "CullingAVX.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define BONOBO_CULLING_SSE2 1
+#endif
+
+// Set by the build when it compiles the AVX path, see CullingAVX.cpp.
+#if defined(BONOBO_CULLING_AVX) && defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+namespace
+{
+#if defined(BONOBO_CULLING_SSE2)
+	constexpr std::size_t batch_size = 4u;
+#else
+	constexpr std::size_t batch_size = 1u;
+#endif
+	// Boxes are padded for the widest batches, those of the AVX path.
+	constexpr std::size_t padding = 8u;
+}
+
+bool
+bonobo::avx::isSupported()
+{
+#if defined(BONOBO_CULLING_AVX)
+	static bool const is_supported = []() {
+#	if defined(_MSC_VER)
+		// The OS has to save the AVX registers as well, as told by XCR0.
+		int info[4];
+		__cpuid(info, 1);
+		bool const has_avx = (info[2] & (1 << 28)) != 0;
+		bool const has_osxsave = (info[2] & (1 << 27)) != 0;
+		return has_avx && has_osxsave && (_xgetbv(0) & 0x6u) == 0x6u;
+#	else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx") != 0;
+#	endif
+	}();
+	return is_supported;
+#else
+	return false;
+#endif
+}
+
+bool
+bonobo::BoundingBox::is_valid() const
+{
+	return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+}
+
+void
+bonobo::BoundingBox::extend(glm::vec3 const& point)
+{
+	min = glm::min(min, point);
+	max = glm::max(max, point);
+}
+
+void
+bonobo::BoundingBox::extend(BoundingBox const& box)
+{
+	if (!box.is_valid())
+		return;
+	min = glm::min(min, box.min);
+	max = glm::max(max, box.max);
+}
+
+bonobo::BoundingBox
+bonobo::BoundingBox::transform(glm::mat4 const& matrix) const
+{
+	if (!is_valid())
+		return *this;
+
+	// The extents of the transformed box are the ones of the original
+	// box, projected onto each axis by the absolute linear part.
+	auto const centre = 0.5f * (min + max);
+	auto const extents = 0.5f * (max - min);
+	auto const linear = glm::mat3(matrix);
+	glm::mat3 absolute_linear;
+	for (int i = 0; i < 3; ++i)
+		absolute_linear[i] = glm::abs(linear[i]);
+
+	auto const transformed_centre = glm::vec3(matrix * glm::vec4(centre, 1.0f));
+	auto const transformed_extents = absolute_linear * extents;
+
+	BoundingBox box;
+	box.min = transformed_centre - transformed_extents;
+	box.max = transformed_centre + transformed_extents;
+	return box;
+}
+
+void
+bonobo::computeBounds(glm::vec3 const* vertices, std::size_t vertices_nb,
+                      BoundingBox& box, BoundingSphere& sphere)
+{
+	box = BoundingBox();
+	sphere = BoundingSphere();
+	if (vertices == nullptr || vertices_nb == 0u)
+		return;
+
+	for (std::size_t i = 0u; i < vertices_nb; ++i)
+		box.extend(vertices[i]);
+
+	// Centring the sphere on the box only needs one more pass, and is
+	// tighter than the half-diagonal of the box.
+	sphere.centre = 0.5f * (box.min + box.max);
+	float squared_radius = 0.0f;
+	for (std::size_t i = 0u; i < vertices_nb; ++i) {
+		auto const offset = vertices[i] - sphere.centre;
+		squared_radius = std::max(squared_radius, glm::dot(offset, offset));
+	}
+	sphere.radius = std::sqrt(squared_radius);
+}
+
+bonobo::Frustum
+bonobo::extractFrustum(glm::mat4 const& world_to_clip)
+{
+	// A point is inside when -w <= x, y, z <= w in clip-space; rows of the
+	// matrix give each of those inequalities in world-space.
+	auto const row = [&world_to_clip](int i) {
+		return glm::vec4(world_to_clip[0][i], world_to_clip[1][i], world_to_clip[2][i], world_to_clip[3][i]);
+	};
+	Frustum frustum;
+	frustum.planes = { { row(3) + row(0), row(3) - row(0),
+	                     row(3) + row(1), row(3) - row(1),
+	                     row(3) + row(2), row(3) - row(2) } };
+	for (auto& plane : frustum.planes) {
+		auto const length = glm::length(glm::vec3(plane));
+		if (length > 0.0f)
+			plane /= length;
+	}
+	return frustum;
+}
+
+void
+bonobo::FrustumCuller::clear()
+{
+	_boxes_nb = 0u;
+	for (int axis = 0; axis < 3; ++axis) {
+		_centres[axis].clear();
+		_extents[axis].clear();
+	}
+}
+
+std::size_t
+bonobo::FrustumCuller::add(BoundingBox const& box)
+{
+	// Unknown bounds are given extents large enough for them to always
+	// be on the inner side of every plane.
+	auto const centre = box.is_valid() ? 0.5f * (box.min + box.max) : glm::vec3(0.0f);
+	auto const extents = box.is_valid() ? 0.5f * (box.max - box.min) : glm::vec3(std::numeric_limits<float>::max());
+
+	auto const index = _boxes_nb++;
+	auto const padded_size = (_boxes_nb + padding - 1u) / padding * padding;
+	for (int axis = 0; axis < 3; ++axis) {
+		_centres[axis].resize(padded_size, 0.0f);
+		_extents[axis].resize(padded_size, 0.0f);
+		_centres[axis][index] = centre[axis];
+		_extents[axis][index] = extents[axis];
+	}
+	return index;
+}
+
+std::size_t
+bonobo::FrustumCuller::size() const
+{
+	return _boxes_nb;
+}
+
+std::size_t
+bonobo::FrustumCuller::cull(Frustum const& frustum, std::vector<std::uint8_t>& visible) const
+{
+	visible.resize(_boxes_nb);
+
+#if defined(BONOBO_CULLING_AVX)
+	if (avx::isSupported()) {
+		float const* const centres[3] = { _centres[0].data(), _centres[1].data(), _centres[2].data() };
+		float const* const extents[3] = { _extents[0].data(), _extents[1].data(), _extents[2].data() };
+		return avx::cullBoxes(frustum, centres, extents, _boxes_nb, visible.data());
+	}
+#endif
+
+	// A box is outside of a plane when its centre is further away from
+	// it than the extents of the box projected onto the plane normal.
+	std::size_t culled_nb = 0u;
+	for (std::size_t first = 0u; first < _boxes_nb; first += batch_size) {
+		auto const cx = _centres[0].data() + first;
+		auto const cy = _centres[1].data() + first;
+		auto const cz = _centres[2].data() + first;
+		auto const ex = _extents[0].data() + first;
+		auto const ey = _extents[1].data() + first;
+		auto const ez = _extents[2].data() + first;
+
+#if defined(BONOBO_CULLING_SSE2)
+		__m128 outside = _mm_setzero_ps();
+		for (auto const& plane : frustum.planes) {
+			__m128 distance = _mm_set1_ps(plane.w);
+			distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.x), _mm_loadu_ps(cx)));
+			distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.y), _mm_loadu_ps(cy)));
+			distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.z), _mm_loadu_ps(cz)));
+			__m128 radius = _mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), _mm_loadu_ps(ex));
+			radius = _mm_add_ps(radius, _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), _mm_loadu_ps(ey)));
+			radius = _mm_add_ps(radius, _mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), _mm_loadu_ps(ez)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+		int const outside_mask = _mm_movemask_ps(outside);
+#else
+		bool is_outside = false;
+		for (auto const& plane : frustum.planes) {
+			auto const distance = plane.x * cx[0] + plane.y * cy[0] + plane.z * cz[0] + plane.w;
+			auto const radius = std::abs(plane.x) * ex[0] + std::abs(plane.y) * ey[0] + std::abs(plane.z) * ez[0];
+			is_outside = is_outside || distance + radius < 0.0f;
+		}
+		int const outside_mask = is_outside ? 1 : 0;
+#endif
+
+		auto const last = std::min(first + batch_size, _boxes_nb);
+		for (std::size_t i = first; i < last; ++i) {
+			bool const is_visible = (outside_mask & (1 << (i - first))) == 0;
+			visible[i] = is_visible ? 1u : 0u;
+			culled_nb += is_visible ? 0u : 1u;
+		}
+	}
+	return culled_nb;
+}
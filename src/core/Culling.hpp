@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Axis-aligned box; boxes with a minimum greater than their
+	//!        maximum are unknown bounds, which are never culled.
+	struct BoundingBox {
+		glm::vec3 min{std::numeric_limits<float>::max()};
+		glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+		//! \brief Whether the box was computed, rather than left unknown.
+		bool is_valid() const;
+
+		//! \brief Grow the box so that it includes the given point.
+		void extend(glm::vec3 const& point);
+
+		//! \brief Grow the box so that it includes the given box.
+		void extend(BoundingBox const& box);
+
+		//! \brief Get the box enclosing this one once transformed.
+		BoundingBox transform(glm::mat4 const& matrix) const;
+	};
+
+	//! \brief Sphere enclosing a mesh; a negative radius means unknown.
+	struct BoundingSphere {
+		glm::vec3 centre{0.0f};
+		float radius{-1.0f};
+	};
+
+	//! \brief Compute the bounding box of some vertices, and a sphere
+	//!        centred on that box.
+	void computeBounds(glm::vec3 const* vertices, std::size_t vertices_nb,
+	                   BoundingBox& box, BoundingSphere& sphere);
+
+	//! \brief Planes bounding what a view sees, pointing inwards.
+	//!
+	//! Each plane is stored as (a, b, c, d), where a point p is on the
+	//! inner side when a * p.x + b * p.y + c * p.z + d >= 0.
+	struct Frustum {
+		std::array<glm::vec4, 6> planes;
+	};
+
+	//! \brief Extract the frustum of a view from its world-to-clip matrix.
+	Frustum extractFrustum(glm::mat4 const& world_to_clip);
+
+	//! \brief World-space boxes tested against frusta in batches.
+	//!
+	//! Boxes are kept as separate arrays of centres and half-extents, so
+	//! that several of them get tested at once: eight per iteration on
+	//! CPUs supporting AVX, if the build includes that path (see the
+	//! LUGGCGL_CULLING_AVX option), four with SSE2, and one otherwise.
+	class FrustumCuller
+	{
+	public:
+		//! \brief Remove all boxes.
+		void clear();
+
+		//! \brief Add a world-space box.
+		//!
+		//! @return index of the box, at which `cull()` writes its result
+		std::size_t add(BoundingBox const& box);
+
+		//! \brief Get how many boxes were added.
+		std::size_t size() const;
+
+		//! \brief Test all boxes against a frustum.
+		//!
+		//! @param [out] visible set to 1 for boxes intersecting or inside
+		//!              the frustum, and 0 for the others; resized to the
+		//!              number of boxes
+		//! @return how many boxes were culled
+		std::size_t cull(Frustum const& frustum, std::vector<std::uint8_t>& visible) const;
+
+	private:
+		std::size_t _boxes_nb{0u};
+		// Padded to a whole number of batches
+		std::vector<float> _centres[3];
+		std::vector<float> _extents[3];
+	};
+}
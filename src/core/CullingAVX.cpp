@@ -0,0 +1,50 @@
+// This is the only file compiled with AVX enabled: the compiler may use
+// AVX instructions anywhere in it, so nothing here may run before
+// `bonobo::avx::isSupported()`, defined in Culling.cpp for that reason,
+// found the CPU able to execute them.
+
+#include "CullingAVX.hpp"
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cmath>
+
+std::size_t
+bonobo::avx::cullBoxes(Frustum const& frustum, float const* const centres[3], float const* const extents[3],
+                       std::size_t boxes_nb, std::uint8_t* visible)
+{
+	constexpr std::size_t batch_size = 8u;
+
+	std::size_t culled_nb = 0u;
+	for (std::size_t first = 0u; first < boxes_nb; first += batch_size) {
+		auto const cx = _mm256_loadu_ps(centres[0] + first);
+		auto const cy = _mm256_loadu_ps(centres[1] + first);
+		auto const cz = _mm256_loadu_ps(centres[2] + first);
+		auto const ex = _mm256_loadu_ps(extents[0] + first);
+		auto const ey = _mm256_loadu_ps(extents[1] + first);
+		auto const ez = _mm256_loadu_ps(extents[2] + first);
+
+		__m256 outside = _mm256_setzero_ps();
+		for (auto const& plane : frustum.planes) {
+			__m256 distance = _mm256_set1_ps(plane.w);
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.x), cx));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.y), cy));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.z), cz));
+			__m256 radius = _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.x)), ex);
+			radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.y)), ey));
+			radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), ez));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+		int const outside_mask = _mm256_movemask_ps(outside);
+
+		auto const last = std::min(first + batch_size, boxes_nb);
+		for (std::size_t i = first; i < last; ++i) {
+			bool const is_visible = (outside_mask & (1 << (i - first))) == 0;
+			visible[i] = is_visible ? 1u : 0u;
+			culled_nb += is_visible ? 0u : 1u;
+		}
+	}
+
+	return culled_nb;
+}
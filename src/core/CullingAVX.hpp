@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Culling.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bonobo
+{
+	namespace avx
+	{
+		//! \brief Whether the CPU, and the OS, support AVX; always false
+		//!        when the AVX path was not built.
+		bool isSupported();
+
+		//! \brief Test boxes against a frustum eight at a time, as
+		//!        `FrustumCuller::cull()` does.
+		//!
+		//! Only to be called if `isSupported()` returned true.
+		//!
+		//! @param [in] centres x, y and z coordinates of the centres of
+		//!             the boxes, padded to a multiple of eight
+		//! @param [in] extents x, y and z half-extents of the boxes,
+		//!             padded the same way
+		//! @param [out] visible one entry per box, set as by `cull()`
+		//! @return how many boxes were culled
+		std::size_t cullBoxes(Frustum const& frustum, float const* const centres[3], float const* const extents[3],
+		                      std::size_t boxes_nb, std::uint8_t* visible);
+	}
+}
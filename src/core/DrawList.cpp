@@ -0,0 +1,375 @@
+#include "DrawList.hpp"
+
+#include "core/helpers.hpp"
+#include "core/node.hpp"
+#include "core/opengl.hpp"
+#include "core/ShaderProgramManager.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	// Bits of each part of the sort keys, from the most significant.
+	constexpr unsigned int program_bits = 12u;
+	constexpr unsigned int material_bits = 16u;
+	constexpr unsigned int vao_bits = 16u;
+	constexpr unsigned int depth_bits = 20u;
+
+	// Non-negative floats compare like their bit patterns, of which only
+	// the most significant ones are kept.
+	std::uint64_t quantise_depth(float depth)
+	{
+		depth = std::max(depth, 0.0f);
+		std::uint32_t bits = 0u;
+		std::memcpy(&bits, &depth, sizeof(bits));
+		return bits >> (32u - depth_bits);
+	}
+}
+
+bonobo::DrawList::DrawList(std::string name) : _name(std::move(name)), _use_indirect_draws(GLAD_GL_VERSION_4_3 != 0)
+{
+}
+
+bonobo::DrawList::~DrawList()
+{
+	if (_indirect_buffer != 0u)
+		glDeleteBuffers(1, &_indirect_buffer);
+	_indirect_buffer = 0u;
+}
+
+void
+bonobo::DrawList::clear()
+{
+	_draws.clear();
+	_program_ids.clear();
+	_material_ids.clear();
+	_vao_ids.clear();
+	_position_only_programs.clear();
+}
+
+void
+bonobo::DrawList::add(Node const& node, UniformBuffer::Range const& object_constants,
+                      GLuint program, bool bind_textures, float depth,
+                      std::size_t lod, IndirectDraw const& indirect)
+{
+	if (node._vao == 0u || program == 0u)
+		return;
+
+	// Materials are told apart by the textures they bind, and the name
+	// they bind them to.
+	std::uint64_t material_signature = 14695981039346656037ull;
+	if (bind_textures) {
+		auto const mix = [&material_signature](std::uint64_t value) {
+			material_signature = (material_signature ^ value) * 1099511628211ull;
+		};
+		for (std::size_t i = 0u; i < node._textures.size(); ++i) {
+			mix(node._texture_name_hashes[i].first);
+			mix(std::get<1>(node._textures[i]));
+			mix(std::get<2>(node._textures[i]));
+		}
+	}
+
+	std::uint64_t const program_id = get_dense_id(_program_ids, program);
+	std::uint64_t const material_id = get_dense_id(_material_ids, material_signature);
+	GLuint const vao = node._depth_vao != 0u && reads_positions_only(program) ? node._depth_vao : node._vao;
+	std::uint64_t const vao_id = get_dense_id(_vao_ids, vao);
+
+	auto const clamp_to = [](std::uint64_t value, unsigned int bits) {
+		return std::min(value, (std::uint64_t(1) << bits) - 1u);
+	};
+	// Overflowing identifiers get merged, which only degrades the sorting.
+	std::uint64_t const key = (clamp_to(program_id, program_bits) << (material_bits + vao_bits + depth_bits))
+	                        | (clamp_to(material_id, material_bits) << (vao_bits + depth_bits))
+	                        | (clamp_to(vao_id, vao_bits) << depth_bits)
+	                        | quantise_depth(depth);
+
+	_draws.push_back({ key, &node, object_constants, program, vao, bind_textures, lod, indirect });
+}
+
+void
+bonobo::DrawList::sort()
+{
+	std::stable_sort(_draws.begin(), _draws.end(),
+	                 [](Draw const& lhs, Draw const& rhs) { return lhs.key < rhs.key; });
+}
+
+void
+bonobo::DrawList::submit()
+{
+	if (_draws.empty())
+		return;
+
+	if (utils::opengl::debug::isSupported())
+	{
+		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, _name.size(), _name.data());
+	}
+
+	prepare_multi_draws();
+
+	GLuint current_program = 0u;
+	GLuint current_vao = 0u;
+	Node const* current_material = nullptr;
+	UniformBuffer::Range current_constants;
+
+	for (std::size_t i = 0u; i < _draws.size(); i += _call_sizes[i]) {
+		auto const& draw = _draws[i];
+		auto const& node = *draw.node;
+		Node const* const material = get_material(draw);
+
+		if (draw.program != current_program) {
+			// Uniforms belong to programs: the presence flags of the current
+			// material have to be lowered before switching.
+			release_material(current_program, current_material, nullptr);
+			current_material = nullptr;
+			glUseProgram(draw.program);
+			current_program = draw.program;
+			++_stats.program_changes_nb;
+		}
+
+		if (!have_same_textures(material, current_material)) {
+			release_material(current_program, current_material, material);
+			if (material != nullptr)
+				apply_material(current_program, *material);
+			current_material = material;
+			++_stats.material_changes_nb;
+		}
+
+		if (draw.vao != current_vao) {
+			glBindVertexArray(draw.vao);
+			current_vao = draw.vao;
+			++_stats.vao_changes_nb;
+		}
+
+		if (draw.object_constants.buffer != current_constants.buffer
+		    || draw.object_constants.offset != current_constants.offset
+		    || draw.object_constants.size != current_constants.size) {
+			UniformBuffer::bind(uniform_block_bindings::object_constants, draw.object_constants);
+			current_constants = draw.object_constants;
+		}
+
+		// Instance transforms go after the textures of the material, and
+		// are unbound straight away as they are not shared between draws.
+		if (node._instance_texture != 0u) {
+			auto const unit = static_cast<GLenum>(material != nullptr ? material->_textures.size() : 0u);
+			node.bind_instances(current_program, unit);
+			issue(i, _call_sizes[i]);
+			node.release_instances(unit);
+			continue;
+		}
+
+		issue(i, _call_sizes[i]);
+	}
+
+	if (_use_indirect_draws)
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0u);
+
+	release_material(current_program, current_material, nullptr);
+	for (std::size_t i = 0u; i < _bound_textures.size(); ++i) {
+		glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
+		glBindTexture(_bound_textures[i].first, 0u);
+	}
+	_bound_textures.clear();
+	glBindVertexArray(0u);
+	glUseProgram(0u);
+
+	if (utils::opengl::debug::isSupported())
+	{
+		glPopDebugGroup();
+	}
+}
+
+bonobo::DrawList::Stats const&
+bonobo::DrawList::get_stats() const
+{
+	return _stats;
+}
+
+void
+bonobo::DrawList::reset_stats()
+{
+	_stats = Stats();
+}
+
+bool
+bonobo::DrawList::reads_positions_only(GLuint program)
+{
+	auto const it = _position_only_programs.find(program);
+	if (it != _position_only_programs.end())
+		return it->second;
+
+	// Built-in inputs, such as gl_VertexID, have no location.
+	GLint attributes_nb = 0, max_name_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &attributes_nb);
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_name_length);
+	std::vector<GLchar> name(static_cast<std::size_t>(std::max(max_name_length, 1)));
+	bool positions_only = true;
+	for (GLint i = 0; i < attributes_nb && positions_only; ++i) {
+		GLint size = 0;
+		GLenum type = GL_NONE;
+		glGetActiveAttrib(program, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), nullptr, &size, &type, name.data());
+		auto const location = glGetAttribLocation(program, name.data());
+		positions_only = location == -1 || location == static_cast<GLint>(shader_bindings::vertices);
+	}
+
+	_position_only_programs.emplace(program, positions_only);
+	return positions_only;
+}
+
+std::uint32_t
+bonobo::DrawList::get_dense_id(std::unordered_map<std::uint64_t, std::uint32_t>& ids, std::uint64_t value)
+{
+	return ids.emplace(value, static_cast<std::uint32_t>(ids.size())).first->second;
+}
+
+Node const*
+bonobo::DrawList::get_material(Draw const& draw)
+{
+	return draw.bind_textures && !draw.node->_textures.empty() ? draw.node : nullptr;
+}
+
+bool
+bonobo::DrawList::can_share_call(Draw const& lhs, Draw const& rhs)
+{
+	return lhs.program == rhs.program
+	    && lhs.vao == rhs.vao
+	    && lhs.node->_index_type == rhs.node->_index_type
+	    && lhs.node->_has_indices && rhs.node->_has_indices
+	    && lhs.node->_instance_texture == 0u && rhs.node->_instance_texture == 0u
+	    && lhs.indirect.buffer == 0u && rhs.indirect.buffer == 0u
+	    && lhs.node->_drawing_mode == rhs.node->_drawing_mode
+	    && lhs.object_constants.buffer == rhs.object_constants.buffer
+	    && lhs.object_constants.offset == rhs.object_constants.offset
+	    && lhs.object_constants.size == rhs.object_constants.size
+	    && have_same_textures(get_material(lhs), get_material(rhs));
+}
+
+void
+bonobo::DrawList::prepare_multi_draws()
+{
+	_call_sizes.assign(_draws.size(), 1u);
+	for (std::size_t i = _draws.size() - 1u; i > 0u; --i)
+		if (can_share_call(_draws[i - 1u], _draws[i]))
+			_call_sizes[i - 1u] = _call_sizes[i] + 1u;
+
+	// Every indexed draw gets its parameters written out, whether it
+	// ends up sharing a call or not, so that calls can point at them
+	// using the index of their first draw.
+	if (_use_indirect_draws) {
+		_commands.resize(_draws.size());
+		for (std::size_t i = 0u; i < _draws.size(); ++i) {
+			auto const& node = *_draws[i].node;
+			auto const index_range = node.get_index_range(_draws[i].lod);
+			_commands[i] = { static_cast<GLuint>(index_range.second), 1u, static_cast<GLuint>(index_range.first), node._base_vertex, 0u };
+		}
+
+		if (_indirect_buffer == 0u)
+			glGenBuffers(1, &_indirect_buffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirect_buffer);
+		auto const commands_size = static_cast<GLsizeiptr>(_commands.size() * sizeof(DrawElementsIndirectCommand));
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands_size, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands_size, _commands.data());
+	} else {
+		_counts.resize(_draws.size());
+		_offsets.resize(_draws.size());
+		_base_vertices.resize(_draws.size());
+		for (std::size_t i = 0u; i < _draws.size(); ++i) {
+			auto const& node = *_draws[i].node;
+			auto const index_range = node.get_index_range(_draws[i].lod);
+			_counts[i] = index_range.second;
+			_offsets[i] = node.get_indices_offset(index_range.first);
+			_base_vertices[i] = node._base_vertex;
+		}
+	}
+}
+
+void
+bonobo::DrawList::issue(std::size_t first_draw, std::size_t draws_nb)
+{
+	_stats.draws_nb += draws_nb;
+	++_stats.draw_calls_nb;
+
+	auto const& draw = _draws[first_draw];
+	auto const& node = *draw.node;
+	if (draws_nb == 1u && draw.indirect.buffer != 0u) {
+		auto const offset = reinterpret_cast<GLvoid const*>(static_cast<std::size_t>(draw.indirect.offset));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw.indirect.buffer);
+		if (node._has_indices)
+			glDrawElementsIndirect(node._drawing_mode, node._index_type, offset);
+		else
+			glDrawArraysIndirect(node._drawing_mode, offset);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0u);
+		return;
+	}
+	if (draws_nb == 1u) {
+		node.draw_geometry(draw.lod);
+		return;
+	}
+
+	// Culled instances and indirect draws use their own buffers, hence
+	// binding the one of the list again.
+	if (_use_indirect_draws) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirect_buffer);
+		glMultiDrawElementsIndirect(node._drawing_mode, node._index_type,
+		                            reinterpret_cast<GLvoid const*>(first_draw * sizeof(DrawElementsIndirectCommand)),
+		                            static_cast<GLsizei>(draws_nb), 0);
+	} else {
+		glMultiDrawElementsBaseVertex(node._drawing_mode, _counts.data() + first_draw, node._index_type,
+		                              _offsets.data() + first_draw, static_cast<GLsizei>(draws_nb),
+		                              _base_vertices.data() + first_draw);
+	}
+}
+
+bool
+bonobo::DrawList::have_same_textures(Node const* lhs, Node const* rhs)
+{
+	if (lhs == rhs)
+		return true;
+	if (lhs == nullptr || rhs == nullptr || lhs->_textures.size() != rhs->_textures.size())
+		return false;
+
+	for (std::size_t i = 0u; i < lhs->_textures.size(); ++i) {
+		if (lhs->_texture_name_hashes[i] != rhs->_texture_name_hashes[i]
+		    || std::get<1>(lhs->_textures[i]) != std::get<1>(rhs->_textures[i])
+		    || std::get<2>(lhs->_textures[i]) != std::get<2>(rhs->_textures[i]))
+			return false;
+	}
+	return true;
+}
+
+void
+bonobo::DrawList::release_material(GLuint program, Node const* material, Node const* next_material)
+{
+	if (material == nullptr)
+		return;
+
+	// Only lower the flags which the next material will not raise again;
+	// the textures themselves stay bound until overwritten.
+	for (auto const& hashes : material->_texture_name_hashes) {
+		if (next_material != nullptr) {
+			auto const& next_hashes = next_material->_texture_name_hashes;
+			if (std::find(next_hashes.begin(), next_hashes.end(), hashes) != next_hashes.end())
+				continue;
+		}
+		glUniform1i(ShaderProgramManager::GetUniformLocation(program, hashes.second), 0);
+	}
+}
+
+void
+bonobo::DrawList::apply_material(GLuint program, Node const& material)
+{
+	auto const& textures = material._textures;
+	auto const& hashes = material._texture_name_hashes;
+	if (_bound_textures.size() < textures.size())
+		_bound_textures.resize(textures.size(), std::make_pair(static_cast<GLenum>(GL_TEXTURE_2D), 0u));
+	for (std::size_t i = 0u; i < textures.size(); ++i) {
+		auto const bound_texture = std::make_pair(std::get<2>(textures[i]), std::get<1>(textures[i]));
+		if (_bound_textures[i] != bound_texture) {
+			glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
+			glBindTexture(bound_texture.first, bound_texture.second);
+			_bound_textures[i] = bound_texture;
+		}
+		glUniform1i(ShaderProgramManager::GetUniformLocation(program, hashes[i].first), static_cast<GLint>(i));
+		glUniform1i(ShaderProgramManager::GetUniformLocation(program, hashes[i].second), 1);
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "UniformBuffer.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Node;
+
+namespace bonobo
+{
+	//! \brief Draws of a pass, sorted so that those sharing state end up
+	//!        next to each other, and submitted while only emitting the
+	//!        state which changed from one draw to the next.
+	//!
+	//! Draws are sorted by program, then by material (the textures of the
+	//! node), then by vertex array, and finally front to back. Nodes are
+	//! expected to use programs declaring the `ObjectConstants` block, as
+	//! no other per-draw uniform is set.
+	//!
+	//! Consecutive indexed draws only differing by their geometry, such as
+	//! meshes of a `MeshPool` sharing their material and object constants,
+	//! are issued with a single `glMultiDrawElementsIndirect()` call, or
+	//! `glMultiDrawElementsBaseVertex()` where indirect draws are missing.
+	//! Instanced nodes are always issued on their own, as are draws whose
+	//! parameters were written into a buffer by the GPU, such as the ones
+	//! left by an `OcclusionCuller`.
+	//!
+	//! Programs only reading positions, as used by depth-only passes, get
+	//! the position-only vertex array of nodes which have one, so that
+	//! they do not fetch the other attributes.
+	class DrawList
+	{
+	public:
+		//! \brief State changes emitted by `submit()`.
+		struct Stats {
+			std::size_t draws_nb{0u};
+			std::size_t draw_calls_nb{0u};
+			std::size_t program_changes_nb{0u};
+			std::size_t material_changes_nb{0u};
+			std::size_t vao_changes_nb{0u};
+		};
+
+		//! \brief Where the parameters of a draw are to be read from, when
+		//!        they are not known by the CPU; they have to be laid out
+		//!        as expected by `glDrawElementsIndirect()`, or
+		//!        `glDrawArraysIndirect()` for non-indexed nodes.
+		struct IndirectDraw {
+			GLuint buffer;
+			GLintptr offset;
+		};
+
+		//! @param [in] name label of the debug group wrapping submissions
+		explicit DrawList(std::string name = "Draw list");
+		~DrawList();
+
+		DrawList(DrawList const&) = delete;
+		DrawList& operator=(DrawList const&) = delete;
+
+		//! \brief Remove all draws, keeping the statistics.
+		void clear();
+
+		//! \brief Add a draw of a node.
+		//!
+		//! @param [in] node node to draw; it has to outlive the submission
+		//! @param [in] object_constants where the `ObjectConstants` block of
+		//!             the node is to be found
+		//! @param [in] program OpenGL shader program to use
+		//! @param [in] bind_textures whether to bind the textures of the node
+		//! @param [in] depth distance from the view to the node, used to
+		//!             order draws sharing all their state front to back
+		//! @param [in] lod level of detail of the node to draw, as picked
+		//!             by a `LodSelector`
+		//! @param [in] indirect parameters of the draw, if they are to be
+		//!             read from a buffer rather than from the node
+		void add(Node const& node, UniformBuffer::Range const& object_constants,
+		         GLuint program, bool bind_textures, float depth,
+		         std::size_t lod = 0u, IndirectDraw const& indirect = { 0u, 0 });
+
+		//! \brief Sort the draws added so far.
+		void sort();
+
+		//! \brief Issue the draws, in their current order.
+		//!
+		//! Leaves no program, vertex array or texture of the nodes bound.
+		void submit();
+
+		Stats const& get_stats() const;
+		void reset_stats();
+
+	private:
+		struct Draw {
+			std::uint64_t key;
+			Node const* node;
+			UniformBuffer::Range object_constants;
+			GLuint program;
+			GLuint vao;
+			bool bind_textures;
+			std::size_t lod;
+			IndirectDraw indirect;
+		};
+
+		bool reads_positions_only(GLuint program);
+		static std::uint32_t get_dense_id(std::unordered_map<std::uint64_t, std::uint32_t>& ids, std::uint64_t value);
+		// Layout expected by glMultiDrawElementsIndirect()
+		struct DrawElementsIndirectCommand {
+			GLuint count;
+			GLuint instance_count;
+			GLuint first_index;
+			GLint base_vertex;
+			GLuint base_instance;
+		};
+
+		static bool have_same_textures(Node const* lhs, Node const* rhs);
+		static Node const* get_material(Draw const& draw);
+		static bool can_share_call(Draw const& lhs, Draw const& rhs);
+		void prepare_multi_draws();
+		void issue(std::size_t first_draw, std::size_t draws_nb);
+		void release_material(GLuint program, Node const* material, Node const* next_material);
+		void apply_material(GLuint program, Node const& material);
+
+		std::string _name;
+		std::vector<Draw> _draws;
+		Stats _stats;
+
+		// Small consecutive identifiers are given to programs, materials
+		// and vertex arrays, so that they fit in the sort keys.
+		std::unordered_map<std::uint64_t, std::uint32_t> _program_ids;
+		std::unordered_map<std::uint64_t, std::uint32_t> _material_ids;
+		std::unordered_map<std::uint64_t, std::uint32_t> _vao_ids;
+
+		// Whether each program only reads positions; programs can be
+		// reloaded under the same name, hence forgetting them on clear().
+		std::unordered_map<GLuint, bool> _position_only_programs;
+
+		// Textures bound to each unit during a submission
+		std::vector<std::pair<GLenum, GLuint>> _bound_textures;
+
+		// How many draws, starting from each draw, can be issued together
+		std::vector<std::size_t> _call_sizes;
+		bool _use_indirect_draws;
+		GLuint _indirect_buffer{0u};
+		std::vector<DrawElementsIndirectCommand> _commands;
+		// Arguments of glMultiDrawElementsBaseVertex()
+		std::vector<GLsizei> _counts;
+		std::vector<GLvoid const*> _offsets;
+		std::vector<GLint> _base_vertices;
+	};
+}
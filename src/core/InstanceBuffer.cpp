@@ -0,0 +1,112 @@
+#include "InstanceBuffer.hpp"
+
+#include "core/Log.h"
+
+#include <cassert>
+
+bonobo::InstanceBuffer::InstanceBuffer()
+{
+	glGenBuffers(1, &_buffer);
+	assert(_buffer != 0u);
+	glGenTextures(1, &_texture);
+	assert(_texture != 0u);
+}
+
+bonobo::InstanceBuffer::~InstanceBuffer()
+{
+	if (_indirect_buffer != 0u)
+		glDeleteBuffers(1, &_indirect_buffer);
+	_indirect_buffer = 0u;
+	if (_visible_instances_texture != 0u)
+		glDeleteTextures(1, &_visible_instances_texture);
+	_visible_instances_texture = 0u;
+	if (_visible_instances_buffer != 0u)
+		glDeleteBuffers(1, &_visible_instances_buffer);
+	_visible_instances_buffer = 0u;
+	glDeleteTextures(1, &_texture);
+	_texture = 0u;
+	glDeleteBuffers(1, &_buffer);
+	_buffer = 0u;
+}
+
+void
+bonobo::InstanceBuffer::set(std::vector<glm::mat4> const& model_to_world)
+{
+	GLint max_texels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	// Each instance takes up eight RGBA texels: four for each matrix.
+	auto const max_instances_nb = static_cast<std::size_t>(max_texels) / 8u;
+	if (model_to_world.size() > max_instances_nb) {
+		LogError("Trying to set %zu instances, while buffer textures can only hold %zu of them; the instances will **not** be updated.",
+		         model_to_world.size(), max_instances_nb);
+		return;
+	}
+
+	std::vector<glm::mat4> transforms;
+	transforms.reserve(model_to_world.size() * 2u);
+	for (auto const& world : model_to_world) {
+		transforms.push_back(world);
+		transforms.push_back(glm::transpose(glm::inverse(world)));
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, _buffer);
+	glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(transforms.size() * sizeof(glm::mat4)),
+	             transforms.empty() ? nullptr : transforms.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0u);
+
+	glBindTexture(GL_TEXTURE_BUFFER, _texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, _buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0u);
+
+	_instances_nb = model_to_world.size();
+	_model_to_world = model_to_world;
+	_is_culled = false;
+}
+
+GLuint
+bonobo::InstanceBuffer::get_texture() const
+{
+	return _texture;
+}
+
+std::size_t
+bonobo::InstanceBuffer::get_instances_nb() const
+{
+	return _instances_nb;
+}
+
+bonobo::BoundingBox
+bonobo::InstanceBuffer::get_bounds(BoundingBox const& mesh_bounds) const
+{
+	if (!mesh_bounds.is_valid())
+		return mesh_bounds;
+
+	BoundingBox bounds;
+	for (auto const& world : _model_to_world)
+		bounds.extend(mesh_bounds.transform(world));
+	return bounds;
+}
+
+bool
+bonobo::InstanceBuffer::is_culled() const
+{
+	return _is_culled;
+}
+
+void
+bonobo::InstanceBuffer::reset_culling()
+{
+	_is_culled = false;
+}
+
+GLuint
+bonobo::InstanceBuffer::get_visible_instances_texture() const
+{
+	return _visible_instances_texture;
+}
+
+GLuint
+bonobo::InstanceBuffer::get_indirect_buffer() const
+{
+	return _indirect_buffer;
+}
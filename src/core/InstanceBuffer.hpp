@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Culling.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace bonobo
+{
+	class InstanceCuller;
+
+	//! \brief Transforms of the instances of a node, drawn all at once by
+	//!        a single instanced draw call.
+	//!
+	//! Each instance gets its model and normal matrices, relative to the
+	//! node, stored in a buffer texture which shaders read through the
+	//! functions of shaders/instance_constants.glsl, indexed by
+	//! `gl_InstanceID`. The normal matrices are computed when the
+	//! transforms are set, rather than for every draw.
+	class InstanceBuffer
+	{
+	public:
+		//! \brief Allocate the buffer and its texture, without any instance.
+		InstanceBuffer();
+
+		//! \brief Release the buffer and its texture.
+		~InstanceBuffer();
+
+		InstanceBuffer(InstanceBuffer const&) = delete;
+		InstanceBuffer& operator=(InstanceBuffer const&) = delete;
+
+		//! \brief Replace the transforms of all instances.
+		//!
+		//! @param [in] model_to_world Matrices transforming from the
+		//!             model-space of each instance to the one of the node
+		void set(std::vector<glm::mat4> const& model_to_world);
+
+		//! \brief Get the buffer texture to bind to `instance_transforms`.
+		GLuint get_texture() const;
+
+		//! \brief Get how many instances are to be drawn.
+		std::size_t get_instances_nb() const;
+
+		//! \brief Get the box enclosing all instances of a mesh.
+		//!
+		//! @param [in] mesh_bounds model-space bounds of the mesh
+		//! @return bounds in the space of the node
+		BoundingBox get_bounds(BoundingBox const& mesh_bounds) const;
+
+		//! \brief Whether `InstanceCuller` left only some instances to be
+		//!        drawn, through an indirect draw command.
+		bool is_culled() const;
+
+		//! \brief Forget the results of culling, drawing all instances again.
+		void reset_culling();
+
+		//! \brief Get the buffer texture of the indices of the instances
+		//!        left by culling, to bind to `instance_indices`.
+		GLuint get_visible_instances_texture() const;
+
+		//! \brief Get the buffer holding the indirect draw command written
+		//!        by culling.
+		GLuint get_indirect_buffer() const;
+
+	private:
+		friend class InstanceCuller;
+
+		std::vector<glm::mat4> _model_to_world;
+		GLuint      _buffer{0u};
+		GLuint      _texture{0u};
+		std::size_t _instances_nb{0u};
+
+		// Results of culling, allocated when first culled
+		GLuint      _visible_instances_buffer{0u};
+		GLuint      _visible_instances_texture{0u};
+		std::size_t _visible_instances_capacity{0u};
+		GLuint      _indirect_buffer{0u};
+		bool        _is_culled{false};
+	};
+}
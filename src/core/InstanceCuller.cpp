@@ -0,0 +1,253 @@
+#include "InstanceCuller.hpp"
+
+#include "core/helpers.hpp"
+#include "core/InstanceBuffer.hpp"
+#include "core/Log.h"
+#include "core/node.hpp"
+#include "core/opengl.hpp"
+#include "core/ShaderProgramManager.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <array>
+#include <cassert>
+
+namespace
+{
+	// Matches the local size of cull_instances.comp
+	constexpr GLuint cull_group_size = 64u;
+}
+
+bonobo::InstanceCuller::InstanceCuller() : _use_compute_shaders(GLAD_GL_VERSION_4_3 != 0)
+{
+	if (_use_compute_shaders) {
+		_cull_program = ShaderProgramManager::CreateUnmanagedProgram({ { ShaderType::compute, "cull_instances.comp" } });
+	} else {
+		_cull_program = ShaderProgramManager::CreateUnmanagedProgram({ { ShaderType::vertex, "cull_instances.vert" },
+		                                                               { ShaderType::geometry, "cull_instances.geom" } },
+		                                                             { "visible_instance" });
+		_count_program = ShaderProgramManager::CreateUnmanagedProgram({ { ShaderType::vertex, "count_instances.vert" },
+		                                                                { ShaderType::fragment, "count_instances.frag" } });
+		_store_count_program = ShaderProgramManager::CreateUnmanagedProgram({ { ShaderType::vertex, "count_instances.vert" },
+		                                                                      { ShaderType::fragment, "store_instances_count.frag" } });
+
+		glGenTransformFeedbacks(1, &_feedback);
+		assert(_feedback != 0u);
+		glGenVertexArrays(1, &_empty_vao);
+		assert(_empty_vao != 0u);
+
+		_count_texture = createTexture(1u, 1u, GL_TEXTURE_2D, GL_R32F, GL_RED, GL_FLOAT);
+		_count_fbo = createFBO({ _count_texture });
+		_stored_count_texture = createTexture(1u, 1u, GL_TEXTURE_2D, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT);
+		_stored_count_fbo = createFBO({ _stored_count_texture });
+	}
+
+	if (!is_valid())
+		LogWarning("Culling instances on the GPU is not available; see previous messages for details.");
+}
+
+bonobo::InstanceCuller::~InstanceCuller()
+{
+	for (auto program : { _cull_program, _count_program, _store_count_program }) {
+		if (program == 0u)
+			continue;
+		ShaderProgramManager::ForgetProgram(program);
+		glDeleteProgram(program);
+	}
+	_cull_program = _count_program = _store_count_program = 0u;
+
+	if (_feedback != 0u)
+		glDeleteTransformFeedbacks(1, &_feedback);
+	_feedback = 0u;
+	if (_empty_vao != 0u)
+		glDeleteVertexArrays(1, &_empty_vao);
+	_empty_vao = 0u;
+
+	for (auto fbo : { _count_fbo, _stored_count_fbo })
+		if (fbo != 0u)
+			glDeleteFramebuffers(1, &fbo);
+	_count_fbo = _stored_count_fbo = 0u;
+	for (auto texture : { _count_texture, _stored_count_texture })
+		if (texture != 0u)
+			glDeleteTextures(1, &texture);
+	_count_texture = _stored_count_texture = 0u;
+}
+
+bool
+bonobo::InstanceCuller::is_valid() const
+{
+	return _cull_program != 0u
+	    && (_use_compute_shaders || (_count_program != 0u && _store_count_program != 0u));
+}
+
+bool
+bonobo::InstanceCuller::uses_compute_shaders() const
+{
+	return _use_compute_shaders;
+}
+
+void
+bonobo::InstanceCuller::cull(InstanceBuffer& instances, Node const& node, glm::mat4 const& world_to_clip)
+{
+	if (!is_valid())
+		return;
+	if (node._instances != &instances) {
+		LogError("Only nodes drawn from the given instances can be culled with them.");
+		return;
+	}
+	// Without bounds, all instances have to be drawn.
+	if (!node._mesh_bounds.is_valid() || instances._instances_nb == 0u) {
+		instances.reset_culling();
+		return;
+	}
+
+	reserve(instances);
+
+	// The parameters of the mesh are filled in here, while the instance
+	// count is left for the GPU; non-indexed meshes only use the first
+	// four values, the last one of which has to be zero.
+	std::array<GLuint, 5> const command = { {
+		static_cast<GLuint>(node._has_indices ? node._indices_nb : node._vertices_nb),
+		0u,
+		node._has_indices ? static_cast<GLuint>(node._first_index) : 0u,
+		node._has_indices ? static_cast<GLuint>(node._base_vertex) : 0u,
+		0u
+	} };
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, instances._indirect_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, static_cast<GLsizeiptr>(sizeof(command)), command.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0u);
+
+	using namespace bonobo::literals;
+	auto const frustum = extractFrustum(world_to_clip);
+	auto const world = node.get_transform().GetMatrix();
+	auto const bounds_centre = 0.5f * (node._mesh_bounds.min + node._mesh_bounds.max);
+	auto const bounds_extents = 0.5f * (node._mesh_bounds.max - node._mesh_bounds.min);
+
+	glUseProgram(_cull_program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, instances._texture);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(_cull_program, "instance_transforms"_hash), 0);
+	glUniformMatrix4fv(ShaderProgramManager::GetUniformLocation(_cull_program, "node_model_to_world"_hash), 1, GL_FALSE, glm::value_ptr(world));
+	glUniform3fv(ShaderProgramManager::GetUniformLocation(_cull_program, "bounds_centre"_hash), 1, glm::value_ptr(bounds_centre));
+	glUniform3fv(ShaderProgramManager::GetUniformLocation(_cull_program, "bounds_extents"_hash), 1, glm::value_ptr(bounds_extents));
+	glUniform4fv(ShaderProgramManager::GetUniformLocation(_cull_program, "frustum_planes"_hash),
+	             static_cast<GLsizei>(frustum.planes.size()), glm::value_ptr(frustum.planes.front()));
+
+	if (_use_compute_shaders)
+		compact_with_compute_shader(instances);
+	else
+		compact_with_transform_feedback(instances);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0u);
+	glUseProgram(0u);
+
+	instances._is_culled = true;
+}
+
+void
+bonobo::InstanceCuller::reserve(InstanceBuffer& instances)
+{
+	if (instances._indirect_buffer == 0u)
+		glGenBuffers(1, &instances._indirect_buffer);
+	if (instances._visible_instances_buffer == 0u)
+		glGenBuffers(1, &instances._visible_instances_buffer);
+	if (instances._visible_instances_texture == 0u)
+		glGenTextures(1, &instances._visible_instances_texture);
+
+	if (instances._visible_instances_capacity >= instances._instances_nb)
+		return;
+
+	glBindBuffer(GL_TEXTURE_BUFFER, instances._visible_instances_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(instances._instances_nb * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0u);
+
+	glBindTexture(GL_TEXTURE_BUFFER, instances._visible_instances_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, instances._visible_instances_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0u);
+
+	instances._visible_instances_capacity = instances._instances_nb;
+}
+
+void
+bonobo::InstanceCuller::compact_with_compute_shader(InstanceBuffer& instances)
+{
+	using namespace bonobo::literals;
+	auto const instances_nb = static_cast<GLuint>(instances._instances_nb);
+	glUniform1ui(ShaderProgramManager::GetUniformLocation(_cull_program, "instances_nb"_hash), instances_nb);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0u, instances._visible_instances_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1u, instances._indirect_buffer);
+	glDispatchCompute((instances_nb + cull_group_size - 1u) / cull_group_size, 1u, 1u);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0u, 0u);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1u, 0u);
+
+	// Draws read the command and fetch the indices written above.
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void
+bonobo::InstanceCuller::compact_with_transform_feedback(InstanceBuffer& instances)
+{
+	// Test one point per instance, the geometry shader only letting the
+	// visible ones through to the feedback buffer.
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(_empty_vao);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, _feedback);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0u, instances._visible_instances_buffer);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(instances._instances_nb));
+	glEndTransformFeedback();
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0u, 0u);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0u);
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	GLboolean const was_blending = glIsEnabled(GL_BLEND);
+	GLint blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha, blend_equation_rgb, blend_equation_alpha;
+	glGetIntegerv(GL_BLEND_SRC_RGB, &blend_src_rgb);
+	glGetIntegerv(GL_BLEND_DST_RGB, &blend_dst_rgb);
+	glGetIntegerv(GL_BLEND_SRC_ALPHA, &blend_src_alpha);
+	glGetIntegerv(GL_BLEND_DST_ALPHA, &blend_dst_alpha);
+	glGetIntegerv(GL_BLEND_EQUATION_RGB, &blend_equation_rgb);
+	glGetIntegerv(GL_BLEND_EQUATION_ALPHA, &blend_equation_alpha);
+
+	// Count the captured points, by adding them up into a single texel;
+	// floats hold exact counts up to 2^24 instances.
+	glViewport(0, 0, 1, 1);
+	glBindFramebuffer(GL_FRAMEBUFFER, _count_fbo);
+	GLfloat const zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glUseProgram(_count_program);
+	glDrawTransformFeedback(GL_POINTS, _feedback);
+	glDisable(GL_BLEND);
+
+	// Convert the count to an integer, and copy it into the instance
+	// count of the command; reading into a buffer does not stall.
+	using namespace bonobo::literals;
+	glBindFramebuffer(GL_FRAMEBUFFER, _stored_count_fbo);
+	glUseProgram(_store_count_program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, _count_texture);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(_store_count_program, "instances_count"_hash), 0);
+	glDrawArrays(GL_POINTS, 0, 1);
+	glBindTexture(GL_TEXTURE_2D, 0u);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, instances._indirect_buffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>(sizeof(GLuint)));
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0u);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0u);
+	glBindVertexArray(0u);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	if (was_blending)
+		glEnable(GL_BLEND);
+	glBlendEquationSeparate(static_cast<GLenum>(blend_equation_rgb), static_cast<GLenum>(blend_equation_alpha));
+	glBlendFuncSeparate(static_cast<GLenum>(blend_src_rgb), static_cast<GLenum>(blend_dst_rgb),
+	                    static_cast<GLenum>(blend_src_alpha), static_cast<GLenum>(blend_dst_alpha));
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+class Node;
+
+namespace bonobo
+{
+	class InstanceBuffer;
+
+	//! \brief Frustum culling of the instances of nodes, run on the GPU.
+	//!
+	//! Visible instances get compacted into a list of indices, and their
+	//! number is written into an indirect draw command, both held by the
+	//! `InstanceBuffer`; the following draws of the node then only cover
+	//! those instances, without the CPU reading anything back, so that the
+	//! cost of submitting stays the same whatever the number of instances.
+	//!
+	//! Instances are tested by a compute shader where OpenGL 4.3 is
+	//! available. Otherwise, a vertex and geometry shader pair compacts
+	//! them through transform feedback; the number of primitives captured
+	//! is then counted by drawing them as points into a single texel, and
+	//! copied into the command through a pixel pack buffer.
+	class InstanceCuller
+	{
+	public:
+		//! \brief Build the programs and objects needed for culling.
+		InstanceCuller();
+
+		//! \brief Release the programs and objects.
+		~InstanceCuller();
+
+		InstanceCuller(InstanceCuller const&) = delete;
+		InstanceCuller& operator=(InstanceCuller const&) = delete;
+
+		//! \brief Whether culling is possible, i.e. whether the programs
+		//!        could be built.
+		bool is_valid() const;
+
+		//! \brief Whether culling uses a compute shader, rather than
+		//!        transform feedback.
+		bool uses_compute_shaders() const;
+
+		//! \brief Cull the instances of a node against a frustum.
+		//!
+		//! Modifies the current program, vertex array and framebuffer; the
+		//! viewport and blending state are restored.
+		//!
+		//! @param [in] instances instance buffer of `node`, receiving the
+		//!             results
+		//! @param [in] node instanced node, giving the mesh to draw and
+		//!             the transform applied to all instances; its mesh
+		//!             needs known bounds
+		//! @param [in] world_to_clip Matrix transforming from world-space
+		//!             to clip-space of the view
+		void cull(InstanceBuffer& instances, Node const& node, glm::mat4 const& world_to_clip);
+
+	private:
+		static void reserve(InstanceBuffer& instances);
+		void compact_with_compute_shader(InstanceBuffer& instances);
+		void compact_with_transform_feedback(InstanceBuffer& instances);
+
+		bool _use_compute_shaders;
+		GLuint _cull_program{0u};
+
+		// Objects used by the transform feedback path
+		GLuint _count_program{0u};
+		GLuint _store_count_program{0u};
+		GLuint _feedback{0u};
+		GLuint _empty_vao{0u};
+		GLuint _count_texture{0u};
+		GLuint _count_fbo{0u};
+		GLuint _stored_count_texture{0u};
+		GLuint _stored_count_fbo{0u};
+	};
+}
@@ -0,0 +1,401 @@
+#include "LevelOfDetail.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+	// Sum of the squared distances to a set of planes, stored as the
+	// coefficients of its quadratic form. Doubles are used as summing
+	// many planes quickly loses precision.
+	struct Quadric {
+		double a00{0.0}, a01{0.0}, a02{0.0}, a11{0.0}, a12{0.0}, a22{0.0};
+		double b0{0.0}, b1{0.0}, b2{0.0};
+		double c{0.0};
+
+		void add_plane(glm::dvec3 const& n, double d)
+		{
+			a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z;
+			a11 += n.y * n.y; a12 += n.y * n.z; a22 += n.z * n.z;
+			b0 += n.x * d; b1 += n.y * d; b2 += n.z * d;
+			c += d * d;
+		}
+
+		void add(Quadric const& other)
+		{
+			a00 += other.a00; a01 += other.a01; a02 += other.a02;
+			a11 += other.a11; a12 += other.a12; a22 += other.a22;
+			b0 += other.b0; b1 += other.b1; b2 += other.b2;
+			c += other.c;
+		}
+
+		double evaluate(glm::vec3 const& point) const
+		{
+			double const x = point.x, y = point.y, z = point.z;
+			return a00 * x * x + a11 * y * y + a22 * z * z
+			     + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			     + 2.0 * (b0 * x + b1 * y + b2 * z)
+			     + c;
+		}
+	};
+
+	// Cheapest merge of vertex `from` into one of its neighbours, valid
+	// while the neighbourhood of `from` is left untouched.
+	struct Collapse {
+		float cost;
+		GLuint from;
+		std::uint32_t version;
+
+		// Cheapest collapses come first out of the queue.
+		bool operator<(Collapse const& other) const { return cost > other.cost; }
+	};
+
+	struct PositionHash {
+		std::size_t operator()(glm::vec3 const& position) const
+		{
+			// Adding zero turns -0.0 into 0.0, as both compare equal.
+			glm::vec3 const normalised = position + glm::vec3(0.0f);
+			std::array<std::uint32_t, 3> bits;
+			std::memcpy(bits.data(), &normalised, sizeof(bits));
+			return (static_cast<std::size_t>(bits[0]) * 73856093u)
+			     ^ (static_cast<std::size_t>(bits[1]) * 19349663u)
+			     ^ (static_cast<std::size_t>(bits[2]) * 83492791u);
+		}
+	};
+
+	std::uint64_t edge_key(GLuint a, GLuint b)
+	{
+		return (static_cast<std::uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	}
+
+	class Simplifier
+	{
+	public:
+		Simplifier(glm::vec3 const* vertices, std::size_t vertices_nb, GLuint const* indices, std::size_t triangles_nb) :
+			_positions(vertices), _triangles(triangles_nb), _is_triangle_alive(triangles_nb, 1u), _alive_triangles_nb(triangles_nb),
+			_quadrics(vertices_nb), _vertex_triangles(vertices_nb), _is_locked(vertices_nb, 0u), _is_removed(vertices_nb, 0u),
+			_versions(vertices_nb, 0u)
+		{
+			for (std::size_t t = 0u; t < triangles_nb; ++t)
+				_triangles[t] = { { indices[3u * t], indices[3u * t + 1u], indices[3u * t + 2u] } };
+
+			lock_seams_and_borders();
+
+			for (std::size_t t = 0u; t < triangles_nb; ++t) {
+				auto const& triangle = _triangles[t];
+				glm::dvec3 const p0 = _positions[triangle[0]];
+				glm::dvec3 normal = glm::cross(glm::dvec3(_positions[triangle[1]]) - p0, glm::dvec3(_positions[triangle[2]]) - p0);
+				double const length = glm::length(normal);
+				for (auto const vertex : triangle)
+					_vertex_triangles[vertex].push_back(static_cast<std::uint32_t>(t));
+				if (length <= 0.0)
+					continue;
+				normal /= length;
+				for (auto const vertex : triangle)
+					_quadrics[vertex].add_plane(normal, -glm::dot(normal, p0));
+			}
+
+			for (std::size_t v = 0u; v < vertices_nb; ++v)
+				update(static_cast<GLuint>(v));
+		}
+
+		// Collapse edges until at most `target_triangles_nb` triangles are
+		// left, or no collapse is possible.
+		void simplify(std::size_t target_triangles_nb)
+		{
+			while (_alive_triangles_nb > target_triangles_nb && !_queue.empty()) {
+				auto const collapse = _queue.top();
+				_queue.pop();
+				if (collapse.version != _versions[collapse.from])
+					continue;
+
+				// Try the neighbours from the cheapest one, as the collapses
+				// onto some of them may be rejected; the vertex goes back
+				// into the queue if the first one allowed is not the
+				// cheapest collapse left.
+				gather_candidates(collapse.from);
+				// Candidates are copied, as applying a collapse gathers those
+				// of other vertices.
+				for (std::size_t i = 0u; i < _candidates.size(); ++i) {
+					auto const candidate = _candidates[i];
+					if (!can_apply(collapse.from, candidate.second))
+						continue;
+					if (!_queue.empty() && candidate.first > _queue.top().cost) {
+						_queue.push({ candidate.first, collapse.from, collapse.version });
+						break;
+					}
+					apply(collapse.from, candidate.second);
+					_max_cost = std::max(_max_cost, candidate.first);
+					break;
+				}
+			}
+		}
+
+		std::size_t get_triangles_nb() const
+		{
+			return _alive_triangles_nb;
+		}
+
+		std::vector<GLuint> get_indices() const
+		{
+			std::vector<GLuint> indices;
+			indices.reserve(3u * _alive_triangles_nb);
+			for (std::size_t t = 0u; t < _triangles.size(); ++t)
+				if (_is_triangle_alive[t])
+					indices.insert(indices.end(), _triangles[t].begin(), _triangles[t].end());
+			return indices;
+		}
+
+		// Distance matching the largest quadric error introduced so far
+		float get_error() const
+		{
+			return std::sqrt(std::max(_max_cost, 0.0f));
+		}
+
+	private:
+		void lock_seams_and_borders()
+		{
+			std::unordered_map<glm::vec3, GLuint, PositionHash> first_vertices;
+			first_vertices.reserve(_is_locked.size());
+			for (std::size_t v = 0u; v < _is_locked.size(); ++v) {
+				auto const insertion = first_vertices.emplace(_positions[v], static_cast<GLuint>(v));
+				if (!insertion.second)
+					_is_locked[v] = _is_locked[insertion.first->second] = 1u;
+			}
+
+			// Edges used by a single triangle lie on a border, while those
+			// used by more than two are not manifold.
+			std::unordered_map<std::uint64_t, std::uint32_t> edge_uses;
+			edge_uses.reserve(3u * _triangles.size());
+			for (auto const& triangle : _triangles)
+				for (std::size_t i = 0u; i < 3u; ++i)
+					++edge_uses[edge_key(triangle[i], triangle[(i + 1u) % 3u])];
+			for (auto const& edge : edge_uses) {
+				if (edge.second == 2u)
+					continue;
+				_is_locked[static_cast<std::size_t>(edge.first >> 32)] = 1u;
+				_is_locked[static_cast<std::size_t>(edge.first & 0xffffffffu)] = 1u;
+			}
+		}
+
+		// Queue the cheapest collapse of a vertex anew, invalidating the
+		// previous one.
+		void update(GLuint vertex)
+		{
+			++_versions[vertex];
+			if (_is_locked[vertex] || _is_removed[vertex])
+				return;
+			gather_candidates(vertex);
+			if (!_candidates.empty())
+				_queue.push({ _candidates.front().first, vertex, _versions[vertex] });
+		}
+
+		// Neighbours of a vertex, sorted by the cost of collapsing the
+		// vertex onto them
+		void gather_candidates(GLuint vertex)
+		{
+			gather_neighbours(vertex, _neighbours);
+			_candidates.clear();
+			for (auto const neighbour : _neighbours)
+				_candidates.emplace_back(static_cast<float>(_quadrics[vertex].evaluate(_positions[neighbour])), neighbour);
+			std::sort(_candidates.begin(), _candidates.end());
+		}
+
+		void gather_neighbours(GLuint vertex, std::vector<GLuint>& neighbours) const
+		{
+			neighbours.clear();
+			for (auto const t : _vertex_triangles[vertex]) {
+				if (!_is_triangle_alive[t])
+					continue;
+				for (auto const other : _triangles[t])
+					if (other != vertex)
+						neighbours.push_back(other);
+			}
+			std::sort(neighbours.begin(), neighbours.end());
+			neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		}
+
+		bool can_apply(GLuint from, GLuint to)
+		{
+			// Keep the surface manifold: both ends may only share the
+			// neighbours opposite to the edge.
+			std::size_t shared_triangles_nb = 0u;
+			for (auto const t : _vertex_triangles[from]) {
+				if (!_is_triangle_alive[t])
+					continue;
+				auto const& triangle = _triangles[t];
+				if (std::find(triangle.begin(), triangle.end(), to) != triangle.end())
+					++shared_triangles_nb;
+			}
+			if (shared_triangles_nb == 0u)
+				return false;
+			gather_neighbours(from, _from_neighbours);
+			gather_neighbours(to, _to_neighbours);
+			_shared_neighbours.clear();
+			std::set_intersection(_from_neighbours.begin(), _from_neighbours.end(),
+			                      _to_neighbours.begin(), _to_neighbours.end(),
+			                      std::back_inserter(_shared_neighbours));
+			if (_shared_neighbours.size() != shared_triangles_nb)
+				return false;
+
+			// Reject collapses folding over any of the moved triangles.
+			for (auto const t : _vertex_triangles[from]) {
+				if (!_is_triangle_alive[t])
+					continue;
+				auto const& triangle = _triangles[t];
+				if (std::find(triangle.begin(), triangle.end(), to) != triangle.end())
+					continue;
+				std::array<glm::vec3, 3> corners;
+				for (std::size_t i = 0u; i < 3u; ++i)
+					corners[i] = _positions[triangle[i]];
+				auto const before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				for (std::size_t i = 0u; i < 3u; ++i)
+					if (triangle[i] == from)
+						corners[i] = _positions[to];
+				auto const after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+					return false;
+			}
+			return true;
+		}
+
+		void apply(GLuint from, GLuint to)
+		{
+			for (auto const t : _vertex_triangles[from]) {
+				if (!_is_triangle_alive[t])
+					continue;
+				auto& triangle = _triangles[t];
+				if (std::find(triangle.begin(), triangle.end(), to) != triangle.end()) {
+					_is_triangle_alive[t] = 0u;
+					--_alive_triangles_nb;
+					continue;
+				}
+				std::replace(triangle.begin(), triangle.end(), from, to);
+				_vertex_triangles[to].push_back(t);
+			}
+			_vertex_triangles[from].clear();
+			_is_removed[from] = 1u;
+
+			auto& to_triangles = _vertex_triangles[to];
+			to_triangles.erase(std::remove_if(to_triangles.begin(), to_triangles.end(),
+			                                  [this](std::uint32_t t) { return !_is_triangle_alive[t]; }),
+			                   to_triangles.end());
+			_quadrics[to].add(_quadrics[from]);
+			++_versions[from];
+
+			// The neighbourhoods of `to` and of its neighbours changed.
+			update(to);
+			gather_neighbours(to, _to_neighbours);
+			for (auto const neighbour : _to_neighbours)
+				update(neighbour);
+		}
+
+		glm::vec3 const* _positions;
+		std::vector<std::array<GLuint, 3>> _triangles;
+		std::vector<std::uint8_t> _is_triangle_alive;
+		std::size_t _alive_triangles_nb;
+
+		std::vector<Quadric> _quadrics;
+		std::vector<std::vector<std::uint32_t>> _vertex_triangles;
+		std::vector<std::uint8_t> _is_locked;
+		std::vector<std::uint8_t> _is_removed;
+		std::vector<std::uint32_t> _versions;
+
+		std::priority_queue<Collapse> _queue;
+		float _max_cost{0.0f};
+
+		// Scratch space
+		std::vector<GLuint> _neighbours, _from_neighbours, _to_neighbours, _shared_neighbours;
+		std::vector<std::pair<float, GLuint>> _candidates;
+	};
+}
+
+std::vector<bonobo::SimplifiedIndices>
+bonobo::simplifyMesh(glm::vec3 const* vertices, std::size_t vertices_nb,
+                     GLuint const* indices, std::size_t indices_nb,
+                     std::size_t levels_nb, std::string& warning)
+{
+	// Below this many triangles, levels are not worth their draws.
+	constexpr std::size_t min_triangles_nb = 32u;
+
+	std::vector<SimplifiedIndices> levels;
+	warning.clear();
+	auto const triangles_nb = indices_nb / 3u;
+	if (vertices == nullptr || indices == nullptr || triangles_nb < 2u * min_triangles_nb || indices_nb % 3u != 0u)
+		return levels;
+	auto const invalid_index = std::find_if(indices, indices + indices_nb, [vertices_nb](GLuint index) { return index >= vertices_nb; });
+	if (invalid_index != indices + indices_nb) {
+		warning = "index " + std::to_string(*invalid_index) + " is past its " + std::to_string(vertices_nb)
+		        + " vertices, so it gets no levels of detail";
+		return levels;
+	}
+
+	Simplifier simplifier(vertices, vertices_nb, indices, triangles_nb);
+	auto previous_triangles_nb = triangles_nb;
+	while (levels.size() < levels_nb && previous_triangles_nb >= 2u * min_triangles_nb) {
+		simplifier.simplify(previous_triangles_nb / 2u);
+
+		// Stop once locked vertices prevent any meaningful reduction.
+		auto const current_triangles_nb = simplifier.get_triangles_nb();
+		if (10u * current_triangles_nb > 9u * previous_triangles_nb)
+			break;
+
+		levels.push_back({ simplifier.get_indices(), simplifier.get_error() });
+		previous_triangles_nb = current_triangles_nb;
+	}
+
+	return levels;
+}
+
+bonobo::LodSelector
+bonobo::LodSelector::perspective(float vertical_fov, float viewport_height, float max_error)
+{
+	LodSelector selector;
+	selector._pixels_per_unit = viewport_height / (2.0f * std::tan(0.5f * vertical_fov));
+	selector._is_orthographic = false;
+	selector._max_error = max_error;
+	return selector;
+}
+
+bonobo::LodSelector
+bonobo::LodSelector::orthographic(float view_height, float viewport_height, float max_error)
+{
+	LodSelector selector;
+	selector._pixels_per_unit = viewport_height / view_height;
+	selector._is_orthographic = true;
+	selector._max_error = max_error;
+	return selector;
+}
+
+std::size_t
+bonobo::LodSelector::select(std::vector<LevelOfDetail> const& lods, BoundingBox const& bounds,
+                            glm::mat4 const& model_to_world, glm::vec3 const& view_position) const
+{
+	if (lods.empty() || _pixels_per_unit <= 0.0f || !bounds.is_valid())
+		return 0u;
+
+	// Errors are measured in model-space, and scaled by the largest
+	// scaling of the transform.
+	auto const scale = std::max(glm::length(glm::vec3(model_to_world[0])),
+	                            std::max(glm::length(glm::vec3(model_to_world[1])), glm::length(glm::vec3(model_to_world[2]))));
+	auto pixels_per_unit = _pixels_per_unit * scale;
+	if (!_is_orthographic) {
+		auto const world_bounds = bounds.transform(model_to_world);
+		auto const closest_point = glm::clamp(view_position, world_bounds.min, world_bounds.max);
+		auto const distance = glm::distance(view_position, closest_point);
+		if (distance <= 0.0f)
+			return 0u;
+		pixels_per_unit /= distance;
+	}
+
+	std::size_t level = 0u;
+	while (level < lods.size() && lods[level].error * pixels_per_unit <= _max_error)
+		++level;
+	return level;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Culling.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Coarser version of a mesh, drawn from the same vertices with
+	//!        its own range of indices.
+	struct LevelOfDetail {
+		std::size_t first_index{0u}; //!< offset, in indices, of the first index of the level
+		std::size_t indices_nb{0u};  //!< number of indices of the level
+		float error{0.0f};           //!< model-space distance by which the level may deviate from the mesh
+	};
+
+	//! \brief Indices of a simplified version of a mesh.
+	struct SimplifiedIndices {
+		std::vector<GLuint> indices;
+		float error;
+	};
+
+	//! \brief Build coarser versions of a triangle mesh, each one with
+	//!        about half the triangles of the previous one.
+	//!
+	//! Edges are collapsed in order of their quadric error, each vertex
+	//! being merged into one of its neighbours, so that all levels keep
+	//! indexing the vertices of the mesh. Vertices on borders, or sharing
+	//! their position with others such as along texture seams, are never
+	//! moved, which keeps the outline and attributes of the mesh intact.
+	//!
+	//! Meshes get simplified from worker threads, so problems are handed
+	//! back to the caller rather than logged.
+	//!
+	//! @param [in] levels_nb how many levels to build at most; fewer are
+	//!             returned once the mesh can not be simplified further
+	//! @param [out] warning why no level was built, if the mesh was not
+	//!              valid; left empty otherwise
+	//! @return the levels, from the finest to the coarsest
+	std::vector<SimplifiedIndices> simplifyMesh(glm::vec3 const* vertices, std::size_t vertices_nb,
+	                                            GLuint const* indices, std::size_t indices_nb,
+	                                            std::size_t levels_nb, std::string& warning);
+
+	//! \brief Picks the level of detail of meshes seen from a view, as the
+	//!        coarsest one whose error covers at most a given number of
+	//!        pixels once projected.
+	class LodSelector
+	{
+	public:
+		//! \brief Selector always picking the mesh itself.
+		LodSelector() = default;
+
+		//! @param [in] vertical_fov vertical field of view, in radians
+		//! @param [in] viewport_height height of the target, in pixels
+		//! @param [in] max_error largest error tolerated, in pixels
+		static LodSelector perspective(float vertical_fov, float viewport_height, float max_error);
+
+		//! @param [in] view_height height of the view volume, in world units
+		//! @param [in] viewport_height height of the target, in pixels
+		//! @param [in] max_error largest error tolerated, in pixels
+		static LodSelector orthographic(float view_height, float viewport_height, float max_error);
+
+		//! \brief Pick the level of a mesh.
+		//!
+		//! @param [in] lods coarser levels of the mesh
+		//! @param [in] bounds model-space bounds of the mesh; the mesh
+		//!             itself is picked when they are unknown
+		//! @param [in] model_to_world Matrix transforming from the
+		//!             model-space of the mesh to world-space
+		//! @param [in] view_position world-space position of the view
+		//! @return 0 for the mesh itself, or i + 1 for `lods[i]`
+		std::size_t select(std::vector<LevelOfDetail> const& lods, BoundingBox const& bounds,
+		                   glm::mat4 const& model_to_world, glm::vec3 const& view_position) const;
+
+	private:
+		// Pixels covered by one unit of length, at a distance of one unit
+		// for perspective views and at any distance otherwise
+		float _pixels_per_unit{0.0f};
+		bool _is_orthographic{false};
+		float _max_error{0.0f};
+	};
+}
@@ -0,0 +1,155 @@
+#include "MappedFile.hpp"
+
+#include "core/AssetPack.hpp"
+#include "core/various.hpp"
+
+#include <utility>
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bonobo::MappedFile::MappedFile(std::string const& path, bool from_disk)
+{
+	if (auto const pack = !from_disk ? getMountedAssetPack() : nullptr) {
+		auto const asset = pack->find(path);
+		if (asset.data != nullptr && asset.size > 0u) {
+			_data = asset.data;
+			_size = asset.size;
+			_is_in_pack = true;
+			return;
+		}
+	}
+
+	map(path);
+}
+
+void
+bonobo::MappedFile::map(std::string const& path)
+{
+#if defined(_WIN32)
+	_file = ::CreateFileW(utils::widen(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+	                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (_file == INVALID_HANDLE_VALUE) {
+		_file = nullptr;
+		return;
+	}
+
+	LARGE_INTEGER size;
+	if (!::GetFileSizeEx(_file, &size) || size.QuadPart <= 0) {
+		release();
+		return;
+	}
+
+	_mapping = ::CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (_mapping == nullptr) {
+		release();
+		return;
+	}
+
+	_data = ::MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (_data == nullptr) {
+		release();
+		return;
+	}
+	_size = static_cast<std::size_t>(size.QuadPart);
+#else
+	int const file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return;
+
+	// The mapping keeps its own reference to the file.
+	struct stat status;
+	if (::fstat(file, &status) == 0 && status.st_size > 0) {
+		auto const size = static_cast<std::size_t>(status.st_size);
+		void* const data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data != MAP_FAILED) {
+			_data = data;
+			_size = size;
+		}
+	}
+	::close(file);
+#endif
+}
+
+bonobo::MappedFile::~MappedFile()
+{
+	release();
+}
+
+bonobo::MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+bonobo::MappedFile&
+bonobo::MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+	std::swap(_data, other._data);
+	std::swap(_size, other._size);
+	std::swap(_is_in_pack, other._is_in_pack);
+#if defined(_WIN32)
+	std::swap(_file, other._file);
+	std::swap(_mapping, other._mapping);
+#endif
+	return *this;
+}
+
+bool
+bonobo::MappedFile::is_valid() const
+{
+	return _data != nullptr;
+}
+
+void const*
+bonobo::MappedFile::data() const
+{
+	return _data;
+}
+
+std::size_t
+bonobo::MappedFile::size() const
+{
+	return _size;
+}
+
+bool
+bonobo::MappedFile::is_in_pack() const
+{
+	return _is_in_pack;
+}
+
+void
+bonobo::MappedFile::release()
+{
+	if (_is_in_pack) {
+		_data = nullptr;
+		_size = 0u;
+		_is_in_pack = false;
+		return;
+	}
+
+#if defined(_WIN32)
+	if (_data != nullptr)
+		::UnmapViewOfFile(_data);
+	if (_mapping != nullptr)
+		::CloseHandle(_mapping);
+	if (_file != nullptr)
+		::CloseHandle(_file);
+	_mapping = nullptr;
+	_file = nullptr;
+#else
+	if (_data != nullptr)
+		::munmap(const_cast<void*>(_data), _size);
+#endif
+	_data = nullptr;
+	_size = 0u;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace bonobo
+{
+	//! \brief Read-only mapping of a whole file into memory.
+	//!
+	//! Pages are only read from the disk when first accessed, and stay
+	//! shared with the file cache of the system, so that loading large
+	//! binary files costs neither a copy nor a parse. Files held by the
+	//! mounted asset pack, if any, are views into it instead.
+	class MappedFile
+	{
+	public:
+		//! \brief Map nothing.
+		MappedFile() = default;
+
+		//! \brief Find the given file in the mounted asset pack, or map
+		//!        it from the disk if the pack does not hold it.
+		//!
+		//! Failing to open or map the file is not reported, as it is
+		//! expected from missing caches; `is_valid()` tells whether it
+		//! succeeded.
+		//!
+		//! @param [in] from_disk whether to skip the pack, e.g. for files
+		//!             edited or rewritten since the pack was built
+		explicit MappedFile(std::string const& path, bool from_disk = false);
+
+		//! \brief Unmap the file.
+		~MappedFile();
+
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+		MappedFile(MappedFile const&) = delete;
+		MappedFile& operator=(MappedFile const&) = delete;
+
+		//! \brief Whether the file was mapped; empty files never are.
+		bool is_valid() const;
+
+		void const* data() const;
+		std::size_t size() const;
+
+		//! \brief Whether the mapping is a view into the asset pack.
+		bool is_in_pack() const;
+
+	private:
+		void map(std::string const& path);
+		void release();
+
+		void const* _data{nullptr};
+		std::size_t _size{0u};
+		bool _is_in_pack{false}; //!< whether the mapping belongs to the pack
+#if defined(_WIN32)
+		void* _file{nullptr};
+		void* _mapping{nullptr};
+#endif
+	};
+}
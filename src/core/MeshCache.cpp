@@ -0,0 +1,281 @@
+#include "MeshCache.hpp"
+
+#include "core/Log.h"
+#include "core/MappedFile.hpp"
+#include "core/MeshPool.hpp"
+#include "core/various.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	constexpr std::uint32_t cache_magic = 0x48534d42u; // "BMSH"
+	// Bumped whenever the layout of caches changes, so that older ones
+	// get rebuilt.
+	constexpr std::uint32_t cache_version = 2u;
+
+	// Everything is stored in native byte order, and padded so that
+	// arrays of vertices and indices start on 4-byte boundaries.
+	class Writer
+	{
+	public:
+		explicit Writer(std::ostream& stream) : _stream(stream)
+		{
+		}
+
+		template<typename T>
+		void write(T const& value)
+		{
+			write_bytes(&value, sizeof(T));
+		}
+
+		void write_bytes(void const* data, std::size_t size)
+		{
+			_stream.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+			_offset += size;
+		}
+
+		void write_string(std::string const& string)
+		{
+			write(static_cast<std::uint32_t>(string.size()));
+			write_bytes(string.data(), string.size());
+			char const padding[4] = { 0, 0, 0, 0 };
+			write_bytes(padding, (4u - _offset % 4u) % 4u);
+		}
+
+	private:
+		std::ostream& _stream;
+		std::size_t _offset{0u};
+	};
+
+	class Reader
+	{
+	public:
+		Reader(void const* data, std::size_t size) : _data(static_cast<char const*>(data)), _size(size)
+		{
+		}
+
+		template<typename T>
+		bool read(T& value)
+		{
+			auto const bytes = take(1u, sizeof(T));
+			if (bytes != nullptr)
+				std::memcpy(&value, bytes, sizeof(T));
+			return bytes != nullptr;
+		}
+
+		bool read_string(std::string& string)
+		{
+			std::uint32_t length = 0u;
+			if (!read(length))
+				return false;
+			auto const characters = take(length, 1u);
+			if (characters == nullptr || take((4u - _offset % 4u) % 4u, 1u) == nullptr)
+				return false;
+			string.assign(characters, length);
+			return true;
+		}
+
+		//! Skip over `count` elements of `size` bytes, returning where
+		//! they start or nullptr if the file is too short.
+		char const* take(std::uint64_t count, std::size_t size)
+		{
+			if (count > (_size - _offset) / size)
+				return nullptr;
+			auto const bytes = _data + _offset;
+			_offset += static_cast<std::size_t>(count) * size;
+			return bytes;
+		}
+
+	private:
+		char const* _data;
+		std::size_t _size;
+		std::size_t _offset{0u};
+	};
+
+	void write_mesh(Writer& writer, bonobo::CookedMesh const& mesh)
+	{
+		writer.write_string(mesh.name);
+		writer.write(mesh.format);
+		writer.write(mesh.material_id);
+		writer.write(static_cast<std::uint64_t>(mesh.vertices_nb));
+		writer.write(static_cast<std::uint64_t>(mesh.indices_nb));
+		writer.write(static_cast<std::uint64_t>(mesh.all_indices_nb));
+		writer.write(static_cast<std::uint32_t>(mesh.lods.size()));
+		for (auto const& lod : mesh.lods) {
+			writer.write(static_cast<std::uint64_t>(lod.first_index));
+			writer.write(static_cast<std::uint64_t>(lod.indices_nb));
+			writer.write(lod.error);
+		}
+		writer.write(mesh.bounding_box.min);
+		writer.write(mesh.bounding_box.max);
+		writer.write(mesh.bounding_sphere.centre);
+		writer.write(mesh.bounding_sphere.radius);
+		writer.write_bytes(mesh.vertices, mesh.vertices_nb * bonobo::MeshPool::get_stride(mesh.format));
+		writer.write_bytes(mesh.indices, mesh.all_indices_nb * sizeof(GLuint));
+	}
+
+	bool read_mesh(Reader& reader, bonobo::CookedMesh& mesh)
+	{
+		std::uint64_t vertices_nb = 0u, indices_nb = 0u, all_indices_nb = 0u;
+		std::uint32_t lods_nb = 0u;
+		if (!reader.read_string(mesh.name)
+		    || !reader.read(mesh.format) || !reader.read(mesh.material_id)
+		    || !reader.read(vertices_nb) || !reader.read(indices_nb) || !reader.read(all_indices_nb)
+		    || !reader.read(lods_nb))
+			return false;
+
+		auto const stride = bonobo::MeshPool::get_stride(mesh.format);
+		if ((mesh.format & 1u) == 0u || mesh.format >= (1u << 4u) || indices_nb > all_indices_nb)
+			return false;
+		mesh.vertices_nb = static_cast<std::size_t>(vertices_nb);
+		mesh.indices_nb = static_cast<std::size_t>(indices_nb);
+		mesh.all_indices_nb = static_cast<std::size_t>(all_indices_nb);
+
+		mesh.lods.resize(lods_nb);
+		for (auto& lod : mesh.lods) {
+			std::uint64_t first_index = 0u, lod_indices_nb = 0u;
+			if (!reader.read(first_index) || !reader.read(lod_indices_nb) || !reader.read(lod.error)
+			    || first_index > all_indices_nb || lod_indices_nb > all_indices_nb - first_index)
+				return false;
+			lod.first_index = static_cast<std::size_t>(first_index);
+			lod.indices_nb = static_cast<std::size_t>(lod_indices_nb);
+		}
+
+		if (!reader.read(mesh.bounding_box.min) || !reader.read(mesh.bounding_box.max)
+		    || !reader.read(mesh.bounding_sphere.centre) || !reader.read(mesh.bounding_sphere.radius))
+			return false;
+
+		mesh.vertices = reader.take(vertices_nb, stride);
+		mesh.indices = reinterpret_cast<GLuint const*>(reader.take(all_indices_nb, sizeof(GLuint)));
+		if (mesh.vertices == nullptr || mesh.indices == nullptr)
+			return false;
+
+		// Indices get checked, as a damaged cache would otherwise have the
+		// GPU read past the vertices of the mesh.
+		return std::all_of(mesh.indices, mesh.indices + mesh.all_indices_nb,
+		                   [vertices_nb](GLuint index) { return index < vertices_nb; });
+	}
+}
+
+std::uint64_t
+bonobo::hashSourceFile(std::string const& path, std::uint64_t settings)
+{
+	MappedFile const source(path);
+	if (!source.is_valid())
+		return 0u;
+
+	// 64-bit FNV-1a
+	std::uint64_t hash = 14695981039346656037ull;
+	auto const mix = [&hash](unsigned char byte) {
+		hash = (hash ^ byte) * 1099511628211ull;
+	};
+	auto const bytes = static_cast<unsigned char const*>(source.data());
+	for (std::size_t i = 0u; i < source.size(); ++i)
+		mix(bytes[i]);
+	for (std::size_t i = 0u; i < sizeof(settings); ++i)
+		mix(static_cast<unsigned char>(settings >> (8u * i)));
+
+	// 0 is kept for unreadable files.
+	return hash != 0u ? hash : 1u;
+}
+
+bool
+bonobo::writeMeshCache(std::string const& path, std::uint64_t source_hash, CookedObjects const& objects)
+{
+	auto const temporary_path = path + ".tmp";
+	{
+		std::ofstream file(utils::widen(temporary_path), std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			LogWarning("Failed to open \"%s\" for writing; meshes will not be cached.", temporary_path.c_str());
+			return false;
+		}
+
+		Writer writer(file);
+		writer.write(cache_magic);
+		writer.write(cache_version);
+		writer.write(source_hash);
+		writer.write(static_cast<std::uint32_t>(objects.materials.size()));
+		writer.write(static_cast<std::uint32_t>(objects.meshes.size()));
+		for (auto const& material : objects.materials) {
+			writer.write(static_cast<std::uint32_t>(material.size()));
+			for (auto const& texture : material) {
+				writer.write_string(texture.name);
+				writer.write_string(texture.path);
+				writer.write(static_cast<std::uint32_t>(texture.generate_mipmap ? 1u : 0u));
+			}
+		}
+		for (auto const& mesh : objects.meshes)
+			write_mesh(writer, mesh);
+
+		if (!file.good()) {
+			LogWarning("Failed to write \"%s\"; meshes will not be cached.", temporary_path.c_str());
+			file.close();
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+	}
+
+	std::remove(path.c_str());
+	if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+		LogWarning("Failed to move \"%s\" to \"%s\"; meshes will not be cached.", temporary_path.c_str(), path.c_str());
+		std::remove(temporary_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool
+bonobo::readMeshCache(MappedFile const& cache, std::uint64_t source_hash, CookedObjects& objects)
+{
+	objects = CookedObjects();
+	if (!cache.is_valid())
+		return false;
+
+	Reader reader(cache.data(), cache.size());
+	std::uint32_t magic = 0u, version = 0u;
+	std::uint64_t hash = 0u;
+	if (!reader.read(magic) || !reader.read(version) || !reader.read(hash)
+	    || magic != cache_magic || version != cache_version || hash != source_hash)
+		return false;
+
+	auto const read_objects = [&reader, &objects, &cache]() {
+		std::uint32_t materials_nb = 0u, meshes_nb = 0u;
+		// Every material and mesh takes at least four bytes.
+		if (!reader.read(materials_nb) || !reader.read(meshes_nb)
+		    || materials_nb > cache.size() / 4u || meshes_nb > cache.size() / 4u)
+			return false;
+
+		objects.materials.resize(materials_nb);
+		for (auto& material : objects.materials) {
+			std::uint32_t textures_nb = 0u;
+			if (!reader.read(textures_nb))
+				return false;
+			for (std::uint32_t i = 0u; i < textures_nb; ++i) {
+				TextureReference texture;
+				std::uint32_t generate_mipmap = 0u;
+				if (!reader.read_string(texture.name) || !reader.read_string(texture.path) || !reader.read(generate_mipmap))
+					return false;
+				texture.generate_mipmap = generate_mipmap != 0u;
+				material.push_back(std::move(texture));
+			}
+		}
+
+		objects.meshes.resize(meshes_nb);
+		for (auto& mesh : objects.meshes)
+			if (!read_mesh(reader, mesh))
+				return false;
+		return true;
+	};
+	if (!read_objects()) {
+		LogWarning("Mesh cache is damaged; it will be rebuilt.");
+		objects = CookedObjects();
+		return false;
+	}
+
+	return true;
+}
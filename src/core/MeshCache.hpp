@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Culling.hpp"
+#include "LevelOfDetail.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bonobo
+{
+	class MappedFile;
+
+	//! \brief Texture of a material, as referenced by an object file.
+	struct TextureReference {
+		std::string name;     //!< name of the sampler it gets bound to
+		std::string path;     //!< path of the image to load
+		bool generate_mipmap; //!< as given to `loadTexture2D()`
+	};
+
+	//! \brief Mesh as produced by importing an object file, ready to be
+	//!        copied into a `MeshPool`.
+	//!
+	//! The vertices and indices are only referenced, as they either live
+	//! in the mapping of a cache or in buffers kept by the importer.
+	struct CookedMesh {
+		std::string name;
+		std::uint32_t format{0u};       //!< attributes present, as returned by `MeshPool::get_format()`
+		std::uint32_t material_id{0u};  //!< index of the material of the mesh
+		std::size_t vertices_nb{0u};
+		void const* vertices{nullptr};  //!< vertices interleaved as by `MeshPool::interleave()`
+		std::size_t indices_nb{0u};     //!< number of indices of the mesh itself
+		std::size_t all_indices_nb{0u}; //!< number of indices of the mesh and of all its levels
+		GLuint const* indices{nullptr}; //!< indices of the mesh, followed by those of its levels
+		std::vector<LevelOfDetail> lods; //!< coarser levels, whose first index is relative to `indices`
+		BoundingBox bounding_box;
+		BoundingSphere bounding_sphere;
+	};
+
+	//! \brief Content of an object file, once imported.
+	struct CookedObjects {
+		std::vector<std::vector<TextureReference>> materials;
+		std::vector<CookedMesh> meshes;
+	};
+
+	//! \brief Hash the content of a file along with the settings used to
+	//!        cook it, identifying the caches built from it.
+	//!
+	//! @param [in] settings value changing whenever the cooked data would
+	//! @return the hash, or 0 if the file could not be read
+	std::uint64_t hashSourceFile(std::string const& path, std::uint64_t settings);
+
+	//! \brief Write cooked objects into a cache file.
+	//!
+	//! The file is written next to its destination before replacing it,
+	//! so that an interrupted write never leaves a truncated cache.
+	//!
+	//! @param [in] source_hash hash of the file the objects come from, as
+	//!             returned by `hashSourceFile()`
+	//! @return whether the cache could be written
+	bool writeMeshCache(std::string const& path, std::uint64_t source_hash, CookedObjects const& objects);
+
+	//! \brief Read cooked objects from a mapped cache file.
+	//!
+	//! Vertices and indices are not copied: the meshes point into the
+	//! mapping, which has to outlive them.
+	//!
+	//! @param [in] source_hash hash the cache was written with; caches of
+	//!             another source, settings or version are rejected
+	//! @return whether the cache was valid and up to date
+	bool readMeshCache(MappedFile const& cache, std::uint64_t source_hash, CookedObjects& objects);
+}
@@ -0,0 +1,252 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+
+namespace
+{
+	// FIFO post-transform cache, telling how many vertices of each
+	// triangle have to be transformed. A vertex is in the cache if it was
+	// inserted less than `cache_size` insertions ago.
+	class CacheSimulator
+	{
+	public:
+		CacheSimulator(std::size_t vertices_nb, std::size_t cache_size) :
+			_insertion_times(vertices_nb, 0u), _cache_size(cache_size), _time(cache_size + 1u)
+		{
+		}
+
+		unsigned int add_triangle(GLuint const* triangle)
+		{
+			unsigned int misses = 0u;
+			for (std::size_t i = 0u; i < 3u; ++i) {
+				auto& insertion_time = _insertion_times[triangle[i]];
+				if (_time - insertion_time > _cache_size) {
+					insertion_time = _time++;
+					++misses;
+				}
+			}
+			return misses;
+		}
+
+		void clear()
+		{
+			_time += _cache_size + 1u;
+		}
+
+	private:
+		std::vector<std::size_t> _insertion_times;
+		std::size_t _cache_size;
+		std::size_t _time;
+	};
+}
+
+float
+bonobo::computeACMR(GLuint const* indices, std::size_t indices_nb, std::size_t vertices_nb, std::size_t cache_size)
+{
+	auto const triangles_nb = indices_nb / 3u;
+	if (triangles_nb == 0u)
+		return 0.0f;
+
+	CacheSimulator cache(vertices_nb, cache_size);
+	std::size_t misses = 0u;
+	for (std::size_t t = 0u; t < triangles_nb; ++t)
+		misses += cache.add_triangle(indices + 3u * t);
+	return static_cast<float>(misses) / static_cast<float>(triangles_nb);
+}
+
+void
+bonobo::optimizeVertexCache(GLuint* indices, std::size_t indices_nb, std::size_t vertices_nb, std::size_t cache_size)
+{
+	auto const triangles_nb = indices_nb / 3u;
+	if (triangles_nb < 2u)
+		return;
+
+	// Triangles using each vertex, and how many of them are left to emit
+	std::vector<std::size_t> offsets(vertices_nb + 1u, 0u);
+	for (std::size_t i = 0u; i < 3u * triangles_nb; ++i)
+		++offsets[indices[i] + 1u];
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	std::vector<GLuint> vertex_triangles(3u * triangles_nb);
+	{
+		auto cursors = offsets;
+		for (std::size_t t = 0u; t < triangles_nb; ++t)
+			for (std::size_t k = 0u; k < 3u; ++k)
+				vertex_triangles[cursors[indices[3u * t + k]]++] = static_cast<GLuint>(t);
+	}
+	std::vector<std::size_t> live_triangles_nb(vertices_nb);
+	for (std::size_t v = 0u; v < vertices_nb; ++v)
+		live_triangles_nb[v] = offsets[v + 1u] - offsets[v];
+
+	std::vector<std::size_t> cache_times(vertices_nb, 0u);
+	std::vector<bool> is_emitted(triangles_nb, false);
+	std::vector<GLuint> dead_ends;
+	std::vector<GLuint> candidates;
+	std::vector<GLuint> ordered;
+	dead_ends.reserve(3u * triangles_nb);
+	ordered.reserve(3u * triangles_nb);
+	std::size_t time = cache_size + 1u;
+	std::size_t next_vertex = 0u;
+
+	// Once the last fan leads nowhere, continue from the most recently
+	// used vertex with triangles left, or else from the next vertex in
+	// input order.
+	auto const skip_dead_end = [&]() {
+		while (!dead_ends.empty()) {
+			auto const vertex = dead_ends.back();
+			dead_ends.pop_back();
+			if (live_triangles_nb[vertex] > 0u)
+				return vertex;
+		}
+		for (; next_vertex < vertices_nb; ++next_vertex)
+			if (live_triangles_nb[next_vertex] > 0u)
+				return static_cast<GLuint>(next_vertex);
+		return unused_vertex;
+	};
+
+	auto fanning_vertex = skip_dead_end();
+	while (fanning_vertex != unused_vertex) {
+		candidates.clear();
+		for (auto i = offsets[fanning_vertex]; i < offsets[fanning_vertex + 1u]; ++i) {
+			auto const t = vertex_triangles[i];
+			if (is_emitted[t])
+				continue;
+			is_emitted[t] = true;
+
+			for (std::size_t k = 0u; k < 3u; ++k) {
+				auto const vertex = indices[3u * t + k];
+				ordered.push_back(vertex);
+				dead_ends.push_back(vertex);
+				candidates.push_back(vertex);
+				--live_triangles_nb[vertex];
+				if (time - cache_times[vertex] > cache_size)
+					cache_times[vertex] = time++;
+			}
+		}
+
+		// Prefer the oldest vertex which stays in the cache while fanning
+		// around it, each of its triangles adding at most two vertices.
+		auto best_vertex = unused_vertex;
+		std::size_t best_priority = 0u;
+		for (auto const vertex : candidates) {
+			if (live_triangles_nb[vertex] == 0u)
+				continue;
+			std::size_t priority = 1u;
+			if (time - cache_times[vertex] + 2u * live_triangles_nb[vertex] <= cache_size)
+				priority += time - cache_times[vertex];
+			if (priority > best_priority) {
+				best_priority = priority;
+				best_vertex = vertex;
+			}
+		}
+		fanning_vertex = best_vertex != unused_vertex ? best_vertex : skip_dead_end();
+	}
+
+	std::copy(ordered.begin(), ordered.end(), indices);
+}
+
+void
+bonobo::optimizeOverdraw(GLuint* indices, std::size_t indices_nb, glm::vec3 const* positions,
+                         std::size_t vertices_nb, float threshold, std::size_t cache_size)
+{
+	auto const triangles_nb = indices_nb / 3u;
+	if (triangles_nb < 2u)
+		return;
+
+	// Hard boundaries, where none of the vertices of a triangle were in
+	// the cache: the order restarted elsewhere on the mesh.
+	CacheSimulator cache(vertices_nb, cache_size);
+	std::vector<std::size_t> hard_boundaries;
+	for (std::size_t t = 0u; t < triangles_nb; ++t)
+		if (cache.add_triangle(indices + 3u * t) == 3u || t == 0u)
+			hard_boundaries.push_back(t);
+	hard_boundaries.push_back(triangles_nb);
+
+	// Soft boundaries, wherever a cluster reaches an ACMR close to the one
+	// of the whole run of triangles it belongs to
+	std::vector<std::size_t> clusters;
+	for (std::size_t h = 0u; h + 1u < hard_boundaries.size(); ++h) {
+		auto const start = hard_boundaries[h];
+		auto const end = hard_boundaries[h + 1u];
+
+		cache.clear();
+		std::size_t run_misses = 0u;
+		for (auto t = start; t < end; ++t)
+			run_misses += cache.add_triangle(indices + 3u * t);
+		auto const run_acmr = static_cast<float>(run_misses) / static_cast<float>(end - start);
+
+		cache.clear();
+		clusters.push_back(start);
+		std::size_t cluster_misses = 0u;
+		std::size_t cluster_triangles_nb = 0u;
+		for (auto t = start; t < end; ++t) {
+			cluster_misses += cache.add_triangle(indices + 3u * t);
+			++cluster_triangles_nb;
+			if (t + 1u < end && static_cast<float>(cluster_misses) <= threshold * run_acmr * static_cast<float>(cluster_triangles_nb)) {
+				clusters.push_back(t + 1u);
+				cluster_misses = 0u;
+				cluster_triangles_nb = 0u;
+				cache.clear();
+			}
+		}
+	}
+	clusters.push_back(triangles_nb);
+
+	// Area-weighted centroid and normal of each cluster, and centroid of
+	// the whole mesh
+	auto const clusters_nb = clusters.size() - 1u;
+	std::vector<glm::vec3> centroids(clusters_nb, glm::vec3(0.0f));
+	std::vector<glm::vec3> normals(clusters_nb, glm::vec3(0.0f));
+	std::vector<float> areas(clusters_nb, 0.0f);
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (std::size_t c = 0u; c < clusters_nb; ++c) {
+		for (auto t = clusters[c]; t < clusters[c + 1u]; ++t) {
+			auto const& p0 = positions[indices[3u * t + 0u]];
+			auto const& p1 = positions[indices[3u * t + 1u]];
+			auto const& p2 = positions[indices[3u * t + 2u]];
+			auto const normal = glm::cross(p1 - p0, p2 - p0);
+			auto const area = glm::length(normal);
+			centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+			normals[c] += normal;
+			areas[c] += area;
+		}
+		mesh_centroid += centroids[c];
+		mesh_area += areas[c];
+	}
+	if (mesh_area > 0.0f)
+		mesh_centroid /= mesh_area;
+
+	std::vector<float> sort_keys(clusters_nb, 0.0f);
+	for (std::size_t c = 0u; c < clusters_nb; ++c) {
+		auto const normal_length = glm::length(normals[c]);
+		if (areas[c] > 0.0f && normal_length > 0.0f)
+			sort_keys[c] = glm::dot(centroids[c] / areas[c] - mesh_centroid, normals[c] / normal_length);
+	}
+
+	std::vector<std::size_t> order(clusters_nb);
+	std::iota(order.begin(), order.end(), std::size_t(0u));
+	std::stable_sort(order.begin(), order.end(),
+	                 [&sort_keys](std::size_t lhs, std::size_t rhs) { return sort_keys[lhs] > sort_keys[rhs]; });
+
+	std::vector<GLuint> ordered;
+	ordered.reserve(3u * triangles_nb);
+	for (auto const c : order)
+		ordered.insert(ordered.end(), indices + 3u * clusters[c], indices + 3u * clusters[c + 1u]);
+	std::copy(ordered.begin(), ordered.end(), indices);
+}
+
+std::vector<GLuint>
+bonobo::optimizeVertexFetch(GLuint* indices, std::size_t indices_nb, std::size_t vertices_nb)
+{
+	std::vector<GLuint> remap(vertices_nb, unused_vertex);
+	GLuint next_index = 0u;
+	for (std::size_t i = 0u; i < indices_nb; ++i) {
+		auto& new_index = remap[indices[i]];
+		if (new_index == unused_vertex)
+			new_index = next_index++;
+		indices[i] = new_index;
+	}
+	return remap;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Size of the post-transform vertex cache the triangle orders
+	//!        get optimised for, as a FIFO of vertices.
+	constexpr std::size_t vertex_cache_size = 16u;
+
+	//! \brief Value given by `optimizeVertexFetch()` to vertices which no
+	//!        triangle uses.
+	constexpr GLuint unused_vertex = std::numeric_limits<GLuint>::max();
+
+	//! \brief Average number of vertices transformed per triangle (ACMR),
+	//!        simulating a FIFO post-transform cache; it goes from 3, when
+	//!        nothing is reused, down to about 0.5 for regular grids.
+	float computeACMR(GLuint const* indices, std::size_t indices_nb, std::size_t vertices_nb,
+	                  std::size_t cache_size = vertex_cache_size);
+
+	//! \brief Reorder triangles so that consecutive ones share vertices
+	//!        still in the post-transform cache.
+	//!
+	//! Uses Tipsify (Sander et al., "Fast Triangle Reordering for Vertex
+	//! Locality and Reduced Overdraw", 2007), which fans around vertices
+	//! and runs in linear time.
+	void optimizeVertexCache(GLuint* indices, std::size_t indices_nb, std::size_t vertices_nb,
+	                         std::size_t cache_size = vertex_cache_size);
+
+	//! \brief Reorder clusters of triangles, as left by
+	//!        `optimizeVertexCache()`, so that those facing outwards get
+	//!        drawn first and occlude the others.
+	//!
+	//! Triangles get split into clusters wherever the order restarts from
+	//! unrelated vertices, and further wherever a cluster can end without
+	//! worsening its ACMR by more than `threshold`; clusters are then
+	//! sorted by how far out along their normal they lie from the centre of
+	//! the mesh.
+	void optimizeOverdraw(GLuint* indices, std::size_t indices_nb, glm::vec3 const* positions,
+	                      std::size_t vertices_nb, float threshold = 1.05f,
+	                      std::size_t cache_size = vertex_cache_size);
+
+	//! \brief Renumber vertices in the order triangles first use them, so
+	//!        that vertex fetches walk the vertex buffer linearly.
+	//!
+	//! @param [in,out] indices indices to renumber
+	//! @return the new index of each vertex, or `unused_vertex` for those
+	//!         no triangle uses, which can be dropped
+	std::vector<GLuint> optimizeVertexFetch(GLuint* indices, std::size_t indices_nb, std::size_t vertices_nb);
+}
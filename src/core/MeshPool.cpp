@@ -0,0 +1,412 @@
+#include "MeshPool.hpp"
+
+#include "core/helpers.hpp"
+#include "core/Log.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	// Binormals are not stored: shaders rebuild them from the normal, the
+	// tangent and its handedness.
+	constexpr std::size_t attributes_nb = 4u;
+
+	// Size of the buffer uploads go through, unless a mesh needs more
+	constexpr std::size_t staging_capacity = 4u << 20;
+
+	// How each attribute is stored. Positions stay full floats, as scenes
+	// span thousands of units; texture coordinates are half floats rather
+	// than UNORM16 as they may tile beyond [0, 1].
+	struct AttributeLayout {
+		GLint components_nb;
+		GLenum type;
+		GLboolean normalized;
+		std::size_t size;
+	};
+	constexpr std::array<AttributeLayout, attributes_nb> attribute_layouts = { {
+		{ 3, GL_FLOAT,      GL_FALSE, 3u * sizeof(GLfloat) }, // position
+		{ 2, GL_SHORT,      GL_TRUE,  2u * sizeof(GLshort) }, // octahedral normal
+		{ 2, GL_HALF_FLOAT, GL_FALSE, 2u * sizeof(GLhalf) },  // texture coordinates
+		{ 4, GL_BYTE,       GL_TRUE,  4u * sizeof(GLbyte) },  // octahedral tangent, handedness
+	} };
+
+	std::array<glm::vec3 const*, attributes_nb> get_attributes(bonobo::MeshPool::VertexStreams const& streams)
+	{
+		return { { streams.vertices, streams.normals, streams.texcoords, streams.tangents } };
+	}
+
+	// Map a direction onto the unit octahedron, whose lower half gets
+	// folded over the upper one, so that it fits in [-1, 1]^2.
+	glm::vec2 encode_octahedral(glm::vec3 const& direction)
+	{
+		auto const norm = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+		if (norm == 0.0f)
+			return glm::vec2(0.0f);
+		auto const v = direction / norm;
+		if (v.z >= 0.0f)
+			return glm::vec2(v.x, v.y);
+		return glm::vec2((1.0f - std::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f),
+		                 (1.0f - std::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	template<typename T>
+	T quantize_snorm(float value)
+	{
+		auto const max = static_cast<float>(std::numeric_limits<T>::max());
+		return static_cast<T>(std::round(glm::clamp(value, -1.0f, 1.0f) * max));
+	}
+
+	template<typename T>
+	void append(std::vector<std::uint8_t>& bytes, T const& value)
+	{
+		auto const first = reinterpret_cast<std::uint8_t const*>(&value);
+		bytes.insert(bytes.end(), first, first + sizeof(T));
+	}
+}
+
+bonobo::MeshPool::MeshPool(std::size_t arena_vertices_nb, std::size_t arena_indices_nb) :
+	_arena_vertices_nb(arena_vertices_nb), _arena_indices_nb(arena_indices_nb),
+	_is_staging_persistent(GLAD_GL_VERSION_4_4 != 0)
+{
+}
+
+bonobo::MeshPool::~MeshPool()
+{
+	release_staging();
+
+	for (auto& arena : _arenas) {
+		glDeleteVertexArrays(1, &arena.vao);
+		glDeleteBuffers(1, &arena.bo);
+		glDeleteBuffers(1, &arena.ibo);
+		if (arena.position_bo != 0u) {
+			glDeleteVertexArrays(1, &arena.depth_vao);
+			glDeleteBuffers(1, &arena.position_bo);
+		}
+	}
+	_arenas.clear();
+}
+
+bool
+bonobo::MeshPool::allocate(VertexStreams const& streams, GLuint const* indices, std::size_t indices_nb, mesh_data& mesh)
+{
+	if (streams.vertices == nullptr) {
+		LogError("Pooled meshes need vertices and indices.");
+		return false;
+	}
+
+	// Interleave the attributes before uploading them.
+	auto const vertex_data = interleave(streams);
+	return allocate(get_format(streams), vertex_data.data(), streams.vertices_nb, indices, indices_nb, mesh);
+}
+
+bool
+bonobo::MeshPool::allocate(std::uint32_t format, void const* vertices, std::size_t vertices_nb,
+                           GLuint const* indices, std::size_t indices_nb, mesh_data& mesh)
+{
+	if ((format & 1u) == 0u || vertices == nullptr || vertices_nb == 0u || indices == nullptr || indices_nb == 0u) {
+		LogError("Pooled meshes need vertices and indices.");
+		return false;
+	}
+	if (format >= (1u << attributes_nb)) {
+		LogError("Mesh \"%s\" has an unknown vertex format 0x%x.", mesh.name.c_str(), format);
+		return false;
+	}
+	if (vertices_nb > static_cast<std::size_t>(std::numeric_limits<GLint>::max())) {
+		LogError("Mesh \"%s\" has too many vertices to be pooled.", mesh.name.c_str());
+		return false;
+	}
+
+	auto const index_type = vertices_nb <= 65536u ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	auto& arena = get_arena(format, index_type, vertices_nb, indices_nb);
+	auto const stride = get_stride(format);
+
+	std::memcpy(stage_upload(arena.bo, arena.vertices_nb * stride, vertices_nb * stride), vertices, vertices_nb * stride);
+	if (arena.position_bo != 0u) {
+		// Positions always come first in a vertex.
+		auto const positions = static_cast<std::uint8_t*>(stage_upload(arena.position_bo, arena.vertices_nb * sizeof(glm::vec3),
+		                                                               vertices_nb * sizeof(glm::vec3)));
+		for (std::size_t v = 0u; v < vertices_nb; ++v)
+			std::memcpy(positions + v * sizeof(glm::vec3), static_cast<std::uint8_t const*>(vertices) + v * stride, sizeof(glm::vec3));
+	}
+
+	if (index_type == GL_UNSIGNED_SHORT) {
+		auto const short_indices = static_cast<GLushort*>(stage_upload(arena.ibo, arena.indices_nb * sizeof(GLushort),
+		                                                               indices_nb * sizeof(GLushort)));
+		std::copy(indices, indices + indices_nb, short_indices);
+	} else {
+		std::memcpy(stage_upload(arena.ibo, arena.indices_nb * sizeof(GLuint), indices_nb * sizeof(GLuint)),
+		            indices, indices_nb * sizeof(GLuint));
+	}
+	if (!_is_batching_uploads)
+		flush_uploads();
+
+	mesh.vao = arena.vao;
+	mesh.depth_vao = arena.depth_vao;
+	mesh.bo = arena.bo;
+	mesh.ibo = arena.ibo;
+	mesh.vertices_nb = vertices_nb;
+	mesh.indices_nb = indices_nb;
+	mesh.first_index = arena.indices_nb;
+	mesh.base_vertex = static_cast<GLint>(arena.vertices_nb);
+	mesh.index_type = index_type;
+
+	arena.vertices_nb += vertices_nb;
+	arena.indices_nb += indices_nb;
+
+	return true;
+}
+
+void
+bonobo::MeshPool::begin_uploads()
+{
+	_is_batching_uploads = true;
+}
+
+void
+bonobo::MeshPool::end_uploads()
+{
+	flush_uploads();
+	_is_batching_uploads = false;
+}
+
+void*
+bonobo::MeshPool::stage_upload(GLuint buffer, std::size_t offset, std::size_t size)
+{
+	auto staging_offset = (_staging_offset + 3u) & ~std::size_t(3u);
+	if (staging_offset + size > _staging_capacity) {
+		flush_uploads();
+		if (size > _staging_capacity) {
+			release_staging();
+			create_staging(std::max(size, staging_capacity));
+		}
+		// Copies out of a persistent staging buffer may still be pending
+		// on the GPU, and have to be waited for before overwriting it.
+		if (_staging_fence != nullptr) {
+			glClientWaitSync(_staging_fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+			glDeleteSync(_staging_fence);
+			_staging_fence = nullptr;
+		}
+		staging_offset = 0u;
+	}
+
+	if (_staging_data == nullptr) {
+		// Without persistent mappings, the buffer gets orphaned rather
+		// than waiting for the copies out of it.
+		glBindBuffer(GL_COPY_READ_BUFFER, _staging_bo);
+		_staging_data = static_cast<std::uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, static_cast<GLsizeiptr>(_staging_capacity),
+		                                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0u);
+		assert(_staging_data != nullptr);
+	}
+
+	_pending_uploads.push_back({ buffer, static_cast<GLintptr>(staging_offset), static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size) });
+	_staging_offset = staging_offset + size;
+	return _staging_data + staging_offset;
+}
+
+void
+bonobo::MeshPool::flush_uploads()
+{
+	if (_pending_uploads.empty())
+		return;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, _staging_bo);
+	if (!_is_staging_persistent) {
+		if (glUnmapBuffer(GL_COPY_READ_BUFFER) == GL_FALSE)
+			LogError("Mesh pool staging buffer got corrupted; some meshes will be garbled.");
+		_staging_data = nullptr;
+		_staging_offset = 0u;
+	}
+	for (auto const& upload : _pending_uploads) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, upload.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, upload.staging_offset, upload.offset, upload.size);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0u);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0u);
+	_pending_uploads.clear();
+
+	// The latest fence covers all the copies issued before it.
+	if (_is_staging_persistent) {
+		if (_staging_fence != nullptr)
+			glDeleteSync(_staging_fence);
+		_staging_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0u);
+	}
+}
+
+void
+bonobo::MeshPool::create_staging(std::size_t capacity)
+{
+	glGenBuffers(1, &_staging_bo);
+	assert(_staging_bo != 0u);
+	glBindBuffer(GL_COPY_READ_BUFFER, _staging_bo);
+	if (_is_staging_persistent) {
+		auto const flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_READ_BUFFER, static_cast<GLsizeiptr>(capacity), nullptr, flags);
+		_staging_data = static_cast<std::uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, static_cast<GLsizeiptr>(capacity), flags));
+		assert(_staging_data != nullptr);
+	} else {
+		glBufferData(GL_COPY_READ_BUFFER, static_cast<GLsizeiptr>(capacity), nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0u);
+	_staging_capacity = capacity;
+	_staging_offset = 0u;
+}
+
+void
+bonobo::MeshPool::release_staging()
+{
+	flush_uploads();
+	if (_staging_fence != nullptr)
+		glDeleteSync(_staging_fence);
+	if (_staging_bo != 0u) {
+		// Deleting a buffer unmaps it.
+		glDeleteBuffers(1, &_staging_bo);
+	}
+	_staging_fence = nullptr;
+	_staging_bo = 0u;
+	_staging_data = nullptr;
+	_staging_capacity = 0u;
+	_staging_offset = 0u;
+}
+
+std::uint32_t
+bonobo::MeshPool::get_format(VertexStreams const& streams)
+{
+	auto const attributes = get_attributes(streams);
+	std::uint32_t format = 0u;
+	for (std::size_t i = 0u; i < attributes_nb; ++i)
+		if (attributes[i] != nullptr)
+			format |= 1u << i;
+	return format;
+}
+
+std::size_t
+bonobo::MeshPool::get_stride(std::uint32_t format)
+{
+	std::size_t stride = 0u;
+	for (std::size_t i = 0u; i < attributes_nb; ++i)
+		if (format & (1u << i))
+			stride += attribute_layouts[i].size;
+	return stride;
+}
+
+std::vector<std::uint8_t>
+bonobo::MeshPool::interleave(VertexStreams const& streams)
+{
+	std::vector<std::uint8_t> vertex_data;
+	vertex_data.reserve(streams.vertices_nb * get_stride(get_format(streams)));
+	for (std::size_t v = 0u; v < streams.vertices_nb; ++v) {
+		append(vertex_data, streams.vertices[v]);
+		if (streams.normals != nullptr) {
+			auto const normal = encode_octahedral(streams.normals[v]);
+			append(vertex_data, quantize_snorm<GLshort>(normal.x));
+			append(vertex_data, quantize_snorm<GLshort>(normal.y));
+		}
+		if (streams.texcoords != nullptr) {
+			append(vertex_data, static_cast<GLhalf>(glm::packHalf1x16(streams.texcoords[v].x)));
+			append(vertex_data, static_cast<GLhalf>(glm::packHalf1x16(streams.texcoords[v].y)));
+		}
+		if (streams.tangents != nullptr) {
+			// The handedness tells whether the binormal is cross(n, t) or
+			// its opposite.
+			auto const& tangent = streams.tangents[v];
+			auto handedness = 1.0f;
+			if (streams.normals != nullptr && streams.binormals != nullptr
+			    && glm::dot(glm::cross(streams.normals[v], tangent), streams.binormals[v]) < 0.0f)
+				handedness = -1.0f;
+			auto const packed_tangent = encode_octahedral(tangent);
+			append(vertex_data, quantize_snorm<GLbyte>(packed_tangent.x));
+			append(vertex_data, quantize_snorm<GLbyte>(packed_tangent.y));
+			append(vertex_data, quantize_snorm<GLbyte>(handedness));
+			append(vertex_data, GLbyte(0));
+		}
+	}
+	return vertex_data;
+}
+
+bonobo::MeshPool::Arena&
+bonobo::MeshPool::get_arena(std::uint32_t format, GLenum index_type, std::size_t vertices_nb, std::size_t indices_nb)
+{
+	// Meshes go to the last arena of their format, while it has room.
+	auto const it = std::find_if(_arenas.rbegin(), _arenas.rend(), [format, index_type](Arena const& arena) {
+		return arena.format == format && arena.index_type == index_type;
+	});
+	if (it != _arenas.rend()
+	    && it->vertices_nb + vertices_nb <= it->vertices_capacity
+	    && it->indices_nb + indices_nb <= it->indices_capacity)
+		return *it;
+
+	Arena arena;
+	arena.format = format;
+	arena.index_type = index_type;
+	arena.vertices_capacity = std::max(_arena_vertices_nb, vertices_nb);
+	arena.vertices_nb = 0u;
+	arena.indices_capacity = std::max(_arena_indices_nb, indices_nb);
+	arena.indices_nb = 0u;
+
+	auto const stride = static_cast<GLsizei>(get_stride(format));
+
+	glGenVertexArrays(1, &arena.vao);
+	assert(arena.vao != 0u);
+	glBindVertexArray(arena.vao);
+
+	glGenBuffers(1, &arena.bo);
+	assert(arena.bo != 0u);
+	glBindBuffer(GL_ARRAY_BUFFER, arena.bo);
+	glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(arena.vertices_capacity * stride), nullptr, GL_STATIC_DRAW);
+
+	std::size_t offset = 0u;
+	for (std::size_t i = 0u; i < attributes_nb; ++i) {
+		if (!(format & (1u << i)))
+			continue;
+		auto const& layout = attribute_layouts[i];
+		glEnableVertexAttribArray(static_cast<unsigned int>(i));
+		glVertexAttribPointer(static_cast<unsigned int>(i), layout.components_nb, layout.type, layout.normalized,
+		                      stride, reinterpret_cast<GLvoid const*>(offset));
+		offset += layout.size;
+	}
+
+	glGenBuffers(1, &arena.ibo);
+	assert(arena.ibo != 0u);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.ibo);
+	auto const index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(arena.indices_capacity * index_size), nullptr, GL_STATIC_DRAW);
+
+	// Depth-only passes get a copy of the positions, tightly packed, so
+	// that they fetch none of the other attributes; it shares the
+	// indices of the arena.
+	arena.position_bo = 0u;
+	arena.depth_vao = arena.vao;
+	if (format != 1u) {
+		glGenVertexArrays(1, &arena.depth_vao);
+		assert(arena.depth_vao != 0u);
+		glBindVertexArray(arena.depth_vao);
+
+		glGenBuffers(1, &arena.position_bo);
+		assert(arena.position_bo != 0u);
+		glBindBuffer(GL_ARRAY_BUFFER, arena.position_bo);
+		glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(arena.vertices_capacity * sizeof(glm::vec3)), nullptr, GL_STATIC_DRAW);
+
+		auto const vertices_location = static_cast<unsigned int>(shader_bindings::vertices);
+		glEnableVertexAttribArray(vertices_location);
+		glVertexAttribPointer(vertices_location, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), reinterpret_cast<GLvoid const*>(0x0));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.ibo);
+	}
+
+	glBindVertexArray(0u);
+	glBindBuffer(GL_ARRAY_BUFFER, 0u);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0u);
+
+	LogInfo("Opened mesh pool arena for format 0x%x: %zu vertices, %zu %d-bit indices.", format, arena.vertices_capacity, arena.indices_capacity,
+	        index_type == GL_UNSIGNED_SHORT ? 16 : 32);
+
+	_arenas.push_back(arena);
+	return _arenas.back();
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bonobo
+{
+	struct mesh_data;
+
+	//! \brief Allocator packing static meshes into shared vertex and index
+	//!        buffers, with a single vertex array per vertex format.
+	//!
+	//! Meshes sharing a vertex array can then be drawn together, with
+	//! `glMultiDrawElementsIndirect()` or `glMultiDrawElementsBaseVertex()`,
+	//! each one being found through its first index and base vertex.
+	//! Vertices are interleaved, with the attributes laid out following
+	//! `bonobo::shader_bindings` and quantised down to 24 bytes: normals
+	//! and tangents are octahedral-encoded, the binormal being replaced
+	//! by the handedness of the tangent frame, and texture coordinates
+	//! are half floats; shaders decode them through
+	//! "shaders/vertex_attributes.glsl". Meshes with at most 65536 vertices get
+	//! 16-bit indices, and thus arenas of their own, as indices are
+	//! relative to the base vertex.
+	//!
+	//! Each arena also keeps the positions of its vertices on their own,
+	//! sourced by a second vertex array which depth-only passes use; see
+	//! `mesh_data::depth_vao`.
+	class MeshPool
+	{
+	public:
+		//! \brief Attribute streams of a mesh, made of one `glm::vec3` per
+		//!        vertex; absent attributes are left to nullptr.
+		//!
+		//! Binormals are only used to find the handedness of the tangents.
+		struct VertexStreams {
+			std::size_t vertices_nb{0u};
+			glm::vec3 const* vertices{nullptr};
+			glm::vec3 const* normals{nullptr};
+			glm::vec3 const* texcoords{nullptr};
+			glm::vec3 const* tangents{nullptr};
+			glm::vec3 const* binormals{nullptr};
+		};
+
+		//! @param [in] arena_vertices_nb how many vertices an arena can
+		//!             hold, unless a mesh needs more
+		//! @param [in] arena_indices_nb how many indices an arena can hold,
+		//!             unless a mesh needs more
+		explicit MeshPool(std::size_t arena_vertices_nb = 1u << 18, std::size_t arena_indices_nb = 1u << 20);
+		~MeshPool();
+
+		MeshPool(MeshPool const&) = delete;
+		MeshPool& operator=(MeshPool const&) = delete;
+
+		//! \brief Copy a mesh into the pool.
+		//!
+		//! Fills in the vertex array, buffers, first index, base vertex,
+		//! index type and counts of `mesh`; the buffers belong to the pool
+		//! and should not be deleted.
+		//!
+		//! @return whether the mesh could be allocated
+		bool allocate(VertexStreams const& streams, GLuint const* indices, std::size_t indices_nb, mesh_data& mesh);
+
+		//! \brief Copy a mesh whose vertices are already interleaved into
+		//!        the pool, e.g. straight from a cache file.
+		//!
+		//! @param [in] format attributes present, as returned by
+		//!             `get_format()`
+		//! @param [in] vertices `vertices_nb` vertices, laid out as
+		//!             returned by `interleave()`
+		//! @return whether the mesh could be allocated
+		bool allocate(std::uint32_t format, void const* vertices, std::size_t vertices_nb,
+		              GLuint const* indices, std::size_t indices_nb, mesh_data& mesh);
+
+		//! \brief Hold back the uploads of the meshes allocated from now
+		//!        on, so that they get copied to the GPU in batches.
+		//!
+		//! Meshes get written into a staging buffer, persistently mapped
+		//! where OpenGL 4.4 is available, and copied into their arenas
+		//! whenever it fills up or when calling `end_uploads()`.
+		void begin_uploads();
+
+		//! \brief Issue the pending uploads, and go back to uploading each
+		//!        mesh as it gets allocated.
+		void end_uploads();
+
+		//! \brief Get the vertex format of some streams: bit `i` is set
+		//!        when the attribute bound to location `i` is present.
+		static std::uint32_t get_format(VertexStreams const& streams);
+
+		//! \brief Get the size, in bytes, of a vertex of the given format.
+		static std::size_t get_stride(std::uint32_t format);
+
+		//! \brief Interleave and quantise the attributes of some streams,
+		//!        as laid out in the vertex buffers of the pool.
+		static std::vector<std::uint8_t> interleave(VertexStreams const& streams);
+
+	private:
+		// A vertex array along with the buffers it sources, holding
+		// meshes of a given vertex format. Arenas are never resized, so
+		// that the names handed out stay valid; a new one gets opened when
+		// the current one is full.
+		struct Arena {
+			std::uint32_t format;
+			GLenum index_type;
+			GLuint vao;
+			GLuint bo;
+			GLuint ibo;
+			GLuint depth_vao;   // sources position_bo, or is vao for position-only formats
+			GLuint position_bo; // positions alone, tightly packed
+			std::size_t vertices_capacity;
+			std::size_t vertices_nb;
+			std::size_t indices_capacity;
+			std::size_t indices_nb;
+		};
+
+		// A copy from the staging buffer into the buffer of an arena
+		struct PendingUpload {
+			GLuint buffer;
+			GLintptr staging_offset;
+			GLintptr offset;
+			GLsizeiptr size;
+		};
+
+		Arena& get_arena(std::uint32_t format, GLenum index_type, std::size_t vertices_nb, std::size_t indices_nb);
+
+		//! \brief Get `size` bytes of the staging buffer to write data
+		//!        into, which gets copied at `offset` in `buffer` on the
+		//!        next flush.
+		void* stage_upload(GLuint buffer, std::size_t offset, std::size_t size);
+		void flush_uploads();
+		void create_staging(std::size_t capacity);
+		void release_staging();
+
+		std::size_t _arena_vertices_nb;
+		std::size_t _arena_indices_nb;
+		std::vector<Arena> _arenas;
+
+		bool _is_staging_persistent;
+		bool _is_batching_uploads{false};
+		GLuint _staging_bo{0u};
+		std::uint8_t* _staging_data{nullptr}; //!< mapping of the staging buffer, if mapped
+		std::size_t _staging_capacity{0u};
+		std::size_t _staging_offset{0u};
+		GLsync _staging_fence{nullptr};       //!< set after copies out of a persistent staging buffer
+		std::vector<PendingUpload> _pending_uploads;
+	};
+}
@@ -0,0 +1,184 @@
+#include "OcclusionCuller.hpp"
+
+#include "core/helpers.hpp"
+#include "core/Log.h"
+#include "core/node.hpp"
+#include "core/ShaderProgramManager.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+bonobo::OcclusionCuller::OcclusionCuller()
+{
+	// Only the instance count of each command gets written, the other
+	// values being skipped over.
+	_test_program = ShaderProgramManager::CreateUnmanagedProgram({ { ShaderType::vertex, "test_occlusion.vert" } },
+	                                                             { "gl_SkipComponents1", "instance_count", "gl_SkipComponents3" });
+
+	glGenTransformFeedbacks(1, &_feedback);
+	assert(_feedback != 0u);
+	glGenVertexArrays(1, &_empty_vao);
+	assert(_empty_vao != 0u);
+	glGenBuffers(1, &_bounds_buffer);
+	assert(_bounds_buffer != 0u);
+	glGenTextures(1, &_bounds_texture);
+	assert(_bounds_texture != 0u);
+	glGenBuffers(1, &_commands_buffer);
+	assert(_commands_buffer != 0u);
+
+	_hiz_sampler = createSampler([](GLuint sampler) {
+		glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	});
+
+	if (!is_valid())
+		LogWarning("Occlusion culling is not available; see previous messages for details.");
+}
+
+bonobo::OcclusionCuller::~OcclusionCuller()
+{
+	if (_test_program != 0u) {
+		ShaderProgramManager::ForgetProgram(_test_program);
+		glDeleteProgram(_test_program);
+	}
+	_test_program = 0u;
+
+	glDeleteSamplers(1, &_hiz_sampler);
+	_hiz_sampler = 0u;
+	glDeleteBuffers(1, &_commands_buffer);
+	_commands_buffer = 0u;
+	glDeleteTextures(1, &_bounds_texture);
+	_bounds_texture = 0u;
+	glDeleteBuffers(1, &_bounds_buffer);
+	_bounds_buffer = 0u;
+	glDeleteVertexArrays(1, &_empty_vao);
+	_empty_vao = 0u;
+	glDeleteTransformFeedbacks(1, &_feedback);
+	_feedback = 0u;
+}
+
+bool
+bonobo::OcclusionCuller::is_valid() const
+{
+	return _test_program != 0u;
+}
+
+void
+bonobo::OcclusionCuller::set_nodes(std::vector<Node> const& nodes)
+{
+	std::vector<glm::vec4> bounds;
+	std::vector<DrawCommand> commands;
+	bounds.reserve(2u * nodes.size());
+	commands.reserve(nodes.size());
+	_is_culled.resize(nodes.size());
+	_first_command.resize(nodes.size());
+
+	// Each level of detail gets its own command, testing the same box, so
+	// that switching levels never rewrites the commands.
+	for (std::size_t i = 0u; i < nodes.size(); ++i) {
+		auto const& node = nodes[i];
+		_is_culled[i] = node._vao != 0u && node._instance_texture == 0u;
+		_first_command[i] = commands.size();
+
+		// Inverted boxes are never occluded.
+		auto const box = node.get_bounds().transform(node.get_transform().GetMatrix());
+		bool const has_bounds = _is_culled[i] && box.is_valid();
+		glm::vec4 const box_min(has_bounds ? box.min : glm::vec3(1.0f), 1.0f);
+		glm::vec4 const box_max(has_bounds ? box.max : glm::vec3(-1.0f), 1.0f);
+
+		if (!node._has_indices) {
+			commands.push_back({ static_cast<GLuint>(node._vertices_nb), 1u, 0u, 0, 0u });
+			bounds.push_back(box_min);
+			bounds.push_back(box_max);
+			continue;
+		}
+		for (std::size_t lod = 0u; lod <= node._lods.size(); ++lod) {
+			auto const index_range = node.get_index_range(lod);
+			commands.push_back({ static_cast<GLuint>(index_range.second), 1u, static_cast<GLuint>(index_range.first), node._base_vertex, 0u });
+			bounds.push_back(box_min);
+			bounds.push_back(box_max);
+		}
+	}
+
+	if (bounds != _bounds) {
+		_bounds = std::move(bounds);
+		glBindBuffer(GL_TEXTURE_BUFFER, _bounds_buffer);
+		glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(_bounds.size() * sizeof(glm::vec4)),
+		             _bounds.empty() ? nullptr : _bounds.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0u);
+
+		glBindTexture(GL_TEXTURE_BUFFER, _bounds_texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, _bounds_buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0u);
+	}
+
+	// Rewriting the commands throws the latest results away.
+	if (commands.size() != _commands.size()
+	    || std::memcmp(commands.data(), _commands.data(), commands.size() * sizeof(DrawCommand)) != 0) {
+		_commands = std::move(commands);
+		reset();
+	}
+}
+
+bonobo::DrawList::IndirectDraw
+bonobo::OcclusionCuller::get_draw(std::size_t index, std::size_t lod) const
+{
+	if (!is_valid() || index >= _is_culled.size() || !_is_culled[index])
+		return { 0u, 0 };
+
+	// Levels past the last one of the node draw its geometry instead.
+	auto const next_node_command = index + 1u < _first_command.size() ? _first_command[index + 1u] : _commands.size();
+	auto const command = _first_command[index] + lod < next_node_command ? _first_command[index] + lod : _first_command[index];
+	return { _commands_buffer, static_cast<GLintptr>(command * sizeof(DrawCommand)) };
+}
+
+void
+bonobo::OcclusionCuller::test(GLuint hiz_pyramid, GLint levels_nb, glm::mat4 const& world_to_clip)
+{
+	if (!is_valid() || _commands.empty())
+		return;
+
+	using namespace bonobo::literals;
+	glUseProgram(_test_program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, hiz_pyramid);
+	glBindSampler(0u, _hiz_sampler);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(_test_program, "hiz_texture"_hash), 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, _bounds_texture);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(_test_program, "object_bounds"_hash), 1);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(_test_program, "hiz_levels"_hash), levels_nb);
+	glUniformMatrix4fv(ShaderProgramManager::GetUniformLocation(_test_program, "world_to_clip"_hash), 1, GL_FALSE, glm::value_ptr(world_to_clip));
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(_empty_vao);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, _feedback);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0u, _commands_buffer);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(_commands.size()));
+	glEndTransformFeedback();
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0u, 0u);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0u);
+	glBindVertexArray(0u);
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0u);
+	glActiveTexture(GL_TEXTURE0);
+	glBindSampler(0u, 0u);
+	glBindTexture(GL_TEXTURE_2D, 0u);
+	glUseProgram(0u);
+}
+
+void
+bonobo::OcclusionCuller::reset()
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _commands_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, static_cast<GLsizeiptr>(_commands.size() * sizeof(DrawCommand)),
+	             _commands.empty() ? nullptr : _commands.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0u);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "DrawList.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+class Node;
+
+namespace bonobo
+{
+	//! \brief Occlusion culling of nodes against a hierarchical depth
+	//!        buffer, run on the GPU.
+	//!
+	//! Each node gets an indirect draw command per level of detail, whose
+	//! instance count is set to 0 or 1 by `test()`: the world-space box of
+	//! the node is projected, and the farthest depth of the Hi-Z texels
+	//! covering its screen-space rectangle is compared against the nearest
+	//! depth of the box. Draws then read those commands through `get_draw()`, so that
+	//! occluded nodes get skipped without the CPU reading anything back.
+	//!
+	//! The commands keep the results of the latest test until the next
+	//! one, so that the nodes found visible can be drawn as occluders
+	//! before testing all nodes again.
+	class OcclusionCuller
+	{
+	public:
+		//! \brief Build the program and objects needed for testing.
+		OcclusionCuller();
+
+		//! \brief Release the program and objects.
+		~OcclusionCuller();
+
+		OcclusionCuller(OcclusionCuller const&) = delete;
+		OcclusionCuller& operator=(OcclusionCuller const&) = delete;
+
+		//! \brief Whether culling is possible, i.e. whether the program
+		//!        could be built.
+		bool is_valid() const;
+
+		//! \brief Set the nodes to test, with their current transforms.
+		//!
+		//! The commands are only written anew, marking all nodes visible,
+		//! when the geometry of the nodes changes; nodes without known
+		//! bounds are always found visible, and instanced nodes are left
+		//! out.
+		void set_nodes(std::vector<Node> const& nodes);
+
+		//! \brief Where the parameters of the draw of a node are to be
+		//!        read from.
+		//!
+		//! @param [in] index index of the node, in the vector given to
+		//!             `set_nodes()`
+		//! @param [in] lod level of detail of the node to draw
+		//! @return the command of the node, or an empty draw if the node
+		//!         is not culled
+		DrawList::IndirectDraw get_draw(std::size_t index, std::size_t lod = 0u) const;
+
+		//! \brief Test all nodes against a Hi-Z pyramid.
+		//!
+		//! Modifies the current program and vertex array.
+		//!
+		//! @param [in] hiz_pyramid texture whose levels keep the farthest
+		//!             depth of the texels they cover in the level below
+		//! @param [in] levels_nb how many levels the pyramid has
+		//! @param [in] world_to_clip Matrix transforming from world-space
+		//!             to clip-space of the view the pyramid was rendered
+		//!             from
+		void test(GLuint hiz_pyramid, GLint levels_nb, glm::mat4 const& world_to_clip);
+
+		//! \brief Mark all nodes visible.
+		void reset();
+
+	private:
+		// Layout shared by glDrawElementsIndirect() and, using the first
+		// four values only, glDrawArraysIndirect()
+		struct DrawCommand {
+			GLuint count;
+			GLuint instance_count;
+			GLuint first;
+			GLint base_vertex;
+			GLuint base_instance;
+		};
+
+		GLuint _test_program{0u};
+		GLuint _feedback{0u};
+		GLuint _empty_vao{0u};
+		GLuint _hiz_sampler{0u};
+
+		// Two RGBA texels per command: the minimum and maximum corners of
+		// the world-space box of its node
+		GLuint _bounds_buffer{0u};
+		GLuint _bounds_texture{0u};
+		std::vector<glm::vec4> _bounds;
+
+		GLuint _commands_buffer{0u};
+		std::vector<DrawCommand> _commands;
+		std::vector<bool> _is_culled;
+		// Index of the command of the first level of each node
+		std::vector<std::size_t> _first_command;
+	};
+}
@@ -0,0 +1,93 @@
+#include "OcclusionQuery.hpp"
+
+#include "core/Log.h"
+
+bonobo::OcclusionQuery::OcclusionQuery(std::size_t latency) : _queries(latency > 0u ? latency : 1u, 0u)
+{
+	glGenQueries(static_cast<GLsizei>(_queries.size()), _queries.data());
+}
+
+bonobo::OcclusionQuery::~OcclusionQuery()
+{
+	glDeleteQueries(static_cast<GLsizei>(_queries.size()), _queries.data());
+	_queries.clear();
+}
+
+bool
+bonobo::OcclusionQuery::begin()
+{
+	if (_is_active) {
+		LogWarning("Occlusion query %u is already active: ignoring begin().", _last_issued);
+		return false;
+	}
+
+	// All queries are in flight: reusing the oldest one would mean waiting
+	// on the GPU for its result, so skip this test instead.
+	if (_pending_nb == _queries.size())
+		return false;
+
+	_last_issued = _queries[(_oldest + _pending_nb) % _queries.size()];
+	glBeginQuery(GL_ANY_SAMPLES_PASSED, _last_issued);
+	_is_active = true;
+	return true;
+}
+
+void
+bonobo::OcclusionQuery::end()
+{
+	if (!_is_active)
+		return;
+
+	glEndQuery(GL_ANY_SAMPLES_PASSED);
+	_is_active = false;
+	++_pending_nb;
+}
+
+bool
+bonobo::OcclusionQuery::poll()
+{
+	// Results become available in submission order, so stop at the first
+	// one which is not ready yet.
+	while (_pending_nb > 0u) {
+		GLuint is_available = GL_FALSE;
+		glGetQueryObjectuiv(_queries[_oldest], GL_QUERY_RESULT_AVAILABLE, &is_available);
+		if (is_available == GL_FALSE)
+			break;
+		retrieve_oldest();
+	}
+
+	return _was_visible;
+}
+
+void
+bonobo::OcclusionQuery::reset()
+{
+	_was_visible = true;
+	_discarded_nb = _pending_nb;
+}
+
+bool
+bonobo::OcclusionQuery::was_visible() const
+{
+	return _was_visible;
+}
+
+GLuint
+bonobo::OcclusionQuery::get_last_issued() const
+{
+	return _last_issued;
+}
+
+void
+bonobo::OcclusionQuery::retrieve_oldest()
+{
+	GLuint any_samples_passed = GL_TRUE;
+	glGetQueryObjectuiv(_queries[_oldest], GL_QUERY_RESULT, &any_samples_passed);
+	if (_discarded_nb > 0u)
+		--_discarded_nb;
+	else
+		_was_visible = any_samples_passed != GL_FALSE;
+
+	_oldest = (_oldest + 1u) % _queries.size();
+	--_pending_nb;
+}
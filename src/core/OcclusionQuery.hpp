@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Ring of OpenGL occlusion queries, used to find out whether
+	//!        a proxy geometry (typically a bounding box) ended up covering
+	//!        any sample.
+	//!
+	//! Results are never waited upon by the CPU: they are consumed one or
+	//! more frames after being issued, once the GPU made them available,
+	//! and no new query gets issued while all of them are in flight.
+	//! As results lag behind, they only hold for as long as neither the
+	//! proxy nor what occludes it moved; `reset()` has to be called when
+	//! either did. The query issued during the current frame can be used
+	//! with `glBeginConditionalRender()` to let the GPU skip the draw
+	//! calls depending on it.
+	class OcclusionQuery
+	{
+	public:
+		//! \brief Allocate the queries.
+		//!
+		//! @param [in] latency how many queries can be in flight at the
+		//!             same time; if all of them are still pending, no
+		//!             new one gets issued.
+		explicit OcclusionQuery(std::size_t latency = 3u);
+
+		//! \brief Release the queries.
+		~OcclusionQuery();
+
+		OcclusionQuery(OcclusionQuery const&) = delete;
+		OcclusionQuery& operator=(OcclusionQuery const&) = delete;
+
+		//! \brief Start counting the samples passing the depth test, for
+		//!        the draw calls issued until `end()` is called.
+		//!
+		//! @return whether a query was started; it is not while all of
+		//!         them are in flight, rather than waiting on the GPU.
+		bool begin();
+
+		//! \brief Stop the query started by `begin()`.
+		void end();
+
+		//! \brief Fetch all results which became available since the last
+		//!        call, without stalling.
+		//!
+		//! @return whether the most recently retrieved query had any
+		//!         sample pass; true if no result was ever retrieved.
+		bool poll();
+
+		//! \brief Forget about all results, including those of the queries
+		//!        still in flight, so that the proxy is considered visible
+		//!        until a query issued after this call gets retrieved.
+		void reset();
+
+		//! \brief Latest result retrieved by `poll()`.
+		bool was_visible() const;
+
+		//! \brief OpenGL name of the last query issued, to be used with
+		//!        `glBeginConditionalRender()`; 0 if none was issued.
+		GLuint get_last_issued() const;
+
+	private:
+		void retrieve_oldest();
+
+		std::vector<GLuint> _queries;
+		std::size_t         _oldest{0u};
+		std::size_t         _pending_nb{0u};
+		std::size_t         _discarded_nb{0u}; //!< pending queries issued before `reset()`
+		GLuint              _last_issued{0u};
+		bool                _is_active{false};
+		bool                _was_visible{true};
+	};
+}
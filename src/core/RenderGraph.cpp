@@ -0,0 +1,507 @@
+#include "RenderGraph.hpp"
+
+#include "helpers.hpp"
+
+#include "core/Log.h"
+#include "core/opengl.hpp"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <set>
+#include <utility>
+
+namespace
+{
+	using Version = std::pair<std::uint32_t, std::uint32_t>;
+
+	Version as_version(bonobo::RenderGraph::ResourceHandle handle)
+	{
+		return { handle.resource, handle.version };
+	}
+}
+
+bool
+bonobo::RenderGraph::TextureDesc::operator==(TextureDesc const& other) const
+{
+	return width == other.width && height == other.height
+	    && internal_format == other.internal_format && format == other.format
+	    && type == other.type && levels_nb == other.levels_nb;
+}
+
+bonobo::RenderGraph::PassBuilder::PassBuilder(RenderGraph& graph, std::size_t pass_index) : _graph(graph), _pass_index(pass_index)
+{
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::PassBuilder::read(ResourceHandle handle)
+{
+	if (!handle.is_valid() || handle.resource >= _graph._resources.size()) {
+		LogError("Pass \"%s\" reads an invalid resource.", _graph._passes[_pass_index].name.c_str());
+		return ResourceHandle{};
+	}
+
+	_graph._passes[_pass_index].reads.push_back(handle);
+	return handle;
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::PassBuilder::write_colour(ResourceHandle handle)
+{
+	auto const new_handle = write_resource(handle);
+	if (new_handle.is_valid())
+		_graph._passes[_pass_index].colour_attachments.push_back(handle.resource);
+	return new_handle;
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::PassBuilder::write_depth(ResourceHandle handle)
+{
+	auto const new_handle = write_resource(handle);
+	if (new_handle.is_valid())
+		_graph._passes[_pass_index].depth_attachment = handle.resource;
+	return new_handle;
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::PassBuilder::write(ResourceHandle handle)
+{
+	return write_resource(handle);
+}
+
+void
+bonobo::RenderGraph::PassBuilder::enable_if(std::function<bool ()> const& condition)
+{
+	_graph._passes[_pass_index].condition = condition;
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::PassBuilder::write_resource(ResourceHandle handle)
+{
+	auto& pass = _graph._passes[_pass_index];
+	if (!handle.is_valid() || handle.resource >= _graph._resources.size()) {
+		LogError("Pass \"%s\" writes to an invalid resource.", pass.name.c_str());
+		return ResourceHandle{};
+	}
+
+	auto& resource = _graph._resources[handle.resource];
+	if (handle.version + 1u != resource.versions_nb) {
+		LogError("Pass \"%s\" writes to version %u of \"%s\", which has already been written to.",
+		         pass.name.c_str(), handle.version, resource.name.c_str());
+		return ResourceHandle{};
+	}
+
+	pass.has_side_effects |= resource.is_imported;
+
+	ResourceHandle const new_handle{ handle.resource, resource.versions_nb++ };
+	pass.writes.push_back(new_handle);
+	return new_handle;
+}
+
+bonobo::RenderGraph::~RenderGraph()
+{
+	clear();
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::import_texture(std::string const& name, GLuint texture, TextureDesc const& desc)
+{
+	Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	resource.texture = texture;
+	resource.is_imported = true;
+	_resources.push_back(resource);
+	_is_compiled = false;
+
+	return ResourceHandle{ static_cast<std::uint32_t>(_resources.size() - 1u), 0u };
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::import_backbuffer(GLsizei width, GLsizei height)
+{
+	TextureDesc desc;
+	desc.width = width;
+	desc.height = height;
+
+	auto const handle = import_texture("Backbuffer", 0u, desc);
+	_resources[handle.resource].is_backbuffer = true;
+	return handle;
+}
+
+bonobo::RenderGraph::ResourceHandle
+bonobo::RenderGraph::create_texture(std::string const& name, TextureDesc const& desc)
+{
+	Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	_resources.push_back(resource);
+	_is_compiled = false;
+
+	return ResourceHandle{ static_cast<std::uint32_t>(_resources.size() - 1u), 0u };
+}
+
+void
+bonobo::RenderGraph::add_pass(std::string const& name, std::function<void (PassBuilder&)> const& setup, std::function<void ()> const& execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = execute;
+	_passes.push_back(pass);
+	_is_compiled = false;
+
+	PassBuilder builder(*this, _passes.size() - 1u);
+	setup(builder);
+}
+
+void
+bonobo::RenderGraph::mark_output(ResourceHandle handle)
+{
+	if (!handle.is_valid() || handle.resource >= _resources.size()) {
+		LogError("Trying to mark an invalid resource as output.");
+		return;
+	}
+
+	_outputs.push_back(handle);
+	_is_compiled = false;
+}
+
+bool
+bonobo::RenderGraph::compile()
+{
+	if (!sort_passes())
+		return false;
+	cull_passes();
+	allocate_transients();
+	_is_compiled = create_framebuffers();
+
+	return _is_compiled;
+}
+
+void
+bonobo::RenderGraph::execute() const
+{
+	if (!_is_compiled)
+		return;
+
+	for (auto const pass_index : _order) {
+		auto const& pass = _passes[pass_index];
+		if (pass.is_culled || (pass.condition && !pass.condition()))
+			continue;
+
+		if (utils::opengl::debug::isSupported())
+		{
+			glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, pass.name.size(), pass.name.data());
+		}
+
+		if (!pass.colour_attachments.empty() || pass.depth_attachment != ~0u) {
+			glBindFramebuffer(GL_FRAMEBUFFER, pass.fbo);
+			glViewport(0, 0, pass.width, pass.height);
+		}
+
+		pass.execute();
+
+		if (utils::opengl::debug::isSupported())
+		{
+			glPopDebugGroup();
+		}
+	}
+}
+
+void
+bonobo::RenderGraph::clear()
+{
+	for (auto const& framebuffer : _framebuffers)
+		if (framebuffer.second != 0u)
+			glDeleteFramebuffers(1, &framebuffer.second);
+	_framebuffers.clear();
+
+	if (!_allocated_textures.empty())
+		glDeleteTextures(static_cast<GLsizei>(_allocated_textures.size()), _allocated_textures.data());
+	_allocated_textures.clear();
+
+	_resources.clear();
+	_passes.clear();
+	_outputs.clear();
+	_order.clear();
+	_is_compiled = false;
+}
+
+GLuint
+bonobo::RenderGraph::get_texture(ResourceHandle handle) const
+{
+	if (!handle.is_valid() || handle.resource >= _resources.size())
+		return 0u;
+
+	return _resources[handle.resource].texture;
+}
+
+bonobo::RenderGraph::TextureDesc const&
+bonobo::RenderGraph::get_desc(ResourceHandle handle) const
+{
+	return _resources.at(handle.resource).desc;
+}
+
+void
+bonobo::RenderGraph::show_stats() const
+{
+	std::size_t transients_nb = 0u;
+	for (auto const& resource : _resources)
+		if (!resource.is_imported)
+			++transients_nb;
+	ImGui::Text("%zu transient textures backed by %zu allocations", transients_nb, _allocated_textures.size());
+
+	for (auto const pass_index : _order) {
+		auto const& pass = _passes[pass_index];
+		if (pass.is_culled)
+			ImGui::TextDisabled("%s (culled)", pass.name.c_str());
+		else
+			ImGui::Text("%s", pass.name.c_str());
+	}
+}
+
+bool
+bonobo::RenderGraph::sort_passes()
+{
+	std::map<Version, std::size_t> producers;
+	std::map<Version, std::vector<std::size_t>> readers;
+	for (std::size_t i = 0u; i < _passes.size(); ++i) {
+		for (auto const& handle : _passes[i].writes)
+			producers[as_version(handle)] = i;
+		for (auto const& handle : _passes[i].reads)
+			readers[as_version(handle)].push_back(i);
+	}
+
+	std::vector<std::set<std::size_t>> successors(_passes.size());
+	auto const add_edge = [&successors](std::size_t from, std::size_t to) {
+		if (from != to)
+			successors[from].insert(to);
+	};
+	for (std::size_t i = 0u; i < _passes.size(); ++i) {
+		// Read after write
+		for (auto const& handle : _passes[i].reads) {
+			auto const producer = producers.find(as_version(handle));
+			if (producer != producers.end())
+				add_edge(producer->second, i);
+			else if (handle.version > 0u || !_resources[handle.resource].is_imported)
+				LogWarning("Pass \"%s\" reads \"%s\", which is never written to.",
+				           _passes[i].name.c_str(), _resources[handle.resource].name.c_str());
+		}
+
+		// Write after write, and write after read
+		for (auto const& handle : _passes[i].writes) {
+			Version const previous{ handle.resource, handle.version - 1u };
+			auto const producer = producers.find(previous);
+			if (producer != producers.end())
+				add_edge(producer->second, i);
+			auto const previous_readers = readers.find(previous);
+			if (previous_readers != readers.end())
+				for (auto const reader : previous_readers->second)
+					add_edge(reader, i);
+		}
+	}
+
+	// Kahn's algorithm, preferring passes in declaration order when there
+	// is a choice.
+	std::vector<std::size_t> predecessors_nb(_passes.size(), 0u);
+	for (auto const& pass_successors : successors)
+		for (auto const successor : pass_successors)
+			++predecessors_nb[successor];
+
+	std::priority_queue<std::size_t, std::vector<std::size_t>, std::greater<std::size_t>> ready;
+	for (std::size_t i = 0u; i < _passes.size(); ++i)
+		if (predecessors_nb[i] == 0u)
+			ready.push(i);
+
+	_order.clear();
+	while (!ready.empty()) {
+		auto const pass_index = ready.top();
+		ready.pop();
+		_order.push_back(pass_index);
+		for (auto const successor : successors[pass_index])
+			if (--predecessors_nb[successor] == 0u)
+				ready.push(successor);
+	}
+
+	if (_order.size() != _passes.size()) {
+		LogError("The render graph contains a cycle.");
+		_order.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void
+bonobo::RenderGraph::cull_passes()
+{
+	std::set<Version> needed;
+	for (auto const& handle : _outputs)
+		needed.insert(as_version(handle));
+
+	for (auto it = _order.rbegin(); it != _order.rend(); ++it) {
+		auto& pass = _passes[*it];
+		pass.is_culled = !pass.has_side_effects
+		              && std::none_of(pass.writes.begin(), pass.writes.end(),
+		                              [&needed](ResourceHandle const& handle) {
+		                                  return needed.count(as_version(handle)) != 0u;
+		                              });
+		if (pass.is_culled)
+			continue;
+
+		for (auto const& handle : pass.reads)
+			needed.insert(as_version(handle));
+	}
+}
+
+void
+bonobo::RenderGraph::allocate_transients()
+{
+	// Find the first and last passes using each transient resource.
+	std::size_t const unused = ~static_cast<std::size_t>(0u);
+	std::vector<std::pair<std::size_t, std::size_t>> lifetimes(_resources.size(), { unused, 0u });
+	for (std::size_t position = 0u; position < _order.size(); ++position) {
+		auto const& pass = _passes[_order[position]];
+		if (pass.is_culled)
+			continue;
+
+		auto const extend = [&lifetimes, position](ResourceHandle const& handle) {
+			auto& lifetime = lifetimes[handle.resource];
+			lifetime.first = std::min(lifetime.first, position);
+			lifetime.second = std::max(lifetime.second, position);
+		};
+		std::for_each(pass.reads.begin(), pass.reads.end(), extend);
+		std::for_each(pass.writes.begin(), pass.writes.end(), extend);
+	}
+
+	// Outputs are used after the graph has been executed, so they must not
+	// be shared with any other resource.
+	for (auto const& handle : _outputs)
+		if (lifetimes[handle.resource].first != unused)
+			lifetimes[handle.resource].second = _order.size();
+
+	std::vector<std::uint32_t> transients;
+	for (std::uint32_t i = 0u; i < _resources.size(); ++i)
+		if (!_resources[i].is_imported && lifetimes[i].first != unused)
+			transients.push_back(i);
+	std::sort(transients.begin(), transients.end(), [&lifetimes](std::uint32_t lhs, std::uint32_t rhs) {
+		return lifetimes[lhs].first < lifetimes[rhs].first;
+	});
+
+	// Give each resource the first allocation with the same description
+	// which is no longer in use; allocate a new one otherwise.
+	struct Allocation {
+		TextureDesc desc;
+		GLuint      texture;
+		std::size_t last_use;
+	};
+	std::vector<Allocation> allocations;
+	for (auto const resource_index : transients) {
+		auto& resource = _resources[resource_index];
+		auto const& lifetime = lifetimes[resource_index];
+
+		auto allocation = std::find_if(allocations.begin(), allocations.end(),
+		                               [&resource, &lifetime](Allocation const& candidate) {
+		                                   return candidate.desc == resource.desc && candidate.last_use < lifetime.first;
+		                               });
+		if (allocation == allocations.end()) {
+			auto const& desc = resource.desc;
+			GLuint const texture = bonobo::createTexture(desc.width, desc.height, GL_TEXTURE_2D,
+			                                             desc.internal_format, desc.format, desc.type);
+			if (desc.levels_nb > 1) {
+				glBindTexture(GL_TEXTURE_2D, texture);
+				for (GLint level = 1; level < desc.levels_nb; ++level)
+					glTexImage2D(GL_TEXTURE_2D, level, desc.internal_format,
+					             std::max(desc.width >> level, 1), std::max(desc.height >> level, 1),
+					             0, desc.format, desc.type, nullptr);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, desc.levels_nb - 1);
+				glBindTexture(GL_TEXTURE_2D, 0u);
+			}
+			_allocated_textures.push_back(texture);
+			allocations.push_back({ desc, texture, lifetime.second });
+			allocation = allocations.end() - 1;
+		} else {
+			allocation->last_use = lifetime.second;
+		}
+
+		resource.texture = allocation->texture;
+	}
+}
+
+bool
+bonobo::RenderGraph::create_framebuffers()
+{
+	bool is_valid = true;
+	for (auto const pass_index : _order) {
+		auto& pass = _passes[pass_index];
+		if (pass.is_culled || (pass.colour_attachments.empty() && pass.depth_attachment == ~0u))
+			continue;
+
+		std::vector<std::uint32_t> attachments = pass.colour_attachments;
+		if (pass.depth_attachment != ~0u)
+			attachments.push_back(pass.depth_attachment);
+
+		auto const& first = _resources[attachments.front()];
+		pass.width = first.desc.width;
+		pass.height = first.desc.height;
+
+		auto const backbuffers_nb = std::count_if(attachments.begin(), attachments.end(),
+		                                          [this](std::uint32_t attachment) {
+		                                              return _resources[attachment].is_backbuffer;
+		                                          });
+		if (backbuffers_nb != 0) {
+			if (backbuffers_nb != static_cast<std::ptrdiff_t>(attachments.size())) {
+				LogError("Pass \"%s\" mixes the backbuffer with other attachments.", pass.name.c_str());
+				is_valid = false;
+			}
+			pass.fbo = 0u;
+			continue;
+		}
+
+		// Passes rendering to the same textures share their framebuffer;
+		// the depth attachment is tagged to tell it apart from colour ones.
+		std::vector<GLuint> key;
+		for (auto const attachment : pass.colour_attachments)
+			key.push_back(_resources[attachment].texture);
+		key.push_back(0u);
+		if (pass.depth_attachment != ~0u)
+			key.push_back(_resources[pass.depth_attachment].texture);
+
+		auto const framebuffer = _framebuffers.find(key);
+		if (framebuffer != _framebuffers.end()) {
+			pass.fbo = framebuffer->second;
+			continue;
+		}
+
+		std::vector<GLuint> colour_textures;
+		for (auto const attachment : pass.colour_attachments)
+			colour_textures.push_back(_resources[attachment].texture);
+		GLuint const depth_texture = pass.depth_attachment != ~0u ? _resources[pass.depth_attachment].texture : 0u;
+		pass.fbo = bonobo::createFBO(colour_textures, depth_texture);
+
+		// The draw buffers are part of the framebuffer state, so setting
+		// them once is enough.
+		glBindFramebuffer(GL_FRAMEBUFFER, pass.fbo);
+		std::vector<GLenum> draw_buffers;
+		for (std::size_t i = 0u; i < colour_textures.size(); ++i)
+			draw_buffers.push_back(static_cast<GLenum>(GL_COLOR_ATTACHMENT0 + i));
+		if (draw_buffers.empty()) {
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+		} else {
+			glDrawBuffers(static_cast<GLsizei>(draw_buffers.size()), draw_buffers.data());
+		}
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			LogError("Framebuffer of pass \"%s\" is incomplete.", pass.name.c_str());
+			is_valid = false;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0u);
+
+		_framebuffers.emplace(key, pass.fbo);
+	}
+
+	return is_valid;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Frame described as passes declaring which textures they read
+	//!        and write, rather than as a hand-written sequence of draw
+	//!        calls and framebuffer bindings.
+	//!
+	//! The graph is declared once, then compiled: passes get ordered
+	//! following their dependencies, passes whose results are never used
+	//! get culled, transient textures get allocated (sharing the same
+	//! OpenGL texture between transient textures whose lifetimes do not
+	//! overlap), and one framebuffer per set of attachments gets created
+	//! and validated. Executing the graph every frame then only binds
+	//! those framebuffers and calls the passes.
+	//!
+	//! Whenever the set of passes or the description of a texture has to
+	//! change, the graph should be cleared and declared anew.
+	class RenderGraph
+	{
+	public:
+		//! \brief Format and size of a texture handled by the graph.
+		struct TextureDesc {
+			GLsizei width{0};
+			GLsizei height{0};
+			GLint internal_format{GL_RGBA};
+			GLenum format{GL_RGBA};
+			GLenum type{GL_UNSIGNED_BYTE};
+			GLint levels_nb{1};              //!< how many mipmap levels to allocate
+
+			bool operator==(TextureDesc const& other) const;
+		};
+
+		//! \brief Refers to a given version of a resource: every write
+		//!        to a resource produces a new version of it.
+		struct ResourceHandle {
+			std::uint32_t resource{~0u};
+			std::uint32_t version{0u};
+
+			bool is_valid() const { return resource != ~0u; }
+		};
+
+		//! \brief Used by the passes to declare their inputs and outputs.
+		class PassBuilder
+		{
+		public:
+			//! \brief Declare that the pass samples the given version.
+			ResourceHandle read(ResourceHandle handle);
+
+			//! \brief Declare that the pass renders into the given
+			//!        resource, as the next colour attachment.
+			//!
+			//! @return the version of the resource produced by the pass
+			ResourceHandle write_colour(ResourceHandle handle);
+
+			//! \brief Declare that the pass renders into the given
+			//!        resource, as its depth attachment.
+			//!
+			//! @return the version of the resource produced by the pass
+			ResourceHandle write_depth(ResourceHandle handle);
+
+			//! \brief Declare that the pass writes to the given resource
+			//!        by its own means, e.g. attaching specific mipmap
+			//!        levels itself.
+			//!
+			//! @return the version of the resource produced by the pass
+			ResourceHandle write(ResourceHandle handle);
+
+			//! \brief Make the execution of the pass depend on a condition
+			//!        evaluated every frame.
+			//!
+			//! The outputs of a pass which does not get executed keep
+			//! whatever content they previously had; if they are
+			//! transient, that content is undefined.
+			void enable_if(std::function<bool ()> const& condition);
+
+		private:
+			friend class RenderGraph;
+			PassBuilder(RenderGraph& graph, std::size_t pass_index);
+			ResourceHandle write_resource(ResourceHandle handle);
+
+			RenderGraph& _graph;
+			std::size_t  _pass_index;
+		};
+
+		RenderGraph() = default;
+		~RenderGraph();
+
+		RenderGraph(RenderGraph const&) = delete;
+		RenderGraph& operator=(RenderGraph const&) = delete;
+
+		//! \brief Make a texture owned by the caller available to the
+		//!        passes; its content persists across frames, so passes
+		//!        writing to it are never culled.
+		ResourceHandle import_texture(std::string const& name, GLuint texture, TextureDesc const& desc);
+
+		//! \brief Make the default framebuffer available to the passes.
+		ResourceHandle import_backbuffer(GLsizei width, GLsizei height);
+
+		//! \brief Declare a texture whose content only lives during a
+		//!        frame; it is allocated by the graph.
+		ResourceHandle create_texture(std::string const& name, TextureDesc const& desc);
+
+		//! \brief Declare a pass.
+		//!
+		//! @param [in] name used for debug groups and error messages
+		//! @param [in] setup called right away, to declare the inputs and
+		//!             outputs of the pass
+		//! @param [in] execute called every frame the pass is run, with
+		//!             its framebuffer bound and the viewport covering its
+		//!             attachments
+		void add_pass(std::string const& name,
+		              std::function<void (PassBuilder&)> const& setup,
+		              std::function<void ()> const& execute);
+
+		//! \brief Declare that the given version has to be produced every
+		//!        frame, e.g. because it is displayed afterwards.
+		void mark_output(ResourceHandle handle);
+
+		//! \brief Order and cull the passes, allocate the transient
+		//!        textures and create the framebuffers.
+		//!
+		//! @return whether the graph is valid, i.e. without cycles nor
+		//!         incomplete framebuffers
+		bool compile();
+
+		//! \brief Run all the passes kept by `compile()`.
+		void execute() const;
+
+		//! \brief Forget all passes and resources, releasing the textures
+		//!        and framebuffers created by the graph.
+		void clear();
+
+		//! \brief OpenGL texture backing a resource; transient resources
+		//!        only have one once the graph is compiled.
+		GLuint get_texture(ResourceHandle handle) const;
+
+		//! \brief Description a resource was declared with.
+		TextureDesc const& get_desc(ResourceHandle handle) const;
+
+		//! \brief Add the list of passes, in execution order, and of the
+		//!        allocated textures to the current ImGui window.
+		void show_stats() const;
+
+	private:
+		struct Resource {
+			std::string name;
+			TextureDesc desc;
+			GLuint      texture{0u};
+			std::uint32_t versions_nb{1u};
+			bool        is_imported{false};
+			bool        is_backbuffer{false};
+		};
+
+		struct Pass {
+			std::string                    name;
+			std::function<void ()>         execute;
+			std::function<bool ()>         condition;
+			std::vector<ResourceHandle>    reads;
+			std::vector<ResourceHandle>    writes;
+			std::vector<std::uint32_t>     colour_attachments;
+			std::uint32_t                  depth_attachment{~0u};
+			GLuint                         fbo{0u};
+			GLsizei                        width{0};
+			GLsizei                        height{0};
+			bool                           has_side_effects{false};
+			bool                           is_culled{false};
+		};
+
+		bool sort_passes();
+		void cull_passes();
+		void allocate_transients();
+		bool create_framebuffers();
+
+		std::vector<Resource>       _resources;
+		std::vector<Pass>           _passes;
+		std::vector<ResourceHandle> _outputs;
+		std::vector<std::size_t>    _order;
+		std::vector<GLuint>         _allocated_textures;
+		std::map<std::vector<GLuint>, GLuint> _framebuffers;
+		bool                        _is_compiled{false};
+	};
+}
@@ -3,17 +3,191 @@
 #include "config.hpp"
 
 #include "Log.h"
+#include "MappedFile.hpp"
 #include "opengl.hpp"
+#include "UniformBuffer.hpp"
 #include "various.hpp"
 
 #include <imgui.h>
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #include <type_traits>
 
+namespace
+{
+	std::unordered_map<GLuint, ShaderProgramManager::ProgramReflection> program_reflections;
+
+	// Incremented whenever a program gets forgotten, so that uniform
+	// handles know their cached locations may be outdated.
+	std::uint32_t reflection_generation = 0u;
+
+	// Linked programs are cached as driver-specific binaries, one file per
+	// program named after its shaders, and keyed by everything which
+	// could change the binary: the resolved sources and the driver.
+	namespace binary_cache
+	{
+		constexpr std::uint32_t magic = 0x47525042u; // "BPRG"
+		// Bumped whenever the layout of cached programs changes.
+		constexpr std::uint32_t version = 1u;
+
+		struct Header {
+			std::uint32_t magic;
+			std::uint32_t version;
+			std::uint64_t key;
+			std::uint32_t binary_format;
+			std::uint32_t binary_length;
+		};
+
+		// 64-bit FNV-1a, continuing from `hash`
+		std::uint64_t hash_bytes(std::uint64_t hash, void const* data, std::size_t size)
+		{
+			auto const bytes = static_cast<unsigned char const*>(data);
+			for (std::size_t i = 0u; i < size; ++i)
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			return hash;
+		}
+
+		// Strings are hashed along with their length, so that consecutive
+		// ones cannot be confused.
+		std::uint64_t hash_string(std::uint64_t hash, std::string const& str)
+		{
+			auto const length = static_cast<std::uint64_t>(str.size());
+			return hash_bytes(hash_bytes(hash, &length, sizeof(length)), str.data(), str.size());
+		}
+
+		std::uint64_t get_driver_hash()
+		{
+			static std::uint64_t const hash = []() {
+				auto h = hash_bytes(14695981039346656037ull, &version, sizeof(version));
+				for (auto const name : { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION }) {
+					auto const str = reinterpret_cast<char const*>(glGetString(name));
+					h = hash_string(h, str != nullptr ? str : "");
+				}
+				return h;
+			}();
+			return hash;
+		}
+
+		// Formats the driver accepts back, none meaning that it cannot
+		// cache programs at all
+		std::vector<GLint> const& get_binary_formats()
+		{
+			static std::vector<GLint> const formats = []() {
+				GLint formats_nb = 0;
+				glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats_nb);
+				std::vector<GLint> values(static_cast<std::size_t>(std::max(formats_nb, 0)));
+				if (!values.empty())
+					glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, values.data());
+				return values;
+			}();
+			return formats;
+		}
+
+		std::string get_path(ShaderProgramManager::ProgramData const& program_data)
+		{
+			std::uint64_t hash = 14695981039346656037ull;
+			for (auto const& i : program_data) {
+				auto const type = static_cast<std::uint32_t>(i.first);
+				hash = hash_string(hash_bytes(hash, &type, sizeof(type)), i.second);
+			}
+			char name[32];
+			std::snprintf(name, sizeof(name), "%016" PRIx64 ".program", hash);
+			return std::string(config::shader_cache_dir) + "/" + name;
+		}
+
+		std::uint64_t get_key(std::vector<std::pair<ShaderType, std::string>> const& sources)
+		{
+			auto key = get_driver_hash();
+			for (auto const& source : sources) {
+				auto const type = static_cast<std::uint32_t>(source.first);
+				key = hash_string(hash_bytes(key, &type, sizeof(type)), source.second);
+			}
+			return key;
+		}
+
+		// Returns 0 if the cache is missing or outdated, or if the driver
+		// rejects the binary, which it may do at any time.
+		GLuint load(std::string const& path, std::uint64_t key)
+		{
+			auto const& formats = get_binary_formats();
+			bonobo::MappedFile const cache(path);
+			if (formats.empty() || !cache.is_valid() || cache.size() < sizeof(Header))
+				return 0u;
+
+			Header header;
+			std::memcpy(&header, cache.data(), sizeof(header));
+			if (header.magic != magic || header.version != version || header.key != key
+			    || header.binary_length != cache.size() - sizeof(Header)
+			    || std::find(formats.begin(), formats.end(), static_cast<GLint>(header.binary_format)) == formats.end())
+				return 0u;
+
+			GLuint const program = glCreateProgram();
+			glProgramBinary(program, header.binary_format, static_cast<unsigned char const*>(cache.data()) + sizeof(Header),
+			                static_cast<GLsizei>(header.binary_length));
+			GLint status = GL_FALSE;
+			glGetProgramiv(program, GL_LINK_STATUS, &status);
+			if (status == GL_FALSE) {
+				glDeleteProgram(program);
+				return 0u;
+			}
+			return program;
+		}
+
+		void save(std::string const& path, std::uint64_t key, GLuint program)
+		{
+			if (get_binary_formats().empty())
+				return;
+
+			GLint length = 0;
+			glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+			if (length <= 0)
+				return;
+			std::vector<char> binary(static_cast<std::size_t>(length));
+			GLenum binary_format = 0u;
+			glGetProgramBinary(program, length, &length, &binary_format, binary.data());
+
+			auto const temporary_path = path + ".tmp";
+			{
+				std::ofstream file(utils::widen(temporary_path), std::ios::binary | std::ios::trunc);
+				if (!file.is_open()) {
+					LogLocOnce(Log::Type::TYPE_WARNING, "Failed to open \"%s\" for writing; programs will not be cached.", temporary_path.c_str());
+					return;
+				}
+				Header const header = { magic, version, key, binary_format, static_cast<std::uint32_t>(length) };
+				file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+				file.write(binary.data(), length);
+				if (!file.good()) {
+					LogLocOnce(Log::Type::TYPE_WARNING, "Failed to write \"%s\"; programs will not be cached.", temporary_path.c_str());
+					file.close();
+					std::remove(temporary_path.c_str());
+					return;
+				}
+			}
+			// Windows does not rename over an existing file.
+			std::remove(path.c_str());
+			if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+				LogLocOnce(Log::Type::TYPE_WARNING, "Failed to replace \"%s\"; programs will not be cached.", path.c_str());
+				std::remove(temporary_path.c_str());
+			}
+		}
+	}
+}
+
+ShaderProgramManager::ShaderProgramManager()
+{
+	uniform_block_bindings.emplace("ObjectConstants", static_cast<GLuint>(bonobo::uniform_block_bindings::object_constants));
+}
+
 ShaderProgramManager::~ShaderProgramManager()
 {
 	for (auto const& i : program_entries) {
 		if (i.first != 0u) {
+			ForgetProgram(i.first);
 			glDeleteProgram(i.first);
 			i.first = 0u;
 		}
@@ -54,10 +228,14 @@ bool ShaderProgramManager::ReloadAllPrograms()
 {
 	bool encountered_failures = false;
 	for (auto& i : program_entries) {
-		if (i.first != 0u)
+		if (i.first != 0u) {
+			ForgetProgram(i.first);
 			glDeleteProgram(i.first);
+		}
 		i.first = 0u;
-		ProcessProgram(i.second, i.first);
+		// Reloads pick up the edits made on disk, which the asset pack
+		// does not have.
+		ProcessProgram(i.second, i.first, true);
 		encountered_failures |= i.first == 0u;
 	}
 
@@ -78,31 +256,263 @@ ShaderProgramManager::SelectedProgram ShaderProgramManager::SelectProgram(std::s
 	return selection_result;
 }
 
-void ShaderProgramManager::ProcessProgram(ProgramData const& program_data, GLuint& program)
+void ShaderProgramManager::SetUniformBlockBinding(std::string const& block_name, GLuint binding)
 {
-	std::vector<GLuint> shaders;
-	shaders.reserve(program_data.size());
+	uniform_block_bindings[block_name] = binding;
 
+	for (auto const& i : program_entries)
+		if (i.first != 0u)
+			ApplyUniformBlockBindings(i.first);
+}
+
+void ShaderProgramManager::ProcessProgram(ProgramData const& program_data, GLuint& program, bool from_disk)
+{
+	// Sources are always resolved, as they key the cached binary.
+	std::vector<std::string> full_filenames;
+	std::vector<std::pair<ShaderType, std::string>> sources;
+	full_filenames.reserve(program_data.size());
+	sources.reserve(program_data.size());
 	for (auto const& i : program_data) {
-		std::string const full_filename = config::shaders_path(i.second);
-		auto const shader_source = utils::slurp_file(full_filename);
+		full_filenames.push_back(config::shaders_path(i.second));
+		auto shader_source = ResolveIncludes(utils::slurp_file(full_filenames.back(), from_disk), full_filenames.back(), 0u, from_disk);
 		if (shader_source.empty()) {
-			LogError("Retrieval of shader '%s' failed; see previous message for details.", full_filename.c_str());
+			LogError("Retrieval of shader '%s' failed; see previous message for details.", full_filenames.back().c_str());
 			return;
 		}
+		sources.emplace_back(i.first, std::move(shader_source));
+	}
+
+	auto const cache_path = binary_cache::get_path(program_data);
+	auto const cache_key = binary_cache::get_key(sources);
+	program = binary_cache::load(cache_path, cache_key);
+	if (program == 0u) {
+		std::vector<GLuint> shaders;
+		shaders.reserve(sources.size());
+		for (std::size_t i = 0u; i < sources.size(); ++i) {
+			GLuint shader = utils::opengl::shader::generate_shader(static_cast<std::underlying_type<ShaderType>::type>(sources[i].first), sources[i].second);
+			if (shader == 0u) {
+				for (auto& shader : shaders)
+					glDeleteShader(shader);
+				LogError("Compilation of shader '%s' failed; see previous message for details.", full_filenames[i].c_str());
+				return;
+			}
+			shaders.push_back(shader);
+		}
+
+		program = glCreateProgram();
+		for (auto const shader : shaders)
+			glAttachShader(program, shader);
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		if (utils::opengl::shader::link_program(program)) {
+			binary_cache::save(cache_path, cache_key, program);
+		} else {
+			glDeleteProgram(program);
+			program = 0u;
+		}
+
+		for (auto& shader : shaders)
+			glDeleteShader(shader);
+	}
 
-		GLuint shader = utils::opengl::shader::generate_shader(static_cast<std::underlying_type<ShaderType>::type>(i.first), shader_source);
+	if (program != 0u) {
+		ApplyUniformBlockBindings(program);
+		ReflectProgram(program, program_reflections[program]);
+	}
+}
+
+GLuint ShaderProgramManager::CreateUnmanagedProgram(ProgramData const& program_data, std::vector<char const*> const& feedback_varyings)
+{
+	GLuint const program = glCreateProgram();
+	bool built = true;
+	for (auto const& i : program_data) {
+		std::string const full_filename = config::shaders_path(i.second);
+		auto const shader_source = ResolveIncludes(utils::slurp_file(full_filename), full_filename, 0u);
+		GLuint const shader = shader_source.empty() ? 0u
+		                    : utils::opengl::shader::generate_shader(static_cast<std::underlying_type<ShaderType>::type>(i.first), shader_source);
 		if (shader == 0u) {
-			for (auto& shader : shaders)
-				glDeleteShader(shader);
 			LogError("Compilation of shader '%s' failed; see previous message for details.", full_filename.c_str());
-			return;
+			built = false;
+			break;
 		}
-		shaders.push_back(shader);
+		// Attached shaders only get deleted along with the program.
+		glAttachShader(program, shader);
+		glDeleteShader(shader);
 	}
 
-	program = utils::opengl::shader::generate_program(shaders);
+	// Varyings to capture have to be known before linking.
+	if (built && !feedback_varyings.empty())
+		glTransformFeedbackVaryings(program, static_cast<GLsizei>(feedback_varyings.size()), feedback_varyings.data(), GL_INTERLEAVED_ATTRIBS);
 
-	for (auto& shader : shaders)
-		glDeleteShader(shader);
+	if (!built || !utils::opengl::shader::link_program(program)) {
+		glDeleteProgram(program);
+		return 0u;
+	}
+	return program;
+}
+
+// Replace every line of the form `#include "path"` by the content of the
+// file found at that path, relative to the shaders folder, so that
+// declarations shared between shaders (such as uniform blocks) are only
+// written once.
+std::string ShaderProgramManager::ResolveIncludes(std::string const& source, std::string const& filename, unsigned int depth,
+                                                  bool from_disk)
+{
+	if (depth > 16u) {
+		LogError("Too many nested includes in '%s'; is a file including itself?", filename.c_str());
+		return std::string("");
+	}
+
+	std::istringstream lines(source);
+	std::string resolved_source;
+	resolved_source.reserve(source.size());
+	for (std::string line; std::getline(lines, line);) {
+		auto const directive_start = line.find_first_not_of(" \t");
+		if (directive_start == std::string::npos || line.compare(directive_start, 8, "#include") != 0) {
+			resolved_source.append(line).append(1, '\n');
+			continue;
+		}
+
+		auto const path_start = line.find('"', directive_start + 8);
+		auto const path_end = path_start != std::string::npos ? line.find('"', path_start + 1) : std::string::npos;
+		if (path_end == std::string::npos) {
+			LogError("Malformed include directive in '%s': %s", filename.c_str(), line.c_str());
+			return std::string("");
+		}
+
+		std::string const included_filename = config::shaders_path(line.substr(path_start + 1, path_end - path_start - 1));
+		auto const included_source = ResolveIncludes(utils::slurp_file(included_filename, from_disk), included_filename, depth + 1u, from_disk);
+		if (included_source.empty()) {
+			LogError("Failed to include '%s' in '%s'.", included_filename.c_str(), filename.c_str());
+			return std::string("");
+		}
+		resolved_source.append(included_source);
+	}
+
+	return resolved_source;
+}
+
+void ShaderProgramManager::ApplyUniformBlockBindings(GLuint program) const
+{
+	for (auto const& binding : uniform_block_bindings) {
+		auto const block_index = glGetUniformBlockIndex(program, binding.first.c_str());
+		if (block_index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, block_index, binding.second);
+	}
+}
+
+ShaderProgramManager::ProgramReflection const& ShaderProgramManager::GetReflection(GLuint program)
+{
+	auto it = program_reflections.find(program);
+	if (it == program_reflections.end()) {
+		it = program_reflections.emplace(program, ProgramReflection()).first;
+		ReflectProgram(program, it->second);
+	}
+	return it->second;
+}
+
+GLint ShaderProgramManager::GetUniformLocation(GLuint program, std::uint32_t name_hash)
+{
+	if (program == 0u)
+		return -1;
+
+	auto const& locations = GetReflection(program).uniform_locations;
+	auto const it = locations.find(name_hash);
+	return it != locations.end() ? it->second : -1;
+}
+
+GLuint ShaderProgramManager::GetUniformBlockIndex(GLuint program, std::uint32_t name_hash)
+{
+	if (program == 0u)
+		return GL_INVALID_INDEX;
+
+	auto const& indices = GetReflection(program).uniform_block_indices;
+	auto const it = indices.find(name_hash);
+	return it != indices.end() ? it->second : GL_INVALID_INDEX;
+}
+
+void ShaderProgramManager::ForgetProgram(GLuint program)
+{
+	if (program_reflections.erase(program) > 0u)
+		++reflection_generation;
+}
+
+void ShaderProgramManager::ReflectProgram(GLuint program, ProgramReflection& reflection)
+{
+	reflection.uniform_locations.clear();
+	reflection.uniform_block_indices.clear();
+
+	// Only used for reporting hash collisions.
+	std::unordered_map<std::uint32_t, std::string> names;
+	auto const add_name = [&names, program](std::string const& name) {
+		auto const hash = bonobo::hash_string(name.data(), name.size());
+		auto const insertion = names.emplace(hash, name);
+		if (!insertion.second && insertion.first->second != name) {
+			LogWarning("Names '%s' and '%s' of program %u share the same hash; only the former can be looked up.",
+			           insertion.first->second.c_str(), name.c_str(), program);
+			return false;
+		}
+		return insertion.second;
+	};
+	auto const add_uniform = [&](std::string const& name, GLint location) {
+		if (add_name(name))
+			reflection.uniform_locations.emplace(bonobo::hash_string(name.data(), name.size()), location);
+	};
+
+	GLint uniforms_nb = 0, max_name_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniforms_nb);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length);
+	std::vector<GLchar> name_buffer(static_cast<std::size_t>(max_name_length) + 1u);
+	for (GLuint i = 0u; i < static_cast<GLuint>(uniforms_nb); ++i) {
+		// Members of uniform blocks have no location.
+		GLint block_index = -1;
+		glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &block_index);
+		if (block_index != -1)
+			continue;
+
+		GLsizei name_length = 0;
+		GLint size = 0;
+		GLenum type = GL_NONE;
+		glGetActiveUniform(program, i, static_cast<GLsizei>(name_buffer.size()), &name_length, &size, &type, name_buffer.data());
+		std::string const name(name_buffer.data(), static_cast<std::size_t>(name_length));
+		auto const location = glGetUniformLocation(program, name.c_str());
+		add_uniform(name, location);
+
+		// Arrays are reported through their first element only.
+		auto const array_suffix = std::string("[0]");
+		if (name.size() > array_suffix.size() && name.compare(name.size() - array_suffix.size(), array_suffix.size(), array_suffix) == 0) {
+			auto const base_name = name.substr(0u, name.size() - array_suffix.size());
+			add_uniform(base_name, location);
+			for (GLint j = 1; j < size; ++j) {
+				auto const element_name = base_name + "[" + std::to_string(j) + "]";
+				add_uniform(element_name, glGetUniformLocation(program, element_name.c_str()));
+			}
+		}
+	}
+
+	GLint blocks_nb = 0, max_block_name_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks_nb);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_block_name_length);
+	name_buffer.resize(static_cast<std::size_t>(max_block_name_length) + 1u);
+	for (GLuint i = 0u; i < static_cast<GLuint>(blocks_nb); ++i) {
+		GLsizei name_length = 0;
+		glGetActiveUniformBlockName(program, i, static_cast<GLsizei>(name_buffer.size()), &name_length, name_buffer.data());
+		std::string const name(name_buffer.data(), static_cast<std::size_t>(name_length));
+		if (add_name(name))
+			reflection.uniform_block_indices.emplace(bonobo::hash_string(name.data(), name.size()), i);
+	}
+}
+
+ShaderProgramManager::Uniform::Uniform(GLuint const& program, std::uint32_t name_hash) :
+	_program(&program), _name_hash(name_hash), _resolved_program(0u), _resolved_generation(0u), _location(-1)
+{
+}
+
+GLint ShaderProgramManager::Uniform::location() const
+{
+	if (*_program != _resolved_program || _resolved_generation != reflection_generation) {
+		_location = GetUniformLocation(*_program, _name_hash);
+		_resolved_program = *_program;
+		_resolved_generation = reflection_generation;
+	}
+	return _location;
 }
@@ -3,13 +3,40 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <cstddef>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <cstdint>
 
+namespace bonobo
+{
+	//! \brief Hash a string with FNV-1a; being constexpr, it lets uniform
+	//!        names be hashed at compile time.
+	constexpr std::uint32_t hash_string(char const* str, std::size_t length)
+	{
+		std::uint32_t hash = 2166136261u;
+		for (std::size_t i = 0; i < length; ++i) {
+			hash ^= static_cast<std::uint8_t>(str[i]);
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	namespace literals
+	{
+		//! \brief Hash a string literal at compile time, as in
+		//!        `"diffuse_texture"_hash`.
+		constexpr std::uint32_t operator"" _hash(char const* str, std::size_t length)
+		{
+			return hash_string(str, length);
+		}
+	}
+}
+
 enum class ShaderType : std::uint32_t {
 	vertex = GL_VERTEX_SHADER,
 	tess_eval = GL_TESS_EVALUATION_SHADER,
@@ -28,15 +55,99 @@ public:
 		GLuint const* program = nullptr;
 		char const* name = nullptr;
 	};
+	ShaderProgramManager();
 	~ShaderProgramManager();
+	//! \brief Build a program and register it for reloading.
+	//!
+	//! Linked programs are cached in `config::shader_cache_dir` as driver
+	//! binaries, which get restored instead of compiling the shaders as
+	//! long as neither their resolved sources nor the driver changed.
 	void CreateAndRegisterProgram(char const* const program_name, ProgramData const& program_data, GLuint& program);
 	void CreateAndRegisterComputeProgram(char const* const program_name, std::string const& filename, GLuint& program);
 	bool ReloadAllPrograms();
 	SelectedProgram SelectProgram(std::string const& label, std::int32_t& program_index);
 
+	//! \brief Bind the uniform block of the given name, in all programs
+	//!        registered so far and to come, to the given binding point.
+	void SetUniformBlockBinding(std::string const& block_name, GLuint binding);
+
+	//! \brief Active uniforms and uniform blocks of a program, keyed by
+	//!        the hash of their names.
+	//!
+	//! Elements of arrays are found both as `name[i]` and, for the first
+	//! one, as `name`, as with glGetUniformLocation().
+	struct ProgramReflection {
+		std::unordered_map<std::uint32_t, GLint> uniform_locations;
+		std::unordered_map<std::uint32_t, GLuint> uniform_block_indices;
+	};
+
+	//! \brief Retrieve the reflection of a program.
+	//!
+	//! Programs registered with a manager are reflected when linked;
+	//! others get reflected the first time they are looked up, and should
+	//! be forgotten with ForgetProgram() when deleted.
+	static ProgramReflection const& GetReflection(GLuint program);
+
+	//! \brief Location of a uniform, or -1 if the program has no active
+	//!        uniform with that name.
+	static GLint GetUniformLocation(GLuint program, std::uint32_t name_hash);
+
+	//! \brief Index of a uniform block, or GL_INVALID_INDEX if the program
+	//!        has no active block with that name.
+	static GLuint GetUniformBlockIndex(GLuint program, std::uint32_t name_hash);
+
+	//! \brief Drop the reflection of a program, before deleting it.
+	static void ForgetProgram(GLuint program);
+
+	//! \brief Handle to a uniform of a program, whose location is cached
+	//!        and looked up again only after programs got (re)linked, for
+	//!        example by ReloadAllPrograms().
+	class Uniform {
+	public:
+		//! @param [in] program the program variable, which has to outlive
+		//!             the handle; it may be relinked in the meantime
+		//! @param [in] name_hash hash of the uniform name, see
+		//!             bonobo::literals::operator""_hash()
+		Uniform(GLuint const& program, std::uint32_t name_hash);
+
+		GLint location() const;
+
+	private:
+		GLuint const* _program;
+		std::uint32_t _name_hash;
+		mutable GLuint _resolved_program;
+		mutable std::uint32_t _resolved_generation;
+		mutable GLint _location;
+	};
+
+	//! \brief Build a program which is neither registered nor reloaded,
+	//!        such as the ones used internally by the framework.
+	//!
+	//! @param [in] program_data paths of the shaders, relative to the
+	//!             shaders folder
+	//! @param [in] feedback_varyings outputs captured by transform
+	//!             feedback, interleaved in a single buffer
+	//! @return the program, or 0 on failure; it has to be deleted by the
+	//!         caller, after calling ForgetProgram()
+	static GLuint CreateUnmanagedProgram(ProgramData const& program_data,
+	                                     std::vector<char const*> const& feedback_varyings = {});
+
+	//! \brief Replace the `#include "path"` directives of a shader source
+	//!        by the content of the files they name, relative to the
+	//!        shaders folder.
+	//!
+	//! @param [in] from_disk whether to read the included files from the
+	//!             disk rather than from the mounted asset pack
+	//! @return the resolved source, or an empty string on failure
+	static std::string ResolveIncludes(std::string const& source, std::string const& filename, unsigned int depth = 0u,
+	                                   bool from_disk = false);
+
 private:
-	void ProcessProgram(ProgramData const& program_data, GLuint& program);
+	void ProcessProgram(ProgramData const& program_data, GLuint& program, bool from_disk = false);
+	void ApplyUniformBlockBindings(GLuint program) const;
+	static void ReflectProgram(GLuint program, ProgramReflection& reflection);
 	using ProgramEntry = std::pair<GLuint&, ProgramData>;
 	std::vector<ProgramEntry> program_entries;
 	std::vector<char const*> program_names;
+	std::map<std::string, GLuint> uniform_block_bindings;
 };
@@ -0,0 +1,462 @@
+#include "TextureCache.hpp"
+
+#include "core/MappedFile.hpp"
+#include "core/various.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace
+{
+	constexpr std::uint32_t cache_magic = 0x58455442u; // "BTEX"
+	// Bumped whenever the layout of caches changes, so that older ones
+	// get rebuilt.
+	constexpr std::uint32_t cache_version = 2u;
+	// Texels start on a boundary of that many bytes.
+	constexpr std::size_t data_alignment = 16u;
+	constexpr std::size_t channels_nb = 4u;
+
+	struct CacheHeader {
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint64_t source_hash;
+		std::uint32_t internal_format;
+		std::uint32_t levels_nb;
+	};
+
+	struct CacheLevel {
+		std::uint32_t width;
+		std::uint32_t height;
+		std::uint64_t offset;
+		std::uint64_t size;
+	};
+
+	std::size_t get_data_offset(std::size_t levels_nb)
+	{
+		auto const headers_size = sizeof(CacheHeader) + levels_nb * sizeof(CacheLevel);
+		return (headers_size + data_alignment - 1u) / data_alignment * data_alignment;
+	}
+
+	struct FormatInfo {
+		bool is_compressed;
+		std::size_t size; // bytes per texel, or per 4x4 block if compressed
+	};
+
+	bool get_format_info(GLenum internal_format, FormatInfo& info)
+	{
+		switch (internal_format) {
+		case GL_R8:                                   info = { false, 1u }; return true;
+		case GL_RG8:                                  info = { false, 2u }; return true;
+		case GL_RGBA8:
+		case GL_SRGB8_ALPHA8:                         info = { false, 4u }; return true;
+		case GL_COMPRESSED_RED_RGTC1:
+		case bonobo::compressed_rgb_s3tc_dxt1:
+		case bonobo::compressed_srgb_s3tc_dxt1:       info = { true, 8u }; return true;
+		case GL_COMPRESSED_RG_RGTC2:
+		case bonobo::compressed_rgba_s3tc_dxt5:
+		case bonobo::compressed_srgb_alpha_s3tc_dxt5: info = { true, 16u }; return true;
+		default:                                      return false;
+		}
+	}
+
+	std::size_t get_level_size(FormatInfo const& info, std::uint32_t width, std::uint32_t height)
+	{
+		if (!info.is_compressed)
+			return static_cast<std::size_t>(width) * height * info.size;
+		return static_cast<std::size_t>((width + 3u) / 4u) * ((height + 3u) / 4u) * info.size;
+	}
+
+	float decode_srgb(std::uint8_t value)
+	{
+		static auto const table = []() {
+			std::array<float, 256> values;
+			for (std::size_t i = 0u; i < values.size(); ++i) {
+				auto const s = static_cast<float>(i) / 255.0f;
+				values[i] = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+			}
+			return values;
+		}();
+		return table[value];
+	}
+
+	std::uint8_t encode_srgb(float value)
+	{
+		value = std::min(std::max(value, 0.0f), 1.0f);
+		auto const s = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+		return static_cast<std::uint8_t>(s * 255.0f + 0.5f);
+	}
+
+	// Halve an image with a separable [1 3 3 1] / 8 filter, clamping at
+	// the edges. sRGB colours are averaged once decoded, as their encoding
+	// would otherwise darken every level.
+	std::vector<std::uint8_t> downsample(std::uint8_t const* texels, std::uint32_t width, std::uint32_t height,
+	                                     std::uint32_t level_width, std::uint32_t level_height, bool is_srgb)
+	{
+		constexpr std::array<float, 4> weights = { { 1.0f, 3.0f, 3.0f, 1.0f } };
+		auto const clamp_index = [](std::int64_t i, std::uint32_t size) {
+			return static_cast<std::size_t>(std::min<std::int64_t>(std::max<std::int64_t>(i, 0), std::int64_t(size) - 1));
+		};
+
+		std::vector<float> rows(static_cast<std::size_t>(level_width) * height * channels_nb, 0.0f);
+		for (std::uint32_t y = 0u; y < height; ++y)
+			for (std::uint32_t x = 0u; x < level_width; ++x) {
+				auto const row = rows.data() + (static_cast<std::size_t>(y) * level_width + x) * channels_nb;
+				for (std::size_t k = 0u; k < weights.size(); ++k) {
+					auto const source_x = clamp_index(2 * std::int64_t(x) - 1 + std::int64_t(k), width);
+					auto const source = texels + (static_cast<std::size_t>(y) * width + source_x) * channels_nb;
+					for (std::size_t c = 0u; c < channels_nb; ++c)
+						row[c] += weights[k] * (is_srgb && c < 3u ? decode_srgb(source[c]) * 255.0f : static_cast<float>(source[c]));
+				}
+			}
+
+		std::vector<std::uint8_t> level(static_cast<std::size_t>(level_width) * level_height * channels_nb);
+		for (std::uint32_t y = 0u; y < level_height; ++y)
+			for (std::uint32_t x = 0u; x < level_width; ++x)
+				for (std::size_t c = 0u; c < channels_nb; ++c) {
+					float sum = 0.0f;
+					for (std::size_t k = 0u; k < weights.size(); ++k) {
+						auto const source_y = clamp_index(2 * std::int64_t(y) - 1 + std::int64_t(k), height);
+						sum += weights[k] * rows[(source_y * level_width + x) * channels_nb + c];
+					}
+					level[(static_cast<std::size_t>(y) * level_width + x) * channels_nb + c] = is_srgb && c < 3u
+					                                                                          ? encode_srgb(sum / (64.0f * 255.0f))
+					                                                                          : static_cast<std::uint8_t>(std::min(sum / 64.0f + 0.5f, 255.0f));
+				}
+		return level;
+	}
+
+	using Block = std::array<glm::vec4, 16>;
+
+	std::uint16_t pack_565(glm::vec3 const& colour)
+	{
+		auto const c = glm::clamp(colour, glm::vec3(0.0f), glm::vec3(255.0f));
+		return static_cast<std::uint16_t>((static_cast<unsigned int>(c.x * 31.0f / 255.0f + 0.5f) << 11)
+		                                | (static_cast<unsigned int>(c.y * 63.0f / 255.0f + 0.5f) << 5)
+		                                |  static_cast<unsigned int>(c.z * 31.0f / 255.0f + 0.5f));
+	}
+
+	glm::vec3 unpack_565(std::uint16_t colour)
+	{
+		unsigned int const r = (colour >> 11) & 31u, g = (colour >> 5) & 63u, b = colour & 31u;
+		return glm::vec3(static_cast<float>((r << 3) | (r >> 2)),
+		                 static_cast<float>((g << 2) | (g >> 4)),
+		                 static_cast<float>((b << 3) | (b >> 2)));
+	}
+
+	// Colour part of DXT1 and DXT5 blocks, always in four-colour mode:
+	// the endpoints are the extremes of the texels along their principal
+	// axis, slightly inset, and each texel picks the closest of the
+	// colours interpolated between them.
+	void encode_colours(Block const& block, std::uint8_t* output)
+	{
+		glm::vec3 mean(0.0f);
+		for (auto const& texel : block)
+			mean += glm::vec3(texel.x, texel.y, texel.z);
+		mean /= 16.0f;
+
+		// Columns of the covariance matrix, whose main eigenvector gets
+		// found by power iteration
+		glm::vec3 covariance[3] = { glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f) };
+		for (auto const& texel : block) {
+			auto const d = glm::vec3(texel.x, texel.y, texel.z) - mean;
+			covariance[0] += d * d.x;
+			covariance[1] += d * d.y;
+			covariance[2] += d * d.z;
+		}
+		glm::vec3 axis(1.0f, 1.0f, 1.0f);
+		for (int i = 0; i < 8; ++i) {
+			axis = covariance[0] * axis.x + covariance[1] * axis.y + covariance[2] * axis.z;
+			auto const length = glm::length(axis);
+			if (length < 1e-6f) {
+				axis = glm::vec3(0.57735f);
+				break;
+			}
+			axis /= length;
+		}
+
+		auto min_t = std::numeric_limits<float>::max();
+		auto max_t = std::numeric_limits<float>::lowest();
+		for (auto const& texel : block) {
+			auto const t = glm::dot(glm::vec3(texel.x, texel.y, texel.z) - mean, axis);
+			min_t = std::min(min_t, t);
+			max_t = std::max(max_t, t);
+		}
+		auto const inset = (max_t - min_t) / 16.0f;
+		auto colour0 = pack_565(mean + axis * (max_t - inset));
+		auto colour1 = pack_565(mean + axis * (min_t + inset));
+		if (colour0 < colour1)
+			std::swap(colour0, colour1);
+
+		std::array<glm::vec3, 4> palette;
+		palette[0] = unpack_565(colour0);
+		palette[1] = unpack_565(colour1);
+		palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+		palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+
+		// Equal endpoints would switch the block to three-colour mode,
+		// where they are all the first one anyway.
+		std::uint32_t indices = 0u;
+		if (colour0 != colour1) {
+			for (std::size_t i = 0u; i < block.size(); ++i) {
+				std::uint32_t best = 0u;
+				auto best_distance = std::numeric_limits<float>::max();
+				for (std::uint32_t p = 0u; p < palette.size(); ++p) {
+					auto const d = glm::vec3(block[i].x, block[i].y, block[i].z) - palette[p];
+					auto const distance = glm::dot(d, d);
+					if (distance < best_distance) {
+						best_distance = distance;
+						best = p;
+					}
+				}
+				indices |= best << (2u * i);
+			}
+		}
+
+		std::memcpy(output + 0, &colour0, sizeof(colour0));
+		std::memcpy(output + 2, &colour1, sizeof(colour1));
+		std::memcpy(output + 4, &indices, sizeof(indices));
+	}
+
+	// Alpha part of DXT5 blocks, which is also how RGTC encodes each of
+	// its channels, in eight-value mode between the extremes
+	void encode_channel(Block const& block, std::size_t channel, std::uint8_t* output)
+	{
+		auto min_value = 255.0f, max_value = 0.0f;
+		for (auto const& texel : block) {
+			min_value = std::min(min_value, texel[static_cast<glm::length_t>(channel)]);
+			max_value = std::max(max_value, texel[static_cast<glm::length_t>(channel)]);
+		}
+		auto const value0 = static_cast<std::uint8_t>(max_value + 0.5f);
+		auto const value1 = static_cast<std::uint8_t>(min_value + 0.5f);
+
+		std::array<float, 8> palette;
+		palette[0] = value0;
+		palette[1] = value1;
+		for (std::size_t i = 2u; i < palette.size(); ++i)
+			palette[i] = (static_cast<float>(8u - i) * value0 + static_cast<float>(i - 1u) * value1) / 7.0f;
+
+		std::uint64_t indices = 0u;
+		if (value0 != value1) {
+			for (std::size_t i = 0u; i < block.size(); ++i) {
+				std::uint64_t best = 0u;
+				auto best_distance = std::numeric_limits<float>::max();
+				for (std::size_t p = 0u; p < palette.size(); ++p) {
+					auto const distance = std::abs(block[i][static_cast<glm::length_t>(channel)] - palette[p]);
+					if (distance < best_distance) {
+						best_distance = distance;
+						best = p;
+					}
+				}
+				indices |= best << (3u * i);
+			}
+		}
+
+		output[0] = value0;
+		output[1] = value1;
+		for (std::size_t i = 0u; i < 6u; ++i)
+			output[2u + i] = static_cast<std::uint8_t>(indices >> (8u * i));
+	}
+
+	// Compress a level in 4x4 blocks, repeating the last row and column
+	// of levels whose size is not a multiple of 4. RGTC formats encode
+	// the kept channels of the RGBA texels.
+	void compress(std::uint8_t const* texels, std::uint32_t width, std::uint32_t height,
+	              GLenum internal_format, std::vector<std::size_t> const& channels, std::uint8_t* output)
+	{
+		for (std::uint32_t by = 0u; by < height; by += 4u)
+			for (std::uint32_t bx = 0u; bx < width; bx += 4u) {
+				Block block;
+				for (std::uint32_t y = 0u; y < 4u; ++y)
+					for (std::uint32_t x = 0u; x < 4u; ++x) {
+						auto const texel = texels + (static_cast<std::size_t>(std::min(by + y, height - 1u)) * width + std::min(bx + x, width - 1u)) * channels_nb;
+						block[4u * y + x] = glm::vec4(texel[0], texel[1], texel[2], texel[3]);
+					}
+				switch (internal_format) {
+				case GL_COMPRESSED_RED_RGTC1:
+					encode_channel(block, channels[0], output);
+					output += 8;
+					break;
+				case GL_COMPRESSED_RG_RGTC2:
+					encode_channel(block, channels[0], output);
+					encode_channel(block, channels[1], output + 8);
+					output += 16;
+					break;
+				case bonobo::compressed_rgba_s3tc_dxt5:
+				case bonobo::compressed_srgb_alpha_s3tc_dxt5:
+					encode_channel(block, 3u, output);
+					encode_colours(block, output + 8);
+					output += 16;
+					break;
+				default:
+					encode_colours(block, output);
+					output += 8;
+					break;
+				}
+			}
+	}
+}
+
+void
+bonobo::cookTexture(unsigned char const* texels, std::uint32_t width, std::uint32_t height,
+                    int source_channels_nb, TextureUsage usage, bool generate_mipmap, bool compress_texels,
+                    std::vector<std::uint8_t>& storage, CookedTexture& texture)
+{
+	auto const is_srgb = usage == TextureUsage::srgb_colour;
+	std::vector<std::vector<std::uint8_t>> levels;
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> sizes;
+	levels.emplace_back(texels, texels + static_cast<std::size_t>(width) * height * channels_nb);
+	sizes.emplace_back(width, height);
+	while (generate_mipmap && (sizes.back().first > 1u || sizes.back().second > 1u)) {
+		auto const level_width = std::max(sizes.back().first / 2u, 1u);
+		auto const level_height = std::max(sizes.back().second / 2u, 1u);
+		levels.push_back(downsample(levels.back().data(), sizes.back().first, sizes.back().second, level_width, level_height, is_srgb));
+		sizes.emplace_back(level_width, level_height);
+	}
+
+	bool has_alpha = false;
+	for (std::size_t i = 3u; i < levels.front().size() && !has_alpha; i += channels_nb)
+		has_alpha = levels.front()[i] != 255u;
+
+	// Channels of the RGBA texels which are kept, in order
+	std::vector<std::size_t> channels;
+	texture = CookedTexture();
+	switch (usage) {
+	case TextureUsage::colour:
+		if (source_channels_nb <= 2) {
+			channels = has_alpha ? std::vector<std::size_t>{ 0u, 3u } : std::vector<std::size_t>{ 0u };
+			texture.internal_format = has_alpha ? (compress_texels ? GL_COMPRESSED_RG_RGTC2 : GL_RG8)
+			                                    : (compress_texels ? GL_COMPRESSED_RED_RGTC1 : GL_R8);
+		} else {
+			channels = { 0u, 1u, 2u, 3u };
+			texture.internal_format = compress_texels ? (has_alpha ? compressed_rgba_s3tc_dxt5 : compressed_rgb_s3tc_dxt1) : GL_RGBA8;
+		}
+		break;
+	case TextureUsage::srgb_colour:
+		channels = { 0u, 1u, 2u, 3u };
+		texture.internal_format = compress_texels ? (has_alpha ? compressed_srgb_alpha_s3tc_dxt5 : compressed_srgb_s3tc_dxt1) : GL_SRGB8_ALPHA8;
+		break;
+	case TextureUsage::normal_map:
+		channels = { 0u, 1u };
+		texture.internal_format = compress_texels ? GL_COMPRESSED_RG_RGTC2 : GL_RG8;
+		break;
+	case TextureUsage::mask:
+		channels = { 0u };
+		texture.internal_format = compress_texels ? GL_COMPRESSED_RED_RGTC1 : GL_R8;
+		break;
+	}
+
+	FormatInfo info;
+	get_format_info(texture.internal_format, info);
+	std::size_t size = 0u;
+	for (auto const& level_size : sizes) {
+		auto const level_bytes = get_level_size(info, level_size.first, level_size.second);
+		texture.levels.push_back({ level_size.first, level_size.second, size, level_bytes });
+		size += level_bytes;
+	}
+
+	storage.resize(size);
+	for (std::size_t i = 0u; i < levels.size(); ++i) {
+		auto const& level = texture.levels[i];
+		auto output = storage.data() + level.offset;
+		if (info.is_compressed) {
+			compress(levels[i].data(), level.width, level.height, texture.internal_format, channels, output);
+		} else {
+			for (std::size_t t = 0u; t < levels[i].size(); t += channels_nb)
+				for (auto const channel : channels)
+					*output++ = levels[i][t + channel];
+		}
+	}
+	texture.data = storage.data();
+	texture.size = storage.size();
+}
+
+bool
+bonobo::isCompressedFormat(GLenum internal_format)
+{
+	FormatInfo info;
+	return get_format_info(internal_format, info) && info.is_compressed;
+}
+
+bool
+bonobo::writeTextureCache(std::string const& path, std::uint64_t source_hash, CookedTexture const& texture)
+{
+	// Unique to the writer, so that concurrent writes of the same cache
+	// cannot interleave.
+	auto const temporary_path = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream file(utils::widen(temporary_path), std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		CacheHeader const header = { cache_magic, cache_version, source_hash, texture.internal_format,
+		                             static_cast<std::uint32_t>(texture.levels.size()) };
+		file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+		for (auto const& level : texture.levels) {
+			CacheLevel const cache_level = { level.width, level.height, level.offset, level.size };
+			file.write(reinterpret_cast<char const*>(&cache_level), sizeof(cache_level));
+		}
+		char const padding[data_alignment] = {};
+		auto const headers_size = sizeof(CacheHeader) + texture.levels.size() * sizeof(CacheLevel);
+		file.write(padding, static_cast<std::streamsize>(get_data_offset(texture.levels.size()) - headers_size));
+		file.write(reinterpret_cast<char const*>(texture.data), static_cast<std::streamsize>(texture.size));
+
+		if (!file.good()) {
+			file.close();
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+	}
+
+	std::remove(path.c_str());
+	if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+		std::remove(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool
+bonobo::readTextureCache(MappedFile const& cache, std::uint64_t source_hash, CookedTexture& texture)
+{
+	texture = CookedTexture();
+	if (!cache.is_valid() || cache.size() < sizeof(CacheHeader))
+		return false;
+
+	auto const bytes = static_cast<unsigned char const*>(cache.data());
+	CacheHeader header;
+	std::memcpy(&header, bytes, sizeof(header));
+	FormatInfo info;
+	if (header.magic != cache_magic || header.version != cache_version || header.source_hash != source_hash
+	    || header.levels_nb == 0u || header.levels_nb > 32u || !get_format_info(header.internal_format, info))
+		return false;
+
+	auto const data_offset = get_data_offset(header.levels_nb);
+	if (cache.size() < data_offset)
+		return false;
+	auto const data_size = cache.size() - data_offset;
+
+	// A damaged cache would otherwise have the GPU read past the mapping.
+	for (std::uint32_t i = 0u; i < header.levels_nb; ++i) {
+		CacheLevel level;
+		std::memcpy(&level, bytes + sizeof(CacheHeader) + i * sizeof(CacheLevel), sizeof(level));
+		if (level.width == 0u || level.height == 0u || level.size != get_level_size(info, level.width, level.height)
+		    || level.offset > data_size || level.size > data_size - level.offset)
+			return false;
+		texture.levels.push_back({ level.width, level.height, static_cast<std::size_t>(level.offset), static_cast<std::size_t>(level.size) });
+	}
+	texture.internal_format = header.internal_format;
+	texture.data = bytes + data_offset;
+	texture.size = data_size;
+	return true;
+}
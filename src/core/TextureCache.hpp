@@ -0,0 +1,93 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bonobo
+{
+	class MappedFile;
+
+	//! \brief S3TC formats, from EXT_texture_compression_s3tc and
+	//!        EXT_texture_sRGB; glad was not generated with those
+	//!        extensions, although all desktop drivers expose them.
+	constexpr GLenum compressed_rgb_s3tc_dxt1 = 0x83F0u;
+	constexpr GLenum compressed_rgba_s3tc_dxt5 = 0x83F3u;
+	constexpr GLenum compressed_srgb_s3tc_dxt1 = 0x8C4Cu;
+	constexpr GLenum compressed_srgb_alpha_s3tc_dxt5 = 0x8C4Fu;
+
+	//! \brief What the texels of a texture stand for, deciding how many
+	//!        channels it keeps and how it gets compressed.
+	enum class TextureUsage : std::uint8_t {
+		colour,      //!< RGBA, kept in R or RG for grey images, which get swizzled back to RGBA
+		srgb_colour, //!< RGBA encoded in sRGB, which sampling decodes to linear
+		normal_map,  //!< tangent-space X and Y in RG, Z being rebuilt by shaders
+		mask         //!< single channel, e.g. opacity or roughness
+	};
+
+	//! \brief Level of a cooked texture.
+	struct TextureLevel {
+		std::uint32_t width;
+		std::uint32_t height;
+		std::size_t offset; //!< where its texels start in the data of the texture
+		std::size_t size;   //!< in bytes
+	};
+
+	//! \brief Texture with its whole mipmap chain, ready to be uploaded
+	//!        level by level.
+	//!
+	//! The texels are only referenced, as they either live in the mapping
+	//! of a cache or in storage kept by whoever cooked them.
+	struct CookedTexture {
+		GLenum internal_format{GL_RGBA8};    //!< GL_R8, GL_RG8, GL_RGBA8, GL_SRGB8_ALPHA8 or a compressed version of them
+		std::vector<TextureLevel> levels;    //!< from the largest to the smallest
+		unsigned char const* data{nullptr};  //!< texels of all levels
+		std::size_t size{0u};
+	};
+
+	//! \brief Build the mipmap chain of an RGBA image, only keeping the
+	//!        channels its usage needs, and optionally compress it.
+	//!
+	//! Levels get downsampled with a [1 3 3 1] tent filter, smoother than
+	//! the box filter drivers usually use for `glGenerateMipmap()`; sRGB
+	//! colours are filtered in linear space. Compressed colours use DXT1,
+	//! or DXT5 if any texel is translucent, while single- and two-channel
+	//! textures use RGTC1 and RGTC2.
+	//!
+	//! @param [in] texels `width` * `height` RGBA texels, 8 bits per
+	//!             channel
+	//! @param [in] source_channels_nb how many channels the image had
+	//!             before being expanded to RGBA, 1 or 2 for grey ones
+	//! @param [in] generate_mipmap whether to build the whole chain, or
+	//!             only keep the first level
+	//! @param [out] storage bytes `texture` points into
+	void cookTexture(unsigned char const* texels, std::uint32_t width, std::uint32_t height,
+	                 int source_channels_nb, TextureUsage usage, bool generate_mipmap, bool compress,
+	                 std::vector<std::uint8_t>& storage, CookedTexture& texture);
+
+	//! \brief Whether a format is one of the block-compressed ones
+	//!        `cookTexture()` produces.
+	bool isCompressedFormat(GLenum internal_format);
+
+	//! \brief Write a cooked texture into a cache file.
+	//!
+	//! As with `writeMeshCache()`, the file is written next to its
+	//! destination before replacing it. Nothing gets logged, as textures
+	//! are cached from worker threads.
+	//!
+	//! @param [in] source_hash hash of the image the texture comes from,
+	//!             as returned by `hashSourceFile()`
+	//! @return whether the cache could be written
+	bool writeTextureCache(std::string const& path, std::uint64_t source_hash, CookedTexture const& texture);
+
+	//! \brief Read a cooked texture from a mapped cache file.
+	//!
+	//! The texels are not copied: the texture points into the mapping,
+	//! which has to outlive it.
+	//!
+	//! @return whether the cache was valid and up to date
+	bool readTextureCache(MappedFile const& cache, std::uint64_t source_hash, CookedTexture& texture);
+}
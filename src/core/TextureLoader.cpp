@@ -0,0 +1,426 @@
+#include "TextureLoader.hpp"
+
+#include "core/Log.h"
+#include "core/MeshCache.hpp"
+#include "core/various.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <utility>
+
+namespace
+{
+	// Enough for uploading while the GPU still reads the previous images
+	constexpr std::size_t pixel_buffers_nb = 3u;
+	constexpr std::size_t channels_nb = 4u;
+
+	std::size_t get_channels_nb(GLenum internal_format)
+	{
+		switch (internal_format) {
+		case GL_R8:
+		case GL_COMPRESSED_RED_RGTC1:
+			return 1u;
+		case GL_RG8:
+		case GL_COMPRESSED_RG_RGTC2:
+			return 2u;
+		default:
+			return 4u;
+		}
+	}
+
+	GLenum get_pixel_format(GLenum internal_format)
+	{
+		switch (get_channels_nb(internal_format)) {
+		case 1u:  return GL_RED;
+		case 2u:  return GL_RG;
+		default:  return GL_RGBA;
+		}
+	}
+}
+
+bonobo::TextureLoader::TextureLoader(std::size_t upload_budget) :
+	_upload_budget(upload_budget), _pixel_buffers(pixel_buffers_nb)
+{
+	// glad was not generated with the S3TC extensions, so look them up by
+	// hand. RGTC is core, and always available.
+	bool has_srgb = false;
+	GLint extensions_nb = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensions_nb);
+	for (GLint i = 0; i < extensions_nb; ++i) {
+		auto const extension = reinterpret_cast<char const*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+		if (extension == nullptr)
+			continue;
+		if (std::strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0)
+			_has_s3tc = true;
+		else if (std::strcmp(extension, "GL_EXT_texture_sRGB") == 0)
+			has_srgb = true;
+	}
+	_has_srgb_s3tc = _has_s3tc && has_srgb;
+	if (!_has_s3tc)
+		LogInfo("S3TC is not supported: colour textures will be left uncompressed.");
+
+	// The main thread keeps a core for itself.
+	auto const workers_nb = std::max(std::thread::hardware_concurrency(), 2u) - 1u;
+	_workers.reserve(workers_nb);
+	for (unsigned int i = 0u; i < workers_nb; ++i)
+		_workers.emplace_back([this]() { decode_images(); });
+}
+
+bonobo::TextureLoader::~TextureLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_is_stopping = true;
+	}
+	_work_available.notify_all();
+	for (auto& worker : _workers)
+		worker.join();
+
+	for (auto& request : _requests)
+		release(*request);
+
+	for (auto& pixel_buffer : _pixel_buffers) {
+		if (pixel_buffer.fence != nullptr)
+			glDeleteSync(pixel_buffer.fence);
+		if (pixel_buffer.bo != 0u)
+			glDeleteBuffers(1, &pixel_buffer.bo);
+	}
+}
+
+GLuint
+bonobo::TextureLoader::load_2d(std::string const& filename, bool generate_mipmap, TextureUsage usage,
+                               Colour const& placeholder)
+{
+	// Materials often share images; cooking one twice would also have two
+	// workers write the same cache.
+	auto const key = std::make_tuple(filename, usage, generate_mipmap);
+	auto const it = _textures_2d.find(key);
+	if (it != _textures_2d.end())
+		return it->second;
+
+	auto request = std::make_unique<Request>();
+	request->texture = create_placeholder(GL_TEXTURE_2D, generate_mipmap, placeholder);
+	request->target = GL_TEXTURE_2D;
+	request->generate_mipmap = generate_mipmap;
+	request->flip = true;
+	request->usage = usage;
+	request->compress = can_compress(usage);
+	request->images.resize(1u);
+	request->images[0].filename = filename;
+	request->images_left = 1u;
+
+	auto const texture = request->texture;
+	_textures_2d.emplace(key, texture);
+	enqueue(std::move(request));
+	return texture;
+}
+
+GLuint
+bonobo::TextureLoader::load_cube_map(std::array<std::string, 6> const& filenames, bool generate_mipmap, TextureUsage usage,
+                                     Colour const& placeholder)
+{
+	auto request = std::make_unique<Request>();
+	request->texture = create_placeholder(GL_TEXTURE_CUBE_MAP, generate_mipmap, placeholder);
+	request->target = GL_TEXTURE_CUBE_MAP;
+	request->generate_mipmap = generate_mipmap;
+	request->flip = false;
+	request->usage = usage;
+	request->compress = can_compress(usage);
+	request->images.resize(filenames.size());
+	for (std::size_t i = 0u; i < filenames.size(); ++i)
+		request->images[i].filename = filenames[i];
+	request->images_left = filenames.size();
+
+	auto const texture = request->texture;
+	enqueue(std::move(request));
+	return texture;
+}
+
+void
+bonobo::TextureLoader::update()
+{
+	std::vector<Request*> ready_requests;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_ready_requests.empty())
+			return;
+
+		// Requests over the budget are put back, in the same order.
+		std::size_t bytes_nb = 0u;
+		auto it = _ready_requests.begin();
+		for (; it != _ready_requests.end() && (bytes_nb < _upload_budget || it == _ready_requests.begin()); ++it)
+			for (auto const& image : (*it)->images)
+				bytes_nb += image.texture.size;
+		ready_requests.assign(_ready_requests.begin(), it);
+		_ready_requests.erase(_ready_requests.begin(), it);
+	}
+
+	for (auto const request : ready_requests) {
+		upload(*request);
+		release(*request);
+		_requests.erase(std::find_if(_requests.begin(), _requests.end(), [request](std::unique_ptr<Request> const& r) {
+			return r.get() == request;
+		}));
+	}
+}
+
+void
+bonobo::TextureLoader::finish()
+{
+	while (!_requests.empty()) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_request_ready.wait(lock, [this]() { return !_ready_requests.empty(); });
+		}
+		update();
+	}
+}
+
+std::size_t
+bonobo::TextureLoader::get_pending_nb() const
+{
+	return _requests.size();
+}
+
+bool
+bonobo::TextureLoader::can_compress(TextureUsage usage) const
+{
+	switch (usage) {
+	case TextureUsage::colour:      return _has_s3tc;
+	case TextureUsage::srgb_colour: return _has_srgb_s3tc;
+	default:                        return true;
+	}
+}
+
+GLuint
+bonobo::TextureLoader::create_placeholder(GLenum target, bool generate_mipmap, Colour const& placeholder) const
+{
+	GLuint texture = 0u;
+	glGenTextures(1, &texture);
+	assert(texture != 0u);
+	glBindTexture(target, texture);
+	if (target == GL_TEXTURE_CUBE_MAP) {
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		for (GLenum face = 0u; face < 6u; ++face)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder.data());
+	} else {
+		glTexImage2D(target, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder.data());
+	}
+	// A single texel is a complete mipmap hierarchy already.
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, generate_mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(target, 0u);
+	return texture;
+}
+
+void
+bonobo::TextureLoader::enqueue(std::unique_ptr<Request> request)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (std::size_t i = 0u; i < request->images.size(); ++i)
+			_images_to_decode.emplace_back(request.get(), i);
+	}
+	_requests.push_back(std::move(request));
+	_work_available.notify_all();
+}
+
+void
+bonobo::TextureLoader::decode_images()
+{
+	for (;;) {
+		std::pair<Request*, std::size_t> item;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_work_available.wait(lock, [this]() { return _is_stopping || !_images_to_decode.empty(); });
+			if (_is_stopping)
+				return;
+			item = _images_to_decode.front();
+			_images_to_decode.pop_front();
+		}
+
+		auto& request = *item.first;
+		auto& image = request.images[item.second];
+		load_image(request, image);
+
+		bool is_ready = false;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			is_ready = --request.images_left == 0u;
+			if (is_ready)
+				_ready_requests.push_back(&request);
+		}
+		if (is_ready)
+			_request_ready.notify_all();
+	}
+}
+
+void
+bonobo::TextureLoader::load_image(Request const& request, Image& image) const
+{
+	// The cache depends on how the image gets cooked, as well as on its
+	// content.
+	auto const settings = (request.generate_mipmap ? 1u : 0u)
+	                    | (request.compress ? 2u : 0u)
+	                    | (request.flip ? 4u : 0u)
+	                    | (static_cast<unsigned int>(request.usage) << 3);
+	auto const cache_path = image.filename + ".cache";
+	auto const source_hash = hashSourceFile(image.filename, settings);
+	if (source_hash == 0u)
+		return;
+
+	image.cache = MappedFile(cache_path);
+	auto is_cached = readTextureCache(image.cache, source_hash, image.texture);
+	// Caches rewritten since the pack was built are only up to date on
+	// disk.
+	if (!is_cached && image.cache.is_in_pack()) {
+		image.cache = MappedFile(cache_path, true);
+		is_cached = readTextureCache(image.cache, source_hash, image.texture);
+	}
+	if (is_cached) {
+		image.was_cached = true;
+		return;
+	}
+	image.cache = MappedFile();
+
+	// Images are decoded out of their mapping, possibly in the asset
+	// pack, into the buffer stb allocates, which is only needed until
+	// the mipmap chain got cooked.
+	MappedFile const source(image.filename);
+	if (!source.is_valid())
+		return;
+	int width = 0, height = 0, source_channels_nb = 0;
+	stbi_set_flip_vertically_on_load_thread(request.flip ? 1 : 0);
+	auto const texels = stbi_load_from_memory(static_cast<stbi_uc const*>(source.data()), static_cast<int>(source.size()),
+	                                          &width, &height, &source_channels_nb, static_cast<int>(channels_nb));
+	if (texels == nullptr)
+		return;
+	cookTexture(texels, static_cast<std::uint32_t>(width), static_cast<std::uint32_t>(height), source_channels_nb,
+	            request.usage, request.generate_mipmap, request.compress, image.storage, image.texture);
+	stbi_image_free(texels);
+
+	// Images only found in the asset pack have no folder on disk to keep
+	// their cache in.
+	if (source.is_in_pack() && !std::ifstream(utils::widen(image.filename)))
+		return;
+	image.was_written = writeTextureCache(cache_path, source_hash, image.texture);
+}
+
+void
+bonobo::TextureLoader::upload(Request const& request)
+{
+	for (auto const& image : request.images) {
+		if (image.texture.levels.empty()) {
+			LogWarning("Couldn't load or decode image file %s", image.filename.c_str());
+			return;
+		}
+		if (!image.was_written)
+			LogWarning("Couldn't write the texture cache of %s", image.filename.c_str());
+	}
+	// The faces of a cubemap have to be square, and cooked alike.
+	auto const& first = request.images[0].texture;
+	if (request.target == GL_TEXTURE_CUBE_MAP) {
+		for (auto const& image : request.images) {
+			auto const& texture = image.texture;
+			if (texture.levels[0].width != texture.levels[0].height || texture.levels[0].width != first.levels[0].width
+			    || texture.levels.size() != first.levels.size() || texture.internal_format != first.internal_format) {
+				LogWarning("Faces of cubemap %s differ in size or format, or are not square", request.images[0].filename.c_str());
+				return;
+			}
+		}
+	}
+
+	glBindTexture(request.target, request.texture);
+	bool is_uploaded = true;
+	for (std::size_t i = 0u; i < request.images.size(); ++i) {
+		auto const target = request.target == GL_TEXTURE_CUBE_MAP ? static_cast<GLenum>(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i) : request.target;
+		is_uploaded = upload_image(request.images[i], target) && is_uploaded;
+	}
+	// Levels were cooked along with the image rather than generated
+	// here; a texture keeping its placeholder only has the first one.
+	if (is_uploaded) {
+		glTexParameteri(request.target, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(first.levels.size()) - 1);
+		// Grey colours were kept as luminance, and alpha if any.
+		if (request.usage == TextureUsage::colour && get_channels_nb(first.internal_format) < 4u) {
+			auto const has_alpha = get_channels_nb(first.internal_format) == 2u;
+			GLint const swizzle[] = { GL_RED, GL_RED, GL_RED, has_alpha ? GL_GREEN : GL_ONE };
+			glTexParameteriv(request.target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		}
+	}
+	glBindTexture(request.target, 0u);
+}
+
+bool
+bonobo::TextureLoader::upload_image(Image const& image, GLenum target)
+{
+	auto& pixel_buffer = _pixel_buffers[_next_pixel_buffer];
+	_next_pixel_buffer = (_next_pixel_buffer + 1u) % _pixel_buffers.size();
+
+	// Only wait for the GPU to be done with the previous upload out of
+	// this buffer, which was issued a whole ring ago.
+	if (pixel_buffer.fence != nullptr) {
+		glClientWaitSync(pixel_buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+		glDeleteSync(pixel_buffer.fence);
+		pixel_buffer.fence = nullptr;
+	}
+
+	// All levels go through the buffer at once.
+	auto const& texture = image.texture;
+	if (pixel_buffer.bo == 0u)
+		glGenBuffers(1, &pixel_buffer.bo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer.bo);
+	if (pixel_buffer.capacity < texture.size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(texture.size), nullptr, GL_STREAM_DRAW);
+		pixel_buffer.capacity = texture.size;
+	}
+
+	bool is_uploaded = false;
+	auto const pixel_format = get_pixel_format(texture.internal_format);
+	auto const data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(texture.size),
+	                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (data != nullptr) {
+		std::memcpy(data, texture.data, texture.size);
+		if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE) {
+			// Rows of single- and two-channel levels are tightly packed.
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			for (std::size_t l = 0u; l < texture.levels.size(); ++l) {
+				auto const& level = texture.levels[l];
+				auto const offset = reinterpret_cast<GLvoid const*>(level.offset);
+				if (isCompressedFormat(texture.internal_format))
+					glCompressedTexImage2D(target, static_cast<GLint>(l), texture.internal_format,
+					                       static_cast<GLsizei>(level.width), static_cast<GLsizei>(level.height),
+					                       0, static_cast<GLsizei>(level.size), offset);
+				else
+					glTexImage2D(target, static_cast<GLint>(l), static_cast<GLint>(texture.internal_format),
+					             static_cast<GLsizei>(level.width), static_cast<GLsizei>(level.height),
+					             0, pixel_format, GL_UNSIGNED_BYTE, offset);
+			}
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			is_uploaded = true;
+		} else {
+			LogWarning("Pixel buffer got corrupted while uploading %s; the texture keeps its placeholder.", image.filename.c_str());
+		}
+	} else {
+		LogWarning("Failed to map a pixel buffer for uploading %s", image.filename.c_str());
+	}
+	pixel_buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0u);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0u);
+	return is_uploaded;
+}
+
+void
+bonobo::TextureLoader::release(Request& request)
+{
+	for (auto& image : request.images) {
+		image.texture = CookedTexture();
+		image.cache = MappedFile();
+		std::vector<std::uint8_t>().swap(image.storage);
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "core/MappedFile.hpp"
+#include "core/TextureCache.hpp"
+
+#include <glad/glad.h>
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Loader of images into textures, decoding them in the
+	//!        background.
+	//!
+	//! Textures are created straight away, holding a single texel of a
+	//! placeholder colour, so that they can be bound right after being
+	//! requested. Worker threads cook the images into their whole mipmap
+	//! chain, only keeping the channels their usage needs and compressed
+	//! when the driver supports it, and keep the
+	//! result in a `.cache` file next to each image; later runs only map
+	//! that file. `update()` uploads the textures which are ready through
+	//! a ring of pixel buffer objects; each one is fenced, so that it only
+	//! gets rewritten once the GPU is done reading it.
+	class TextureLoader
+	{
+	public:
+		//! \brief RGBA colour of a placeholder texel.
+		using Colour = std::array<std::uint8_t, 4>;
+
+		//! @param [in] upload_budget how many bytes of texels `update()`
+		//!             uploads at most, although it always uploads at
+		//!             least one texture when any is ready
+		explicit TextureLoader(std::size_t upload_budget = 64u << 20);
+		~TextureLoader();
+
+		TextureLoader(TextureLoader const&) = delete;
+		TextureLoader& operator=(TextureLoader const&) = delete;
+
+		//! \brief Request an image to be loaded into a 2D-texture.
+		//!
+		//! Images failing to load are reported by `update()`, and keep
+		//! their placeholder. Requesting the same image again, for the
+		//! same usage and mipmapping, returns the texture of the first
+		//! request rather than cooking it twice.
+		//!
+		//! @param [in] usage what the image holds, deciding the format
+		//!             of the texture
+		//! @return the name of the texture, holding the placeholder until
+		//!         the image gets uploaded
+		GLuint load_2d(std::string const& filename, bool generate_mipmap,
+		               TextureUsage usage = TextureUsage::colour,
+		               Colour const& placeholder = { { 255u, 255u, 255u, 255u } });
+
+		//! \brief Request six images to be loaded into a cubemap-texture,
+		//!        which gets all of its faces at once.
+		//!
+		//! @param [in] filenames images of the faces, in the order of the
+		//!             GL_TEXTURE_CUBE_MAP_POSITIVE_X & co. targets
+		GLuint load_cube_map(std::array<std::string, 6> const& filenames, bool generate_mipmap,
+		                     TextureUsage usage = TextureUsage::colour,
+		                     Colour const& placeholder = { { 255u, 255u, 255u, 255u } });
+
+		//! \brief Upload the textures whose images were decoded, within
+		//!        the upload budget; to be called once per frame.
+		void update();
+
+		//! \brief Wait for all requested textures, and upload them.
+		void finish();
+
+		//! \brief Number of textures still waiting for their images.
+		std::size_t get_pending_nb() const;
+
+	private:
+		struct Image {
+			std::string filename;
+			MappedFile cache;                  //!< backing `texture` when it was cached
+			std::vector<std::uint8_t> storage; //!< backing `texture` when it was cooked
+			CookedTexture texture;             //!< without any level if loading failed
+			bool was_cached{false};
+			bool was_written{true};            //!< whether its cache could be written
+		};
+
+		struct Request {
+			GLuint texture;
+			GLenum target;
+			bool generate_mipmap;
+			bool flip;
+			TextureUsage usage;
+			bool compress;
+			std::vector<Image> images;
+			std::size_t images_left; //!< guarded by `_mutex`
+		};
+
+		// Buffer of the upload ring, along with the fence of the last
+		// upload out of it
+		struct PixelBuffer {
+			GLuint bo{0u};
+			std::size_t capacity{0u};
+			GLsync fence{nullptr};
+		};
+
+		GLuint create_placeholder(GLenum target, bool generate_mipmap, Colour const& placeholder) const;
+		void enqueue(std::unique_ptr<Request> request);
+		void decode_images();
+		void upload(Request const& request);
+		bool upload_image(Image const& image, GLenum target);
+		void load_image(Request const& request, Image& image) const;
+		bool can_compress(TextureUsage usage) const;
+		static void release(Request& request);
+
+		std::size_t _upload_budget;
+		bool _has_s3tc{false};
+		bool _has_srgb_s3tc{false};
+		std::vector<PixelBuffer> _pixel_buffers;
+		std::size_t _next_pixel_buffer{0u};
+
+		// Textures returned by `load_2d()`, by image, usage and mipmapping
+		std::map<std::tuple<std::string, TextureUsage, bool>, GLuint> _textures_2d;
+
+		// Requests being decoded, which the workers point into
+		std::vector<std::unique_ptr<Request>> _requests;
+
+		mutable std::mutex _mutex;
+		std::condition_variable _work_available;
+		std::condition_variable _request_ready;
+		std::deque<std::pair<Request*, std::size_t>> _images_to_decode;
+		std::vector<Request*> _ready_requests;
+		bool _is_stopping{false};
+		std::vector<std::thread> _workers;
+	};
+}
@@ -0,0 +1,104 @@
+#include "UniformBuffer.hpp"
+
+#include "core/Log.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+bonobo::ObjectConstants
+bonobo::makeObjectConstants(glm::mat4 const& world, glm::mat4 const& world_to_clip)
+{
+	return { world, glm::transpose(glm::inverse(world)), world_to_clip };
+}
+
+bonobo::UniformBuffer::UniformBuffer(GLsizeiptr capacity) : _capacity(std::max(capacity, static_cast<GLsizeiptr>(1)))
+{
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	if (alignment > 0)
+		_alignment = static_cast<GLsizeiptr>(alignment);
+
+	glGenBuffers(1, &_buffer);
+	assert(_buffer != 0u);
+	glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+	glBufferData(GL_UNIFORM_BUFFER, _capacity, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0u);
+
+	_staging.reserve(static_cast<std::size_t>(_capacity));
+}
+
+bonobo::UniformBuffer::~UniformBuffer()
+{
+	glDeleteBuffers(1, &_buffer);
+	_buffer = 0u;
+}
+
+void
+bonobo::UniformBuffer::reset()
+{
+	_staging.clear();
+	_uploaded_size = 0;
+	_needs_orphaning = true;
+}
+
+bonobo::UniformBuffer::Range
+bonobo::UniformBuffer::push(void const* data, GLsizeiptr size)
+{
+	auto const offset = aligned_size();
+	_staging.resize(static_cast<std::size_t>(offset + size));
+	std::memcpy(_staging.data() + offset, data, static_cast<std::size_t>(size));
+
+	return Range{ _buffer, offset, size };
+}
+
+bool
+bonobo::UniformBuffer::has_room_for(GLsizeiptr size) const
+{
+	return aligned_size() + size <= _capacity;
+}
+
+void
+bonobo::UniformBuffer::upload()
+{
+	auto const size = static_cast<GLsizeiptr>(_staging.size());
+	if (size == _uploaded_size)
+		return;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+	if (size > _capacity) {
+		// Ranges handed out so far stay valid as the buffer keeps its name,
+		// but everything has to be uploaded again.
+		while (_capacity < size)
+			_capacity *= 2;
+		LogInfo("Growing uniform buffer %u to %lld bytes.", _buffer, static_cast<long long>(_capacity));
+		glBufferData(GL_UNIFORM_BUFFER, _capacity, nullptr, GL_STREAM_DRAW);
+		_uploaded_size = 0;
+	} else if (_needs_orphaning) {
+		glBufferData(GL_UNIFORM_BUFFER, _capacity, nullptr, GL_STREAM_DRAW);
+	}
+	glBufferSubData(GL_UNIFORM_BUFFER, _uploaded_size, size - _uploaded_size, _staging.data() + _uploaded_size);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0u);
+
+	_uploaded_size = size;
+	_needs_orphaning = false;
+}
+
+void
+bonobo::UniformBuffer::bind(GLuint binding, Range const& range)
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, range.buffer, range.offset, range.size);
+}
+
+void
+bonobo::UniformBuffer::bind(uniform_block_bindings binding, Range const& range)
+{
+	bind(static_cast<GLuint>(binding), range);
+}
+
+GLsizeiptr
+bonobo::UniformBuffer::aligned_size() const
+{
+	auto const size = static_cast<GLsizeiptr>(_staging.size());
+	return (size + _alignment - 1) / _alignment * _alignment;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace bonobo
+{
+	//! \brief Uniform block binding points reserved by the framework;
+	//!        applications can use any binding point starting from
+	//!        `first_application_binding`.
+	enum class uniform_block_bindings : GLuint {
+		object_constants = 0u,    //!< = 0, binding point of the `ObjectConstants` block
+		first_application_binding //!< = 1, first binding point free for applications
+	};
+
+	//! \brief Constants of a single draw call, as laid out (following the
+	//!        std140 rules) by the `ObjectConstants` block declared in
+	//!        shaders/object_constants.glsl.
+	struct ObjectConstants {
+		glm::mat4 vertex_model_to_world;
+		glm::mat4 normal_model_to_world;
+		glm::mat4 vertex_world_to_clip;
+	};
+
+	//! \brief Compute the constants of a draw call.
+	//!
+	//! @param [in] world Matrix transforming from model-space to
+	//!             world-space
+	//! @param [in] world_to_clip Matrix transforming from world-space to
+	//!             clip-space
+	ObjectConstants makeObjectConstants(glm::mat4 const& world, glm::mat4 const& world_to_clip);
+
+	//! \brief Buffer into which uniform blocks are appended during a frame,
+	//!        and uploaded all at once.
+	//!
+	//! Each block starts at an offset respecting
+	//! GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, so that it can be bound on its
+	//! own: drawing with different constants then only requires binding a
+	//! different range of the same buffer.
+	class UniformBuffer
+	{
+	public:
+		//! \brief Part of a buffer holding one block.
+		struct Range {
+			GLuint     buffer{0u};
+			GLintptr   offset{0};
+			GLsizeiptr size{0};
+		};
+
+		//! \brief Allocate the buffer.
+		//!
+		//! @param [in] capacity how many bytes to allocate at first; the
+		//!             buffer grows if more than that is pushed between two
+		//!             resets.
+		explicit UniformBuffer(GLsizeiptr capacity = 64 * 1024);
+
+		//! \brief Release the buffer.
+		~UniformBuffer();
+
+		UniformBuffer(UniformBuffer const&) = delete;
+		UniformBuffer& operator=(UniformBuffer const&) = delete;
+
+		//! \brief Forget all blocks pushed so far, typically at the
+		//!        beginning of a frame.
+		//!
+		//! The previous content of the buffer is orphaned during the next
+		//! upload, rather than overwritten, so that draw calls still in
+		//! flight keep reading it.
+		void reset();
+
+		//! \brief Append a block, to be uploaded by the next call to
+		//!        `upload()`.
+		//!
+		//! @return where the block will be found in the buffer
+		Range push(void const* data, GLsizeiptr size);
+
+		template<typename T>
+		Range push(T const& block) { return push(&block, static_cast<GLsizeiptr>(sizeof(T))); }
+
+		//! \brief Whether a block of the given size can be pushed without
+		//!        having to grow the buffer.
+		bool has_room_for(GLsizeiptr size) const;
+
+		//! \brief Copy to the buffer all blocks pushed since the previous
+		//!        upload.
+		void upload();
+
+		//! \brief Bind a block to the given binding point.
+		static void bind(GLuint binding, Range const& range);
+		static void bind(uniform_block_bindings binding, Range const& range);
+
+	private:
+		GLsizeiptr aligned_size() const;
+
+		GLuint                    _buffer{0u};
+		GLsizeiptr                _capacity{0};
+		GLsizeiptr                _alignment{256};
+		GLsizeiptr                _uploaded_size{0};
+		bool                      _needs_orphaning{false};
+		std::vector<std::uint8_t> _staging;
+	};
+}
@@ -1,25 +1,39 @@
 #include "config.hpp"
 #include "helpers.hpp"
 
+#include "core/AssetPack.hpp"
 #include "core/Log.h"
+#include "core/MappedFile.hpp"
+#include "core/MeshCache.hpp"
+#include "core/MeshOptimizer.hpp"
 #include "core/opengl.hpp"
+#include "core/ShaderProgramManager.hpp"
 #include "core/various.hpp"
 
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/Importer.hpp>
+#include <assimp/IOStream.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <imgui.h>
-#include <stb_image.h>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <utility>
 
 namespace local
 {
 	static GLuint fullscreen_shader;
 	static GLuint display_vao;
+	static std::unique_ptr<bonobo::UniformBuffer> streaming_uniform_buffer;
+	static std::unique_ptr<bonobo::MeshPool> mesh_pool;
+	static std::unique_ptr<bonobo::TextureLoader> texture_loader;
 	static std::array<char const*, 3> const cull_mode_labels{
 		"Disabled",
 		"Back faces",
@@ -40,72 +54,164 @@ bonobo::init()
 	local::fullscreen_shader = bonobo::createProgram("fullscreen.vert", "fullscreen.frag");
 	if (local::fullscreen_shader == 0u)
 		LogError("Failed to load \"fullscreen.vert\" and \"fullscreen.frag\"");
+	local::streaming_uniform_buffer = std::make_unique<bonobo::UniformBuffer>();
+	local::mesh_pool = std::make_unique<bonobo::MeshPool>();
+	local::texture_loader = std::make_unique<bonobo::TextureLoader>();
 }
 
 void
 bonobo::deinit()
 {
 	glDeleteVertexArrays(1, &local::display_vao);
+	local::streaming_uniform_buffer.reset();
+	local::mesh_pool.reset();
+	local::texture_loader.reset();
 }
 
-static std::vector<std::uint8_t>
-getTextureData(std::string const& filename, std::uint32_t& width, std::uint32_t& height, bool flip)
+bonobo::UniformBuffer&
+bonobo::getStreamingUniformBuffer()
 {
-	auto const channels_nb = 4u;
-	stbi_set_flip_vertically_on_load_thread(flip ? 1 : 0);
-	unsigned char* image_data = stbi_load(filename.c_str(), reinterpret_cast<int*>(&width), reinterpret_cast<int*>(&height), nullptr, channels_nb);
-	if (image_data == nullptr) {
-		LogWarning("Couldn't load or decode image file %s", filename.c_str());
-
-		// Provide a small empty image instead in case of failure.
-		width = 16;
-		height = 16;
-		return std::vector<unsigned char>(width * height * channels_nb);
-	}
+	assert(local::streaming_uniform_buffer != nullptr);
+	return *local::streaming_uniform_buffer;
+}
 
-	std::vector<unsigned char> image(width * height * channels_nb);
-	std::memcpy(image.data(), image_data, image.size());
-	stbi_image_free(image_data);
+bonobo::MeshPool&
+bonobo::getMeshPool()
+{
+	assert(local::mesh_pool != nullptr);
+	return *local::mesh_pool;
+}
 
-	return image;
+bonobo::TextureLoader&
+bonobo::getTextureLoader()
+{
+	assert(local::texture_loader != nullptr);
+	return *local::texture_loader;
 }
 
-std::vector<bonobo::mesh_data>
-bonobo::loadObjects(std::string const& filename)
+// Settings changing what gets cooked out of an object file, hashed along
+// with it so that caches get rebuilt when they change
+namespace cooking
 {
-	std::vector<bonobo::mesh_data> objects;
-	std::vector<texture_bindings> materials_bindings;
+	static unsigned int const import_flags = aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_CalcTangentSpace
+	                                       | aiProcess_JoinIdenticalVertices;
+	// Each level has about half the triangles of the previous one.
+	static std::size_t const lods_nb = 4u;
+	// Bumped whenever meshes get processed differently
+	static std::uint64_t const version = 2u;
+	static std::uint64_t const settings = import_flags | (static_cast<std::uint64_t>(lods_nb) << 32) | (version << 40);
+}
 
-	auto const end_of_basedir = filename.rfind("/");
-	auto const parent_folder = (end_of_basedir != std::string::npos ? filename.substr(0, end_of_basedir) : ".") + "/";
-	LogInfo("Loading \"%s\"", filename.c_str());
+// Assimp reads object files and their materials out of mappings rather
+// than streams, which also finds them in the mounted asset pack.
+namespace mapped_io
+{
+	class Stream : public Assimp::IOStream
+	{
+	public:
+		explicit Stream(bonobo::MappedFile file) : _file(std::move(file))
+		{
+		}
+
+		size_t Read(void* buffer, size_t size, size_t count) override
+		{
+			if (size == 0u)
+				return 0u;
+			count = std::min(count, (_file.size() - _position) / size);
+			std::memcpy(buffer, static_cast<unsigned char const*>(_file.data()) + _position, size * count);
+			_position += size * count;
+			return count;
+		}
+
+		size_t Write(void const* /*buffer*/, size_t /*size*/, size_t /*count*/) override
+		{
+			return 0u;
+		}
+
+		aiReturn Seek(size_t offset, aiOrigin origin) override
+		{
+			auto const base = origin == aiOrigin_SET ? 0u : origin == aiOrigin_CUR ? _position : _file.size();
+			if (offset > _file.size() - base)
+				return aiReturn_FAILURE;
+			_position = base + offset;
+			return aiReturn_SUCCESS;
+		}
+
+		size_t Tell() const override
+		{
+			return _position;
+		}
+
+		size_t FileSize() const override
+		{
+			return _file.size();
+		}
+
+		void Flush() override
+		{
+		}
+
+	private:
+		bonobo::MappedFile _file;
+		std::size_t _position{0u};
+	};
+
+	// Falls back to the default streams for writing, and for files which
+	// cannot be mapped, such as empty ones.
+	class System : public Assimp::DefaultIOSystem
+	{
+	public:
+		bool Exists(char const* path) const override
+		{
+			auto const pack = bonobo::getMountedAssetPack();
+			if (pack != nullptr && pack->find(path).data != nullptr)
+				return true;
+			return DefaultIOSystem::Exists(path);
+		}
+
+		Assimp::IOStream* Open(char const* path, char const* mode) override
+		{
+			if (std::strchr(mode, 'w') == nullptr && std::strchr(mode, 'a') == nullptr) {
+				bonobo::MappedFile file(path);
+				if (file.is_valid())
+					return new Stream(std::move(file));
+			}
+			return DefaultIOSystem::Open(path, mode);
+		}
+	};
+}
+
+// Import an object file with assimp, keeping the vertices and indices of
+// its meshes in `buffers`, which the cooked meshes point into.
+static bool
+importObjects(std::string const& filename, bonobo::CookedObjects& objects,
+              std::vector<std::pair<std::vector<std::uint8_t>, std::vector<GLuint>>>& buffers)
+{
 	Assimp::Importer importer;
-	auto const assimp_scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_CalcTangentSpace);
+	importer.SetIOHandler(new mapped_io::System());
+	auto const assimp_scene = importer.ReadFile(filename, cooking::import_flags);
 	if (assimp_scene == nullptr || assimp_scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || assimp_scene->mRootNode == nullptr) {
 		LogError("Assimp failed to load \"%s\": %s", filename.c_str(), importer.GetErrorString());
-		return objects;
+		return false;
 	}
 
 	if (assimp_scene->mNumMeshes == 0u) {
 		LogError("No mesh available; loading \"%s\" must have had issues", filename.c_str());
-		return objects;
+		return false;
 	}
 
-	LogInfo("\t* materials");
-	materials_bindings.reserve(assimp_scene->mNumMaterials);
+	objects.materials.reserve(assimp_scene->mNumMaterials);
 	for (size_t i = 0; i < assimp_scene->mNumMaterials; ++i) {
-		texture_bindings bindings;
+		std::vector<bonobo::TextureReference> textures;
 		auto const material = assimp_scene->mMaterials[i];
 
-		auto const process_texture = [&bindings,&material,i,&parent_folder](aiTextureType type, std::string const& type_as_str, std::string const& name){
+		auto const process_texture = [&textures,&material,i](aiTextureType type, std::string const& type_as_str, std::string const& name){
 			if (material->GetTextureCount(type)) {
 				if (material->GetTextureCount(type) > 1)
 					LogWarning("Material %d has more than one %s texture: discarding all but the first one.", i, type_as_str.c_str());
 				aiString path;
 				material->GetTexture(type, 0, &path);
-				auto const id = bonobo::loadTexture2D(parent_folder + std::string(path.C_Str()), type_as_str != "opacity");
-				if (id != 0u)
-					bindings.emplace(name, id);
+				textures.push_back({ name, std::string(path.C_Str()), type_as_str != "opacity" });
 			}
 		};
 		process_texture(aiTextureType_DIFFUSE,  "diffuse",  "diffuse_texture");
@@ -113,102 +219,75 @@ bonobo::loadObjects(std::string const& filename)
 		process_texture(aiTextureType_NORMALS,  "normals",  "normals_texture");
 		process_texture(aiTextureType_OPACITY,  "opacity",  "opacity_texture");
 
-		materials_bindings.push_back(bindings);
+		objects.materials.push_back(textures);
 	}
 
-	LogInfo("\t* meshes");
-	objects.reserve(assimp_scene->mNumMeshes);
-	for (size_t j = 0; j < assimp_scene->mNumMeshes; ++j) {
+	// Meshes get cooked in parallel, each one into its own slot so that
+	// they keep their order. Messages are only logged once all meshes are
+	// done, as the log outputs are not meant to be shared between threads.
+	struct CookingSlot {
+		bonobo::CookedMesh mesh;
+		bool is_cooked{false};
+		std::string error;
+		std::string warning; // about a mesh which got cooked nonetheless
+		// Number of triangles, and average number of vertices transformed
+		// per triangle before and after reordering
+		std::size_t triangles_nb{0u};
+		double acmr_before{0.0};
+		double acmr_after{0.0};
+	};
+	std::vector<CookingSlot> slots(assimp_scene->mNumMeshes);
+
+	// The buffers are never reallocated, so that the meshes can point
+	// into them.
+	buffers.resize(assimp_scene->mNumMeshes);
+
+	utils::parallel_for(assimp_scene->mNumMeshes, [assimp_scene, &slots, &buffers](std::size_t j) {
 		auto const assimp_object_mesh = assimp_scene->mMeshes[j];
+		auto& slot = slots[j];
 
 		if (!assimp_object_mesh->HasFaces()) {
-			LogError("Unsupported object \"%s\": has no faces", assimp_object_mesh->mName.C_Str());
-			continue;
+			slot.error = "has no faces";
+			return;
 		}
 		if ((assimp_object_mesh->mPrimitiveTypes & ~static_cast<uint32_t>(aiPrimitiveType_POINT))    != 0u
 		 && (assimp_object_mesh->mPrimitiveTypes & ~static_cast<uint32_t>(aiPrimitiveType_LINE))     != 0u
 		 && (assimp_object_mesh->mPrimitiveTypes & ~static_cast<uint32_t>(aiPrimitiveType_TRIANGLE)) != 0u) {
-			LogError("Unsupported object \"%s\": uses multiple primitive types", assimp_object_mesh->mName.C_Str());
-			continue;
+			slot.error = "uses multiple primitive types";
+			return;
 		}
 		if ((assimp_object_mesh->mPrimitiveTypes & static_cast<uint32_t>(aiPrimitiveType_POLYGON)) == static_cast<uint32_t>(aiPrimitiveType_POLYGON)) {
-			LogError("Unsupported object \"%s\": uses polygons", assimp_object_mesh->mName.C_Str());
-			continue;
+			slot.error = "uses polygons";
+			return;
 		}
 		if (!assimp_object_mesh->HasPositions()) {
-			LogError("Unsupported object \"%s\": has no positions", assimp_object_mesh->mName.C_Str());
-			continue;
+			slot.error = "has no positions";
+			return;
 		}
 
-		bonobo::mesh_data object;
+		auto& mesh = slot.mesh;
 		if (assimp_object_mesh->mName.length != 0)
 		{
-			object.name = std::string(assimp_object_mesh->mName.C_Str());
+			mesh.name = std::string(assimp_object_mesh->mName.C_Str());
 		}
-
-		glGenVertexArrays(1, &object.vao);
-		assert(object.vao != 0u);
-		glBindVertexArray(object.vao);
-
-		auto const vertices_offset = 0u;
-		auto const vertices_size = static_cast<GLsizeiptr>(assimp_object_mesh->mNumVertices * sizeof(glm::vec3));
-
-		auto const normals_offset = vertices_size;
-		auto const normals_size = assimp_object_mesh->HasNormals() ? vertices_size : 0u;
-
-		auto const texcoords_offset = normals_offset + normals_size;
-		auto const texcoords_size = assimp_object_mesh->HasTextureCoords(0u) ? vertices_size : 0u;
-
-		auto const tangents_offset = texcoords_offset + texcoords_size;
-		auto const tangents_size = assimp_object_mesh->HasTangentsAndBitangents() ? vertices_size : 0u;
-
-		auto const binormals_offset = tangents_offset + tangents_size;
-		auto const binormals_size = assimp_object_mesh->HasTangentsAndBitangents() ? vertices_size : 0u;
-
-
-		auto const bo_size = static_cast<GLsizeiptr>(vertices_size
-		                                            +normals_size
-		                                            +texcoords_size
-		                                            +tangents_size
-		                                            +binormals_size
-		                                            );
-
-		glGenBuffers(1, &object.bo);
-		assert(object.bo != 0u);
-		glBindBuffer(GL_ARRAY_BUFFER, object.bo);
-		glBufferData(GL_ARRAY_BUFFER, bo_size, nullptr, GL_STATIC_DRAW);
-
-		glBufferSubData(GL_ARRAY_BUFFER, vertices_offset, vertices_size, static_cast<GLvoid const*>(assimp_object_mesh->mVertices));
-		glEnableVertexAttribArray(static_cast<unsigned int>(bonobo::shader_bindings::vertices));
-		glVertexAttribPointer(static_cast<unsigned int>(bonobo::shader_bindings::vertices), 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<GLvoid const*>(0x0));
-
-		if (assimp_object_mesh->HasNormals()) {
-			glBufferSubData(GL_ARRAY_BUFFER, normals_offset, normals_size, static_cast<GLvoid const*>(assimp_object_mesh->mNormals));
-			glEnableVertexAttribArray(static_cast<unsigned int>(bonobo::shader_bindings::normals));
-			glVertexAttribPointer(static_cast<unsigned int>(bonobo::shader_bindings::normals), 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<GLvoid const*>(normals_offset));
-		}
-
-		if (assimp_object_mesh->HasTextureCoords(0u)) {
-			glBufferSubData(GL_ARRAY_BUFFER, texcoords_offset, texcoords_size, static_cast<GLvoid const*>(assimp_object_mesh->mTextureCoords[0u]));
-			glEnableVertexAttribArray(static_cast<unsigned int>(bonobo::shader_bindings::texcoords));
-			glVertexAttribPointer(static_cast<unsigned int>(bonobo::shader_bindings::texcoords), 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<GLvoid const*>(texcoords_offset));
-		}
-
+		mesh.material_id = assimp_object_mesh->mMaterialIndex;
+
+		// aiVector3D is laid out like glm::vec3.
+		bonobo::MeshPool::VertexStreams streams;
+		streams.vertices_nb = assimp_object_mesh->mNumVertices;
+		streams.vertices = reinterpret_cast<glm::vec3 const*>(assimp_object_mesh->mVertices);
+		if (assimp_object_mesh->HasNormals())
+			streams.normals = reinterpret_cast<glm::vec3 const*>(assimp_object_mesh->mNormals);
+		if (assimp_object_mesh->HasTextureCoords(0u))
+			streams.texcoords = reinterpret_cast<glm::vec3 const*>(assimp_object_mesh->mTextureCoords[0u]);
 		if (assimp_object_mesh->HasTangentsAndBitangents()) {
-			glBufferSubData(GL_ARRAY_BUFFER, tangents_offset, tangents_size, static_cast<GLvoid const*>(assimp_object_mesh->mTangents));
-			glEnableVertexAttribArray(static_cast<unsigned int>(bonobo::shader_bindings::tangents));
-			glVertexAttribPointer(static_cast<unsigned int>(bonobo::shader_bindings::tangents), 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<GLvoid const*>(tangents_offset));
-
-			glBufferSubData(GL_ARRAY_BUFFER, binormals_offset, binormals_size, static_cast<GLvoid const*>(assimp_object_mesh->mBitangents));
-			glEnableVertexAttribArray(static_cast<unsigned int>(bonobo::shader_bindings::binormals));
-			glVertexAttribPointer(static_cast<unsigned int>(bonobo::shader_bindings::binormals), 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<GLvoid const*>(binormals_offset));
+			streams.tangents = reinterpret_cast<glm::vec3 const*>(assimp_object_mesh->mTangents);
+			streams.binormals = reinterpret_cast<glm::vec3 const*>(assimp_object_mesh->mBitangents);
 		}
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0u);
-
 		auto const num_vertices_per_face = assimp_object_mesh->mFaces[0u].mNumIndices;
-		object.indices_nb = assimp_object_mesh->mNumFaces * num_vertices_per_face;
-		auto object_indices = std::make_unique<GLuint[]>(static_cast<size_t>(object.indices_nb));
+		auto const indices_nb = static_cast<size_t>(assimp_object_mesh->mNumFaces * num_vertices_per_face);
+		std::vector<GLuint> object_indices(indices_nb);
 		for (size_t i = 0u; i < assimp_object_mesh->mNumFaces; ++i) {
 			auto const& face = assimp_object_mesh->mFaces[i];
 			assert(face.mNumIndices <= 3);
@@ -218,29 +297,169 @@ bonobo::loadObjects(std::string const& filename)
 			if (num_vertices_per_face >= 2u)
 				object_indices[num_vertices_per_face * i + 2u] = face.mIndices[2u];
 		}
-		glGenBuffers(1, &object.ibo);
-		assert(object.ibo != 0u);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, object.ibo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<unsigned int>(object.indices_nb) * sizeof(GL_UNSIGNED_INT), reinterpret_cast<GLvoid const*>(object_indices.get()), GL_STATIC_DRAW);
-		object_indices.reset(nullptr);
-
-		glBindVertexArray(0u);
-		glBindBuffer(GL_ARRAY_BUFFER, 0u);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0u);
-
-		auto const material_id = assimp_object_mesh->mMaterialIndex;
-		if (material_id >= materials_bindings.size())
-			LogError("Object \"%s\" has a material index of %u, but only %u materials were retrieved.", assimp_object_mesh->mName.C_Str(), material_id, materials_bindings.size());
-		else
-			object.bindings = materials_bindings[material_id];
 
-		objects.push_back(object);
+		// Triangles get reordered for the post-transform cache, and then
+		// by clusters so that those likely to occlude others come first.
+		auto const optimize_triangles = [&streams](GLuint* indices, std::size_t indices_nb) {
+			bonobo::optimizeVertexCache(indices, indices_nb, streams.vertices_nb);
+			bonobo::optimizeOverdraw(indices, indices_nb, streams.vertices, streams.vertices_nb);
+		};
+		std::vector<bonobo::SimplifiedIndices> levels;
+		if (num_vertices_per_face == 3u) {
+			slot.triangles_nb = indices_nb / 3u;
+			slot.acmr_before = bonobo::computeACMR(object_indices.data(), indices_nb, streams.vertices_nb);
+			optimize_triangles(object_indices.data(), indices_nb);
+			slot.acmr_after = bonobo::computeACMR(object_indices.data(), indices_nb, streams.vertices_nb);
+
+			levels = bonobo::simplifyMesh(streams.vertices, streams.vertices_nb, object_indices.data(), indices_nb, cooking::lods_nb,
+			                              slot.warning);
+		}
+
+		// Coarser levels index the same vertices, so their indices simply
+		// get appended to the ones of the object.
+		for (auto& level : levels) {
+			optimize_triangles(level.indices.data(), level.indices.size());
+			mesh.lods.push_back({ object_indices.size(), level.indices.size(), level.error });
+			object_indices.insert(object_indices.end(), level.indices.begin(), level.indices.end());
+		}
+
+		bonobo::computeBounds(streams.vertices, streams.vertices_nb, mesh.bounding_box, mesh.bounding_sphere);
+
+		// Vertices get renumbered in the order the mesh, and then its
+		// levels, first use them, dropping the unused ones.
+		auto const remap = bonobo::optimizeVertexFetch(object_indices.data(), object_indices.size(), streams.vertices_nb);
+		auto const interleaved = bonobo::MeshPool::interleave(streams);
+		auto const stride = bonobo::MeshPool::get_stride(bonobo::MeshPool::get_format(streams));
+		auto const used_vertices_nb = static_cast<std::size_t>(std::count_if(remap.begin(), remap.end(), [](GLuint index) {
+			return index != bonobo::unused_vertex;
+		}));
+		std::vector<std::uint8_t> fetched(used_vertices_nb * stride);
+		for (std::size_t v = 0u; v < remap.size(); ++v)
+			if (remap[v] != bonobo::unused_vertex)
+				std::copy_n(interleaved.begin() + v * stride, stride, fetched.begin() + remap[v] * stride);
+
+		buffers[j] = std::make_pair(std::move(fetched), std::move(object_indices));
+		mesh.format = bonobo::MeshPool::get_format(streams);
+		mesh.vertices_nb = used_vertices_nb;
+		mesh.vertices = buffers[j].first.data();
+		mesh.indices_nb = indices_nb;
+		mesh.all_indices_nb = buffers[j].second.size();
+		mesh.indices = buffers[j].second.data();
+		slot.is_cooked = true;
 
 //		LogInfo("Loaded object \"%s\" with normals:%d, tangents&bitangents:%d, texcoords:%d",
 //		        assimp_object_mesh->mName.C_Str(), assimp_object_mesh->HasNormals(),
 //		        assimp_object_mesh->HasTangentsAndBitangents(), assimp_object_mesh->HasTextureCoords(0));
+	});
+
+	std::size_t triangles_nb = 0u;
+	double acmr_before = 0.0, acmr_after = 0.0;
+	objects.meshes.reserve(slots.size());
+	for (std::size_t j = 0u; j < slots.size(); ++j) {
+		auto& slot = slots[j];
+		if (!slot.is_cooked) {
+			LogError("Unsupported object \"%s\": %s", assimp_scene->mMeshes[j]->mName.C_Str(), slot.error.c_str());
+			continue;
+		}
+		if (!slot.warning.empty())
+			LogWarning("Object \"%s\" of \"%s\": %s.", assimp_scene->mMeshes[j]->mName.C_Str(), filename.c_str(), slot.warning.c_str());
+		triangles_nb += slot.triangles_nb;
+		acmr_before += static_cast<double>(slot.triangles_nb) * slot.acmr_before;
+		acmr_after += static_cast<double>(slot.triangles_nb) * slot.acmr_after;
+		objects.meshes.push_back(std::move(slot.mesh));
 	}
 
+	if (triangles_nb > 0u)
+		LogInfo("\t* %zu triangles, ACMR went from %.3f to %.3f", triangles_nb,
+		        acmr_before / static_cast<double>(triangles_nb), acmr_after / static_cast<double>(triangles_nb));
+
+	return true;
+}
+
+std::vector<bonobo::mesh_data>
+bonobo::loadObjects(std::string const& filename)
+{
+	std::vector<bonobo::mesh_data> objects;
+
+	auto const end_of_basedir = filename.rfind("/");
+	auto const parent_folder = (end_of_basedir != std::string::npos ? filename.substr(0, end_of_basedir) : ".") + "/";
+	LogInfo("Loading \"%s\"", filename.c_str());
+
+	// Objects get cooked into a cache next to their file, which later
+	// loads map and upload as is, rather than importing the file again.
+	auto const cache_path = filename + ".cache";
+	auto const source_hash = hashSourceFile(filename, cooking::settings);
+	MappedFile cache = source_hash != 0u ? MappedFile(cache_path) : MappedFile();
+	CookedObjects cooked;
+	std::vector<std::pair<std::vector<std::uint8_t>, std::vector<GLuint>>> imported_buffers;
+	auto is_cached = readMeshCache(cache, source_hash, cooked);
+	// Caches rewritten since the pack was built are only up to date on
+	// disk.
+	if (!is_cached && cache.is_in_pack()) {
+		cache = MappedFile(cache_path, true);
+		is_cached = readMeshCache(cache, source_hash, cooked);
+	}
+	if (is_cached) {
+		LogInfo("\t* from \"%s\"", cache_path.c_str());
+	} else {
+		// The mapping has to be released before replacing its file.
+		cache = MappedFile();
+		if (!importObjects(filename, cooked, imported_buffers))
+			return objects;
+		// Files only found in the asset pack have no folder on disk to
+		// keep their cache in.
+		auto const is_only_packed = MappedFile(filename).is_in_pack() && !std::ifstream(utils::widen(filename));
+		if (source_hash != 0u && !is_only_packed && writeMeshCache(cache_path, source_hash, cooked))
+			LogInfo("\t* cached into \"%s\"", cache_path.c_str());
+	}
+
+	LogInfo("\t* materials");
+	std::vector<texture_bindings> materials_bindings;
+	materials_bindings.reserve(cooked.materials.size());
+	for (auto const& material : cooked.materials) {
+		texture_bindings bindings;
+		for (auto const& texture : material) {
+			// Placeholders should look neutral until the images arrive.
+			auto placeholder = TextureLoader::Colour{ { 255u, 255u, 255u, 255u } };
+			auto usage = TextureUsage::colour;
+			if (texture.name == "normals_texture") {
+				placeholder = { { 128u, 128u, 255u, 255u } };
+				usage = TextureUsage::normal_map;
+			} else if (texture.name == "specular_texture") {
+				placeholder = { { 0u, 0u, 0u, 255u } };
+			} else if (texture.name == "opacity_texture") {
+				usage = TextureUsage::mask;
+			}
+			bindings.emplace(texture.name, getTextureLoader().load_2d(parent_folder + texture.path, texture.generate_mipmap, usage, placeholder));
+		}
+		materials_bindings.push_back(bindings);
+	}
+
+	LogInfo("\t* meshes");
+	objects.reserve(cooked.meshes.size());
+	getMeshPool().begin_uploads();
+	for (auto const& mesh : cooked.meshes) {
+		bonobo::mesh_data object;
+		object.name = mesh.name;
+		if (!getMeshPool().allocate(mesh.format, mesh.vertices, mesh.vertices_nb, mesh.indices, mesh.all_indices_nb, object)) {
+			LogError("Failed to allocate object \"%s\"", mesh.name.c_str());
+			continue;
+		}
+		object.indices_nb = mesh.indices_nb;
+		for (auto const& lod : mesh.lods)
+			object.lods.push_back({ object.first_index + lod.first_index, lod.indices_nb, lod.error });
+		object.bounding_box = mesh.bounding_box;
+		object.bounding_sphere = mesh.bounding_sphere;
+
+		if (mesh.material_id >= materials_bindings.size())
+			LogError("Object \"%s\" has a material index of %u, but only %u materials were retrieved.", mesh.name.c_str(), mesh.material_id, materials_bindings.size());
+		else
+			object.bindings = materials_bindings[mesh.material_id];
+
+		objects.push_back(object);
+	}
+	getMeshPool().end_uploads();
+
 	return objects;
 }
 
@@ -271,98 +490,21 @@ bonobo::createTexture(uint32_t width, uint32_t height, GLenum target, GLint inte
 }
 
 GLuint
-bonobo::loadTexture2D(std::string const& filename, bool generate_mipmap)
+bonobo::loadTexture2D(std::string const& filename, bool generate_mipmap, TextureUsage usage)
 {
-	std::uint32_t width, height;
-	auto const data = getTextureData(filename, width, height, true);
-	if (data.empty())
-		return 0u;
-
-	GLuint texture = bonobo::createTexture(width, height, GL_TEXTURE_2D, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<GLvoid const*>(data.data()));
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, generate_mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	if (generate_mipmap)
-		glGenerateMipmap(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, 0u);
-
-	return texture;
+	return getTextureLoader().load_2d(filename, generate_mipmap, usage);
 }
 
 GLuint
 bonobo::loadTextureCubeMap(std::string const& posx, std::string const& negx,
                            std::string const& posy, std::string const& negy,
                            std::string const& posz, std::string const& negz,
-                           bool generate_mipmap)
+                           bool generate_mipmap, TextureUsage usage)
 {
-	GLuint texture = 0u;
-	// Create an OpenGL texture object. Similarly to `glGenVertexArrays()`
-	// and `glGenBuffers()` that were used in assignment 2,
-	// `glGenTextures()` can create `n` texture objects at once. Here we
-	// only one texture object that will contain our whole cube map.
-	glGenTextures(1, &texture);
-	assert(texture != 0u);
-
-	// Similarly to vertex arrays and buffers, we first need to bind the
-	// texture object in orther to use it. Here we will bind it to the
-	// GL_TEXTURE_CUBE_MAP target to indicate we want a cube map. If you
-	// look at `bonobo::loadTexture2D()` just above, you will see that
-	// GL_TEXTURE_2D is used there, as we want a simple 2D-texture.
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
-
-	// Set the wrapping properties of the texture; you can have a look on
-	// http://docs.gl to learn more about them
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	// Set the minification and magnification properties of the textures;
-	// you can have a look on http://docs.gl to lear more about them, or
-	// attend EDAN35 in the next period ;-)
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, generate_mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	std::string directions[] = { posx, negx, posy, negy, posz, negz };
-
-	for (int i = 0; i < 6; i++) {
-		// We need to fill in the cube map using the images passed in as
-		// argument. The function `getTextureData()` uses stb to read in the
-		// image files and return a `std::vector<u8>` containing all the
-		// texels.
-		uint32_t width, height;
-		auto data = getTextureData(directions[i], width, height, false);
-		if (data.empty()) {
-			glDeleteTextures(1, &texture);
-			return 0u;
-		}
-		// With all the texels available on the CPU, we now want to push them
-		// to the GPU: this is done using `glTexImage2D()` (among others). You
-		// might have thought that the target used here would be the same as
-		// the one passed to `glBindTexture()` or `glTexParameteri()`, similar
-		// to what is done `bonobo::loadTexture2D()`. However, we want to fill
-		// in a cube map, which has six different faces, so instead we specify
-		// as the target the face we want to fill in. In this case, we will
-		// start by filling the face sitting on the negative side of the
-		// x-axis by specifying GL_TEXTURE_CUBE_MAP_NEGATIVE_X.
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-			/* mipmap level, you'll see that in EDAN35 */0,
-			/* how are the components internally stored */GL_RGBA,
-			/* the width of the cube map's face */static_cast<GLsizei>(width),
-			/* the height of the cube map's face */static_cast<GLsizei>(height),
-			/* must always be 0 */0,
-			/* the format of the pixel data: which components are available */GL_RGBA,
-			/* the type of each component */GL_UNSIGNED_BYTE,
-			/* the pointer to the actual data on the CPU */reinterpret_cast<GLvoid const*>(data.data()));
-	}
-
-	if (generate_mipmap)
-		// Generate the mipmap hierarchy; wait for EDAN35 to understand
-		// what it does
-		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0u);
-
-	return texture;
+	// The faces are given in the order of their targets, starting from
+	// GL_TEXTURE_CUBE_MAP_POSITIVE_X; they get decoded in parallel, and
+	// uploaded together once all of them are.
+	return getTextureLoader().load_cube_map({ { posx, negx, posy, negy, posz, negz } }, generate_mipmap, usage);
 }
 
 GLuint
@@ -396,17 +538,19 @@ bonobo::displayTexture(glm::vec2 const& lower_left, glm::vec2 const& upper_right
 	                                      relative_to_absolute(upper_right.y, window_size.y))
 	                         - viewport_origin;
 
+	using namespace bonobo::literals;
+
 	glViewport(viewport_origin.x, viewport_origin.y, viewport_size.x, viewport_size.y);
 	glUseProgram(local::fullscreen_shader);
 	glBindVertexArray(local::display_vao);
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, texture);
 	glBindSampler(0, sampler);
-	glUniform1i(glGetUniformLocation(local::fullscreen_shader, "tex"), 0);
-	glUniform4iv(glGetUniformLocation(local::fullscreen_shader, "swizzle"), 1, glm::value_ptr(swizzle));
-	glUniform1i(glGetUniformLocation(local::fullscreen_shader, "linearise"), linearise);
-	glUniform1f(glGetUniformLocation(local::fullscreen_shader, "near"), nearPlane);
-	glUniform1f(glGetUniformLocation(local::fullscreen_shader, "far"), farPlane);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(local::fullscreen_shader, "tex"_hash), 0);
+	glUniform4iv(ShaderProgramManager::GetUniformLocation(local::fullscreen_shader, "swizzle"_hash), 1, glm::value_ptr(swizzle));
+	glUniform1i(ShaderProgramManager::GetUniformLocation(local::fullscreen_shader, "linearise"_hash), linearise);
+	glUniform1f(ShaderProgramManager::GetUniformLocation(local::fullscreen_shader, "near"_hash), nearPlane);
+	glUniform1f(ShaderProgramManager::GetUniformLocation(local::fullscreen_shader, "far"_hash), farPlane);
 	glDrawArrays(GL_TRIANGLES, 0, 3);
 	glBindSampler(0, 0u);
 	glBindTexture(GL_TEXTURE_2D, 0);
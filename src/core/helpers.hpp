@@ -4,7 +4,12 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include "core/Culling.hpp"
 #include "core/FPSCamera.h" // As it includes OpenGL headers, import it after glad
+#include "core/LevelOfDetail.hpp"
+#include "core/MeshPool.hpp"
+#include "core/TextureLoader.hpp"
+#include "core/UniformBuffer.hpp"
 
 #include <functional>
 #include <string>
@@ -21,7 +26,7 @@ namespace bonobo
 		normals,       //!< = 1, value of the binding point for normals
 		texcoords,     //!< = 2, value of the binding point for texcoords
 		tangents,      //!< = 3, value of the binding point for tangents
-		binormals      //!< = 4, value of the binding point for binormals
+		binormals      //!< = 4, value of the binding point for binormals; pooled meshes rebuild them in shaders instead
 	};
 
 	//! \brief Association of a sampler name used in GLSL to a
@@ -31,10 +36,17 @@ namespace bonobo
 	//! \brief Contains the data for a mesh in OpenGL.
 	struct mesh_data {
 		GLuint vao{0u};                          //!< OpenGL name of the Vertex Array Object
+		GLuint depth_vao{0u};                    //!< OpenGL name of a Vertex Array Object sourcing only positions, for depth-only passes, if any
 		GLuint bo{0u};                           //!< OpenGL name of the Buffer Object
 		GLuint ibo{0u};                          //!< OpenGL name of the Buffer Object for indices
 		size_t vertices_nb{0u};                  //!< number of vertices stored in bo
 		size_t indices_nb{0u};                   //!< number of indices stored in ibo
+		size_t first_index{0u};                  //!< offset, in indices, of the first index of the mesh in ibo
+		GLint base_vertex{0};                    //!< value added to the indices, when the mesh shares its buffers with others
+		GLenum index_type{GL_UNSIGNED_INT};      //!< type of the indices in ibo, i.e. GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		BoundingBox bounding_box{};              //!< model-space bounds of the vertices; unknown bounds are never culled
+		std::vector<LevelOfDetail> lods{};       //!< coarser versions of the mesh, from the finest to the coarsest, with their indices in ibo
+		BoundingSphere bounding_sphere{};        //!< model-space sphere enclosing the vertices
 		texture_bindings bindings{};             //!< texture bindings for this mesh
 		GLenum drawing_mode{GL_TRIANGLES};       //!< OpenGL drawing mode, i.e. GL_TRIANGLES, GL_LINES, etc.
 		std::string name{};                      //!< Name of the mesh; used for debugging purposes.
@@ -58,8 +70,31 @@ namespace bonobo
 	//! \brief Deallocate objects allocated by the `init()` function.
 	void deinit();
 
+	//! \brief Uniform buffer into which blocks needed by a single draw
+	//!        call get streamed, e.g. by `Node::render()` when not given
+	//!        already uploaded object constants; it is only available
+	//!        between calls to `init()` and `deinit()`.
+	UniformBuffer& getStreamingUniformBuffer();
+
+	//! \brief Pool into which `loadObjects()` and the parametric shapes
+	//!        put their geometry; it is only available between calls to
+	//!        `init()` and `deinit()`.
+	MeshPool& getMeshPool();
+
+	//! \brief Loader decoding the images of `loadTexture2D()`,
+	//!        `loadTextureCubeMap()` and `loadObjects()` in the background;
+	//!        its `update()` has to be called once per frame for them to
+	//!        arrive. It is only available between calls to `init()` and
+	//!        `deinit()`.
+	TextureLoader& getTextureLoader();
+
 	//! \brief Load objects found in an object/scene file, using assimp.
 	//!
+	//! The objects get cooked into `<filename>.cache` the first time, from
+	//! which later loads map them and upload them straight away; caches
+	//! are rebuilt whenever the object file changes, but not when only the
+	//! materials it references do.
+	//!
 	//! @param [in] filename of the object/scene file to load.
 	//! @return a vector of filled in `mesh_data` structures, one per
 	//!         object found in the input file
@@ -86,14 +121,24 @@ namespace bonobo
 
 	//! \brief Load an image into an OpenGL 2D-texture.
 	//!
+	//! The image gets decoded in the background: until it is uploaded by
+	//! `getTextureLoader().update()`, the texture holds a white texel.
+	//! Its mipmap hierarchy, possibly compressed, is cached next to it in
+	//! a `.cache` file.
+	//!
 	//! @param [in] filename of the image.
 	//! @param [in] generate_mipmap whether or not to generate a mipmap hierarchy
+	//! @param [in] usage what the image holds, which decides how many
+	//!             channels the texture keeps, and whether it is sRGB
 	//! @return the name of the OpenGL 2D-texture
 	GLuint loadTexture2D(std::string const& filename,
-	                     bool generate_mipmap = true);
+	                     bool generate_mipmap = true,
+	                     TextureUsage usage = TextureUsage::colour);
 
 	//! \brief Load six images into an OpenGL cubemap-texture.
 	//!
+	//! As with `loadTexture2D()`, the images get decoded in the background.
+	//!
 	//! @param [in] posx path to the texture on the left of the cubemap
 	//! @param [in] negx path to the texture on the right of the cubemap
 	//! @param [in] posy path to the texture on the top of the cubemap
@@ -101,11 +146,13 @@ namespace bonobo
 	//! @param [in] posz path to the texture on the back of the cubemap
 	//! @param [in] negz path to the texture on the front of the cubemap
 	//! @param [in] generate_mipmap whether or not to generate a mipmap hierarchy
+	//! @param [in] usage what the images hold, as for `loadTexture2D()`
 	//! @return the name of the OpenGL cubemap-texture
 	GLuint loadTextureCubeMap(std::string const& posx, std::string const& negx,
                                   std::string const& posy, std::string const& negy,
                                   std::string const& posz, std::string const& negz,
-                                  bool generate_mipmap = true);
+                                  bool generate_mipmap = true,
+                                  TextureUsage usage = TextureUsage::colour);
 
 	//! \brief Create an OpenGL program consisting of a vertex and a
 	//!        fragment shader.
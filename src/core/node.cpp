@@ -1,13 +1,15 @@
 #include "node.hpp"
 #include "helpers.hpp"
+#include "InstanceBuffer.hpp"
 
 #include "core/Log.h"
 #include "core/opengl.hpp"
+#include "core/ShaderProgramManager.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-Node::Node() : _vao(0u), _vertices_nb(0u), _indices_nb(0u), _drawing_mode(GL_TRIANGLES), _has_indices(true), _program(nullptr), _textures(), _transform(), _children()
+Node::Node() : _vao(0u), _depth_vao(0u), _vertices_nb(0u), _indices_nb(0u), _drawing_mode(GL_TRIANGLES), _has_indices(true), _first_index(0), _base_vertex(0), _index_type(GL_UNSIGNED_INT), _lods(), _instance_texture(0u), _instances_nb(0), _instances(nullptr), _mesh_bounds(), _bounds(), _program(nullptr), _textures(), _texture_name_hashes(), _transform(), _children()
 {
 }
 
@@ -20,10 +22,32 @@ Node::render(glm::mat4 const& WVP, glm::mat4 const& parentTransform) const
 
 void
 Node::render(glm::mat4 const& WVP, glm::mat4 const& world, GLuint program, std::function<void (GLuint)> const& set_uniforms) const
+{
+	render(WVP, world, program, true, set_uniforms);
+}
+
+void
+Node::render(glm::mat4 const& WVP, glm::mat4 const& world, GLuint program, bool bind_textures, std::function<void(GLuint)> const& set_uniforms) const
 {
 	if (_vao == 0u || program == 0u)
 		return;
 
+	// Programs declaring the `ObjectConstants` block get the matrices
+	// streamed into a uniform buffer, others get them as plain uniforms.
+	// Either way this costs an upload per draw, which is why callers
+	// drawing many nodes use the overload taking a range instead.
+	using namespace bonobo::literals;
+	if (ShaderProgramManager::GetUniformBlockIndex(program, "ObjectConstants"_hash) != GL_INVALID_INDEX) {
+		auto& uniform_buffer = bonobo::getStreamingUniformBuffer();
+		if (!uniform_buffer.has_room_for(sizeof(bonobo::ObjectConstants)))
+			uniform_buffer.reset();
+		auto const object_constants = uniform_buffer.push(bonobo::makeObjectConstants(world, WVP));
+		uniform_buffer.upload();
+
+		render(object_constants, program, bind_textures, set_uniforms);
+		return;
+	}
+
 	if (utils::opengl::debug::isSupported())
 	{
 		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0u, _name.size(), _name.data());
@@ -35,34 +59,11 @@ Node::render(glm::mat4 const& WVP, glm::mat4 const& world, GLuint program, std::
 
 	set_uniforms(program);
 
-	glUniformMatrix4fv(glGetUniformLocation(program, "vertex_model_to_world"), 1, GL_FALSE, glm::value_ptr(world));
-	glUniformMatrix4fv(glGetUniformLocation(program, "normal_model_to_world"), 1, GL_FALSE, glm::value_ptr(normal_model_to_world));
-	glUniformMatrix4fv(glGetUniformLocation(program, "vertex_world_to_clip"), 1, GL_FALSE, glm::value_ptr(WVP));
-
-	for (size_t i = 0u; i < _textures.size(); ++i) {
-		auto const& texture = _textures[i];
-		glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
-		glBindTexture(std::get<2>(texture), std::get<1>(texture));
-		glUniform1i(glGetUniformLocation(program, std::get<0>(texture).c_str()), static_cast<GLint>(i));
-
-		std::string texture_presence_var_name = "has_" + std::get<0>(texture);
-		glUniform1i(glGetUniformLocation(program, texture_presence_var_name.c_str()), 1);
-	}
-
-	glBindVertexArray(_vao);
-	if (_has_indices)
-		glDrawElements(_drawing_mode, _indices_nb, GL_UNSIGNED_INT, reinterpret_cast<GLvoid const*>(0x0));
-	else
-		glDrawArrays(_drawing_mode, 0, _vertices_nb);
-	glBindVertexArray(0u);
-
-	for (auto const& texture : _textures) {
-		glBindTexture(std::get<2>(texture), 0);
-		glUniform1i(glGetUniformLocation(program, std::get<0>(texture).c_str()), 0);
+	glUniformMatrix4fv(ShaderProgramManager::GetUniformLocation(program, "vertex_model_to_world"_hash), 1, GL_FALSE, glm::value_ptr(world));
+	glUniformMatrix4fv(ShaderProgramManager::GetUniformLocation(program, "normal_model_to_world"_hash), 1, GL_FALSE, glm::value_ptr(normal_model_to_world));
+	glUniformMatrix4fv(ShaderProgramManager::GetUniformLocation(program, "vertex_world_to_clip"_hash), 1, GL_FALSE, glm::value_ptr(WVP));
 
-		std::string texture_presence_var_name = "has_" + std::get<0>(texture);
-		glUniform1i(glGetUniformLocation(program, texture_presence_var_name.c_str()), 0);
-	}
+	draw(program, bind_textures);
 
 	glUseProgram(0u);
 
@@ -73,7 +74,7 @@ Node::render(glm::mat4 const& WVP, glm::mat4 const& world, GLuint program, std::
 }
 
 void
-Node::render(glm::mat4 const& WVP, glm::mat4 const& world, GLuint program, bool bind_textures, std::function<void(GLuint)> const& set_uniforms) const
+Node::render(bonobo::UniformBuffer::Range const& object_constants, GLuint program, bool bind_textures, std::function<void (GLuint)> const& set_uniforms) const
 {
 	if (_vao == 0u || program == 0u)
 		return;
@@ -85,58 +86,145 @@ Node::render(glm::mat4 const& WVP, glm::mat4 const& world, GLuint program, bool
 
 	glUseProgram(program);
 
-	auto const normal_model_to_world = glm::transpose(glm::inverse(world));
-
 	set_uniforms(program);
 
-	glUniformMatrix4fv(glGetUniformLocation(program, "vertex_model_to_world"), 1, GL_FALSE, glm::value_ptr(world));
-	glUniformMatrix4fv(glGetUniformLocation(program, "normal_model_to_world"), 1, GL_FALSE, glm::value_ptr(normal_model_to_world));
-	glUniformMatrix4fv(glGetUniformLocation(program, "vertex_world_to_clip"), 1, GL_FALSE, glm::value_ptr(WVP));
+	bonobo::UniformBuffer::bind(bonobo::uniform_block_bindings::object_constants, object_constants);
+
+	draw(program, bind_textures);
+
+	glUseProgram(0u);
+
+	if (utils::opengl::debug::isSupported())
+	{
+		glPopDebugGroup();
+	}
+}
 
+void
+Node::draw(GLuint program, bool bind_textures) const
+{
 	if (bind_textures) {
 		for (size_t i = 0u; i < _textures.size(); ++i) {
 			auto const& texture = _textures[i];
 			glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
 			glBindTexture(std::get<2>(texture), std::get<1>(texture));
-			glUniform1i(glGetUniformLocation(program, std::get<0>(texture).c_str()), static_cast<GLint>(i));
-
-			std::string texture_presence_var_name = "has_" + std::get<0>(texture);
-			glUniform1i(glGetUniformLocation(program, texture_presence_var_name.c_str()), 1);
+			glUniform1i(ShaderProgramManager::GetUniformLocation(program, _texture_name_hashes[i].first), static_cast<GLint>(i));
+			glUniform1i(ShaderProgramManager::GetUniformLocation(program, _texture_name_hashes[i].second), 1);
 		}
 	}
 
+	// Instance transforms go after the textures of the node.
+	GLenum const instances_unit = bind_textures ? static_cast<GLenum>(_textures.size()) : 0u;
+	bind_instances(program, instances_unit);
+
 	glBindVertexArray(_vao);
-	if (_has_indices)
-		glDrawElements(_drawing_mode, _indices_nb, GL_UNSIGNED_INT, reinterpret_cast<GLvoid const*>(0x0));
-	else
-		glDrawArrays(_drawing_mode, 0, _vertices_nb);
+	draw_geometry();
 	glBindVertexArray(0u);
 
-	for (auto const& texture : _textures) {
-		glBindTexture(std::get<2>(texture), 0);
-		glUniform1i(glGetUniformLocation(program, std::get<0>(texture).c_str()), 0);
-
-		std::string texture_presence_var_name = "has_" + std::get<0>(texture);
-		glUniform1i(glGetUniformLocation(program, texture_presence_var_name.c_str()), 0);
+	release_instances(instances_unit);
+	// Units this call did not bind may hold textures of the caller.
+	if (!bind_textures)
+		return;
+	for (size_t i = 0u; i < _textures.size(); ++i) {
+		glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
+		glBindTexture(std::get<2>(_textures[i]), 0);
+		glUniform1i(ShaderProgramManager::GetUniformLocation(program, _texture_name_hashes[i].first), 0);
+		glUniform1i(ShaderProgramManager::GetUniformLocation(program, _texture_name_hashes[i].second), 0);
 	}
+}
 
-	glUseProgram(0u);
+void
+Node::bind_instances(GLuint program, GLenum unit) const
+{
+	if (_instance_texture == 0u)
+		return;
 
-	if (utils::opengl::debug::isSupported())
-	{
-		glPopDebugGroup();
+	using namespace bonobo::literals;
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, _instance_texture);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(program, "instance_transforms"_hash), static_cast<GLint>(unit));
+
+	// The indices sampler always gets its own unit, as samplers of
+	// different types may not share one.
+	bool const is_culled = _instances != nullptr && _instances->is_culled();
+	glActiveTexture(GL_TEXTURE0 + unit + 1u);
+	glBindTexture(GL_TEXTURE_BUFFER, is_culled ? _instances->get_visible_instances_texture() : 0u);
+	glUniform1i(ShaderProgramManager::GetUniformLocation(program, "instance_indices"_hash), static_cast<GLint>(unit + 1u));
+	glUniform1i(ShaderProgramManager::GetUniformLocation(program, "has_instance_indices"_hash), is_culled ? 1 : 0);
+}
+
+void
+Node::release_instances(GLenum unit) const
+{
+	if (_instance_texture == 0u)
+		return;
+
+	for (GLenum i = 0u; i < 2u; ++i) {
+		glActiveTexture(GL_TEXTURE0 + unit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, 0u);
 	}
 }
 
+void
+Node::draw_geometry(std::size_t lod) const
+{
+	auto const index_range = get_index_range(lod);
+	auto const indices_offset = get_indices_offset(index_range.first);
+	if (_instances != nullptr && _instances->is_culled()) {
+		// The number of instances left was written by the GPU.
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _instances->get_indirect_buffer());
+		if (_has_indices)
+			glDrawElementsIndirect(_drawing_mode, _index_type, nullptr);
+		else
+			glDrawArraysIndirect(_drawing_mode, nullptr);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0u);
+	} else if (_instance_texture != 0u) {
+		if (_has_indices)
+			glDrawElementsInstancedBaseVertex(_drawing_mode, index_range.second, _index_type, indices_offset,
+			                                  _instances_nb, _base_vertex);
+		else
+			glDrawArraysInstanced(_drawing_mode, 0, _vertices_nb, _instances_nb);
+	} else {
+		if (_has_indices)
+			glDrawElementsBaseVertex(_drawing_mode, index_range.second, _index_type, indices_offset, _base_vertex);
+		else
+			glDrawArrays(_drawing_mode, 0, _vertices_nb);
+	}
+}
+
+std::pair<GLsizei, GLsizei>
+Node::get_index_range(std::size_t lod) const
+{
+	if (lod == 0u || lod > _lods.size())
+		return std::make_pair(_first_index, _indices_nb);
+
+	auto const& level = _lods[lod - 1u];
+	return std::make_pair(static_cast<GLsizei>(level.first_index), static_cast<GLsizei>(level.indices_nb));
+}
+
+GLvoid const*
+Node::get_indices_offset(GLsizei first_index) const
+{
+	auto const index_size = _index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	return reinterpret_cast<GLvoid const*>(static_cast<std::size_t>(first_index) * index_size);
+}
+
 void
 Node::set_geometry(bonobo::mesh_data const& shape)
 {
 	_vao = shape.vao;
+	_depth_vao = shape.depth_vao;
 	_vertices_nb = static_cast<GLsizei>(shape.vertices_nb);
 	_indices_nb = static_cast<GLsizei>(shape.indices_nb);
 	_drawing_mode = shape.drawing_mode;
 	_has_indices = shape.ibo != 0u;
+	_first_index = static_cast<GLsizei>(shape.first_index);
+	_base_vertex = shape.base_vertex;
+	_index_type = shape.index_type;
+	_lods = shape.lods;
+	_mesh_bounds = shape.bounding_box;
 	_name = shape.name;
+	update_bounds();
 
 	if (!shape.bindings.empty()) {
 		for (auto const& binding : shape.bindings)
@@ -189,6 +277,39 @@ Node::add_texture(std::string const& name, GLuint tex_id, GLenum type)
 	}
 
 	_textures.emplace_back(name, tex_id, type);
+
+	// Hash the names once, so that drawing does not have to deal with
+	// strings.
+	auto const presence_name = "has_" + name;
+	_texture_name_hashes.emplace_back(bonobo::hash_string(name.data(), name.size()),
+	                                  bonobo::hash_string(presence_name.data(), presence_name.size()));
+}
+
+void
+Node::set_instances(bonobo::InstanceBuffer const& instances)
+{
+	_instance_texture = instances.get_texture();
+	_instances_nb = static_cast<GLsizei>(instances.get_instances_nb());
+	_instances = &instances;
+	update_bounds();
+}
+
+bonobo::BoundingBox const&
+Node::get_bounds() const
+{
+	return _bounds;
+}
+
+std::vector<bonobo::LevelOfDetail> const&
+Node::get_lods() const
+{
+	return _lods;
+}
+
+void
+Node::update_bounds()
+{
+	_bounds = _instances != nullptr ? _instances->get_bounds(_mesh_bounds) : _mesh_bounds;
 }
 
 void
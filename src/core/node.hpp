@@ -1,18 +1,27 @@
 #pragma once
 
+#include "Culling.hpp"
+#include "LevelOfDetail.hpp"
 #include "TRSTransform.h"
+#include "UniformBuffer.hpp"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 namespace bonobo
 {
+	class DrawList;
+	class InstanceBuffer;
+	class InstanceCuller;
+	class OcclusionCuller;
 	struct mesh_data;
 }
 
@@ -25,6 +34,14 @@ public:
 
 	//! \brief Render this node.
 	//!
+	//! This, like the other overloads taking matrices, is a slow path:
+	//! programs declaring the `ObjectConstants` block get the constants
+	//! of this single draw pushed into the streaming uniform buffer and
+	//! uploaded right away. Code drawing more than a handful of nodes per
+	//! frame should push all their constants, upload them once, and use
+	//! the overload taking a `bonobo::UniformBuffer::Range`, or go
+	//! through a `bonobo::DrawList`.
+	//!
 	//! @param [in] WVP Matrix transforming from world-space to clip-space
 	//! @param [in] parentTransform Matrix transforming from parent-space to
 	//!             world-space
@@ -32,6 +49,9 @@ public:
 
 	//! \brief Render this node with a specific shader program.
 	//!
+	//! Slow path, uploading the constants of this single draw; see
+	//! `render(WVP, parentTransform)`.
+	//!
 	//! @param [in] WVP Matrix transforming from world-space to clip-space
 	//! @param [in] world Matrix transforming from model-space to
 	//!             world-space
@@ -43,10 +63,26 @@ public:
 	            GLuint program,
 	            std::function<void (GLuint)> const& set_uniforms = [](GLuint /*programID*/){}) const;
 
+	//! \brief Same as above, optionally leaving the textures of this node
+	//!        unbound.
 	void render(glm::mat4 const& WVP, glm::mat4 const& world,
 				GLuint program, bool bind_textures,
 				std::function<void(GLuint)> const& set_uniforms = [](GLuint /*programID*/) {}) const;
 
+	//! \brief Render this node with a specific shader program, using
+	//!        object constants which were already uploaded.
+	//!
+	//! @param [in] object_constants where the `ObjectConstants` block of
+	//!             this node is to be found
+	//! @param [in] program OpenGL shader program to use
+	//! @param [in] bind_textures whether to bind the textures of this node
+	//! @param [in] set_uniforms function that will take as argument an
+	//!             OpenGL shader program, and will setup that program's
+	//!             uniforms
+	void render(bonobo::UniformBuffer::Range const& object_constants,
+	            GLuint program, bool bind_textures = true,
+	            std::function<void (GLuint)> const& set_uniforms = [](GLuint /*programID*/){}) const;
+
 	//! \brief Set the geometry of this node.
 	//!
 	//! A node without any geometry will not render itself, but its
@@ -88,6 +124,31 @@ public:
 	//!                  GL_TEXTURE_CUBE_MAP, etc.
 	void add_texture(std::string const& name, GLuint tex_id, GLenum type);
 
+	//! \brief Draw this node once per instance of the given buffer, with
+	//!        a single instanced draw call.
+	//!
+	//! The buffer texture gets bound to `instance_transforms`, after the
+	//! textures of the node; programs apply the instance transforms using
+	//! shaders/instance_constants.glsl.
+	//!
+	//! @param [in] instances transforms of the instances; the buffer has
+	//!             to outlive the node, and the number of instances is the
+	//!             one it holds when calling this function
+	void set_instances(bonobo::InstanceBuffer const& instances);
+
+	//! \brief Get the bounds of the geometry of this node, including all
+	//!        of its instances.
+	//!
+	//! @return model-space bounds, to be transformed by the matrix of the
+	//!         node; they are unknown if the geometry did not have any
+	bonobo::BoundingBox const& get_bounds() const;
+
+	//! \brief Get the coarser versions of the geometry of this node.
+	//!
+	//! @return the levels, from the finest to the coarsest; level `i + 1`
+	//!         of draws refers to the `i`th one
+	std::vector<bonobo::LevelOfDetail> const& get_lods() const;
+
 	//! \brief Add a child to this node.
 	//!
 	//! @param [in] child pointer to the child to add; the pointer has to
@@ -114,12 +175,53 @@ public:
 	TRSTransformf& get_transform();
 
 private:
+	friend class bonobo::DrawList;
+	friend class bonobo::InstanceCuller;
+	friend class bonobo::OcclusionCuller;
+
+	void draw(GLuint program, bool bind_textures) const;
+
+	void update_bounds();
+
+	//! \brief Bind the instance transforms, if any, to the given unit,
+	//!        and the indices of the instances left by culling to the next.
+	void bind_instances(GLuint program, GLenum unit) const;
+	void release_instances(GLenum unit) const;
+
+	//! \brief Issue the draw call, with the vertex array already bound.
+	//!
+	//! @param [in] lod level of detail to draw, 0 being the geometry
+	//!             itself; it is ignored by culled instances, whose
+	//!             command was written by the GPU
+	void draw_geometry(std::size_t lod = 0u) const;
+
+	//! \brief Range of indices drawn for the given level of detail, as
+	//!        the offset of its first index and the number of indices.
+	std::pair<GLsizei, GLsizei> get_index_range(std::size_t lod) const;
+
+	//! \brief Offset, in bytes, of the given index in the index buffer.
+	GLvoid const* get_indices_offset(GLsizei first_index) const;
+
 	// Geometry data
 	GLuint _vao;
+	GLuint _depth_vao;
 	GLsizei _vertices_nb;
 	GLsizei _indices_nb;
 	GLenum _drawing_mode;
 	bool _has_indices;
+	GLsizei _first_index;
+	GLint _base_vertex;
+	GLenum _index_type;
+	std::vector<bonobo::LevelOfDetail> _lods;
+
+	// Instancing data; nodes without instances are drawn once
+	GLuint _instance_texture;
+	GLsizei _instances_nb;
+	bonobo::InstanceBuffer const* _instances;
+
+	// Bounds of the geometry alone, and of all its instances
+	bonobo::BoundingBox _mesh_bounds;
+	bonobo::BoundingBox _bounds;
 
 	// Program data
 	GLuint const* _program;
@@ -127,6 +229,8 @@ private:
 
 	// Textures data
 	std::vector<std::tuple<std::string, GLuint, GLenum>> _textures;
+	//! Hashes of the name of each texture, and of its `has_` uniform
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> _texture_name_hashes;
 
 	// Transformation data
 	TRSTransformf _transform;
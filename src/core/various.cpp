@@ -1,11 +1,16 @@
 #include "various.hpp"
 
 #include "core/Log.h"
+#include "core/MappedFile.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <thread>
+#include <vector>
 #if defined(_WIN32)
 #include <Windows.h>
 #endif
@@ -70,8 +75,15 @@ utils::widen(std::string const& utf8)
 #endif
 
 std::string
-utils::slurp_file(std::string const& path)
+utils::slurp_file(std::string const& path, bool from_disk)
 {
+  // Files are mapped, which also finds them in the mounted asset pack,
+  // and copied once into the string.
+  bonobo::MappedFile const mapping(path, from_disk);
+  if (mapping.is_valid())
+    return std::string(static_cast<char const*>(mapping.data()), mapping.size());
+
+  // Empty files are never mapped.
   std::ifstream file = std::ifstream(utils::widen(path));
   if (!file.is_open()) {
     LogError("Failed to open \"%s\"", path.c_str());
@@ -88,3 +100,27 @@ utils::slurp_file(std::string const& path)
 
   return std::string(content.get());
 }
+
+void
+utils::parallel_for(std::size_t count, std::function<void (std::size_t)> const& work)
+{
+	auto const threads_nb = std::min(count, static_cast<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u)));
+	if (threads_nb <= 1u) {
+		for (std::size_t i = 0u; i < count; ++i)
+			work(i);
+		return;
+	}
+
+	std::atomic<std::size_t> next_item{0u};
+	auto const run = [&next_item, count, &work]() {
+		for (auto i = next_item++; i < count; i = next_item++)
+			work(i);
+	};
+	std::vector<std::thread> workers;
+	workers.reserve(threads_nb - 1u);
+	for (std::size_t i = 1u; i < threads_nb; ++i)
+		workers.emplace_back(run);
+	run();
+	for (auto& worker : workers)
+		worker.join();
+}
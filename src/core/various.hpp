@@ -1,6 +1,8 @@
 #pragma once
 
 
+#include <cstddef>
+#include <functional>
 #include <string>
 
 
@@ -15,6 +17,16 @@ inline char const* widen(char const* utf8) { return utf8; }
 inline std::string const& widen(std::string const& utf8) { return utf8; }
 #endif
 
-std::string slurp_file(std::string const& path);
+//! \brief Read a whole file, from the mounted asset pack if it holds it
+//!        and `from_disk` is not set.
+std::string slurp_file(std::string const& path, bool from_disk = false);
+
+//! \brief Call `work` once for each item in [0, count), spread over as
+//!        many threads as the hardware runs concurrently.
+//!
+//! Items are handed out one at a time, and the calling thread takes its
+//! share; returns once all of them are done. `work` must not touch the
+//! OpenGL context, which belongs to the calling thread.
+void parallel_for(std::size_t count, std::function<void (std::size_t)> const& work);
 
 } // end of namespace